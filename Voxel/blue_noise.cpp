@@ -0,0 +1,140 @@
+#include "blue_noise.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+
+#include "profiler.h"
+
+namespace {
+
+// Width of the Gaussian that measures how crowded each texel is, in texels.
+const float kSigma = 1.5f;
+// Share of the texels set in the initial pattern.
+const uint32_t kInitialDivisor = 10;
+
+// The texels set in a binary pattern and how close each texel is to them.
+class Pattern {
+  public:
+	explicit Pattern(uint32_t size)
+		: size_(size), kernel_(size * size), energy_(size * size, 0.0f),
+		  set_(size * size, 0) {
+		// Squared distances wrap around the tile.
+		for (uint32_t y = 0; y < size; ++y) {
+			const float dy = static_cast<float>(std::min(y, size - y));
+			for (uint32_t x = 0; x < size; ++x) {
+				const float dx = static_cast<float>(std::min(x, size - x));
+				kernel_[y * size + x] =
+					std::exp(-(dx * dx + dy * dy) / (2.0f * kSigma * kSigma));
+			}
+		}
+	}
+
+	bool IsSet(size_t texel) const {
+		return set_[texel] != 0;
+	}
+
+	void Toggle(size_t texel) {
+		const float sign = set_[texel] ? -1.0f : 1.0f;
+		set_[texel] = !set_[texel];
+		const uint32_t tx = static_cast<uint32_t>(texel % size_);
+		const uint32_t ty = static_cast<uint32_t>(texel / size_);
+		for (uint32_t y = 0; y < size_; ++y) {
+			const float* kernel_row =
+				&kernel_[((y + size_ - ty) % size_) * size_];
+			float* energy_row = &energy_[y * size_];
+			// The kernel row starts at |tx|, wrapped in two runs.
+			for (uint32_t x = 0; x < tx; ++x)
+				energy_row[x] += sign * kernel_row[x + size_ - tx];
+			for (uint32_t x = tx; x < size_; ++x)
+				energy_row[x] += sign * kernel_row[x - tx];
+		}
+	}
+
+	// The set texel with the most set texels around it.
+	size_t TightestCluster() const {
+		size_t best = 0;
+		float best_energy = -1.0f;
+		for (size_t i = 0; i < energy_.size(); ++i) {
+			if (set_[i] && energy_[i] > best_energy) {
+				best = i;
+				best_energy = energy_[i];
+			}
+		}
+		return best;
+	}
+
+	// The unset texel farthest from the set ones.
+	size_t LargestVoid() const {
+		size_t best = 0;
+		float best_energy = INFINITY;
+		for (size_t i = 0; i < energy_.size(); ++i) {
+			if (!set_[i] && energy_[i] < best_energy) {
+				best = i;
+				best_energy = energy_[i];
+			}
+		}
+		return best;
+	}
+
+  private:
+	uint32_t size_;
+	std::vector<float> kernel_;
+	// Sum of the kernel centered on every set texel.
+	std::vector<float> energy_;
+	std::vector<uint8_t> set_;
+};
+
+}  // namespace
+
+void GenerateBlueNoise(uint32_t size, std::vector<uint16_t>* noise) {
+	const ProfileScope scope("GenerateBlueNoise");
+	const size_t texel_count = static_cast<size_t>(size) * size;
+
+	// Scatter a few texels at random, then move the one in the tightest
+	// cluster to the largest void until it would stay where it is.
+	Pattern initial(size);
+	std::mt19937 random(size);
+	std::uniform_int_distribution<size_t> texel_distribution(0, texel_count - 1);
+	const size_t initial_count = std::max<size_t>(texel_count / kInitialDivisor, 1);
+	for (size_t placed = 0; placed < initial_count;) {
+		const size_t texel = texel_distribution(random);
+		if (!initial.IsSet(texel)) {
+			initial.Toggle(texel);
+			++placed;
+		}
+	}
+	for (;;) {
+		const size_t cluster = initial.TightestCluster();
+		initial.Toggle(cluster);
+		const size_t void_texel = initial.LargestVoid();
+		initial.Toggle(void_texel);
+		if (void_texel == cluster)
+			break;
+	}
+
+	std::vector<uint32_t> ranks(texel_count);
+	// The texels of the initial pattern are ranked from the last one by
+	// removing the tightest cluster each time.
+	Pattern removed = initial;
+	for (size_t rank = initial_count; rank-- > 0;) {
+		const size_t cluster = removed.TightestCluster();
+		removed.Toggle(cluster);
+		ranks[cluster] = static_cast<uint32_t>(rank);
+	}
+	// The others by filling the largest void each time. Past half of the
+	// tile this is also the tightest cluster of the unset texels.
+	Pattern filled = initial;
+	for (size_t rank = initial_count; rank < texel_count; ++rank) {
+		const size_t void_texel = filled.LargestVoid();
+		filled.Toggle(void_texel);
+		ranks[void_texel] = static_cast<uint32_t>(rank);
+	}
+
+	noise->resize(texel_count);
+	for (size_t i = 0; i < texel_count; ++i) {
+		(*noise)[i] = static_cast<uint16_t>(
+			(ranks[i] + 0.5) / texel_count * 65535.0 + 0.5);
+	}
+}
@@ -0,0 +1,19 @@
+#ifndef VOXEL_BLUE_NOISE
+#define VOXEL_BLUE_NOISE
+
+#include <cstdint>
+#include <vector>
+
+// Number of texels along each side of the blue noise tile. It repeats over
+// the window.
+const uint32_t kBlueNoiseSize = 64;
+
+// Fills |noise| with a |size| x |size| tile of blue noise made by the
+// void-and-cluster method: every texel gets a distinct rank, ranks spread as
+// evenly as possible over the tile at every threshold, and the tile wraps
+// around without seams. Values are (rank + 0.5) / |size|^2 scaled to the
+// range of uint16_t, x fastest, ready for a GL_R16 texture. The tile is the
+// same on every run.
+void GenerateBlueNoise(uint32_t size, std::vector<uint16_t>* noise);
+
+#endif  // VOXEL_BLUE_NOISE
@@ -0,0 +1,126 @@
+#include "camera_list.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// Digits the indices in the names of the images are padded to.
+const size_t kImageIndexDigits = 5;
+
+// A view pinned to a frame of an animation.
+struct Keyframe {
+	int frame = 0;
+	float yaw_degrees = 0.0f;
+	float pitch_degrees = 0.0f;
+};
+
+// Reads "FRAME YAW [PITCH]" from |fields| into |key|.
+bool ParseKeyframe(std::istringstream* fields, Keyframe* key) {
+	std::string rest;
+	if (!(*fields >> key->frame >> key->yaw_degrees) || key->frame < 0)
+		return false;
+	if (*fields >> rest) {
+		std::istringstream pitch(rest);
+		if (!(pitch >> key->pitch_degrees) || !pitch.eof())
+			return false;
+	}
+	return !(*fields >> rest);
+}
+
+// Reads "YAW [PITCH] [OUT]" from |fields|, whose first field is |first|,
+// into |view|.
+bool ParseView(const std::string& first, std::istringstream* fields,
+	CameraView* view) {
+	std::istringstream yaw(first);
+	std::string rest;
+	if (!(yaw >> view->yaw_degrees) || !yaw.eof())
+		return false;
+	// The pitch is optional, a field that isn't a number is the output.
+	if (*fields >> rest) {
+		std::istringstream pitch(rest);
+		if (pitch >> view->pitch_degrees && pitch.eof())
+			*fields >> view->output_path;
+		else
+			view->output_path = rest;
+	}
+	return !(*fields >> rest);
+}
+
+}  // namespace
+
+bool LoadCameraList(const char* path, std::vector<CameraView>* views) {
+	std::ifstream file(path);
+	if (!file) {
+		std::cout << "Failed to open camera list: " << path << "\n";
+		return false;
+	}
+
+	views->clear();
+	std::vector<Keyframe> keys;
+	std::string line;
+	for (int line_number = 1; std::getline(file, line); ++line_number) {
+		std::istringstream fields(line);
+		std::string first;
+		if (!(fields >> first) || first[0] == '#')
+			continue;
+
+		bool valid = false;
+		if (first == "key") {
+			Keyframe key;
+			valid = ParseKeyframe(&fields, &key) &&
+				(keys.empty() || key.frame > keys.back().frame);
+			keys.push_back(key);
+		} else {
+			CameraView view;
+			valid = ParseView(first, &fields, &view);
+			views->push_back(view);
+		}
+		if (!valid) {
+			std::cout << "Invalid camera on line " << line_number << " of "
+				<< path << ": " << line << "\n";
+			return false;
+		}
+	}
+
+	if (!keys.empty() && !views->empty()) {
+		std::cout << "Camera list " << path << " mixes views and keyframes\n";
+		return false;
+	}
+
+	// Every frame up to the last key, interpolated between the keys around
+	// it. The frames before the first key hold it.
+	for (size_t i = 0; i < keys.size(); ++i) {
+		const Keyframe& key = keys[i];
+		const Keyframe& previous = keys[i == 0 ? 0 : i - 1];
+		for (int frame = i == 0 ? 0 : previous.frame + 1; frame <= key.frame;
+			++frame) {
+			const float t = frame <= previous.frame ? 1.0f :
+				static_cast<float>(frame - previous.frame) /
+				(key.frame - previous.frame);
+			CameraView view;
+			view.yaw_degrees =
+				previous.yaw_degrees + (key.yaw_degrees - previous.yaw_degrees) * t;
+			view.pitch_degrees = previous.pitch_degrees +
+				(key.pitch_degrees - previous.pitch_degrees) * t;
+			views->push_back(view);
+		}
+	}
+
+	if (views->empty()) {
+		std::cout << "No cameras in " << path << "\n";
+		return false;
+	}
+	return true;
+}
+
+std::string GetViewImagePath(const CameraView& view, size_t index,
+	const char* prefix, const char* extension) {
+	if (!view.output_path.empty())
+		return view.output_path;
+	std::string digits = std::to_string(index);
+	if (digits.size() < kImageIndexDigits)
+		digits.insert(0, kImageIndexDigits - digits.size(), '0');
+	return prefix + digits + extension;
+}
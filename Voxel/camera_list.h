@@ -0,0 +1,31 @@
+#ifndef VOXEL_CAMERA_LIST
+#define VOXEL_CAMERA_LIST
+
+#include <string>
+#include <vector>
+
+// A view of the volume rendered without a window. The volume turns by
+// |yaw_degrees| around the vertical axis, the way the window rotates it,
+// then tilts by |pitch_degrees| towards the camera.
+struct CameraView {
+	float yaw_degrees = 0.0f;
+	float pitch_degrees = 0.0f;
+	// Where the frame is written, empty to name it after its index.
+	std::string output_path;
+};
+
+// Reads the views listed in the text file at |path| into |views|, one per
+// line as "YAW [PITCH] [OUT]" with angles in degrees. Instead of views, the
+// file can hold keyframes as "key FRAME YAW [PITCH]" lines in increasing
+// frame order, which give a view for every frame up to the last key,
+// interpolated linearly between the keys around it. Blank lines and lines
+// starting with '#' are skipped. Returns false if the file can't be read,
+// a line can't be parsed or there are no views.
+bool LoadCameraList(const char* path, std::vector<CameraView>* views);
+
+// Returns where the view at |index| of a list is written: its output path,
+// or |prefix| followed by the index padded to 5 digits and |extension|.
+std::string GetViewImagePath(const CameraView& view, size_t index,
+	const char* prefix, const char* extension);
+
+#endif  // VOXEL_CAMERA_LIST
@@ -0,0 +1,104 @@
+#include "cpu_features.h"
+
+#ifdef VOXEL_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#include <cstdint>
+
+namespace {
+
+#ifdef VOXEL_X86
+
+void CpuId(uint32_t leaf, uint32_t subleaf, uint32_t registers[4]) {
+#ifdef _MSC_VER
+	int values[4];
+	__cpuidex(values, static_cast<int>(leaf), static_cast<int>(subleaf));
+	for (int i = 0; i < 4; ++i)
+		registers[i] = static_cast<uint32_t>(values[i]);
+#else
+	__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2],
+		registers[3]);
+#endif
+}
+
+// Returns the register state the OS saves on context switches.
+uint64_t GetEnabledXState() {
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+CpuFeatures DetectCpuFeatures() {
+	CpuFeatures features;
+	uint32_t registers[4];
+	CpuId(0, 0, registers);
+	const uint32_t max_leaf = registers[0];
+	if (max_leaf < 1)
+		return features;
+
+	CpuId(1, 0, registers);
+	const uint32_t ecx1 = registers[2];
+	features.sse41 = (ecx1 & (1u << 19)) != 0;
+	// AVX registers are only usable if the OS saves them (OSXSAVE + XCR0).
+	const bool os_saves_avx = (ecx1 & (1u << 27)) != 0 &&
+		(GetEnabledXState() & 0x6) == 0x6;
+	const bool os_saves_avx512 =
+		os_saves_avx && (GetEnabledXState() & 0xe6) == 0xe6;
+	const bool avx = os_saves_avx && (ecx1 & (1u << 28)) != 0;
+	features.fma = avx && (ecx1 & (1u << 12)) != 0;
+	features.f16c = avx && (ecx1 & (1u << 29)) != 0;
+
+	if (max_leaf < 7)
+		return features;
+	CpuId(7, 0, registers);
+	const uint32_t ebx7 = registers[1];
+	features.avx2 = avx && (ebx7 & (1u << 5)) != 0;
+	features.bmi2 = (ebx7 & (1u << 8)) != 0;
+	features.avx512f = os_saves_avx512 && (ebx7 & (1u << 16)) != 0;
+	return features;
+}
+
+#else
+
+CpuFeatures DetectCpuFeatures() {
+	return CpuFeatures();
+}
+
+#endif
+
+const CpuFeatures& GetDetectedCpuFeatures() {
+	static const CpuFeatures features = DetectCpuFeatures();
+	return features;
+}
+
+// The detected features less those hidden by LimitCpuFeatures().
+CpuFeatures& GetEnabledCpuFeatures() {
+	static CpuFeatures features = GetDetectedCpuFeatures();
+	return features;
+}
+
+}  // namespace
+
+const CpuFeatures& GetCpuFeatures() {
+	return GetEnabledCpuFeatures();
+}
+
+void LimitCpuFeatures(const CpuFeatures& allowed) {
+	const CpuFeatures& detected = GetDetectedCpuFeatures();
+	CpuFeatures& enabled = GetEnabledCpuFeatures();
+	enabled.sse41 = detected.sse41 && allowed.sse41;
+	enabled.avx2 = detected.avx2 && allowed.avx2;
+	enabled.fma = detected.fma && allowed.fma;
+	enabled.f16c = detected.f16c && allowed.f16c;
+	enabled.bmi2 = detected.bmi2 && allowed.bmi2;
+	enabled.avx512f = detected.avx512f && allowed.avx512f;
+}
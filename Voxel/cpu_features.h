@@ -0,0 +1,38 @@
+#ifndef VOXEL_CPU_FEATURES
+#define VOXEL_CPU_FEATURES
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || \
+	defined(__i386__)
+#define VOXEL_X86 1
+#endif
+
+// Marks a function as compiled for the given instruction set extensions so
+// that intrinsics can be used without enabling them for the whole program.
+// MSVC always allows intrinsics so nothing is needed there. Functions marked
+// with this must only be called after checking GetCpuFeatures().
+#if defined(__GNUC__) || defined(__clang__)
+#define VOXEL_TARGET(features) __attribute__((target(features)))
+#else
+#define VOXEL_TARGET(features)
+#endif
+
+// Instruction set extensions supported by the CPU and enabled by the OS.
+struct CpuFeatures {
+	bool sse41 = false;
+	bool avx2 = false;
+	bool fma = false;
+	bool f16c = false;
+	bool bmi2 = false;
+	bool avx512f = false;
+};
+
+// Returns the features of the CPU the program runs on. Detected once.
+const CpuFeatures& GetCpuFeatures();
+
+// Hides the features |allowed| doesn't have from GetCpuFeatures(), so that
+// the kernels picked afterwards are no wider than it allows, to compare
+// them. Each call replaces the previous limit. Must not be called while a
+// kernel runs.
+void LimitCpuFeatures(const CpuFeatures& allowed);
+
+#endif  // VOXEL_CPU_FEATURES
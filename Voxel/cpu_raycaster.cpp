@@ -0,0 +1,263 @@
+#include "cpu_raycaster.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "profiler.h"
+#include "ray_sampling.h"
+#include "tile_scheduler.h"
+#include "voxel_simd.h"
+
+namespace {
+
+using namespace simd;
+
+// Rays stop once their opacity reaches this value, as in
+// QUAD_FRAGMENT_SHADER.
+const float kOpaqueAlpha = 0.99f;
+
+uint8_t ToUnorm8(float value) {
+	return static_cast<uint8_t>(
+		std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+}  // namespace
+
+bool CpuRaycaster::CreateCpuRaycaster(CpuRaycaster* raycaster,
+	const uint8_t* texels, const uint32_t dims[3], TextureFormat format,
+	const std::vector<uint8_t>& transfer_function) {
+	if (transfer_function.empty() || transfer_function.size() % 4 != 0) {
+		assert(false);
+		return false;
+	}
+	raycaster->texels = texels;
+	std::copy(dims, dims + 3, raycaster->dims);
+	raycaster->format = format;
+	raycaster->kernel = GetBestRaycastKernel();
+	switch (format) {
+	case TextureFormat::kR8:
+		raycaster->value_scale = 1.0f / 255.0f;
+		break;
+	case TextureFormat::kR16:
+		raycaster->value_scale = 1.0f / 65535.0f;
+		break;
+	case TextureFormat::kR16F:
+	case TextureFormat::kR32F:
+		raycaster->value_scale = 1.0f;
+		break;
+	}
+	raycaster->transfer_function.resize(transfer_function.size());
+	for (size_t i = 0; i < transfer_function.size(); ++i)
+		raycaster->transfer_function[i] = transfer_function[i] / 255.0f;
+	return true;
+}
+
+template <typename T>
+float CpuRaycaster::SampleVolume(const CpuRaycaster* raycaster,
+	const glm::vec3& position) {
+	const uint32_t* dims = raycaster->dims;
+	const T* texels = reinterpret_cast<const T*>(raycaster->texels);
+	// Texel centers are at (i + 0.5) / size.
+	int lower[3];
+	int upper[3];
+	float weights[3];
+	for (int axis = 0; axis < 3; ++axis) {
+		const float coordinate = position[axis] * dims[axis] - 0.5f;
+		const float floor = std::floor(coordinate);
+		const int last = static_cast<int>(dims[axis]) - 1;
+		lower[axis] = std::min(std::max(static_cast<int>(floor), 0), last);
+		upper[axis] = std::min(std::max(static_cast<int>(floor) + 1, 0), last);
+		weights[axis] = std::nearbyint((coordinate - floor) * kFilterWeightSteps) /
+			kFilterWeightSteps;
+	}
+
+	const size_t row = dims[0];
+	const size_t slice = row * dims[1];
+	float along_z[2];
+	for (int k = 0; k < 2; ++k) {
+		const size_t z = (k == 0 ? lower[2] : upper[2]) * slice;
+		float along_y[2];
+		for (int j = 0; j < 2; ++j) {
+			const T* line = texels + z + (j == 0 ? lower[1] : upper[1]) * row;
+			const float left = LoadScalar(line + lower[0], false);
+			const float right = LoadScalar(line + upper[0], false);
+			along_y[j] = left + (right - left) * weights[0];
+		}
+		along_z[k] = along_y[0] + (along_y[1] - along_y[0]) * weights[1];
+	}
+	return (along_z[0] + (along_z[1] - along_z[0]) * weights[2]) *
+		raycaster->value_scale;
+}
+
+int CpuRaycaster::GetRaySteps(const CpuRaycaster* raycaster,
+	const glm::vec3& ray, float step_voxels, float* step_size) {
+	const glm::vec3 dims(
+		raycaster->dims[0], raycaster->dims[1], raycaster->dims[2]);
+	const float ray_voxels = glm::length(ray * dims);
+	*step_size = glm::length(ray) * step_voxels / ray_voxels;
+	return static_cast<int>(
+		std::ceil(ray_voxels / step_voxels - kFirstSampleOffset));
+}
+
+template <typename T>
+glm::vec4 CpuRaycaster::TraceRay(const CpuRaycaster* raycaster,
+	const float* table, float step_voxels, const glm::vec3& entry,
+	const glm::vec3& exit) {
+	const glm::vec3 ray = exit - entry;
+	const glm::vec3 direction = glm::normalize(ray);
+	float step_size;
+	const int sample_count =
+		GetRaySteps(raycaster, ray, step_voxels, &step_size);
+	const int table_size =
+		static_cast<int>(raycaster->transfer_function.size() / 4);
+
+	glm::vec3 color(0.0f);
+	float alpha = 0.0f;
+	for (int i = 0; i < sample_count; ++i) {
+		if (alpha > kOpaqueAlpha)
+			break;
+		const glm::vec3 position =
+			entry + direction * (step_size * (i + kFirstSampleOffset));
+		const float voxel = SampleVolume<T>(raycaster, position);
+
+		// GL_NEAREST with GL_REPEAT.
+		const float wrapped = voxel - std::floor(voxel);
+		const int index =
+			std::min(static_cast<int>(wrapped * table_size), table_size - 1);
+		const float* entry_color = table + index * 4;
+		const float voxel_alpha = entry_color[3];
+		const glm::vec3 voxel_color =
+			glm::vec3(entry_color[0], entry_color[1], entry_color[2]) * voxel_alpha;
+
+		color = (1.0f - alpha) * voxel_color + color;
+		alpha = (1.0f - alpha) * voxel_alpha + alpha;
+	}
+	return glm::vec4(color, alpha);
+}
+
+template <typename T>
+void CpuRaycaster::RenderTiles(const CpuRaycaster* raycaster,
+	const CameraTransforms& camera, Image* image, TileScheduleStats* stats) {
+	const glm::mat4 model_from_clip = glm::inverse(camera.proj_from_view *
+		camera.view_from_world * camera.world_from_model);
+	const int width = image->width;
+	const int height = image->height;
+	const int tile_size = std::max(raycaster->tile_size, 1);
+	const int tiles_x = (width + tile_size - 1) / tile_size;
+	const int tiles_y = (height + tile_size - 1) / tile_size;
+
+	// Step as QUAD_FRAGMENT_SHADER does at the full resolution level.
+	const float step_voxels = SampleStepVoxels(raycaster->sampling_rate, 0.0f);
+	std::vector<float> table = raycaster->transfer_function;
+	CorrectOpacities(step_voxels, &table);
+
+	// The packet kernels index the volume with 32-bit integers and gather
+	// at least 4 bytes at a time.
+	const size_t texel_count =
+		static_cast<size_t>(raycaster->dims[0]) * raycaster->dims[1] *
+		raycaster->dims[2];
+	TracePacketFunction trace_packet = nullptr;
+	if (texel_count >= 4 && texel_count <= 0x7fffffff)
+		trace_packet = GetTracePacketFunction(raycaster->kernel, raycaster->format);
+	const int packet_width =
+		trace_packet ? RaycastKernelWidth(raycaster->kernel) : 1;
+	PacketVolume volume;
+	volume.texels = raycaster->texels;
+	for (int axis = 0; axis < 3; ++axis)
+		volume.dims[axis] = static_cast<int>(raycaster->dims[axis]);
+	volume.value_scale = raycaster->value_scale;
+	volume.transfer_function = table.data();
+	volume.transfer_function_size = static_cast<int>(table.size() / 4);
+
+	RunTiles(static_cast<size_t>(tiles_x) * tiles_y, raycaster->schedule,
+		[&](size_t tile) {
+		PacketRays rays;
+		PacketColors colors;
+		const int x_begin = static_cast<int>(tile % tiles_x) * tile_size;
+		const int y_begin = static_cast<int>(tile / tiles_x) * tile_size;
+		const int x_end = std::min(x_begin + tile_size, width);
+		const int y_end = std::min(y_begin + tile_size, height);
+		for (int y = y_begin; y < y_end; ++y) {
+			uint8_t* row = image->rgba.data() + static_cast<size_t>(y) * width * 4;
+			// Rows are stored top to bottom, gl_FragCoord goes up.
+			const float ndc_y = 1.0f - 2.0f * (y + 0.5f) / height;
+			for (int x = x_begin; x < x_end; x += packet_width) {
+				// Set up a packet of rays along the row, or a single one.
+				const int lanes = std::min(packet_width, x_end - x);
+				glm::vec3 entries[kMaxPacketWidth];
+				glm::vec3 exits[kMaxPacketWidth];
+				bool hits[kMaxPacketWidth];
+				for (int lane = 0; lane < lanes; ++lane) {
+					const float ndc_x = 2.0f * (x + lane + 0.5f) / width - 1.0f;
+					const glm::vec4 near_point =
+						model_from_clip * glm::vec4(ndc_x, ndc_y, -1.0f, 1.0f);
+					const glm::vec4 far_point =
+						model_from_clip * glm::vec4(ndc_x, ndc_y, 1.0f, 1.0f);
+					const glm::vec3 origin = glm::vec3(near_point) / near_point.w;
+					const glm::vec3 direction =
+						glm::vec3(far_point) / far_point.w - origin;
+					float t_near;
+					float t_far;
+					hits[lane] =
+						IntersectUnitCube(origin, direction, &t_near, &t_far);
+					entries[lane] = origin + direction * t_near;
+					exits[lane] = origin + direction * t_far;
+				}
+
+				if (!trace_packet) {
+					const glm::vec4 color = hits[0] ?
+						TraceRay<T>(raycaster, table.data(), step_voxels, entries[0],
+							exits[0]) : glm::vec4(0.0f);
+					for (int c = 0; c < 4; ++c)
+						row[x * 4 + c] = ToUnorm8(color[c]);
+					continue;
+				}
+
+				int max_sample_count = 0;
+				for (int lane = 0; lane < packet_width; ++lane) {
+					const bool hit = lane < lanes && hits[lane];
+					const glm::vec3 ray =
+						hit ? exits[lane] - entries[lane] : glm::vec3(0.0f);
+					const glm::vec3 direction =
+						hit ? glm::normalize(ray) : glm::vec3(0.0f);
+					float step_size = 0.0f;
+					const int sample_count =
+						hit ? GetRaySteps(raycaster, ray, step_voxels, &step_size) : 0;
+					for (int axis = 0; axis < 3; ++axis) {
+						rays.entry[axis][lane] = hit ? entries[lane][axis] : 0.0f;
+						rays.direction[axis][lane] = direction[axis];
+					}
+					rays.step_size[lane] = step_size;
+					rays.sample_count[lane] = static_cast<float>(sample_count);
+					max_sample_count = std::max(max_sample_count, sample_count);
+				}
+				trace_packet(
+					volume, rays, max_sample_count, kOpaqueAlpha, &colors);
+				for (int lane = 0; lane < lanes; ++lane) {
+					for (int c = 0; c < 4; ++c)
+						row[(x + lane) * 4 + c] = ToUnorm8(colors.rgba[c][lane]);
+				}
+			}
+		}
+	}, stats);
+}
+
+void CpuRaycaster::RenderImage(const CpuRaycaster* raycaster,
+	const CameraTransforms& camera, Image* image, TileScheduleStats* stats) {
+	const ProfileScope scope("CpuRaycaster::RenderImage");
+	switch (raycaster->format) {
+	case TextureFormat::kR8:
+		RenderTiles<uint8_t>(raycaster, camera, image, stats);
+		return;
+	case TextureFormat::kR16:
+		RenderTiles<uint16_t>(raycaster, camera, image, stats);
+		return;
+	case TextureFormat::kR16F:
+		RenderTiles<Half>(raycaster, camera, image, stats);
+		return;
+	case TextureFormat::kR32F:
+		RenderTiles<float>(raycaster, camera, image, stats);
+		return;
+	}
+}
@@ -0,0 +1,102 @@
+#ifndef VOXEL_CPU_RAYCASTER
+#define VOXEL_CPU_RAYCASTER
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "image.h"
+#include "ray_packets.h"
+#include "tile_scheduler.h"
+#include "voxel_convert.h"
+
+// Matrices that place the volume cube and the camera, the same ones given to
+// the shaders as uniforms.
+struct CameraTransforms {
+	glm::mat4 world_from_model;
+	glm::mat4 view_from_world;
+	glm::mat4 proj_from_view;
+};
+
+// Reference implementation of the two render passes on the CPU.
+//
+// Every pixel marches the same ray as QUAD_FRAGMENT_SHADER: from the front
+// face of the cube to its back face in steps of the same length in voxels,
+// with opacities corrected for the step, sampling the volume with
+// trilinear filtering and clamping to the edge, looking the voxel up in the
+// transfer function without filtering and wrapping, and compositing front
+// to back until the ray is opaque. The entry and exit points are found
+// analytically like the single-pass mode of the window does, so the image
+// only differs from the two-pass mode where the back face texture rounds
+// the exit points.
+//
+// The image is split in square tiles that are handed to all the threads by
+// RunTiles(), stealing by default as rays cost very differently across the
+// image: empty corners end at once while rays through the volume march
+// until they are opaque. Within a tile, neighbouring rays of a row are marched
+// together in SIMD packets by the widest kernel the CPU supports.
+class CpuRaycaster {
+  public:
+	// Sets up |raycaster| to render |texels|, a linear x-fastest volume of
+	// size |dims| in |format| as returned by GetLinearTexels(), colored with
+	// |transfer_function|, a table of RGBA8 entries. |texels| must outlive
+	// |raycaster|.
+	static bool CreateCpuRaycaster(CpuRaycaster* raycaster,
+		const uint8_t* texels, const uint32_t dims[3], TextureFormat format,
+		const std::vector<uint8_t>& transfer_function);
+
+	// Renders the volume seen through |camera| into |image|, which must
+	// already have its final size. Fills |stats| with the load balance of
+	// the threads if it isn't null.
+	static void RenderImage(const CpuRaycaster* raycaster,
+		const CameraTransforms& camera, Image* image,
+		TileScheduleStats* stats);
+
+	// Width and height of the tiles in pixels, and how they are shared
+	// between the threads. Both can change between two renders.
+	int tile_size = 32;
+	TileSchedule schedule = TileSchedule::kWorkStealing;
+	// Samples per Nyquist step of the volume, see SampleStepVoxels().
+	float sampling_rate = 1.0f;
+	// How rays are marched. Defaults to GetBestRaycastKernel(), can be
+	// changed to any supported kernel before rendering.
+	RaycastKernel kernel = RaycastKernel::kScalar;
+
+  private:
+	// Returns the color of the ray from |entry| to |exit|, both in model
+	// space, as written to fragColor.
+	// |table| is the transfer function with opacities corrected for steps of
+	// |step_voxels|.
+	template <typename T>
+	static glm::vec4 TraceRay(const CpuRaycaster* raycaster,
+		const float* table, float step_voxels, const glm::vec3& entry,
+		const glm::vec3& exit);
+
+	// Returns the number of samples along |ray|, in model space, with steps
+	// of |step_voxels|, and stores the length of the steps in model space in
+	// |step_size|.
+	static int GetRaySteps(const CpuRaycaster* raycaster,
+		const glm::vec3& ray, float step_voxels, float* step_size);
+
+	// Returns the value of the volume at |position| in model space, [0, 1]
+	// in each axis, with trilinear filtering.
+	template <typename T>
+	static float SampleVolume(const CpuRaycaster* raycaster,
+		const glm::vec3& position);
+
+	// Renders the tiles of |image| with texels of type T.
+	template <typename T>
+	static void RenderTiles(const CpuRaycaster* raycaster,
+		const CameraTransforms& camera, Image* image, TileScheduleStats* stats);
+
+	const uint8_t* texels = nullptr;
+	uint32_t dims[3] = {0, 0, 0};
+	TextureFormat format = TextureFormat::kR8;
+	// Multiplier that normalizes integer texels to [0, 1] like GL does.
+	float value_scale = 1.0f;
+	// The transfer function as floats in [0, 1], 4 per entry.
+	std::vector<float> transfer_function;
+};
+
+#endif  // VOXEL_CPU_RAYCASTER
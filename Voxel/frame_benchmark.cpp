@@ -0,0 +1,109 @@
+#include "frame_benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+
+#include "json_writer.h"
+
+namespace {
+
+// Returns the time |share| of |sorted_ms| don't exceed, the nearest rank.
+float Percentile(const std::vector<float>& sorted_ms, double share) {
+	const size_t rank = static_cast<size_t>(
+		std::ceil(share * static_cast<double>(sorted_ms.size())));
+	return sorted_ms[std::max<size_t>(rank, 1) - 1];
+}
+
+}  // namespace
+
+FrameTimeSummary SummarizeFrameBenchmark(const FrameBenchmark& benchmark) {
+	FrameTimeSummary summary;
+	if (benchmark.frame_ms.empty())
+		return summary;
+	std::vector<float> sorted_ms = benchmark.frame_ms;
+	std::sort(sorted_ms.begin(), sorted_ms.end());
+	const double total_ms =
+		std::accumulate(sorted_ms.begin(), sorted_ms.end(), 0.0);
+	summary.min_ms = sorted_ms.front();
+	summary.p50_ms = Percentile(sorted_ms, 0.5);
+	summary.p95_ms = Percentile(sorted_ms, 0.95);
+	summary.p99_ms = Percentile(sorted_ms, 0.99);
+	summary.max_ms = sorted_ms.back();
+	summary.mean_ms = static_cast<float>(total_ms / sorted_ms.size());
+	summary.frames_per_second = sorted_ms.size() * 1000.0 / total_ms;
+	summary.samples_per_second =
+		benchmark.samples_per_frame * summary.frames_per_second;
+	const double voxels = static_cast<double>(benchmark.dims[0]) *
+		benchmark.dims[1] * benchmark.dims[2];
+	summary.mvoxels_per_second = voxels * summary.frames_per_second / 1e6;
+	return summary;
+}
+
+void PrintFrameBenchmark(const FrameBenchmark& benchmark) {
+	const FrameTimeSummary summary = SummarizeFrameBenchmark(benchmark);
+	std::cout << "Benchmark of " << benchmark.volume_path << " ("
+		<< benchmark.dims[0] << "x" << benchmark.dims[1] << "x"
+		<< benchmark.dims[2] << ") at " << benchmark.width << "x"
+		<< benchmark.height << " on " << benchmark.renderer << ", "
+		<< benchmark.frame_ms.size() << " frames after "
+		<< benchmark.warmup_frames << " to warm up\n"
+		<< "  Frame time min " << summary.min_ms << " ms, p50 "
+		<< summary.p50_ms << " ms, p95 " << summary.p95_ms << " ms, p99 "
+		<< summary.p99_ms << " ms, max " << summary.max_ms << " ms, mean "
+		<< summary.mean_ms << " ms\n"
+		<< "  " << summary.frames_per_second << " frames/s, "
+		<< summary.samples_per_second / 1e6 << " Msamples/s, "
+		<< summary.mvoxels_per_second << " MVoxel/s\n";
+}
+
+bool WriteFrameBenchmarkJson(const char* path, const FrameBenchmark& benchmark) {
+	std::ofstream file;
+	if (path) {
+		file.open(path, std::ofstream::out | std::ofstream::trunc);
+		if (!file) {
+			std::cout << "Failed to open " << path << "\n";
+			return false;
+		}
+	}
+	std::ostream& out = path ? file : std::cout;
+
+	const FrameTimeSummary summary = SummarizeFrameBenchmark(benchmark);
+	out << "{\n  \"renderer\": ";
+	WriteJsonString(out, benchmark.renderer);
+	out << ",\n  \"volume\": ";
+	WriteJsonString(out, benchmark.volume_path);
+	out << ",\n  \"dims\": [" << benchmark.dims[0] << ", " << benchmark.dims[1]
+		<< ", " << benchmark.dims[2] << "],\n  \"width\": " << benchmark.width
+		<< ",\n  \"height\": " << benchmark.height << ",\n  \"settings\": {";
+	for (size_t i = 0; i < benchmark.settings.size(); ++i) {
+		const FrameBenchmarkSetting& setting = benchmark.settings[i];
+		out << (i == 0 ? "\n    " : ",\n    ");
+		WriteJsonString(out, setting.name);
+		out << ": ";
+		if (setting.is_string)
+			WriteJsonString(out, setting.value);
+		else
+			out << setting.value;
+	}
+	out << "\n  },\n  \"warmup_frames\": " << benchmark.warmup_frames
+		<< ",\n  \"frames\": " << benchmark.frame_ms.size()
+		<< ",\n  \"frame_ms\": {\"min\": " << summary.min_ms
+		<< ", \"p50\": " << summary.p50_ms << ", \"p95\": " << summary.p95_ms
+		<< ", \"p99\": " << summary.p99_ms << ", \"max\": " << summary.max_ms
+		<< ", \"mean\": " << summary.mean_ms << "},\n  \"frames_per_second\": "
+		<< summary.frames_per_second << ",\n  \"samples_per_frame\": "
+		<< benchmark.samples_per_frame << ",\n  \"samples_per_second\": "
+		<< summary.samples_per_second << ",\n  \"mvoxels_per_second\": "
+		<< summary.mvoxels_per_second << ",\n  \"frame_times_ms\": [";
+	for (size_t i = 0; i < benchmark.frame_ms.size(); ++i)
+		out << (i == 0 ? "" : ", ") << benchmark.frame_ms[i];
+	out << "]\n}\n";
+	if (path) {
+		std::cout << "Wrote " << path << "\n";
+		return static_cast<bool>(file);
+	}
+	return true;
+}
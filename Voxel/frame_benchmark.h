@@ -0,0 +1,56 @@
+#ifndef VOXEL_FRAME_BENCHMARK
+#define VOXEL_FRAME_BENCHMARK
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A setting of a FrameBenchmark. Strings are quoted and escaped in the
+// JSON, other values, numbers and booleans, are written as they are.
+struct FrameBenchmarkSetting {
+	std::string name;
+	std::string value;
+	bool is_string = false;
+};
+
+// What a benchmark rendered and how long its frames took.
+struct FrameBenchmark {
+	std::string renderer;
+	std::string volume_path;
+	uint32_t dims[3] = {};
+	int width = 0;
+	int height = 0;
+	// Settings that change the cost of the frames.
+	std::vector<FrameBenchmarkSetting> settings;
+	int warmup_frames = 0;
+	// Time of every timed frame, from the end of the previous one.
+	std::vector<float> frame_ms;
+	// Ray samples of a frame, averaged over views of the orbit.
+	double samples_per_frame = 0.0;
+};
+
+// Frame times of a FrameBenchmark. The percentiles are the times no more
+// than that share of the frames exceeds.
+struct FrameTimeSummary {
+	float min_ms = 0.0f;
+	float p50_ms = 0.0f;
+	float p95_ms = 0.0f;
+	float p99_ms = 0.0f;
+	float max_ms = 0.0f;
+	float mean_ms = 0.0f;
+	double frames_per_second = 0.0;
+	double samples_per_second = 0.0;
+	// Voxels of the volume drawn per second, in millions.
+	double mvoxels_per_second = 0.0;
+};
+
+FrameTimeSummary SummarizeFrameBenchmark(const FrameBenchmark& benchmark);
+
+// Prints |benchmark| to std::cout.
+void PrintFrameBenchmark(const FrameBenchmark& benchmark);
+
+// Writes |benchmark| and its summary as a JSON object to |path|, or to
+// std::cout if |path| is null.
+bool WriteFrameBenchmarkJson(const char* path, const FrameBenchmark& benchmark);
+
+#endif  // VOXEL_FRAME_BENCHMARK
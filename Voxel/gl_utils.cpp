@@ -0,0 +1,38 @@
+#include "gl_utils.h"
+
+#include <iostream>
+
+bool CheckGlError() {
+	bool result = true;
+	GLenum gl_error = glGetError();
+	while (gl_error != GL_NO_ERROR) {
+		std::cout << "GL ERROR[" << gl_error << "]: "
+				  << gluErrorString(gl_error) << "\n";
+		gl_error = glGetError();
+		result = false;
+	}
+
+	return result;
+}
+
+void GetGlTextureFormat(TextureFormat format, GLint* internal_format,
+	GLenum* pixel_type) {
+	switch (format) {
+	case TextureFormat::kR8:
+		*internal_format = GL_R8;
+		*pixel_type = GL_UNSIGNED_BYTE;
+		return;
+	case TextureFormat::kR16:
+		*internal_format = GL_R16;
+		*pixel_type = GL_UNSIGNED_SHORT;
+		return;
+	case TextureFormat::kR16F:
+		*internal_format = GL_R16F;
+		*pixel_type = GL_HALF_FLOAT;
+		return;
+	case TextureFormat::kR32F:
+		*internal_format = GL_R32F;
+		*pixel_type = GL_FLOAT;
+		return;
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef VOXEL_GL_UTILS
+#define VOXEL_GL_UTILS
+
+// Required when linking GLEW as a static library.
+#ifndef GLEW_STATIC
+#define GLEW_STATIC
+#endif
+
+#include <GL/glew.h>
+
+#include "voxel_convert.h"
+
+// Checks for GL errors, returns true if no errors are found and false
+// otherwise. All GL errors are flushed.
+bool CheckGlError();
+
+// Returns the GL internal format and pixel type of |format|.
+void GetGlTextureFormat(TextureFormat format, GLint* internal_format,
+	GLenum* pixel_type);
+
+#endif  // VOXEL_GL_UTILS
@@ -0,0 +1,214 @@
+#include "golden_test.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+// Returns the path of the golden of view |view_index| of |result|.
+std::string GoldenImagePath(const char* directory, const GoldenResult& result,
+	size_t view_index) {
+	return std::string(directory) + "/" + result.renderer + "_" +
+		result.variant + "_" + std::to_string(view_index) + ".ppm";
+}
+
+// Keeps the worst of |difference| and |worst|.
+void KeepWorst(const ImageDifference& difference, ImageDifference* worst) {
+	worst->psnr = std::min(worst->psnr, difference.psnr);
+	worst->mean_error = std::max(worst->mean_error, difference.mean_error);
+	worst->outlier_fraction =
+		std::max(worst->outlier_fraction, difference.outlier_fraction);
+	worst->ssim = std::min(worst->ssim, difference.ssim);
+}
+
+// Returns the mean error of |images| against |target| over the views.
+double MeanError(const std::vector<Image>& images,
+	const std::vector<Image>& target) {
+	double sum = 0.0;
+	for (size_t i = 0; i < images.size(); ++i)
+		sum += CompareImages(images[i], target[i]).mean_error;
+	return images.empty() ? 0.0 : sum / images.size();
+}
+
+// Returns the index of the variant called |name| in GetGoldenVariants().
+size_t VariantIndex(const char* name) {
+	const std::vector<GoldenVariant>& variants = GetGoldenVariants();
+	for (size_t i = 0; i < variants.size(); ++i) {
+		if (std::strcmp(variants[i].name, name) == 0)
+			return i;
+	}
+	assert(false);
+	return 0;
+}
+
+}  // namespace
+
+const std::vector<GoldenVariant>& GetGoldenVariants() {
+	// name, rate, skip, pre-integrate, shading, precomputed, packing,
+	// two-pass, CPU.
+	const GradientEncoding rgba8 = GradientEncoding::kRgba8;
+	const GradientEncoding octahedral = GradientEncoding::kOctahedral;
+	static const std::vector<GoldenVariant> variants = {
+		{"reference", 1.0f, false, false, false, false, rgba8, false, true},
+		{"skip_empty", 1.0f, true, false, false, false, rgba8, false, true},
+		{"preintegrate", 1.0f, false, true, false, false, rgba8, false, false},
+		{"half_rate", 0.5f, false, false, false, false, rgba8, false, false},
+		{"double_rate", 2.0f, false, false, false, false, rgba8, false, false},
+		{"half_rate_preintegrate", 0.5f, false, true, false, false, rgba8, false,
+			false},
+		{"shading", 1.0f, false, false, true, true, rgba8, false, false},
+		{"shading_octahedral", 1.0f, false, false, true, true, octahedral, false,
+			false},
+		{"shading_in_shader", 1.0f, false, false, true, false, rgba8, false,
+			false},
+		{"two_pass", 1.0f, false, false, false, false, rgba8, true, false},
+		{"defaults", 1.0f, true, true, true, true, rgba8, false, false},
+	};
+	return variants;
+}
+
+std::vector<CameraView> GetGoldenViews() {
+	// Oblique views from all around, and the face-on view of the window.
+	const float angles[][2] = {
+		{0.0f, 0.0f},
+		{35.0f, 20.0f},
+		{140.0f, -15.0f},
+		{250.0f, 40.0f},
+	};
+	std::vector<CameraView> views;
+	for (const auto& angle : angles) {
+		CameraView view;
+		view.yaw_degrees = angle[0];
+		view.pitch_degrees = angle[1];
+		views.push_back(view);
+	}
+	return views;
+}
+
+const std::vector<GoldenOrdering>& GetGoldenOrderings() {
+	// better, worse, target.
+	static const std::vector<GoldenOrdering> orderings = {
+		// Pre-integration makes up for the samples it leaves out.
+		{"half_rate_preintegrate", "half_rate", "double_rate"},
+	};
+	return orderings;
+}
+
+bool CompareToGoldens(const char* directory, bool update,
+	const GoldenThresholds& thresholds, const std::vector<Image>& images,
+	const std::vector<Image>* reference, GoldenResult* result) {
+	result->golden.psnr = result->reference.psnr =
+		std::numeric_limits<double>::infinity();
+	result->golden.ssim = result->reference.ssim = 1.0;
+	result->golden.mean_error = result->reference.mean_error = 0.0;
+	result->golden.outlier_fraction = result->reference.outlier_fraction = 0.0;
+	result->has_golden = !update;
+	result->has_reference = reference != nullptr;
+	result->written = update;
+	for (size_t i = 0; i < images.size(); ++i) {
+		const std::string path = GoldenImagePath(directory, *result, i);
+		if (update) {
+			if (!WritePpm(path.c_str(), images[i]))
+				return false;
+		} else {
+			Image golden;
+			if (!ReadPpm(path.c_str(), &golden)) {
+				result->has_golden = false;
+			} else if (golden.width != images[i].width ||
+				golden.height != images[i].height) {
+				std::cout << path << " is " << golden.width << "x"
+					<< golden.height << ", not " << images[i].width << "x"
+					<< images[i].height << "\n";
+				return false;
+			} else {
+				KeepWorst(CompareImages(images[i], golden), &result->golden);
+			}
+		}
+		if (reference)
+			KeepWorst(CompareImages(images[i], (*reference)[i]), &result->reference);
+	}
+	result->passed = update || (result->has_golden &&
+		result->golden.psnr >= thresholds.min_psnr &&
+		result->golden.ssim >= thresholds.min_ssim);
+	if (reference && result->matches_reference) {
+		result->passed = result->passed &&
+			result->reference.mean_error <= thresholds.max_reference_error &&
+			result->reference.outlier_fraction <=
+				thresholds.max_reference_outliers;
+	}
+	return true;
+}
+
+bool PrintGoldenTable(const std::vector<GoldenResult>& results,
+	const GoldenThresholds& thresholds) {
+	std::cout << "Worst view against the goldens (pass at " << thresholds.min_psnr
+		<< " dB and SSIM " << thresholds.min_ssim
+		<< ") and against the CPU reference (pass at a mean error of "
+		<< thresholds.max_reference_error << " and "
+		<< thresholds.max_reference_outliers * 100.0 << "% of the pixels off by "
+		<< kOutlierError << " for the variants marked *):\n"
+		<< std::left << std::setw(9) << "renderer" << std::setw(24) << "variant"
+		<< std::right << std::setw(10) << "ms/view" << std::setw(8) << "speed"
+		<< std::setw(10) << "PSNR" << std::setw(8) << "SSIM"
+		<< std::setw(10) << "ref PSNR" << std::setw(9) << "ref SSIM"
+		<< std::setw(9) << "ref MAE" << std::setw(9) << "outliers"
+		<< "  result\n";
+	bool all_passed = true;
+	double first_ms = 0.0;
+	for (size_t i = 0; i < results.size(); ++i) {
+		const GoldenResult& result = results[i];
+		if (i == 0 || result.renderer != results[i - 1].renderer)
+			first_ms = result.ms_per_view;
+		std::cout << std::left << std::setw(9) << result.renderer
+			<< std::setw(24) << (result.matches_reference ?
+				result.variant + " *" : result.variant) << std::right << std::fixed
+			<< std::setprecision(2) << std::setw(10) << result.ms_per_view
+			<< std::setw(7) << first_ms / result.ms_per_view << "x";
+		if (result.has_golden) {
+			std::cout << std::setw(10) << result.golden.psnr
+				<< std::setprecision(4) << std::setw(8) << result.golden.ssim;
+		} else {
+			std::cout << std::setw(10) << "-" << std::setw(8) << "-";
+		}
+		if (result.has_reference) {
+			std::cout << std::setprecision(2) << std::setw(10)
+				<< result.reference.psnr << std::setprecision(4) << std::setw(9)
+				<< result.reference.ssim << std::setprecision(3) << std::setw(9)
+				<< result.reference.mean_error << std::setprecision(2)
+				<< std::setw(8) << result.reference.outlier_fraction * 100.0 << "%";
+		} else {
+			std::cout << std::setw(10) << "-" << std::setw(9) << "-"
+				<< std::setw(9) << "-" << std::setw(9) << "-";
+		}
+		std::cout << "  " << (result.written ? "written" : result.passed ?
+			"pass" : result.has_golden ? "FAIL" : "no golden") << "\n";
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(6);
+		all_passed = all_passed && result.passed;
+	}
+	return all_passed;
+}
+
+bool CheckGoldenOrderings(const std::vector<std::vector<Image>>& images) {
+	bool all_held = true;
+	for (const GoldenOrdering& ordering : GetGoldenOrderings()) {
+		const std::vector<Image>& target = images[VariantIndex(ordering.target)];
+		const double better_error =
+			MeanError(images[VariantIndex(ordering.better)], target);
+		const double worse_error =
+			MeanError(images[VariantIndex(ordering.worse)], target);
+		const bool held = better_error <= worse_error;
+		std::cout << "Mean error against " << ordering.target << ": "
+			<< ordering.better << " " << std::fixed << std::setprecision(3)
+			<< better_error << ", " << ordering.worse << " " << worse_error
+			<< "  " << (held ? "pass" : "FAIL") << "\n";
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(6);
+		all_held = all_held && held;
+	}
+	return all_held;
+}
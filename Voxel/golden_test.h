@@ -0,0 +1,94 @@
+#ifndef VOXEL_GOLDEN_TEST
+#define VOXEL_GOLDEN_TEST
+
+#include <string>
+#include <vector>
+
+#include "camera_list.h"
+#include "gradient_volume.h"
+#include "image.h"
+
+// A combination of the features of the renderers that change the image.
+struct GoldenVariant {
+	const char* name;
+	// Samples per Nyquist step, see SampleStepVoxels().
+	float sampling_rate;
+	bool skip_empty;
+	bool preintegrate;
+	bool shading;
+	bool precompute_gradients;
+	// How the precomputed gradients are packed.
+	GradientEncoding gradient_encoding;
+	bool two_pass;
+	// Only has the features of the CPU reference, so it is also held to the
+	// reference. The two renderers place the samples with a different
+	// precision, so at the sharp edges of the transfer function a few land on
+	// the other side of the CPU ones, and outliers are tolerated.
+	bool matches_cpu;
+};
+
+// Returns the variants the GL renderer is tested with, "reference" first.
+const std::vector<GoldenVariant>& GetGoldenVariants();
+
+// Returns the fixed views every variant is rendered from.
+std::vector<CameraView> GetGoldenViews();
+
+// Variants of which |better| has to draw images at least as close to those
+// of |target| as |worse| does, by their mean error over the views: what a
+// feature is for, which the goldens alone don't check.
+struct GoldenOrdering {
+	const char* better;
+	const char* worse;
+	const char* target;
+};
+
+// Returns the orderings the variants of GetGoldenVariants() have to keep.
+const std::vector<GoldenOrdering>& GetGoldenOrderings();
+
+// Smallest PSNR and SSIM an image needs against its golden to pass, and
+// largest mean error and fraction of outlier pixels against the CPU
+// reference for the variants that match it.
+struct GoldenThresholds {
+	double min_psnr = 40.0;
+	double min_ssim = 0.98;
+	double max_reference_error = 0.5;
+	double max_reference_outliers = 0.01;
+};
+
+// Quality and speed of a renderer with one variant over the golden views.
+struct GoldenResult {
+	// "cpu" or "gl", and the name of the variant.
+	std::string renderer;
+	std::string variant;
+	double ms_per_view = 0.0;
+	// The worst view against its golden, and against the CPU reference.
+	ImageDifference golden;
+	ImageDifference reference;
+	bool has_golden = false;
+	bool has_reference = false;
+	// True if the images have to match the CPU reference to pass.
+	bool matches_reference = false;
+	// True if the images were written as the new goldens instead.
+	bool written = false;
+	bool passed = false;
+};
+
+// Fills the quality of |result| from |images|, one per golden view: against
+// the goldens of its renderer and variant in |directory|, which are written
+// instead when |update| is set, and against |reference| if it isn't null.
+// Returns false if a golden can't be written or has another size.
+bool CompareToGoldens(const char* directory, bool update,
+	const GoldenThresholds& thresholds, const std::vector<Image>& images,
+	const std::vector<Image>* reference, GoldenResult* result);
+
+// Prints whether the orderings of GetGoldenOrderings() hold for |images|,
+// the images of each variant of GetGoldenVariants() in order, one per view.
+// Returns true if they all hold.
+bool CheckGoldenOrderings(const std::vector<std::vector<Image>>& images);
+
+// Prints |results| as a table of quality against speed, the speed relative
+// to the first result of the same renderer. Returns true if they all passed.
+bool PrintGoldenTable(const std::vector<GoldenResult>& results,
+	const GoldenThresholds& thresholds);
+
+#endif  // VOXEL_GOLDEN_TEST
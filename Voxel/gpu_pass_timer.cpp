@@ -0,0 +1,182 @@
+#include "gpu_pass_timer.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// Weight of the latest frame in the smoothed times.
+const float kSmoothing = 0.1f;
+
+}  // namespace
+
+const char* GpuPassName(GpuPass pass) {
+	switch (pass) {
+	case GpuPass::kBackFaces:
+		return "back_faces";
+	case GpuPass::kRaymarch:
+		return "raymarch";
+	case GpuPass::kAccumulate:
+		return "accumulate";
+	case GpuPass::kDisplay:
+		return "display";
+	case GpuPass::kSwap:
+		return "swap";
+	case GpuPass::kCount:
+		break;
+	}
+	return "unknown";
+}
+
+bool GpuPassTimer::CreateGpuPassTimer(GpuPassTimer* timer, const char* csv_path) {
+	for (FrameQueries& frame : timer->frames) {
+		glGenQueries(static_cast<GLsizei>(kGpuPassCount + 1), frame.queries);
+	}
+	if (csv_path) {
+		timer->log.open(csv_path, std::ofstream::out | std::ofstream::trunc);
+		if (!timer->log) {
+			std::cout << "Failed to open " << csv_path << "\n";
+			return false;
+		}
+		timer->log << "frame";
+		for (size_t pass = 0; pass < kGpuPassCount; ++pass)
+			timer->log << "," << GpuPassName(static_cast<GpuPass>(pass)) << "_ms";
+		timer->log << ",frame_ms\n";
+	}
+	timer->enabled = true;
+	return CheckGlError();
+}
+
+void GpuPassTimer::BeginFrame(GpuPassTimer* timer) {
+	timer->timing = timer->enabled && timer->pending_count < kGpuPassTimerFrames;
+	if (!timer->timing)
+		return;
+	FrameQueries& frame = timer->frames[
+		(timer->first_frame + timer->pending_count) % kGpuPassTimerFrames];
+	frame.pass_count = 0;
+	glQueryCounter(frame.queries[0], GL_TIMESTAMP);
+}
+
+void GpuPassTimer::EndPass(GpuPassTimer* timer, GpuPass pass) {
+	if (!timer->timing)
+		return;
+	FrameQueries& frame = timer->frames[
+		(timer->first_frame + timer->pending_count) % kGpuPassTimerFrames];
+	frame.passes[frame.pass_count] = pass;
+	++frame.pass_count;
+	glQueryCounter(frame.queries[frame.pass_count], GL_TIMESTAMP);
+}
+
+void GpuPassTimer::EndFrame(GpuPassTimer* timer) {
+	if (!timer->timing)
+		return;
+	++timer->pending_count;
+	timer->timing = false;
+}
+
+void GpuPassTimer::Update(GpuPassTimer* timer) {
+	while (timer->pending_count > 0) {
+		const FrameQueries& frame = timer->frames[timer->first_frame];
+		// The timestamps of a frame are written in order, once the last one
+		// is available so are the others.
+		GLint available = 0;
+		glGetQueryObjectiv(frame.queries[frame.pass_count],
+			GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+		GLuint64 timestamps[kGpuPassCount + 1] = {};
+		for (size_t i = 0; i <= frame.pass_count; ++i) {
+			glGetQueryObjectui64v(
+				frame.queries[i], GL_QUERY_RESULT, &timestamps[i]);
+		}
+		timer->first_frame = (timer->first_frame + 1) % kGpuPassTimerFrames;
+		--timer->pending_count;
+
+		float pass_ms[kGpuPassCount] = {};
+		bool timed[kGpuPassCount] = {};
+		for (size_t i = 0; i < frame.pass_count; ++i) {
+			const size_t pass = static_cast<size_t>(frame.passes[i]);
+			pass_ms[pass] += static_cast<float>(
+				(timestamps[i + 1] - timestamps[i]) / 1e6);
+			timed[pass] = true;
+		}
+		const float frame_ms = static_cast<float>(
+			(timestamps[frame.pass_count] - timestamps[0]) / 1e6);
+		for (Stats* stats : {&timer->stats, &timer->totals}) {
+			++stats->frame_count;
+			stats->frame_ms_sum += frame_ms;
+			for (size_t pass = 0; pass < kGpuPassCount; ++pass) {
+				if (!timed[pass])
+					continue;
+				++stats->pass_counts[pass];
+				stats->pass_ms_sums[pass] += pass_ms[pass];
+				stats->pass_ms_maxes[pass] =
+					std::max(stats->pass_ms_maxes[pass], pass_ms[pass]);
+			}
+		}
+		// Passes a frame skips took no time in it.
+		for (size_t pass = 0; pass < kGpuPassCount; ++pass) {
+			timer->smoothed_ms[pass] +=
+				(pass_ms[pass] - timer->smoothed_ms[pass]) * kSmoothing;
+		}
+
+		if (timer->log.is_open()) {
+			timer->log << timer->frame_index;
+			for (size_t pass = 0; pass < kGpuPassCount; ++pass) {
+				timer->log << ",";
+				if (timed[pass])
+					timer->log << pass_ms[pass];
+			}
+			timer->log << "," << frame_ms << "\n";
+		}
+		++timer->frame_index;
+	}
+}
+
+bool GpuPassTimer::WriteJson(const char* path) const {
+	std::ofstream file(path, std::ofstream::out | std::ofstream::trunc);
+	if (!file) {
+		std::cout << "Failed to open " << path << "\n";
+		return false;
+	}
+	const double frame_ms_sum = std::max(totals.frame_ms_sum, 1e-9);
+	file << "{\n  \"frames\": " << totals.frame_count
+		<< ",\n  \"frame_ms_mean\": "
+		<< totals.frame_ms_sum / std::max(totals.frame_count, 1)
+		<< ",\n  \"passes\": {";
+	for (size_t pass = 0; pass < kGpuPassCount; ++pass) {
+		const int count = totals.pass_counts[pass];
+		file << (pass == 0 ? "\n    \"" : ",\n    \"")
+			<< GpuPassName(static_cast<GpuPass>(pass)) << "\": {\"frames\": "
+			<< count << ", \"mean_ms\": "
+			<< totals.pass_ms_sums[pass] / std::max(count, 1) << ", \"max_ms\": "
+			<< totals.pass_ms_maxes[pass] << ", \"share\": "
+			<< totals.pass_ms_sums[pass] / frame_ms_sum << "}";
+	}
+	file << "\n  }\n}\n";
+	std::cout << "Wrote " << path << "\n";
+	return static_cast<bool>(file);
+}
+
+std::string GpuPassTimer::Summary() const {
+	std::ostringstream summary;
+	summary << std::fixed << std::setprecision(2);
+	float frame_ms = 0.0f;
+	for (size_t pass = 0; pass < kGpuPassCount; ++pass) {
+		summary << GpuPassName(static_cast<GpuPass>(pass)) << " "
+			<< smoothed_ms[pass] << " ms, ";
+		frame_ms += smoothed_ms[pass];
+	}
+	summary << "GPU frame " << frame_ms << " ms";
+	return summary.str();
+}
+
+void GpuPassTimer::DestroyGpuPassTimer(GpuPassTimer* timer) {
+	if (!timer->enabled)
+		return;
+	for (FrameQueries& frame : timer->frames) {
+		glDeleteQueries(static_cast<GLsizei>(kGpuPassCount + 1), frame.queries);
+	}
+}
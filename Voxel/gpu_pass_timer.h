@@ -0,0 +1,104 @@
+#ifndef VOXEL_GPU_PASS_TIMER
+#define VOXEL_GPU_PASS_TIMER
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+
+#include "gl_utils.h"
+
+// The GL work of a frame, in the order it is issued.
+enum class GpuPass {
+	kBackFaces,
+	kRaymarch,
+	kAccumulate,
+	kDisplay,
+	// From the end of the display pass to the swap being done.
+	kSwap,
+	kCount,
+};
+
+const size_t kGpuPassCount = static_cast<size_t>(GpuPass::kCount);
+// Frames the GPU can be behind before frames stop being timed.
+const size_t kGpuPassTimerFrames = 4;
+
+const char* GpuPassName(GpuPass pass);
+
+// Times every pass of the frames on the GPU.
+//
+// A GL_TIMESTAMP query is written at the start of each frame and at the
+// end of each of its passes, and the time of a pass is the difference with
+// the timestamp before it. The queries of a few frames are kept in a ring
+// and only read back once the GPU is done with them, so the CPU never
+// waits. Unlike GL_TIME_ELAPSED, timestamps can be taken while the
+// ResolutionGovernor times the whole frame. Until it is created every call
+// returns right away.
+class GpuPassTimer {
+  public:
+	~GpuPassTimer() {
+		DestroyGpuPassTimer(this);
+	}
+
+	// Times of the passes read back since the last ResetStats(), and since
+	// the timer was created.
+	struct Stats {
+		int frame_count = 0;
+		int pass_counts[kGpuPassCount] = {};
+		double pass_ms_sums[kGpuPassCount] = {};
+		float pass_ms_maxes[kGpuPassCount] = {};
+		double frame_ms_sum = 0.0;
+	};
+
+	// If |csv_path| isn't null, the times of every frame read back are
+	// appended to it as a CSV row.
+	static bool CreateGpuPassTimer(GpuPassTimer* timer, const char* csv_path);
+
+	// Bracket the passes of a frame. EndPass() marks the end of |pass|,
+	// which started where the previous one ended. Passes that aren't ended
+	// aren't timed in that frame.
+	static void BeginFrame(GpuPassTimer* timer);
+	static void EndPass(GpuPassTimer* timer, GpuPass pass);
+	static void EndFrame(GpuPassTimer* timer);
+
+	// Reads back the frames the GPU finished, without waiting for the
+	// others.
+	static void Update(GpuPassTimer* timer);
+
+	// Writes the times of every frame read back as a JSON object to |path|.
+	bool WriteJson(const char* path) const;
+
+	// Returns the smoothed times of the passes as a single line.
+	std::string Summary() const;
+
+	void ResetStats() {
+		stats = Stats();
+	}
+
+	bool enabled = false;
+	Stats stats;
+	Stats totals;
+	// Times of the passes smoothed over the last frames.
+	float smoothed_ms[kGpuPassCount] = {};
+
+  private:
+	static void DestroyGpuPassTimer(GpuPassTimer* timer);
+
+	// A timestamp for the start of the frame and one for the end of each
+	// pass, which pass each one ends, and how many passes were ended.
+	struct FrameQueries {
+		GLuint queries[kGpuPassCount + 1] = {};
+		GpuPass passes[kGpuPassCount] = {};
+		size_t pass_count = 0;
+	};
+
+	FrameQueries frames[kGpuPassTimerFrames];
+	// Oldest frame in flight and number of frames in flight. A frame is in
+	// flight from BeginFrame() until it is read back.
+	size_t first_frame = 0;
+	size_t pending_count = 0;
+	bool timing = false;
+	size_t frame_index = 0;
+	std::ofstream log;
+};
+
+#endif  // VOXEL_GPU_PASS_TIMER
@@ -0,0 +1,509 @@
+#include "gradient_volume.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "cpu_features.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "voxel_simd.h"
+
+namespace {
+
+using namespace simd;
+
+// Weights of the neighbours at -1, 0 and +1 across the axis of a derivative,
+// and the difference along it.
+const float kCentralWeights[3] = {0.0f, 1.0f, 0.0f};
+const float kSobelWeights[3] = {1.0f, 2.0f, 1.0f};
+const float kDifference[3] = {-1.0f, 0.0f, 1.0f};
+
+// Octahedral gradients under half of kFlatGradientMagnitude, where the fade
+// of the RGBA8 ones is half way, are stored as flat.
+const float kFlatSquaredLength =
+	0.25f * kFlatGradientMagnitude * kFlatGradientMagnitude;
+
+// The gradient of a voxel is computed from three rows of sums along y and
+// z, which are then combined along x:
+// - rows[0] is smoothed along y and z, its difference along x gives gx.
+// - rows[1] is differenced along y and smoothed along z, smoothing it along
+//   x gives gy.
+// - rows[2] is smoothed along y and differenced along z, smoothing it along
+//   x gives gz.
+// Each row has one padding float on each side so that the x taps never need
+// clamping.
+template <typename T>
+void AccumulateRowsScalar(const float weights[3], const T* source,
+	float* const rows[3], uint32_t width) {
+	for (uint32_t x = 0; x < width; ++x) {
+		const float value = LoadScalar(source + x, false);
+		for (int i = 0; i < 3; ++i)
+			rows[i][x] += weights[i] * value;
+	}
+}
+
+// Returns |value| clamped to [0, 1], NaN to 0 like _mm256_max_ps(), and
+// scaled to a byte, rounded to nearest even like _mm256_cvtps_epi32().
+template <typename F>
+uint8_t ToByte(F value) {
+	const F clamped = value > F(0) ? std::min(value, F(1)) : F(0);
+	return static_cast<uint8_t>(std::nearbyint(clamped * F(255)));
+}
+
+// Packs the gradient |g| into the texel at |destination|. Floats give the
+// same bytes as EncodeRowAvx2(), which does the same operations in the same
+// order, and doubles the reference of CheckGradientKernels().
+template <typename F>
+void EncodeGradient(GradientEncoding encoding, const F g[3],
+	uint8_t* destination) {
+	if (encoding == GradientEncoding::kRgba8) {
+		const F length = std::sqrt(g[0] * g[0] + g[1] * g[1] + g[2] * g[2]);
+		const F inverse = length > F(0) ? F(1) / length : F(0);
+		for (int i = 0; i < 3; ++i)
+			destination[i] = ToByte(g[i] * inverse * F(0.5) + F(0.5));
+		destination[3] = ToByte(length / F(kMaxGradientMagnitude));
+		return;
+	}
+	// Flat gradients take the code (0, 0). The squared length is compared so
+	// that no square root is needed.
+	const F squared_length = g[0] * g[0] + g[1] * g[1] + g[2] * g[2];
+	if (squared_length < F(kFlatSquaredLength)) {
+		destination[0] = 0;
+		destination[1] = 0;
+		return;
+	}
+	// Project on the octahedron |x| + |y| + |z| = 1 and fold the lower half
+	// over the corners of the square. The folds go by the sign bits, so -0
+	// folds like the negative values.
+	const F l1 = std::abs(g[0]) + std::abs(g[1]) + std::abs(g[2]);
+	const F inverse = l1 > F(0) ? F(1) / l1 : F(0);
+	F u = g[0] * inverse;
+	F v = g[1] * inverse;
+	if (g[2] < F(0)) {
+		const F folded_u = (F(1) - std::abs(v)) * std::copysign(F(1), u);
+		v = (F(1) - std::abs(u)) * std::copysign(F(1), v);
+		u = folded_u;
+	}
+	destination[0] = ToByte(u * F(0.5) + F(0.5));
+	destination[1] = ToByte(v * F(0.5) + F(0.5));
+	// All the corners of the square are -z.
+	if (destination[0] == 0 && destination[1] == 0) {
+		destination[0] = 255;
+		destination[1] = 255;
+	}
+}
+
+// Combines |rows| into the gradients of |width| voxels scaled by |scale| and
+// packs them into |destination|.
+void EncodeRowScalar(GradientEncoding encoding, const float smoothing[3],
+	float scale, const float* const rows[3], uint8_t* destination,
+	uint32_t width) {
+	const size_t texel_size = encoding == GradientEncoding::kRgba8 ? 4 : 2;
+	for (uint32_t x = 0; x < width; ++x) {
+		const int i = static_cast<int>(x);
+		float g[3] = {rows[0][i + 1] - rows[0][i - 1], 0.0f, 0.0f};
+		for (int axis = 1; axis < 3; ++axis) {
+			g[axis] = smoothing[0] * rows[axis][i - 1] +
+				smoothing[1] * rows[axis][i] + smoothing[2] * rows[axis][i + 1];
+		}
+		for (float& component : g)
+			component *= scale;
+		EncodeGradient(encoding, g, destination + x * texel_size);
+	}
+}
+
+#ifdef VOXEL_X86
+
+// VOXEL_AVX2 without FMA, so that GCC and clang can't fuse the multiplies and
+// adds the scalar kernel rounds separately. MSVC never fuses intrinsics.
+#define VOXEL_GRADIENT_AVX2 "avx2,f16c"
+
+template <typename T>
+VOXEL_TARGET(VOXEL_GRADIENT_AVX2) void AccumulateRowsAvx2(
+	const float weights[3], const T* source, float* const rows[3],
+	uint32_t width) {
+	const __m256 weights0 = _mm256_set1_ps(weights[0]);
+	const __m256 weights1 = _mm256_set1_ps(weights[1]);
+	const __m256 weights2 = _mm256_set1_ps(weights[2]);
+	uint32_t x = 0;
+	for (; x + 8 <= width; x += 8) {
+		const __m256 values = Load8(source + x, false);
+		_mm256_storeu_ps(rows[0] + x, _mm256_add_ps(
+			_mm256_loadu_ps(rows[0] + x), _mm256_mul_ps(values, weights0)));
+		_mm256_storeu_ps(rows[1] + x, _mm256_add_ps(
+			_mm256_loadu_ps(rows[1] + x), _mm256_mul_ps(values, weights1)));
+		_mm256_storeu_ps(rows[2] + x, _mm256_add_ps(
+			_mm256_loadu_ps(rows[2] + x), _mm256_mul_ps(values, weights2)));
+	}
+	float* const tail_rows[3] = {rows[0] + x, rows[1] + x, rows[2] + x};
+	AccumulateRowsScalar(weights, source + x, tail_rows, width - x);
+}
+
+// Returns |values| clamped to [0, 1] and scaled to bytes, rounded to
+// nearest even, in the low byte of each 32-bit lane.
+VOXEL_TARGET(VOXEL_GRADIENT_AVX2) inline __m256i ToBytes8(__m256 values) {
+	const __m256 clamped = _mm256_min_ps(
+		_mm256_max_ps(values, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+	return _mm256_cvtps_epi32(_mm256_mul_ps(clamped, _mm256_set1_ps(255.0f)));
+}
+
+// Returns 1 where |values| is positive or zero and -1 elsewhere.
+VOXEL_TARGET(VOXEL_GRADIENT_AVX2) inline __m256 SignNotZero8(__m256 values) {
+	return _mm256_or_ps(_mm256_set1_ps(1.0f),
+		_mm256_and_ps(values, _mm256_set1_ps(-0.0f)));
+}
+
+VOXEL_TARGET(VOXEL_GRADIENT_AVX2) void EncodeRowAvx2(GradientEncoding encoding,
+	const float smoothing[3], float scale, const float* const rows[3],
+	uint8_t* destination, uint32_t width) {
+	const __m256 scales = _mm256_set1_ps(scale);
+	const __m256 smoothing0 = _mm256_set1_ps(smoothing[0]);
+	const __m256 smoothing1 = _mm256_set1_ps(smoothing[1]);
+	const __m256 smoothing2 = _mm256_set1_ps(smoothing[2]);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const __m256 flat_squared_length = _mm256_set1_ps(kFlatSquaredLength);
+	const __m256i zero_bytes = _mm256_setzero_si256();
+	const __m256i corner_bytes = _mm256_set1_epi32(0xffff);
+	const size_t texel_size = encoding == GradientEncoding::kRgba8 ? 4 : 2;
+	uint32_t x = 0;
+	for (; x + 8 <= width; x += 8) {
+		const __m256 gx = _mm256_mul_ps(_mm256_sub_ps(
+			_mm256_loadu_ps(rows[0] + x + 1), _mm256_loadu_ps(rows[0] + x - 1)),
+			scales);
+		__m256 g[2];
+		for (int axis = 1; axis < 3; ++axis) {
+			const float* row = rows[axis] + x;
+			g[axis - 1] = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(smoothing0, _mm256_loadu_ps(row - 1)),
+				_mm256_mul_ps(smoothing1, _mm256_loadu_ps(row))),
+				_mm256_mul_ps(smoothing2, _mm256_loadu_ps(row + 1))), scales);
+		}
+		const __m256 gy = g[0];
+		const __m256 gz = g[1];
+		if (encoding == GradientEncoding::kRgba8) {
+			const __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(gx, gx), _mm256_mul_ps(gy, gy)),
+				_mm256_mul_ps(gz, gz)));
+			const __m256 inverse = _mm256_and_ps(
+				_mm256_cmp_ps(length, zero, _CMP_GT_OQ),
+				_mm256_div_ps(one, length));
+			const __m256i r = ToBytes8(_mm256_add_ps(
+				_mm256_mul_ps(_mm256_mul_ps(gx, inverse), half), half));
+			const __m256i g8 = ToBytes8(_mm256_add_ps(
+				_mm256_mul_ps(_mm256_mul_ps(gy, inverse), half), half));
+			const __m256i b = ToBytes8(_mm256_add_ps(
+				_mm256_mul_ps(_mm256_mul_ps(gz, inverse), half), half));
+			const __m256i a = ToBytes8(
+				_mm256_div_ps(length, _mm256_set1_ps(kMaxGradientMagnitude)));
+			const __m256i texels = _mm256_or_si256(
+				_mm256_or_si256(r, _mm256_slli_epi32(g8, 8)),
+				_mm256_or_si256(_mm256_slli_epi32(b, 16), _mm256_slli_epi32(a, 24)));
+			_mm256_storeu_si256(
+				reinterpret_cast<__m256i*>(destination + x * texel_size), texels);
+			continue;
+		}
+		const __m256 l1 = _mm256_add_ps(_mm256_add_ps(
+			_mm256_and_ps(gx, abs_mask), _mm256_and_ps(gy, abs_mask)),
+			_mm256_and_ps(gz, abs_mask));
+		const __m256 inverse = _mm256_and_ps(
+			_mm256_cmp_ps(l1, zero, _CMP_GT_OQ), _mm256_div_ps(one, l1));
+		__m256 u = _mm256_mul_ps(gx, inverse);
+		__m256 v = _mm256_mul_ps(gy, inverse);
+		const __m256 folded_u = _mm256_mul_ps(
+			_mm256_sub_ps(one, _mm256_and_ps(v, abs_mask)), SignNotZero8(u));
+		const __m256 folded_v = _mm256_mul_ps(
+			_mm256_sub_ps(one, _mm256_and_ps(u, abs_mask)), SignNotZero8(v));
+		const __m256 lower = _mm256_cmp_ps(gz, zero, _CMP_LT_OQ);
+		u = _mm256_blendv_ps(u, folded_u, lower);
+		v = _mm256_blendv_ps(v, folded_v, lower);
+		__m256i texels = _mm256_or_si256(
+			ToBytes8(_mm256_add_ps(_mm256_mul_ps(u, half), half)),
+			_mm256_slli_epi32(
+				ToBytes8(_mm256_add_ps(_mm256_mul_ps(v, half), half)), 8));
+		const __m256i corner = _mm256_cmpeq_epi32(texels, zero_bytes);
+		texels = _mm256_or_si256(texels, _mm256_and_si256(corner, corner_bytes));
+		const __m256 squared_length = _mm256_add_ps(_mm256_add_ps(
+			_mm256_mul_ps(gx, gx), _mm256_mul_ps(gy, gy)), _mm256_mul_ps(gz, gz));
+		const __m256 flat = _mm256_cmp_ps(squared_length, flat_squared_length,
+			_CMP_LT_OQ);
+		texels = _mm256_andnot_si256(_mm256_castps_si256(flat), texels);
+		_mm_storeu_si128(
+			reinterpret_cast<__m128i*>(destination + x * texel_size),
+			_mm_packus_epi32(_mm256_castsi256_si128(texels),
+				_mm256_extracti128_si256(texels, 1)));
+	}
+	const float* const tail_rows[3] = {rows[0] + x, rows[1] + x, rows[2] + x};
+	EncodeRowScalar(encoding, smoothing, scale, tail_rows,
+		destination + x * texel_size, width - x);
+}
+
+#endif  // VOXEL_X86
+
+template <typename T>
+void ComputeGradients(const uint8_t* texel_bytes, float value_scale,
+	GradientVolume* gradients) {
+	const T* texels = reinterpret_cast<const T*>(texel_bytes);
+	const uint32_t* dims = gradients->dims;
+	const float* smoothing = gradients->filter == GradientFilter::kSobel ?
+		kSobelWeights : kCentralWeights;
+	// The differences span 2 voxels and the smoothing weights of the two
+	// other axes add up to |weight_sum| each.
+	const float weight_sum = smoothing[0] + smoothing[1] + smoothing[2];
+	const float scale = value_scale / (2.0f * weight_sum * weight_sum);
+	const size_t texel_size =
+		gradients->encoding == GradientEncoding::kRgba8 ? 4 : 2;
+	const CpuFeatures& features = GetCpuFeatures();
+	const bool use_avx2 = features.avx2 && features.f16c;
+
+	const uint32_t width = dims[0];
+	const size_t rows = static_cast<size_t>(dims[1]) * dims[2];
+	const size_t grain = std::max<size_t>(16384 / width, 1);
+	ParallelFor(rows, grain, [&](size_t begin, size_t end) {
+		std::vector<float> buffer(3 * (width + 2));
+		float* const sums[3] = {buffer.data() + 1, buffer.data() + width + 3,
+			buffer.data() + 2 * width + 5};
+		for (size_t index = begin; index < end; ++index) {
+			const int y = static_cast<int>(index % dims[1]);
+			const int z = static_cast<int>(index / dims[1]);
+			std::fill(buffer.begin(), buffer.end(), 0.0f);
+			for (int tz = 0; tz < 3; ++tz) {
+				const int source_z = std::min(std::max(z + tz - 1, 0),
+					static_cast<int>(dims[2]) - 1);
+				for (int ty = 0; ty < 3; ++ty) {
+					const float weights[3] = {smoothing[ty] * smoothing[tz],
+						kDifference[ty] * smoothing[tz], smoothing[ty] * kDifference[tz]};
+					if (weights[0] == 0.0f && weights[1] == 0.0f && weights[2] == 0.0f)
+						continue;
+					const int source_y = std::min(std::max(y + ty - 1, 0),
+						static_cast<int>(dims[1]) - 1);
+					const T* source_row = texels +
+						(static_cast<size_t>(source_z) * dims[1] + source_y) * width;
+#ifdef VOXEL_X86
+					if (use_avx2) {
+						AccumulateRowsAvx2(weights, source_row, sums, width);
+						continue;
+					}
+#endif
+					AccumulateRowsScalar(weights, source_row, sums, width);
+				}
+			}
+			// Clamp to the edge.
+			for (float* row : sums) {
+				row[-1] = row[0];
+				row[width] = row[width - 1];
+			}
+
+			uint8_t* destination =
+				gradients->texels.data() + index * width * texel_size;
+#ifdef VOXEL_X86
+			if (use_avx2) {
+				EncodeRowAvx2(gradients->encoding, smoothing, scale, sums,
+					destination, width);
+				continue;
+			}
+#endif
+			EncodeRowScalar(gradients->encoding, smoothing, scale, sums,
+				destination, width);
+		}
+	});
+	gradients->kernel_name = use_avx2 ? "avx2" : "scalar";
+}
+
+// Computes the gradients of |gradients| one voxel at a time in double
+// precision, straight from the stencil, and packs them with
+// EncodeGradient(). The reference of CheckGradientKernels().
+template <typename T>
+void ComputeReferenceGradients(const uint8_t* texel_bytes, double value_scale,
+	GradientVolume* gradients) {
+	const T* texels = reinterpret_cast<const T*>(texel_bytes);
+	const uint32_t* dims = gradients->dims;
+	const float* smoothing = gradients->filter == GradientFilter::kSobel ?
+		kSobelWeights : kCentralWeights;
+	const double weight_sum = static_cast<double>(smoothing[0]) +
+		smoothing[1] + smoothing[2];
+	const double scale = value_scale / (2.0 * weight_sum * weight_sum);
+	const size_t texel_size =
+		gradients->encoding == GradientEncoding::kRgba8 ? 4 : 2;
+	// Clamped at the faces like GL_CLAMP_TO_EDGE.
+	const auto value = [&](int x, int y, int z) -> double {
+		x = std::min(std::max(x, 0), static_cast<int>(dims[0]) - 1);
+		y = std::min(std::max(y, 0), static_cast<int>(dims[1]) - 1);
+		z = std::min(std::max(z, 0), static_cast<int>(dims[2]) - 1);
+		return LoadScalar(texels +
+			(static_cast<size_t>(z) * dims[1] + y) * dims[0] + x, false);
+	};
+	uint8_t* destination = gradients->texels.data();
+	for (int z = 0; z < static_cast<int>(dims[2]); ++z) {
+		for (int y = 0; y < static_cast<int>(dims[1]); ++y) {
+			for (int x = 0; x < static_cast<int>(dims[0]); ++x) {
+				double g[3] = {0.0, 0.0, 0.0};
+				// |a| and |b| are the taps across the axis of each derivative.
+				for (int a = -1; a <= 1; ++a) {
+					for (int b = -1; b <= 1; ++b) {
+						const double weight =
+							static_cast<double>(smoothing[a + 1]) * smoothing[b + 1];
+						g[0] += weight * (value(x + 1, y + a, z + b) -
+							value(x - 1, y + a, z + b));
+						g[1] += weight * (value(x + a, y + 1, z + b) -
+							value(x + a, y - 1, z + b));
+						g[2] += weight * (value(x + a, y + b, z + 1) -
+							value(x + a, y + b, z - 1));
+					}
+				}
+				for (double& component : g)
+					component *= scale;
+				EncodeGradient(gradients->encoding, g, destination);
+				destination += texel_size;
+			}
+		}
+	}
+}
+
+}  // namespace
+
+const char* GradientFilterName(GradientFilter filter) {
+	switch (filter) {
+	case GradientFilter::kCentralDifference:
+		return "central";
+	case GradientFilter::kSobel:
+		return "sobel";
+	}
+	return "unknown";
+}
+
+const char* GradientEncodingName(GradientEncoding encoding) {
+	switch (encoding) {
+	case GradientEncoding::kRgba8:
+		return "rgba8";
+	case GradientEncoding::kOctahedral:
+		return "octahedral";
+	}
+	return "unknown";
+}
+
+bool ParseGradientFilter(const char* name, GradientFilter* filter) {
+	for (GradientFilter candidate :
+		{GradientFilter::kCentralDifference, GradientFilter::kSobel}) {
+		if (std::strcmp(name, GradientFilterName(candidate)) == 0) {
+			*filter = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ParseGradientEncoding(const char* name, GradientEncoding* encoding) {
+	for (GradientEncoding candidate :
+		{GradientEncoding::kRgba8, GradientEncoding::kOctahedral}) {
+		if (std::strcmp(name, GradientEncodingName(candidate)) == 0) {
+			*encoding = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool GradientVolume::CreateGradientVolume(GradientVolume* gradients,
+	const uint8_t* texels, const uint32_t dims[3], TextureFormat format,
+	GradientFilter filter, GradientEncoding encoding) {
+	const ProfileScope scope("GradientVolume::CreateGradientVolume");
+	const auto start = std::chrono::steady_clock::now();
+	std::memcpy(gradients->dims, dims, sizeof(gradients->dims));
+	gradients->filter = filter;
+	gradients->encoding = encoding;
+	const size_t texel_size = encoding == GradientEncoding::kRgba8 ? 4 : 2;
+	gradients->texels.resize(
+		static_cast<size_t>(dims[0]) * dims[1] * dims[2] * texel_size);
+
+	const float value_scale = TextureFormatScale(format);
+	switch (format) {
+	case TextureFormat::kR8:
+		ComputeGradients<uint8_t>(texels, value_scale, gradients);
+		break;
+	case TextureFormat::kR16:
+		ComputeGradients<uint16_t>(texels, value_scale, gradients);
+		break;
+	case TextureFormat::kR16F:
+		ComputeGradients<Half>(texels, value_scale, gradients);
+		break;
+	case TextureFormat::kR32F:
+		ComputeGradients<float>(texels, value_scale, gradients);
+		break;
+	}
+
+	const std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+	gradients->build_seconds = elapsed.count();
+	return true;
+}
+
+bool CheckGradientKernels(const uint8_t* texels, const uint32_t dims[3],
+	TextureFormat format) {
+	const CpuFeatures enabled = GetCpuFeatures();
+	const double value_scale = TextureFormatScale(format);
+	bool passed = true;
+	for (GradientFilter filter :
+		{GradientFilter::kCentralDifference, GradientFilter::kSobel}) {
+		for (GradientEncoding encoding :
+			{GradientEncoding::kRgba8, GradientEncoding::kOctahedral}) {
+			GradientVolume widest;
+			GradientVolume scalar;
+			GradientVolume::CreateGradientVolume(
+				&widest, texels, dims, format, filter, encoding);
+			LimitCpuFeatures(CpuFeatures());
+			GradientVolume::CreateGradientVolume(
+				&scalar, texels, dims, format, filter, encoding);
+			LimitCpuFeatures(enabled);
+
+			GradientVolume reference;
+			std::memcpy(reference.dims, dims, sizeof(reference.dims));
+			reference.filter = filter;
+			reference.encoding = encoding;
+			reference.texels.resize(widest.texels.size());
+			switch (format) {
+			case TextureFormat::kR8:
+				ComputeReferenceGradients<uint8_t>(texels, value_scale, &reference);
+				break;
+			case TextureFormat::kR16:
+				ComputeReferenceGradients<uint16_t>(texels, value_scale, &reference);
+				break;
+			case TextureFormat::kR16F:
+				ComputeReferenceGradients<Half>(texels, value_scale, &reference);
+				break;
+			case TextureFormat::kR32F:
+				ComputeReferenceGradients<float>(texels, value_scale, &reference);
+				break;
+			}
+
+			size_t kernel_mismatches = 0;
+			int reference_error = 0;
+			for (size_t i = 0; i < widest.texels.size(); ++i) {
+				if (widest.texels[i] != scalar.texels[i])
+					++kernel_mismatches;
+				reference_error = std::max(reference_error,
+					std::abs(widest.texels[i] - reference.texels[i]));
+			}
+			// Floats round differently from doubles, by one code at most.
+			const bool kernel_passed =
+				kernel_mismatches == 0 && reference_error <= 1;
+			std::cout << "Gradients (" << GradientFilterName(filter) << ", "
+				<< GradientEncodingName(encoding) << "): " << widest.kernel_name
+				<< " and " << scalar.kernel_name << " kernels "
+				<< (kernel_mismatches == 0 ? "match bit for bit" : "differ in " +
+					std::to_string(kernel_mismatches) + " bytes")
+				<< ", up to " << reference_error
+				<< " codes from the double precision reference "
+				<< (kernel_passed ? "pass" : "FAIL") << "\n";
+			passed = passed && kernel_passed;
+		}
+	}
+	return passed;
+}
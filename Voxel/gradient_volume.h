@@ -0,0 +1,93 @@
+#ifndef VOXEL_GRADIENT_VOLUME
+#define VOXEL_GRADIENT_VOLUME
+
+#include <cstdint>
+#include <vector>
+
+#include "gl_utils.h"
+#include "voxel_convert.h"
+
+// Stencil the gradients of the volume are estimated with.
+enum class GradientFilter {
+	// Difference of the two neighbours along each axis, 6 voxels.
+	kCentralDifference,
+	// The central difference smoothed with 1-2-1 weights along the two
+	// other axes, the 3x3x3 neighbourhood. Less noisy on scanned data.
+	kSobel,
+};
+
+// How the gradients are packed into texels.
+enum class GradientEncoding {
+	// The unit normal in rgb, mapped from [-1, 1] to [0, 1], and the
+	// magnitude of the gradient in a. 4 bytes per voxel.
+	kRgba8,
+	// The unit normal projected on an octahedron unfolded into the square,
+	// 2 bytes per voxel. There is no room for the magnitude: gradients under
+	// half of kFlatGradientMagnitude are stored as (0, 0), a corner of the
+	// square that the normals facing -z otherwise take at (255, 255), and
+	// the packed coordinates can't be filtered.
+	kOctahedral,
+};
+
+// Returns the names used for |filter| and |encoding| on the command line
+// ("sobel", "octahedral", ...).
+const char* GradientFilterName(GradientFilter filter);
+const char* GradientEncodingName(GradientEncoding encoding);
+
+// Parse names returned by the functions above.
+bool ParseGradientFilter(const char* name, GradientFilter* filter);
+bool ParseGradientEncoding(const char* name, GradientEncoding* encoding);
+
+// Gradients over 1 value of the normalized range per voxel are stored as 1
+// in the magnitude of kRgba8.
+const float kMaxGradientMagnitude = 1.0f;
+
+// Gradients weaker than this, mostly noise, are shaded less and less, the
+// uFlatGradient of the shader.
+const float kFlatGradientMagnitude = 0.02f;
+
+// The normals of a volume, precomputed so that shading a sample costs one
+// texture fetch instead of the six of central differences in the shader.
+class GradientVolume {
+  public:
+	// Estimates the gradients of |texels|, a linear x-fastest volume of size
+	// |dims| in |format| as returned by GetLinearTexels(), and packs them
+	// with |encoding|. Gradients are in normalized values per voxel, the way
+	// the shader sees the volume, and the volume is clamped at its faces like
+	// GL_CLAMP_TO_EDGE. Runs on all the threads of ParallelFor() with the
+	// widest SIMD kernel the CPU supports.
+	static bool CreateGradientVolume(GradientVolume* gradients,
+		const uint8_t* texels, const uint32_t dims[3], TextureFormat format,
+		GradientFilter filter, GradientEncoding encoding);
+
+	// Uploads the gradients to |texture_id| as a GL_RGBA8 3D texture with
+	// linear filtering, or as a GL_RG8 one read from the nearest voxel.
+	// Defined in gradient_volume_gl.cpp, for the tools that only compute
+	// gradients to link without GL.
+	static bool UploadGradientVolume(const GradientVolume& gradients,
+		GLuint texture_id);
+
+	// Size in bytes of the packed gradients, what the texture adds.
+	size_t SizeInBytes() const {
+		return texels.size();
+	}
+
+	uint32_t dims[3] = {0, 0, 0};
+	GradientFilter filter = GradientFilter::kCentralDifference;
+	GradientEncoding encoding = GradientEncoding::kRgba8;
+	// Packed gradients, x fastest.
+	std::vector<uint8_t> texels;
+	// Name of the kernel that computed them ("avx2", "scalar").
+	const char* kernel_name = "";
+	double build_seconds = 0.0;
+};
+
+// Builds the gradients of |texels|, laid out like for CreateGradientVolume(),
+// with every filter and encoding, with the widest kernel the CPU supports
+// and with the scalar one, and prints whether they match bit for bit and
+// stay within one code of a double precision reference. Returns false if
+// they don't.
+bool CheckGradientKernels(const uint8_t* texels, const uint32_t dims[3],
+	TextureFormat format);
+
+#endif  // VOXEL_GRADIENT_VOLUME
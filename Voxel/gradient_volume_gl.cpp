@@ -0,0 +1,29 @@
+#include "gradient_volume.h"
+
+#include "profiler.h"
+
+bool GradientVolume::UploadGradientVolume(const GradientVolume& gradients,
+	GLuint texture_id) {
+	const ProfileScope scope("GradientVolume::UploadGradientVolume");
+	const bool rgba = gradients.encoding == GradientEncoding::kRgba8;
+	// Blending octahedral coordinates across a fold, or between the opposite
+	// gradients on both sides of a thin layer, gives normals that point
+	// nowhere near either. Normals in rgb blend through shorter vectors that
+	// still point the right way once normalized.
+	const GLint filter = rgba ? GL_LINEAR : GL_NEAREST;
+	GLint previous_texture;
+	glGetIntegerv(GL_TEXTURE_BINDING_3D, &previous_texture);
+	glBindTexture(GL_TEXTURE_3D, texture_id);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage3D(GL_TEXTURE_3D, 0, rgba ? GL_RGBA8 : GL_RG8, gradients.dims[0],
+		gradients.dims[1], gradients.dims[2], 0, rgba ? GL_RGBA : GL_RG,
+		GL_UNSIGNED_BYTE, gradients.texels.data());
+	glBindTexture(GL_TEXTURE_3D, previous_texture);
+	return CheckGlError();
+}
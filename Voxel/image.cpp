@@ -0,0 +1,394 @@
+#include "image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+
+namespace {
+
+// glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) of row |y| of |image|
+// over a white clear color, into |row| as RGB8.
+void BlendRowOverWhite(const Image& image, int y, uint8_t* row) {
+	const uint8_t* pixel =
+		image.rgba.data() + static_cast<size_t>(y) * image.width * 4;
+	for (int x = 0; x < image.width; ++x, pixel += 4) {
+		const int alpha = pixel[3];
+		for (int c = 0; c < 3; ++c) {
+			row[x * 3 + c] = static_cast<uint8_t>(
+				(pixel[c] * alpha + 255 * (255 - alpha) + 127) / 255);
+		}
+	}
+}
+
+bool EndsWith(const char* text, const char* suffix) {
+	const size_t text_length = std::strlen(text);
+	const size_t suffix_length = std::strlen(suffix);
+	return text_length >= suffix_length &&
+		std::strcmp(text + text_length - suffix_length, suffix) == 0;
+}
+
+// Writes bits least significant first, the order of deflate streams.
+class BitWriter {
+  public:
+	explicit BitWriter(std::vector<uint8_t>* output) : output_(output) {}
+
+	void Write(uint32_t bits, int count) {
+		buffer_ |= static_cast<uint64_t>(bits) << count_;
+		count_ += count;
+		while (count_ >= 8) {
+			output_->push_back(static_cast<uint8_t>(buffer_));
+			buffer_ >>= 8;
+			count_ -= 8;
+		}
+	}
+
+	// Huffman codes are defined most significant bit first.
+	void WriteCode(uint32_t code, int length) {
+		uint32_t reversed = 0;
+		for (int i = 0; i < length; ++i)
+			reversed |= ((code >> i) & 1) << (length - 1 - i);
+		Write(reversed, length);
+	}
+
+	void Flush() {
+		if (count_ > 0)
+			Write(0, 8 - count_);
+	}
+
+  private:
+	std::vector<uint8_t>* output_;
+	uint64_t buffer_ = 0;
+	int count_ = 0;
+};
+
+const uint16_t kLengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19,
+	23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+	2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t kDistanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49,
+	65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577};
+const uint8_t kDistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5,
+	6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+const int kWindowSize = 32768;
+const int kMinMatch = 3;
+const int kMaxMatch = 258;
+const int kHashBits = 15;
+
+// Symbol of the literal/length alphabet with the fixed codes of RFC 1951.
+void WriteFixedSymbol(BitWriter* bits, int symbol) {
+	if (symbol < 144)
+		bits->WriteCode(0x30 + symbol, 8);
+	else if (symbol < 256)
+		bits->WriteCode(0x190 + symbol - 144, 9);
+	else if (symbol < 280)
+		bits->WriteCode(symbol - 256, 7);
+	else
+		bits->WriteCode(0xc0 + symbol - 280, 8);
+}
+
+void WriteMatch(BitWriter* bits, int length, int distance) {
+	int code = 28;
+	while (kLengthBase[code] > length)
+		--code;
+	WriteFixedSymbol(bits, 257 + code);
+	bits->Write(length - kLengthBase[code], kLengthExtra[code]);
+	code = 29;
+	while (kDistanceBase[code] > distance)
+		--code;
+	bits->WriteCode(code, 5);
+	bits->Write(distance - kDistanceBase[code], kDistanceExtra[code]);
+}
+
+// Compresses |data| into a zlib stream of a single deflate block with the
+// fixed Huffman codes. Matches are found greedily from the last position
+// of each 3 byte hash, which is fast and enough for the large flat regions
+// of rendered frames.
+void Deflate(const std::vector<uint8_t>& data, std::vector<uint8_t>* output) {
+	// 32K window, no dictionary, fastest compression level.
+	output->push_back(0x78);
+	output->push_back(0x01);
+	BitWriter bits(output);
+	// Final block with fixed codes.
+	bits.Write(1, 1);
+	bits.Write(1, 2);
+
+	std::vector<int> last_position(1 << kHashBits, -kWindowSize);
+	const int size = static_cast<int>(data.size());
+	int position = 0;
+	while (position < size) {
+		int length = 0;
+		int distance = 0;
+		if (position + kMinMatch <= size) {
+			const uint32_t hash = ((data[position] << 16) |
+				(data[position + 1] << 8) | data[position + 2]) * 2654435761u >>
+				(32 - kHashBits);
+			const int candidate = last_position[hash];
+			last_position[hash] = position;
+			if (position - candidate <= kWindowSize - 1) {
+				const int limit = std::min(kMaxMatch, size - position);
+				while (length < limit &&
+					data[candidate + length] == data[position + length]) {
+					++length;
+				}
+				distance = position - candidate;
+			}
+		}
+		if (length >= kMinMatch) {
+			WriteMatch(&bits, length, distance);
+			position += length;
+		} else {
+			WriteFixedSymbol(&bits, data[position]);
+			++position;
+		}
+	}
+	WriteFixedSymbol(&bits, 256);
+	bits.Flush();
+
+	uint32_t a = 1;
+	uint32_t b = 0;
+	for (uint8_t byte : data) {
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	const uint32_t adler = (b << 16) | a;
+	for (int shift = 24; shift >= 0; shift -= 8)
+		output->push_back(static_cast<uint8_t>(adler >> shift));
+}
+
+uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc) {
+	static uint32_t table[256] = {};
+	if (table[1] == 0) {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t value = i;
+			for (int k = 0; k < 8; ++k)
+				value = value & 1 ? 0xedb88320u ^ (value >> 1) : value >> 1;
+			table[i] = value;
+		}
+	}
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i)
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+void WriteBigEndian(std::ofstream* file, uint32_t value) {
+	const uint8_t bytes[4] = {static_cast<uint8_t>(value >> 24),
+		static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 8),
+		static_cast<uint8_t>(value)};
+	file->write(reinterpret_cast<const char*>(bytes), 4);
+}
+
+void WriteChunk(std::ofstream* file, const char type[4],
+	const std::vector<uint8_t>& data) {
+	WriteBigEndian(file, static_cast<uint32_t>(data.size()));
+	file->write(type, 4);
+	file->write(reinterpret_cast<const char*>(data.data()), data.size());
+	const uint32_t crc = Crc32(data.data(), data.size(),
+		Crc32(reinterpret_cast<const uint8_t*>(type), 4, 0));
+	WriteBigEndian(file, crc);
+}
+
+// Returns the luma of |image| blended over white, one float per pixel.
+std::vector<float> BlendedLuma(const Image& image) {
+	std::vector<float> luma(static_cast<size_t>(image.width) * image.height);
+	std::vector<uint8_t> row(static_cast<size_t>(image.width) * 3);
+	for (int y = 0; y < image.height; ++y) {
+		BlendRowOverWhite(image, y, row.data());
+		for (int x = 0; x < image.width; ++x) {
+			luma[static_cast<size_t>(y) * image.width + x] = 0.299f * row[x * 3] +
+				0.587f * row[x * 3 + 1] + 0.114f * row[x * 3 + 2];
+		}
+	}
+	return luma;
+}
+
+}  // namespace
+
+void ResizeImage(Image* image, int width, int height) {
+	image->width = width;
+	image->height = height;
+	image->rgba.assign(static_cast<size_t>(width) * height * 4, 0);
+}
+
+bool WritePpm(const char* path, const Image& image) {
+	std::ofstream file(path, std::ofstream::out | std::ofstream::binary);
+	if (!file) {
+		std::cout << "Failed to create image file: " << path << "\n";
+		return false;
+	}
+	file << "P6\n" << image.width << " " << image.height << "\n255\n";
+
+	std::vector<uint8_t> row(static_cast<size_t>(image.width) * 3);
+	for (int y = 0; y < image.height; ++y) {
+		BlendRowOverWhite(image, y, row.data());
+		file.write(reinterpret_cast<const char*>(row.data()), row.size());
+	}
+	if (!file) {
+		std::cout << "Failed to write image file: " << path << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool WritePng(const char* path, const Image& image) {
+	std::ofstream file(path, std::ofstream::out | std::ofstream::binary);
+	if (!file) {
+		std::cout << "Failed to create image file: " << path << "\n";
+		return false;
+	}
+	const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+	// 8-bit RGB, deflate, adaptive filtering, not interlaced.
+	std::vector<uint8_t> header(13, 0);
+	for (int i = 0; i < 4; ++i) {
+		header[i] = static_cast<uint8_t>(image.width >> (24 - 8 * i));
+		header[4 + i] = static_cast<uint8_t>(image.height >> (24 - 8 * i));
+	}
+	header[8] = 8;
+	header[9] = 2;
+	WriteChunk(&file, "IHDR", header);
+
+	// Every row starts with its filter type, none.
+	const size_t row_size = static_cast<size_t>(image.width) * 3;
+	std::vector<uint8_t> scanlines((row_size + 1) * image.height);
+	for (int y = 0; y < image.height; ++y) {
+		uint8_t* scanline = &scanlines[(row_size + 1) * y];
+		scanline[0] = 0;
+		BlendRowOverWhite(image, y, scanline + 1);
+	}
+	std::vector<uint8_t> compressed;
+	Deflate(scanlines, &compressed);
+	WriteChunk(&file, "IDAT", compressed);
+	WriteChunk(&file, "IEND", std::vector<uint8_t>());
+	if (!file) {
+		std::cout << "Failed to write image file: " << path << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool WriteImage(const char* path, const Image& image) {
+	if (EndsWith(path, ".png"))
+		return WritePng(path, image);
+	if (EndsWith(path, ".ppm"))
+		return WritePpm(path, image);
+	std::cout << "Images can only be written as .png or .ppm: " << path << "\n";
+	return false;
+}
+
+bool ReadPpm(const char* path, Image* image) {
+	std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
+	if (!file) {
+		std::cout << "Failed to open image file: " << path << "\n";
+		return false;
+	}
+	std::string magic;
+	int width = 0;
+	int height = 0;
+	int max_value = 0;
+	file >> magic >> width >> height >> max_value;
+	// A single whitespace separates the header from the pixels.
+	file.get();
+	if (!file || magic != "P6" || width <= 0 || height <= 0 ||
+		max_value != 255) {
+		std::cout << "Not an 8-bit binary PPM: " << path << "\n";
+		return false;
+	}
+
+	ResizeImage(image, width, height);
+	std::vector<uint8_t> row(static_cast<size_t>(width) * 3);
+	for (int y = 0; y < height; ++y) {
+		file.read(reinterpret_cast<char*>(row.data()), row.size());
+		uint8_t* pixel = image->rgba.data() + static_cast<size_t>(y) * width * 4;
+		for (int x = 0; x < width; ++x, pixel += 4) {
+			std::copy(&row[x * 3], &row[x * 3] + 3, pixel);
+			pixel[3] = 255;
+		}
+	}
+	if (!file) {
+		std::cout << "Failed to read image file: " << path << "\n";
+		return false;
+	}
+	return true;
+}
+
+ImageDifference CompareImages(const Image& image, const Image& reference) {
+	ImageDifference difference;
+	const size_t row_size = static_cast<size_t>(image.width) * 3;
+	std::vector<uint8_t> row(row_size);
+	std::vector<uint8_t> reference_row(row_size);
+	double absolute_error = 0.0;
+	double squared_error = 0.0;
+	size_t outliers = 0;
+	for (int y = 0; y < image.height; ++y) {
+		BlendRowOverWhite(image, y, row.data());
+		BlendRowOverWhite(reference, y, reference_row.data());
+		for (size_t i = 0; i < row_size; i += 3) {
+			bool outlier = false;
+			for (size_t c = i; c < i + 3; ++c) {
+				const double error = static_cast<double>(row[c]) - reference_row[c];
+				absolute_error += std::abs(error);
+				squared_error += error * error;
+				outlier = outlier || std::abs(error) > kOutlierError;
+			}
+			outliers += outlier ? 1 : 0;
+		}
+	}
+	const double channel_count = row_size * static_cast<double>(image.height);
+	difference.mean_error = absolute_error / channel_count;
+	difference.outlier_fraction = outliers * 3.0 / channel_count;
+	const double mean_squared_error = squared_error / channel_count;
+	difference.psnr = mean_squared_error == 0.0 ?
+		std::numeric_limits<double>::infinity() :
+		10.0 * std::log10(255.0 * 255.0 / mean_squared_error);
+
+	// The constants of Wang et al. for 8-bit values.
+	const double c1 = (0.01 * 255.0) * (0.01 * 255.0);
+	const double c2 = (0.03 * 255.0) * (0.03 * 255.0);
+	const int window = 8;
+	const int stride = 4;
+	const std::vector<float> luma = BlendedLuma(image);
+	const std::vector<float> reference_luma = BlendedLuma(reference);
+	double ssim_sum = 0.0;
+	int window_count = 0;
+	for (int y0 = 0; y0 + window <= image.height; y0 += stride) {
+		for (int x0 = 0; x0 + window <= image.width; x0 += stride) {
+			double sum = 0.0, reference_sum = 0.0;
+			double square_sum = 0.0, reference_square_sum = 0.0;
+			double product_sum = 0.0;
+			for (int y = y0; y < y0 + window; ++y) {
+				for (int x = x0; x < x0 + window; ++x) {
+					const size_t i = static_cast<size_t>(y) * image.width + x;
+					const double value = luma[i];
+					const double reference_value = reference_luma[i];
+					sum += value;
+					reference_sum += reference_value;
+					square_sum += value * value;
+					reference_square_sum += reference_value * reference_value;
+					product_sum += value * reference_value;
+				}
+			}
+			const double count = window * window;
+			const double mean = sum / count;
+			const double reference_mean = reference_sum / count;
+			const double variance = square_sum / count - mean * mean;
+			const double reference_variance =
+				reference_square_sum / count - reference_mean * reference_mean;
+			const double covariance = product_sum / count - mean * reference_mean;
+			ssim_sum += (2.0 * mean * reference_mean + c1) *
+				(2.0 * covariance + c2) /
+				((mean * mean + reference_mean * reference_mean + c1) *
+				(variance + reference_variance + c2));
+			++window_count;
+		}
+	}
+	difference.ssim = window_count > 0 ? ssim_sum / window_count : 1.0;
+	return difference;
+}
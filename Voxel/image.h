@@ -0,0 +1,55 @@
+#ifndef VOXEL_IMAGE
+#define VOXEL_IMAGE
+
+#include <cstdint>
+#include <vector>
+
+// An RGBA8 image rendered off screen. Rows are stored top to bottom and the
+// colors are the output of the ray marcher, premultiplied, before blending.
+struct Image {
+	int width = 0;
+	int height = 0;
+	std::vector<uint8_t> rgba;
+};
+
+// Resizes |image| to |width| by |height| transparent pixels.
+void ResizeImage(Image* image, int width, int height);
+
+// Writes |image| as a binary PPM at |path|, blended over the white
+// background the same way the window blends the second pass.
+bool WritePpm(const char* path, const Image& image);
+
+// Writes |image| blended the same way as an RGB PNG at |path|, compressed
+// for speed rather than size.
+bool WritePng(const char* path, const Image& image);
+
+// Writes |image| with WritePng() or WritePpm() depending on the extension
+// of |path|, ".png" or ".ppm".
+bool WriteImage(const char* path, const Image& image);
+
+// Reads the binary PPM at |path|, as written by WritePpm(), into |image| as
+// opaque pixels.
+bool ReadPpm(const char* path, Image* image);
+
+// Difference of a channel, out of 255, past which a pixel is an outlier.
+const int kOutlierError = 16;
+
+// How close an image is to a reference, both blended over white the way
+// WritePpm() blends them.
+struct ImageDifference {
+	// Peak signal to noise ratio of the RGB channels in dB, infinite when
+	// the images are identical.
+	double psnr = 0.0;
+	// Mean absolute difference of the RGB channels, out of 255.
+	double mean_error = 0.0;
+	// Fraction of the pixels with a channel more than kOutlierError away.
+	double outlier_fraction = 0.0;
+	// Structural similarity of the luma, averaged over 8x8 windows 4 pixels
+	// apart, 1 when the images are identical.
+	double ssim = 0.0;
+};
+
+// Compares |image| to |reference|, which must have the same size.
+ImageDifference CompareImages(const Image& image, const Image& reference);
+
+#endif  // VOXEL_IMAGE
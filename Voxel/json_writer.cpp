@@ -0,0 +1,18 @@
+#include "json_writer.h"
+
+void WriteJsonString(std::ostream& out, const std::string& text) {
+	static const char kHexDigits[] = "0123456789abcdef";
+	out << '"';
+	for (char c : text) {
+		const unsigned char byte = static_cast<unsigned char>(c);
+		if (c == '"' || c == '\\') {
+			out << '\\' << c;
+		} else if (byte < 0x20) {
+			// Control characters can't appear as they are.
+			out << "\\u00" << kHexDigits[byte >> 4] << kHexDigits[byte & 0xf];
+		} else {
+			out << c;
+		}
+	}
+	out << '"';
+}
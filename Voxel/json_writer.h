@@ -0,0 +1,11 @@
+#ifndef VOXEL_JSON_WRITER
+#define VOXEL_JSON_WRITER
+
+#include <ostream>
+#include <string>
+
+// Writes |text| to |out| as a JSON string, quoted and escaped, for the
+// reports of the benchmarks and the traces of the profiler.
+void WriteJsonString(std::ostream& out, const std::string& text);
+
+#endif  // VOXEL_JSON_WRITER
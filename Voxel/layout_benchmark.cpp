@@ -0,0 +1,233 @@
+#include "layout_benchmark.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "parallel.h"
+#include "voxel_store.h"
+
+namespace {
+
+// Rays along each side of the grid.
+const int kRayGrid = 256;
+// Rows of rays replayed through the cache model.
+const int kCacheRows = 16;
+// Samples per voxel along the rays.
+const float kSamplesPerVoxel = 2.0f;
+
+struct ViewDirection {
+	const char* name;
+	glm::vec3 direction;
+};
+
+const ViewDirection kViewDirections[] = {
+	{"+x", glm::vec3(1.0f, 0.0f, 0.0f)},
+	{"+y", glm::vec3(0.0f, 1.0f, 0.0f)},
+	{"+z", glm::vec3(0.0f, 0.0f, 1.0f)},
+	{"diagonal", glm::vec3(1.0f, 1.0f, 1.0f)},
+	{"oblique", glm::vec3(0.3f, 0.8f, 0.5f)},
+};
+
+// A set associative cache with LRU replacement that counts its misses.
+class CacheModel {
+  public:
+	static const size_t kLineSize = 64;
+	static const size_t kWays = 8;
+	static const size_t kSets = 256 * 1024 / kLineSize / kWays;
+
+	CacheModel() : tags(kSets * kWays, ~uint64_t{0}), ages(kSets * kWays, 0) {}
+
+	void Access(size_t address) {
+		const uint64_t line = address / kLineSize;
+		const size_t set = static_cast<size_t>(line % kSets) * kWays;
+		++clock;
+		size_t oldest = set;
+		for (size_t way = set; way < set + kWays; ++way) {
+			if (tags[way] == line) {
+				ages[way] = clock;
+				return;
+			}
+			if (ages[way] < ages[oldest])
+				oldest = way;
+		}
+		++misses;
+		tags[oldest] = line;
+		ages[oldest] = clock;
+	}
+
+	size_t misses = 0;
+
+  private:
+	std::vector<uint64_t> tags;
+	std::vector<uint64_t> ages;
+	uint64_t clock = 0;
+};
+
+// Wraps |Address| to replay the bytes of every texel it addresses through
+// a CacheModel.
+template <typename Address>
+struct CountingAddress {
+	size_t Offset(uint32_t x, uint32_t y, uint32_t z) const {
+		const size_t offset = address.Offset(x, y, z);
+		cache->Access(offset * texel_size);
+		return offset;
+	}
+
+	Address address;
+	size_t texel_size;
+	CacheModel* cache;
+};
+
+// A square grid of parallel rays that covers the unit cube seen from
+// |direction|.
+struct RayGrid {
+	explicit RayGrid(const glm::vec3& view_direction) {
+		direction = glm::normalize(view_direction);
+		const glm::vec3 up = std::abs(direction.y) < 0.9f ?
+			glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+		const float extent = std::sqrt(3.0f);
+		u = glm::normalize(glm::cross(up, direction)) * extent;
+		v = glm::cross(direction, glm::normalize(u)) * extent;
+		corner = glm::vec3(0.5f) - direction * extent - (u + v) * 0.5f;
+	}
+
+	// Returns the origin of the ray |i|, |j| of the grid.
+	glm::vec3 Origin(int i, int j) const {
+		return corner + u * ((i + 0.5f) / kRayGrid) +
+			v * ((j + 0.5f) / kRayGrid);
+	}
+
+	glm::vec3 direction;
+	glm::vec3 corner;
+	glm::vec3 u;
+	glm::vec3 v;
+};
+
+// Marches the rays of row |j| of |grid| through the volume and returns the
+// number of samples taken. Adds the samples to |sum| so they aren't
+// optimized away.
+template <typename T, typename Address>
+size_t MarchRow(const Address& address, const T* texels,
+	const uint32_t dims[3], const RayGrid& grid, int j, float* sum) {
+	const float step_size = 1.0f /
+		(kSamplesPerVoxel * std::max(std::max(dims[0], dims[1]), dims[2]));
+	size_t sample_count = 0;
+	for (int i = 0; i < kRayGrid; ++i) {
+		const glm::vec3 origin = grid.Origin(i, j);
+		float t_near = 0.0f;
+		float t_far = 1e30f;
+		for (int axis = 0; axis < 3; ++axis) {
+			const float inverse = 1.0f / grid.direction[axis];
+			const float t0 = -origin[axis] * inverse;
+			const float t1 = (1.0f - origin[axis]) * inverse;
+			t_near = std::max(t_near, std::min(t0, t1));
+			t_far = std::min(t_far, std::max(t0, t1));
+		}
+		for (float t = t_near; t < t_far; t += step_size) {
+			const glm::vec3 position = origin + grid.direction * t;
+			*sum += SampleTrilinear(address, texels, dims, &position[0]);
+			++sample_count;
+		}
+	}
+	return sample_count;
+}
+
+template <typename T>
+void BenchmarkStore(const VoxelStore& store) {
+	const T* texels = reinterpret_cast<const T*>(store.texels.data());
+	VoxelStore::VisitAddress(store, [&](const auto& address) {
+		typedef typename std::decay<decltype(address)>::type Address;
+		for (const ViewDirection& view : kViewDirections) {
+			const RayGrid grid(view.direction);
+
+			// Throughput on all the threads, best of 3 to skip warming up.
+			double best_seconds = 1e30;
+			std::atomic<size_t> sample_count{0};
+			// Where the rows leave their sums so the samples aren't optimized
+			// away.
+			std::vector<float> row_sums(kRayGrid);
+			for (int run = 0; run < 3; ++run) {
+				sample_count = 0;
+				const auto start = std::chrono::steady_clock::now();
+				ParallelFor(kRayGrid, 4, [&](size_t begin, size_t end) {
+					size_t samples = 0;
+					for (size_t j = begin; j < end; ++j) {
+						samples += MarchRow(address, texels, store.dims, grid,
+							static_cast<int>(j), &row_sums[j]);
+					}
+					sample_count += samples;
+				});
+				const std::chrono::duration<double> elapsed =
+					std::chrono::steady_clock::now() - start;
+				best_seconds = std::min(best_seconds, elapsed.count());
+			}
+
+			// Misses of one thread marching a band through the middle of the
+			// grid, in the same order.
+			CacheModel cache;
+			const CountingAddress<Address> counting_address = {
+				address, TextureFormatSize(store.format), &cache};
+			size_t counted_samples = 0;
+			float sum = 0.0f;
+			for (int j = (kRayGrid - kCacheRows) / 2;
+				j < (kRayGrid + kCacheRows) / 2; ++j) {
+				counted_samples += MarchRow(counting_address, texels, store.dims,
+					grid, j, &sum);
+			}
+
+			std::cout << std::left << std::setw(9) << VoxelLayoutName(store.layout)
+				<< std::setw(10) << view.name << std::right << std::fixed
+				<< std::setprecision(1) << std::setw(12)
+				<< sample_count / best_seconds / 1e6 << std::setprecision(2)
+				<< std::setw(16)
+				<< 1000.0 * cache.misses / std::max<size_t>(counted_samples, 1)
+				<< "\n" << std::defaultfloat << std::setprecision(6);
+		}
+	});
+}
+
+}  // namespace
+
+bool RunLayoutBenchmark(
+	const VolumeFile& volume, const VoxelConversion& conversion) {
+	std::vector<uint8_t> texel_storage;
+	const uint8_t* texels =
+		GetLinearTexels(volume, conversion, &texel_storage);
+	const uint32_t* dims = volume.info.dims;
+	std::cout << "Sampling " << dims[0] << "x" << dims[1] << "x" << dims[2]
+		<< " " << TextureFormatName(conversion.target) << " texels with "
+		<< kRayGrid << "x" << kRayGrid << " rays on " << ParallelThreadCount()
+		<< " threads\n"
+		<< "layout   direction   Msamples/s  misses/ksample\n";
+
+	for (VoxelLayout layout : {VoxelLayout::kLinear, VoxelLayout::kBrick8,
+		VoxelLayout::kBrick16, VoxelLayout::kMorton}) {
+		VoxelStore store;
+		if (!VoxelStore::CreateVoxelStore(
+			&store, texels, dims, conversion.target, layout)) {
+			return false;
+		}
+		switch (store.format) {
+		case TextureFormat::kR8:
+			BenchmarkStore<uint8_t>(store);
+			break;
+		case TextureFormat::kR16:
+			BenchmarkStore<uint16_t>(store);
+			break;
+		case TextureFormat::kR16F:
+			BenchmarkStore<simd::Half>(store);
+			break;
+		case TextureFormat::kR32F:
+			BenchmarkStore<float>(store);
+			break;
+		}
+	}
+	return true;
+}
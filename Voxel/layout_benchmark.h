@@ -0,0 +1,16 @@
+#ifndef VOXEL_LAYOUT_BENCHMARK
+#define VOXEL_LAYOUT_BENCHMARK
+
+#include "volume_format.h"
+#include "voxel_convert.h"
+
+// Copies |volume| converted with |conversion| into a VoxelStore of every
+// layout and marches a grid of parallel rays through each along several
+// directions, sampling with SampleTrilinear(). Prints the samples per second
+// on all threads and the cache misses per sample of one thread, counted by
+// replaying its texel addresses through a model of a 256 KB 8-way cache, as
+// hardware counters aren't portable.
+bool RunLayoutBenchmark(
+	const VolumeFile& volume, const VoxelConversion& conversion);
+
+#endif  // VOXEL_LAYOUT_BENCHMARK
@@ -1,12 +1,14 @@
 // Required when linking GLEW as a static library.
 #define GLEW_STATIC
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <cassert>
 #include <cstdint>
+#include <functional>
 #include <math.h>
-#include <fstream>
-#include <sstream>
+#include <string>
 #include <vector>
 
 #include <GL/glew.h>
@@ -14,22 +16,28 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "blue_noise.h"
+#include "camera_list.h"
+#include "cpu_raycaster.h"
+#include "frame_benchmark.h"
+#include "gl_utils.h"
+#include "golden_test.h"
+#include "gpu_pass_timer.h"
+#include "gradient_volume.h"
+#include "image.h"
+#include "layout_benchmark.h"
+#include "occupancy_grid.h"
+#include "options.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "ray_sampling.h"
+#include "resolution_governor.h"
 #include "shaders.h"
-
-// Checks for GL errors, returns true if no errors are found and false
-// otherwise. All GL errors are flushed.
-bool CheckGlError() {
-	bool result = true;
-	GLenum gl_error = glGetError();
-	while (gl_error != GL_NO_ERROR) {
-		std::cout << "GL ERROR[" << gl_error << "]: "
-				  << gluErrorString(gl_error) << "\n";
-		gl_error = glGetError();
-		result = false;
-	}
-
-	return result;
-}
+#include "transfer_function.h"
+#include "volume_format.h"
+#include "volume_pyramid.h"
+#include "volume_streamer.h"
+#include "voxel_convert.h"
 
 class Window {
   public:
@@ -57,9 +65,9 @@ class Shader {
 	static bool CreateShaders(Shader* shader, const GLchar* vertex,
 							  const GLchar* fragment);
 
-	GLuint program_id;
-	GLuint vertex_id;
-	GLuint fragment_id;
+	GLuint program_id = 0;
+	GLuint vertex_id = 0;
+	GLuint fragment_id = 0;
 
   private:
 	// Destroys the ids in |shader|.
@@ -96,9 +104,12 @@ class Texture {
 		  DestroyTexture(this);
 	  }
 
-	  static bool CreateTexture(Texture* texture, int width, int height, void* data);
+	  // Creates a 2D texture of |internal_format| with linear filtering,
+	  // filled with the RGB floats of |data| if it isn't null.
+	  static bool CreateTexture(Texture* texture, int width, int height,
+		  GLint internal_format, void* data);
 
-	  GLuint id;
+	  GLuint id = 0;
 
   private:
 	  static void DestroyTexture(Texture* texture);
@@ -110,46 +121,574 @@ class FrameBuffer {
 		  DestroyFrameBuffer(this);
 	  }
 
-	  static bool CreateFrameBuffer(FrameBuffer* frame_buffer, int width, int height);
+	  // Creates a framebuffer whose color is a texture of |internal_format|,
+	  // with depth and stencil.
+	  static bool CreateFrameBuffer(FrameBuffer* frame_buffer, int width,
+		  int height, GLint internal_format);
 
-	  GLuint id;
-	  GLuint depth_stencil_renderbuffer_id;
+	  GLuint id = 0;
+	  GLuint depth_stencil_renderbuffer_id = 0;
 	  Texture texture;
 
   private:
 	  static void DestroyFrameBuffer(FrameBuffer* frame_buffer);
 };
 
+// Pixel buffers frames are read back to asynchronously, each with the fence
+// of the last read into it, null once it was waited for.
+class PixelBuffers {
+  public:
+	  ~PixelBuffers() {
+		  DestroyPixelBuffers(this);
+	  }
+
+	  // Creates |count| pixel pack buffers of |size| bytes.
+	  static bool CreatePixelBuffers(
+		  PixelBuffers* pixel_buffers, size_t count, GLsizeiptr size);
+
+	  std::vector<GLuint> ids;
+	  std::vector<GLsync> fences;
+
+  private:
+	  static void DestroyPixelBuffers(PixelBuffers* pixel_buffers);
+};
+
+// Tells the presses of a key from it being held down.
+struct KeyPress {
+	// Returns true if |key| is down in |window| and wasn't the last time.
+	bool Pressed(GLFWwindow* window, int key);
+
+	bool down = false;
+};
+
+// Framebuffer the frames rendered at a reduced resolution while the view
+// moves are drawn to the corner of, bound to texture unit 6, and the shader
+// that stretches them over the window. When accumulating, every frame is
+// drawn to it with the depth of its samples in alpha.
+class ReducedFrame {
+  public:
+	  // Creates the framebuffer of a |width| x |height| window, with the depth
+	  // in alpha if |accumulate|.
+	  static bool CreateReducedFrame(ReducedFrame* reduced_frame, int width,
+		  int height, bool accumulate);
+
+	  // Stretches the part of the texture bound to |shader| that covers
+	  // |scale_x| x |scale_y| of it over the |width| x |height| window.
+	  static void DrawToWindow(const ReducedFrame& reduced_frame, int width,
+		  int height, float scale_x, float scale_y);
+
+	  FrameBuffer buffer;
+	  Shader shader;
+	  GLint scale_loc = -1;
+};
+
+// Average of the jittered frames. It alternates between two framebuffers:
+// |shader| blends each frame with the one holding the latest average, bound
+// to texture unit 7, into the other, which the shader of ReducedFrame then
+// copies to the window. The blue noise that jitters the rays is bound to
+// texture unit 8.
+class Accumulator {
+  public:
+	  ~Accumulator() {
+		  DestroyAccumulator(this);
+	  }
+
+	  // Creates the history of a |width| x |height| window for up to
+	  // |samples_per_pixel| frames per pixel, and sets up |front_shader| to
+	  // jitter its rays and |reduced_frame| to show the latest average.
+	  static bool CreateAccumulator(Accumulator* accumulator, int width,
+		  int height, float aspect_ratio, int samples_per_pixel,
+		  const Shader& front_shader, const ReducedFrame& reduced_frame);
+
+	  // Decides how the next frame is blended, from whether it is |reduced|,
+	  // the view is |moving| and the |scene_changed| since the frame before.
+	  static void BeginFrame(Accumulator* accumulator, bool reduced,
+		  bool moving, bool scene_changed);
+
+	  // Blends the frame drawn to the reduced frame, over |scale_x| x
+	  // |scale_y| of it and seen through |view_from_model|, with the latest
+	  // average into the other history buffer, which becomes the latest.
+	  static void BlendFrame(Accumulator* accumulator,
+		  const glm::mat4& view_from_model, float scale_x, float scale_y);
+
+	  FrameBuffer history_buffers[2];
+	  Shader shader;
+	  GLuint blue_noise_tex_id = 0;
+	  GLint scale_loc = -1;
+	  GLint frame_weight_loc = -1;
+	  GLint reproject_loc = -1;
+	  GLint previous_clip_from_view_loc = -1;
+	  int width = 0;
+	  int height = 0;
+	  glm::mat4 proj_from_view;
+	  int samples_per_pixel = 1;
+
+	  // Which history buffer holds the latest average, how many frames it has
+	  // had since the view stopped, and the view of the last frame.
+	  int history_index = 0;
+	  bool history_valid = false;
+	  int accumulated_frames = 0;
+	  glm::mat4 previous_view_from_model = glm::mat4(1.0f);
+
+	  // How BeginFrame() decided to blend the next frame. Converged frames
+	  // only show the average.
+	  float frame_weight = 1.0f;
+	  bool reproject = false;
+	  bool converged = false;
+
+  private:
+	  static void DestroyAccumulator(Accumulator* accumulator);
+};
+
+// The transfer function read from tff.dat, bound to texture unit 1, and its
+// pre-integrated table of segments, bound to texture unit 4 when
+// pre-integrating.
+class TransferFunctionTextures {
+  public:
+	  ~TransferFunctionTextures() {
+		  DestroyTransferFunctionTextures(this);
+	  }
+
+	  // Reads tff.dat into a table sized for voxels of |target|, uploads it
+	  // for |front_shader| and pre-integrates it if |preintegrate|.
+	  static bool CreateTransferFunctionTextures(
+		  TransferFunctionTextures* transfer_function, TextureFormat target,
+		  bool preintegrate, const Shader& front_shader);
+
+	  // Uploads |data| again after it changed, and the pre-integrated table
+	  // if there is one. Prints how long it took.
+	  static void UpdateTransferFunctionTextures(
+		  TransferFunctionTextures* transfer_function);
+
+	  std::vector<uint8_t> data;
+	  GLuint tff_tex_id = 0;
+	  GLuint preintegrated_tex_id = 0;
+	  GLsizei preintegrated_size = 0;
+	  std::vector<float> preintegrated_table;
+
+  private:
+	  static void DestroyTransferFunctionTextures(
+		  TransferFunctionTextures* transfer_function);
+};
+
+// The grids of the bricks the transfer function leaves empty, for the rays
+// to jump over them, one per mip level the rays sample from level 0, and the
+// texture bound to unit 3 that holds the grid of the level sampled,
+// |index|. Empty unless skipping.
+class OccupancyTexture {
+  public:
+	  ~OccupancyTexture() {
+		  DestroyOccupancyTexture(this);
+	  }
+
+	  // Builds the grids of |volume| converted with |conversion| up to mip
+	  // level |max_lod| for the mip filter of |options|, finds the bricks
+	  // |tff_data| leaves empty and uploads the grid of |lod| for
+	  // |front_shader|.
+	  static bool CreateOccupancyTexture(OccupancyTexture* occupancy,
+		  const Options& options, const VolumeFile& volume,
+		  const VoxelConversion& conversion, const std::vector<uint8_t>& tff_data,
+		  float max_lod, float lod, const Shader& front_shader);
+
+	  // Updates the nodes of every grid that |tff_data| changes and uploads the
+	  // ones of the grid in the texture. Prints what changed.
+	  static bool UpdateOccupancyTexture(
+		  OccupancyTexture* occupancy, const std::vector<uint8_t>& tff_data);
+
+	  // Uploads the grid of sampling mip level |lod| unless it is already in
+	  // the texture. Does nothing if there are no grids.
+	  static bool SelectLod(OccupancyTexture* occupancy, float lod);
+
+	  // Returns the grid of sampling mip level |lod|, the coarser of the two
+	  // levels GL blends, or null if there are no grids.
+	  const OccupancyGrid* GridForLod(float lod) const;
+
+	  std::vector<OccupancyGrid> grids;
+	  size_t index = 0;
+	  GLuint texture_id = 0;
+
+  private:
+	  // Returns the index in |grids| of the grid of sampling mip level |lod|.
+	  size_t GridIndex(float lod) const;
+
+	  static void DestroyOccupancyTexture(OccupancyTexture* occupancy);
+};
+
+// The 3D texture of the voxels, bound to texture unit 2, and its loading:
+// the volume streams into it while the first frames render, and its mip
+// levels are built or loaded in the background and uploaded once ready.
+class VolumeTexture {
+  public:
+	  ~VolumeTexture() {
+		  DestroyVolumeTexture(this);
+	  }
+
+	  // Creates the texture of |volume| converted with |conversion| for
+	  // |front_shader|, and uploads the voxels or starts streaming them as
+	  // set by |options|.
+	  static bool CreateVolumeTexture(VolumeTexture* volume_texture,
+		  const Options& options, const VolumeFile& volume,
+		  const VoxelConversion& conversion, const Shader& front_shader);
+
+	  GLuint id = 0;
+	  GLint loaded_depth_loc = -1;
+	  GLint min_lod_loc = -1;
+	  VolumeStreamer streamer;
+	  VolumePyramid pyramid;
+	  bool streaming = false;
+	  bool pyramid_pending = false;
+
+	  // Loading statistics. glfwGetTime() counts from glfwInit().
+	  double first_frame_time = 0.0;
+	  float worst_loading_frame_time = 0.0f;
+
+  private:
+	  static void DestroyVolumeTexture(VolumeTexture* volume_texture);
+};
+
+// Turn of the volume about the vertical axis. Space stops and resumes the
+// rotation, the arrow keys turn it by hand.
+struct Orbit {
+	float angle = 0.0f;
+	bool rotating = true;
+	KeyPress pause_key;
+	// When the view last changed.
+	double last_motion_time = 0.0;
+};
+
+// Resolution a frame is rendered at, and its scale from the window's.
+struct FrameResolution {
+	int width = 0;
+	int height = 0;
+	bool reduced = false;
+	float scale_x = 1.0f;
+	float scale_y = 1.0f;
+};
+
+// Locations of the uniforms of the shaders of the window that change with
+// the view.
+struct ViewUniforms {
+	GLint back_world_from_model = -1;
+	GLint world_from_model = -1;
+	GLint model_from_view = -1;
+	GLint view_from_model = -1;
+	GLint frame_index = -1;
+};
+
+// Frame time statistics of the window, printed every few seconds, and when
+// the pass times in its title were last updated.
+struct FrameReport {
+	double time = 0.0;
+	int frame_count = 0;
+	// Of the frames of the report, the ones rendered at a reduced resolution
+	// and the ones that only showed the converged average.
+	int reduced_frame_count = 0;
+	int converged_frame_count = 0;
+	double title_time = 0.0;
+};
+
+// Benchmarks count their frames from when the volume is loaded, from minus
+// the warm-up frames, and time each frame from the end of the one before.
+struct BenchmarkRun {
+	FrameBenchmark benchmark;
+	int frame = 0;
+	double frame_end = 0.0;
+};
+
 // Creates the geometry data of a cube and sets it in |data|.
 bool CreateCube(VertexData* data);
 
+// Returns the transform that centers the unit cube of the volume described
+// by |info| in front of the camera, scaled to its physical proportions.
+glm::mat4 GetWorldFromModel(const VolumeInfo& info);
+
+// Returns the view and projection transforms of the camera.
+glm::mat4 GetViewFromWorld();
+glm::mat4 GetProjFromView(float aspect_ratio);
+
 // Sets the camera uniforms of |shader|.
 void SetCameraUniforms(const Shader& shader, float aspect_ratio);
 
+// Returns the transforms of a |width| x |height| frame of the volume
+// described by |info| turned by |yaw| radians like the window turns it, then
+// tilted by |pitch| radians towards the camera.
+CameraTransforms GetCameraTransforms(
+	const VolumeInfo& info, float yaw, float pitch, int width, int height);
+
+// Sets up |raycaster| for |volume| converted with |conversion|, colored by
+// tff.dat and marched as set by |options|. The texels it reads may be kept
+// in |texel_storage|, which must outlive it.
+bool CreateVolumeRaycaster(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, std::vector<uint8_t>* texel_storage,
+	CpuRaycaster* raycaster);
+
+// Renders the volume rotated by |angle| radians like the window would with
+// CpuRaycaster and writes it to the path given by |options|.
+bool RenderOnCpu(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, int width, int height, float angle);
+
+// Renders every view of the camera list given by |options| with
+// CpuRaycaster, writes them as images and reports the throughput.
+bool RenderCameraList(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion);
+
+// Time spent by RenderViewsOnGpu(), and how much of it went to queuing the
+// frames, waiting for the GPU to finish them and handing them over.
+struct GpuBatchTimes {
+	double total_seconds = 0.0;
+	double queue_seconds = 0.0;
+	double wait_seconds = 0.0;
+	double output_seconds = 0.0;
+	size_t frames_in_flight = 0;
+};
+
+// Renders |views| at the render size of |options| with the shaders of the
+// window to an offscreen framebuffer and calls |on_frame| with the index
+// and image of each, in order, stopping if it returns false. The textures
+// of the volume described by |info| must be uploaded and bound like the
+// main loop expects them.
+bool RenderViewsOnGpu(const Options& options, const VolumeInfo& info,
+	const Shader& back_shader, const Shader& front_shader,
+	const VertexData& vertex_data, const std::vector<CameraView>& views,
+	const std::function<bool(size_t, const Image&)>& on_frame,
+	GpuBatchTimes* times);
+
+// Renders every view of the camera list given by |options| with
+// RenderViewsOnGpu(), writes them as images and reports the throughput.
+bool RenderCameraListOnGpu(const Options& options, const VolumeInfo& info,
+	const Shader& back_shader, const Shader& front_shader,
+	const VertexData& vertex_data);
+
+// Renders the golden views with the scalar CpuRaycaster as the reference
+// and with the shaders of the window for every GoldenVariant, compares them
+// to the goldens in the directory given by |options| and prints how each
+// trades quality for speed. Returns true if they all passed. The textures
+// of every variant must be uploaded and bound like for RenderViewsOnGpu().
+bool RunGoldenTest(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, const Shader& back_shader,
+	const Shader& front_shader, const VertexData& vertex_data);
+
+// Returns the ray samples of a |width| x |height| frame of the volume
+// described by |info|, sampled as set by |options| at mip level
+// |volume_lod|, averaged over views of a turn of the volume. Empty bricks
+// of |occupancy_grid| are skipped unless it is null.
+double AverageOrbitSamples(const Options& options, const VolumeInfo& info,
+	float volume_lod, const OccupancyGrid* occupancy_grid, int width,
+	int height);
+
+// Returns the mip level of a volume of size |dims| whose voxels best match
+// the pixels it covers in a window |height| pixels tall, as placed by main()
+// and seen from the camera of SetCameraUniforms().
+float VolumeLod(const uint32_t dims[3], int height);
+
 // Creates a new FrameBuffer that will be stored in |frame_buffer| and
 // sets it as a texture uniform in |shader|.
 bool CreateFrameBufferTexture(const Shader& shader, int width, int height,
 	FrameBuffer* frame_buffer);
 
+// Uploads the voxels of |volume| converted with |conversion| to the 3D
+// texture bound to GL_TEXTURE_3D, brick by brick if the volume is bricked.
+bool UploadVolumeTexture(
+	const VolumeFile& volume, const VoxelConversion& conversion);
+
+// Computes the gradients of |volume| converted with |conversion| as set by
+// |options| into a new texture stored in |texture_id|.
+bool CreateGradientTexture(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, GLuint* texture_id);
+
+// Returns the uGradientMode of the shader for |options|, reading the
+// gradients from the texture of CreateGradientTexture() if |precomputed|.
+int GradientMode(const Options& options, bool precomputed);
+
+// Sets the uniforms of |front_shader| that stay the same from frame to
+// frame, for the volume described by |info| sampled at mip level
+// |volume_lod| as set by |options|.
+void SetVolumeUniforms(const Options& options, const VolumeInfo& info,
+	float volume_lod, bool precomputed_gradients, const Shader& front_shader);
+
+// Returns the locations of the uniforms of |back_shader| and |front_shader|
+// that change with the view.
+ViewUniforms GetViewUniforms(
+	const Shader& back_shader, const Shader& front_shader);
+
+// Turns |orbit| for a frame at |time|, |dt| seconds after the one before,
+// by the keys of |window|. Benchmarks turn it to their frame
+// |benchmark_frame| instead, so that the orbit depends on the frame only,
+// not on the time.
+void UpdateOrbit(GLFWwindow* window, const Options& options,
+	int benchmark_frame, double time, float dt, Orbit* orbit);
+
+// Uploads the pyramid of |volume_texture| as soon as it is ready and the
+// slabs of |volume| that finished loading since the frame before, for a
+// frame at |time|, |dt| seconds after it. If the base level is still
+// streaming, the whole volume is rendered from the coarser levels, with
+// their grid of |occupancy|, until it is done. Sets |scene_changed| when
+// what the volume looks like changes.
+bool UpdateVolumeLoading(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, float volume_lod, double time,
+	float dt, const Shader& front_shader, VolumeTexture* volume_texture,
+	OccupancyTexture* occupancy, bool* scene_changed);
+
+// Returns the resolution of a frame of a |width| x |height| window rendered
+// |still_ms| milliseconds after the view last changed. It is divided by the
+// moving scale of |options| while the view moves, by half of it until it
+// has been still for the refine delay, and full from then on. With a frame
+// time to hold, |governor| picks it until the refine delay instead, and is
+// null otherwise.
+FrameResolution ChooseFrameResolution(const Options& options,
+	double still_ms, ResolutionGovernor* governor, int width, int height);
+
+// Draws the volume turned by |world_from_model| and seen through
+// |view_from_model| to |frame_buffer_id|, blended over it if |blend|, with
+// the jitter of frame |frame_index|. The two-pass mode draws the exit
+// points to |back_face_buffer| first. Ends the passes of |pass_timer|.
+void DrawVolume(const Options& options, const Shader& back_shader,
+	const Shader& front_shader, const ViewUniforms& uniforms,
+	const VertexData& vertex_data, const FrameBuffer& back_face_buffer,
+	GLuint frame_buffer_id, bool blend, const glm::mat4& world_from_model,
+	const glm::mat4& view_from_model, int frame_index,
+	GpuPassTimer* pass_timer);
+
+// Counts the frame at |time| in |report|, shows the pass times of
+// |pass_timer| in the title of |window| if |options| asks for it, and
+// prints the statistics of the frames, of |governor| unless it is null and
+// of |pass_timer| every few seconds.
+void UpdateFrameReport(GLFWwindow* window, const Options& options,
+	bool precomputed_gradients, double time, ResolutionGovernor* governor,
+	GpuPassTimer* pass_timer, FrameReport* report);
+
+// Times the frame that just ended in |run|, unless the volume is still
+// |loading|. Returns false once all the frames of |options| are timed.
+bool EndBenchmarkFrame(const Options& options, bool loading,
+	BenchmarkRun* run);
+
+// Describes the frames of |benchmark| the window rendered on |renderer|,
+// of |volume| converted with |conversion| and sampled at mip level
+// |volume_lod| with |occupancy|, then prints it and writes it to the path
+// given by |options|.
+void FinishFrameBenchmark(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, const GLubyte* renderer,
+	float volume_lod, bool precomputed_gradients,
+	const OccupancyTexture& occupancy, int width, int height,
+	FrameBenchmark* benchmark);
+
 int main(int argc, char* argv[]) {
+	Options options;
+	if (!ParseOptions(argc, argv, &options))
+		return 0;
+	const ProfileSession profile_session(options.profile_path);
+
+	// Map the voxel data. Nothing is read until the voxels are uploaded, the
+	// mapped pages are passed directly to GL so the only copy of the volume
+	// is the one made by the driver.
+	VolumeFile volume;
+	ProfileScope open_scope("OpenVolume");
+	if (!OpenVolume(options, &volume))
+		return 0;
+	open_scope.End();
+
+	if (options.convert_path) {
+		if (IsBricked(volume.info)) {
+			std::cout << "Only linear volumes can be converted.\n";
+			return 0;
+		}
+		VolumeInfo info = volume.info;
+		for (uint32_t& brick_dim : info.brick_dims)
+			brick_dim = options.convert_brick_size;
+		if (!VolumeFile::WriteVolumeFile(
+			options.convert_path, info, volume.voxels)) {
+			return 0;
+		}
+		std::cout << "Wrote " << options.convert_path << "\n";
+		return 0;
+	}
+
+	// Decide how the voxels are stored on the GPU.
+	VoxelConversion conversion = PlanVoxelConversion(volume.info);
+	if (options.windowed) {
+		conversion.windowed = true;
+		conversion.window_min = options.window_min;
+		conversion.window_max = options.window_max;
+	}
+	if (volume.info.type == VoxelType::kFloat32)
+		conversion.target = options.float_texture_format;
+
+	if (options.layout_benchmark) {
+		RunLayoutBenchmark(volume, conversion);
+		return 0;
+	}
+
+	constexpr int width = 1080;
+	constexpr int height = 1080;
+	constexpr float aspect_ratio = static_cast<float>(width) / height;
+
+	// Render a single frame on the CPU, without a window or a GPU.
+	if (options.cpu_render_path) {
+		RenderOnCpu(options, volume, conversion,
+			static_cast<int>(options.render_size[0]),
+			static_cast<int>(options.render_size[1]), glm::radians(options.angle));
+		return 0;
+	}
+
+	// Or a whole list of views, for batches on machines without a GPU.
+	if (options.camera_list_path && !options.render_on_gpu) {
+		RenderCameraList(options, volume, conversion);
+		return 0;
+	}
+
+	// Batches on the GPU render every view once, from the whole volume at
+	// full resolution, so nothing is streamed, refined or accumulated.
+	const bool gpu_batch =
+		options.camera_list_path != nullptr || options.golden_dir != nullptr;
+	if (gpu_batch) {
+		options.sync_load = true;
+		options.build_pyramid = false;
+		options.moving_scale = 1;
+		options.target_frame_ms = 0.0f;
+		options.samples_per_pixel = 1;
+	}
+	// The golden test switches the features on and off with the uniforms
+	// of the shader, so the textures of all of them have to exist. It makes
+	// the gradients of each encoding itself.
+	if (options.golden_dir) {
+		options.skip_empty = true;
+		options.preintegrate = true;
+		options.shading = true;
+		options.precompute_gradients = false;
+	}
+
 	glfwSetErrorCallback([](int error_code, const char* error_message) {
 		std::cout << "GLFW ERROR[" << error_code << "]: "
 			<< error_message << "\n";
 	});
 
+	ProfileScope glfw_scope("glfwInit");
 	if (!glfwInit()) {
 		std::cout << "Failed to initialize GLFW.\n";
 		return 0;
 	}
+	glfw_scope.End();
+
+	// Benchmarks time full resolution frames of the whole volume, the same
+	// way from one run to the next. Every frame is a single sample drawn
+	// from scratch, not one blended into the history of the previous ones.
+	if (options.benchmark) {
+		options.sync_load = true;
+		options.moving_scale = 1;
+		options.target_frame_ms = 0.0f;
+		options.samples_per_pixel = 1;
+	}
 
-	constexpr int width = 1080;
-	constexpr int height = 1080;
-	constexpr float aspect_ratio = static_cast<float>(width) / height;
+	// Batches only need the context of the window.
+	if (gpu_batch)
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 	Window window;
+	ProfileScope window_scope("CreateWindow");
 	if (!Window::CreateWindow(&window, width, height)) {
 		assert(false);
 		return 0;
 	}
+	window_scope.End();
 
 	const GLubyte* gl_renderer = glGetString(GL_RENDERER);
 	const GLubyte* gl_version = glGetString(GL_VERSION);
@@ -161,10 +700,12 @@ int main(int argc, char* argv[]) {
 
 	// Load OpenGL extensions. Not needed for this demo.
 	glewExperimental = GL_TRUE;
+	ProfileScope glew_scope("glewInit");
 	if (glewInit() != GLEW_OK) {
 		std::cout << "Failed to initialize GLEW.\n";
 		return 0;
 	}
+	glew_scope.End();
 	// GLEW causes a GL error when initializing so all GL errors need to be
 	// flushed. "GL ERROR[1280]: invalid enumerantAssertion failed".
 	CheckGlError();
@@ -194,176 +735,298 @@ int main(int argc, char* argv[]) {
 	SetCameraUniforms(back_shader, aspect_ratio);
 	SetCameraUniforms(front_shader, aspect_ratio);
 
-	// Create an offscreen framebuffer.
+	// Create an offscreen framebuffer for the exit points of the two-pass
+	// mode. The single-pass mode finds them in the fragment shader.
 	FrameBuffer back_face_buffer;
-	if (!CreateFrameBufferTexture(
+	if (options.two_pass && !CreateFrameBufferTexture(
 		front_shader, width, height, &back_face_buffer)) {
 		return 0;
 	}
+	glUseProgram(front_shader.program_id);
+	glUniform2f(glGetUniformLocation(front_shader.program_id, "uScreenSize"),
+		static_cast<float>(width), static_cast<float>(height));
+	glUseProgram(0);
 
-	GLuint tff_tex_id;
-	{
-		// Read transfer function data.
-		std::string tff_data;
-		std::stringstream ss;
-		std::ifstream file;
-		file.open(
-			"tff.dat", std::ifstream::in | std::ifstream::binary);
-		if (!file.is_open()) {
-			assert(false);
-			return 0;
-		}
-		ss << file.rdbuf();
-		file.close();
-		tff_data = ss.str();
-
-		// Create texture and upload data to GPU.
-		glGenTextures(1, &tff_tex_id);
-		glBindTexture(GL_TEXTURE_1D, tff_tex_id);
-		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		// For debugging GL_NEAREST makes 1.0 wrap to the initial value (a purplish color).
-		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		// Sets how to read pixels. In this case reading 1 byte pixels.
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-		glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA8, 256, 0, GL_RGBA,
-			GL_UNSIGNED_BYTE, tff_data.data());
-
-		// Set the TFF texture uniform and bind it to texture unit 1.
-		glUseProgram(front_shader.program_id);
-		const GLuint tff_mat_loc =
-			glGetUniformLocation(front_shader.program_id, "tffSampler");
-		glActiveTexture(GL_TEXTURE0 + 1); // This is the same as GL_TEXTURE1.
-		glBindTexture(GL_TEXTURE_1D, tff_tex_id);
-		// Assign the texture unit to the sampler. 0 matches the active texture
-		// GL_TEXTURE1.
-		glUniform1i(tff_mat_loc, 1);
-		glUseProgram(0);
-		assert(CheckGlError());
+	// Frames rendered at a reduced resolution while the view moves, and
+	// every frame when accumulating, are drawn to |reduced_frame| first.
+	const bool accumulate = options.samples_per_pixel > 1;
+	const bool governed = options.target_frame_ms > 0.0f;
+	ReducedFrame reduced_frame;
+	if ((options.moving_scale > 1 || accumulate || governed) &&
+		!ReducedFrame::CreateReducedFrame(
+			&reduced_frame, width, height, accumulate)) {
+		assert(false);
+		return 0;
 	}
 
-	GLuint voxel_tex_id;
-	{
-		// Read voxel data.
-		std::string voxel_data;
-		std::stringstream ss;
-		std::ifstream file;
-		file.open(
-			"head256.raw", std::ifstream::in | std::ifstream::binary);
-		if (!file.is_open()) {
-			assert(false);
-			return 0;
-		}
-		ss << file.rdbuf();
-		file.close();
-		voxel_data = ss.str();
-		// Create texture and upload data to GPU.
-		glGenTextures(1, &voxel_tex_id);
-		glBindTexture(GL_TEXTURE_3D, voxel_tex_id);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-		assert(CheckGlError());
-		glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, 256, 256, 225, 0, GL_RED, GL_UNSIGNED_BYTE, voxel_data.data());
-		assert(CheckGlError());
-		// Set the voxel texture uniform and bind it to texture unit 2.
-		glUseProgram(front_shader.program_id);
-		const GLuint voxel_tex_loc =
-			glGetUniformLocation(front_shader.program_id, "voxelSampler");
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_3D, voxel_tex_id);
-		// Assign the texture unit to the sampler. 0 matches the active texture
-		// GL_TEXTURE1.
-		glUniform1i(voxel_tex_loc, 2);
-		glUseProgram(0);
-		assert(CheckGlError());
+	// Picks the resolution of the frames from their GPU times when there is
+	// a frame time to hold.
+	ResolutionGovernor governor;
+	if (governed && !ResolutionGovernor::CreateResolutionGovernor(
+		&governor, options.target_frame_ms, options.governor_log_path)) {
+		assert(false);
+		return 0;
 	}
 
-	const double PI = std::acos(-1);
-	
-	const glm::mat4 world_from_model =
-		glm::scale(glm::mat4(1.0), glm::vec3(3.0)) *
-		// Rotate the cube 90 deg on the X axis to make it face the camera.
-		glm::rotate(glm::mat4(1.0f), static_cast<float>(PI) / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f)) *
-		// The cube is located at (0, 0, 0) to (1, 1, 1) so move it to the center
-		// of the screen i.e. (-0.5, -0.5, -0.5) to (0.5, 0.5, 0.5).
-		glm::translate(glm::mat4(1.0f), glm::vec3(-0.5f, -0.5f, -0.5f));
-	const GLuint model_mat_loc =
-		glGetUniformLocation(back_shader.program_id, "uWorldFromModel");
-	const GLuint model_mat_loc2 =
-		glGetUniformLocation(front_shader.program_id, "uWorldFromModel");
+	// Times each pass of the frames when asked to.
+	GpuPassTimer pass_timer;
+	if (options.gpu_timers && !GpuPassTimer::CreateGpuPassTimer(
+		&pass_timer, options.gpu_timers_csv_path)) {
+		assert(false);
+		return 0;
+	}
 
-	// Logic for rotating the cube.
-	const double rotation_speed = PI / 2.0;
-	float angle = 0.0;
+	Accumulator accumulator;
+	if (accumulate && !Accumulator::CreateAccumulator(&accumulator, width,
+		height, aspect_ratio, options.samples_per_pixel, front_shader,
+		reduced_frame)) {
+		assert(false);
+		return 0;
+	}
+
+	TransferFunctionTextures transfer_function;
+	if (!TransferFunctionTextures::CreateTransferFunctionTextures(
+		&transfer_function, conversion.target, options.preintegrate,
+		front_shader)) {
+		assert(false);
+		return 0;
+	}
+
+	VolumeTexture volume_texture;
+	if (!VolumeTexture::CreateVolumeTexture(
+		&volume_texture, options, volume, conversion, front_shader)) {
+		assert(false);
+		return 0;
+	}
+
+	// The camera never moves, so neither does the screen size of a voxel.
+	const float volume_lod =
+		options.build_pyramid ? VolumeLod(volume.info.dims, height) : 0.0f;
+
+	// The rays sample the level of the window, and level 1 for the preview
+	// while the volume streams in.
+	OccupancyTexture occupancy;
+	if (options.skip_empty && !OccupancyTexture::CreateOccupancyTexture(
+		&occupancy, options, volume, conversion, transfer_function.data,
+		std::max(volume_lod,
+			options.build_pyramid && !options.sync_load ? 1.0f : 0.0f),
+		volume_lod, front_shader)) {
+		assert(false);
+		return 0;
+	}
+
+	// Precompute the gradients of the volume for shading, bound to texture
+	// unit 5. G switches to central differences in the shader and back, the
+	// texture is only built the first time it is needed.
+	GLuint gradient_tex_id = 0;
+	bool precomputed_gradients = options.precompute_gradients;
+	if (options.shading && precomputed_gradients && !CreateGradientTexture(
+		options, volume, conversion, &gradient_tex_id)) {
+		assert(false);
+		return 0;
+	}
+
+	// Build or load the mip levels in the background.
+	volume_texture.pyramid_pending = options.build_pyramid &&
+		VolumePyramid::CreateVolumePyramid(&volume_texture.pyramid, &volume,
+			conversion, options.mip_filter,
+			std::string(options.volume_path) + ".pyramid");
+
+	SetVolumeUniforms(
+		options, volume.info, volume_lod, precomputed_gradients, front_shader);
+
+	if (options.golden_dir) {
+		return RunGoldenTest(options, volume, conversion, back_shader,
+			front_shader, vertex_data) ? 0 : 1;
+	}
+	if (gpu_batch) {
+		RenderCameraListOnGpu(
+			options, volume.info, back_shader, front_shader, vertex_data);
+		return 0;
+	}
+
+	const glm::mat4 world_from_model = GetWorldFromModel(volume.info);
+	const glm::mat4 view_from_world = GetViewFromWorld();
+	const ViewUniforms view_uniforms =
+		GetViewUniforms(back_shader, front_shader);
+	const GLint gradient_mode_loc =
+		glGetUniformLocation(front_shader.program_id, "uGradientMode");
+
+	FrameReport report;
+	report.time = glfwGetTime();
+	report.title_time = report.time;
+	// T reloads tff.dat, to edit the transfer function while rendering.
+	KeyPress reload_key;
+	// G switches between precomputed and on-the-fly gradients.
+	KeyPress gradient_key;
+
+	Orbit orbit;
 	double previous_time = glfwGetTime();
-	// Set the color used to clear the screen.
-	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+	orbit.last_motion_time = previous_time;
+	// Changes to what the volume looks like set |scene_changed| to start the
+	// accumulation over.
+	bool scene_changed = false;
+	int frame_index = 0;
+	BenchmarkRun benchmark_run;
+	benchmark_run.frame = -static_cast<int>(options.benchmark_warmup);
+	// Set the color used to clear the screen. When accumulating, the alpha
+	// of the frames is the depth of their samples, 0 for the background.
+	glClearColor(1.0f, 1.0f, 1.0f, accumulate ? 0.0f : 1.0f);
 	// Enable blending. This allows the empty voxel of the volume to be transparent.
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	while (!glfwWindowShouldClose(window.handle)) {
+		const ProfileScope frame_scope("Frame");
+		ProfileScope update_scope("Update");
 		// Update logic.
-		double current_time = glfwGetTime();
-		float dt = static_cast<float>(current_time - previous_time);
+		const double current_time = glfwGetTime();
+		const float dt = static_cast<float>(current_time - previous_time);
 		previous_time = current_time;
-		angle += rotation_speed * dt;
-		glm::mat4 rot_matrix =
-			glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 1.0f, 0.0f));
-		rot_matrix = rot_matrix * world_from_model;
+		UpdateOrbit(window.handle, options, benchmark_run.frame, current_time,
+			dt, &orbit);
+		const glm::mat4 rot_matrix = glm::rotate(glm::mat4(1.0f), orbit.angle,
+			glm::vec3(0.0f, 1.0f, 0.0f)) * world_from_model;
+
+		// Reload the transfer function on the press of T and update the
+		// nodes of the occupancy hierarchy it changes.
+		if (reload_key.Pressed(window.handle, GLFW_KEY_T) &&
+			LoadTransferFunction("tff.dat", transfer_function.data.size() / 4,
+				&transfer_function.data)) {
+			std::cout << "Reloaded the transfer function";
+			scene_changed = true;
+			TransferFunctionTextures::UpdateTransferFunctionTextures(
+				&transfer_function);
+			if (!OccupancyTexture::UpdateOccupancyTexture(
+				&occupancy, transfer_function.data)) {
+				assert(false);
+				return 0;
+			}
+			std::cout << "\n";
+		}
 
-		// First render pass.
-		//
-		// Bind the first pass framebuffer.
-		glBindFramebuffer(GL_FRAMEBUFFER, back_face_buffer.id);
-		// Clear the curren viewport using the current clear color. The value
-		// passed to this function is a bitmask that defines which buffers
-		// are cleared. In this case only the color buffer is cleared.
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-		glEnable(GL_DEPTH_TEST);
-		// Setup the first pass.
-		glUseProgram(back_shader.program_id);
-		glBindVertexArray(vertex_data.vao);
-		// Enable back face culling. Front faces are CCW.
-		glEnable(GL_CULL_FACE);
-		// To render the inside of the cube, cull the front faces.
-		glCullFace(GL_FRONT);
-		glFrontFace(GL_CCW);
-		// Rotate.
-		glUniformMatrix4fv(model_mat_loc, 1, GL_FALSE, &rot_matrix[0][0]);
-		// Render first pass to texture.
-		glDrawElements(
-			GL_TRIANGLES, vertex_data.index_length, GL_UNSIGNED_BYTE, nullptr);
+		if (gradient_key.Pressed(window.handle, GLFW_KEY_G) && options.shading) {
+			precomputed_gradients = !precomputed_gradients;
+			scene_changed = true;
+			if (precomputed_gradients && gradient_tex_id == 0 &&
+				!CreateGradientTexture(options, volume, conversion, &gradient_tex_id)) {
+				assert(false);
+				return 0;
+			}
+			glUseProgram(front_shader.program_id);
+			glUniform1i(
+				gradient_mode_loc, GradientMode(options, precomputed_gradients));
+			std::cout << "Shading with "
+				<< (precomputed_gradients ? "precomputed" : "on-the-fly")
+				<< " gradients\n";
+		}
 
+		if (!UpdateVolumeLoading(options, volume, conversion, volume_lod,
+			current_time, dt, front_shader, &volume_texture, &occupancy,
+			&scene_changed)) {
+			assert(false);
+			return 0;
+		}
 
-		// Second render pass.
-		//
-		// Bind the window framebuffer.
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-		glEnable(GL_DEPTH_TEST);
-		// Setup the second pass.
-		glUseProgram(front_shader.program_id);
-		glBindVertexArray(vertex_data.vao);
-		// Rotate.
-		glUniformMatrix4fv(model_mat_loc2, 1, GL_FALSE, &rot_matrix[0][0]);
-		// To render the outside of the cube, cull the back faces.
-		glCullFace(GL_BACK);
-		// Render the second pass to the main framebuffer.
-		glDrawElements(
-			GL_TRIANGLES, vertex_data.index_length, GL_UNSIGNED_BYTE, nullptr);
+		update_scope.End();
+		ProfileScope render_scope("Render");
+
+		const double still_ms = (current_time - orbit.last_motion_time) * 1000.0;
+		const bool moving = still_ms == 0.0;
+		const FrameResolution resolution = ChooseFrameResolution(
+			options, still_ms, governed ? &governor : nullptr, width, height);
+		glViewport(0, 0, resolution.width, resolution.height);
+		if (resolution.reduced)
+			++report.reduced_frame_count;
 
+		if (accumulate) {
+			Accumulator::BeginFrame(
+				&accumulator, resolution.reduced, moving, scene_changed);
+		}
+		scene_changed = false;
+
+		GpuPassTimer::Update(&pass_timer);
+		GpuPassTimer::BeginFrame(&pass_timer);
+		if (accumulator.converged) {
+			++report.converged_frame_count;
+		} else {
+			if (governed)
+				ResolutionGovernor::BeginFrame(&governor, resolution.scale_x);
+
+			// Draw to the window, or to the reduced frame. The frames that are
+			// accumulated composite themselves over the background.
+			const glm::mat4 view_from_model = view_from_world * rot_matrix;
+			DrawVolume(options, back_shader, front_shader, view_uniforms,
+				vertex_data, back_face_buffer,
+				resolution.reduced || accumulate ? reduced_frame.buffer.id : 0,
+				/* blend = */ !accumulate, rot_matrix, view_from_model,
+				frame_index, &pass_timer);
+			// Wrapped to keep the shifts of the jitter precise.
+			frame_index = (frame_index + 1) % 1024;
+
+			if (accumulate) {
+				Accumulator::BlendFrame(&accumulator, view_from_model,
+					resolution.scale_x, resolution.scale_y);
+				GpuPassTimer::EndPass(&pass_timer, GpuPass::kAccumulate);
+			}
+
+			if (governed) {
+				ResolutionGovernor::EndFrame(&governor,
+					static_cast<float>((glfwGetTime() - current_time) * 1000.0));
+			}
+		}
+
+		// Show the latest average, or stretch the reduced frame over the
+		// window. The window is multisampled, so it can't be the target of a
+		// blit.
+		if (accumulate || resolution.reduced) {
+			ReducedFrame::DrawToWindow(reduced_frame, width, height,
+				accumulate ? 1.0f : resolution.scale_x,
+				accumulate ? 1.0f : resolution.scale_y);
+			GpuPassTimer::EndPass(&pass_timer, GpuPass::kDisplay);
+		}
+
+		render_scope.End();
 
 		// End of the frame.
+		ProfileScope swap_scope("glfwSwapBuffers");
 		glfwSwapBuffers(window.handle);
+		swap_scope.End();
+		GpuPassTimer::EndPass(&pass_timer, GpuPass::kSwap);
+		GpuPassTimer::EndFrame(&pass_timer);
+		if (volume_texture.first_frame_time == 0.0) {
+			volume_texture.first_frame_time = glfwGetTime();
+			PrintRaySampleCounts(CountRaySamples(
+				glm::inverse(GetProjFromView(aspect_ratio) * view_from_world *
+					rot_matrix),
+				volume.info.dims, SampleStepVoxels(options.sampling_rate, volume_lod),
+				width, height, occupancy.GridForLod(volume_lod)));
+		}
+		UpdateFrameReport(window.handle, options, precomputed_gradients,
+			current_time, governed ? &governor : nullptr, &pass_timer, &report);
+		if (options.benchmark && !EndBenchmarkFrame(options,
+			volume_texture.streaming || volume_texture.pyramid_pending,
+			&benchmark_run)) {
+			break;
+		}
 		// Process input events.
+		const ProfileScope poll_scope("glfwPollEvents");
 		glfwPollEvents();
 	}
-	
+
+	// Read back the frames still in flight before writing the pass times.
+	if (options.gpu_timers_json_path) {
+		glFinish();
+		GpuPassTimer::Update(&pass_timer);
+		pass_timer.WriteJson(options.gpu_timers_json_path);
+	}
+
+	if (options.benchmark && !benchmark_run.benchmark.frame_ms.empty()) {
+		FinishFrameBenchmark(options, volume, conversion, gl_renderer,
+			volume_lod, precomputed_gradients, occupancy, width, height,
+			&benchmark_run.benchmark);
+	}
+
 	return 0;
 }
 
@@ -401,21 +1064,47 @@ bool CreateCube(VertexData* data) {
 	return VertexData::CreateAndUploadVertexData(data, vertices, indices);
 }
 
-void SetCameraUniforms(const Shader& shader, float aspect_ratio) {
-	// Use an identity matrix for |world_from_model|.
-	glm::mat4 world_from_model(1.0f);
+glm::mat4 GetWorldFromModel(const VolumeInfo& info) {
+	const float PI = static_cast<float>(std::acos(-1));
+	// Size of the volume in physical units, normalized so that the longest
+	// side is 1. The cube is scaled by it so that anisotropic volumes keep
+	// their proportions.
+	glm::vec3 extent(
+		info.dims[0] * info.spacing[0],
+		info.dims[1] * info.spacing[1],
+		info.dims[2] * info.spacing[2]);
+	extent /= std::max(extent.x, std::max(extent.y, extent.z));
+	return
+		glm::scale(glm::mat4(1.0), glm::vec3(3.0)) *
+		// Rotate the cube 90 deg on the X axis to make it face the camera.
+		glm::rotate(glm::mat4(1.0f), PI / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f)) *
+		// The cube is located at (0, 0, 0) to (1, 1, 1) so move it to the center
+		// of the screen i.e. (-0.5, -0.5, -0.5) to (0.5, 0.5, 0.5).
+		glm::translate(glm::mat4(1.0f), -0.5f * extent) *
+		glm::scale(glm::mat4(1.0f), extent);
+}
+
+glm::mat4 GetViewFromWorld() {
 	// Set the camera parallel to the floor, in front and looking towards the
 	// geometry from the +Z axis (outside the monitor).
-	glm::mat4 view_from_world =
-		glm::lookAt(
-			/* eye_pos = */ glm::vec3(0.0f, 0.0f, 10.f),
-			/* look_at = */ glm::vec3(0.0f, 0.0f, 0.0f),
-			/* up = */ glm::vec3(0.0f, 1.0f, 0.0f));
+	return glm::lookAt(
+		/* eye_pos = */ glm::vec3(0.0f, 0.0f, 10.f),
+		/* look_at = */ glm::vec3(0.0f, 0.0f, 0.0f),
+		/* up = */ glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+glm::mat4 GetProjFromView(float aspect_ratio) {
 	// FOVY of 45 degrees, precalculated aspect ratio from the window dimensions,
 	// znear of 0.1 and zfar of 100 (relative values to the camera, z points
 	// inside the screen).
-	glm::mat4 proj_from_view =
-		glm::perspective(glm::radians(45.0f), aspect_ratio, 0.1f, 100.0f);
+	return glm::perspective(glm::radians(45.0f), aspect_ratio, 0.1f, 100.0f);
+}
+
+void SetCameraUniforms(const Shader& shader, float aspect_ratio) {
+	// Use an identity matrix for |world_from_model|.
+	glm::mat4 world_from_model(1.0f);
+	glm::mat4 view_from_world = GetViewFromWorld();
+	glm::mat4 proj_from_view = GetProjFromView(aspect_ratio);
 	// Set the values of the uniforms of |shader|.
 	glUseProgram(shader.program_id);
 	GLuint model_mat_loc =
@@ -431,9 +1120,851 @@ void SetCameraUniforms(const Shader& shader, float aspect_ratio) {
 	assert(CheckGlError());
 }
 
+CameraTransforms GetCameraTransforms(
+	const VolumeInfo& info, float yaw, float pitch, int width, int height) {
+	CameraTransforms camera;
+	camera.world_from_model =
+		glm::rotate(glm::mat4(1.0f), pitch, glm::vec3(1.0f, 0.0f, 0.0f)) *
+		glm::rotate(glm::mat4(1.0f), yaw, glm::vec3(0.0f, 1.0f, 0.0f)) *
+		GetWorldFromModel(info);
+	camera.view_from_world = GetViewFromWorld();
+	camera.proj_from_view =
+		GetProjFromView(static_cast<float>(width) / height);
+	return camera;
+}
+
+bool CreateVolumeRaycaster(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, std::vector<uint8_t>* texel_storage,
+	CpuRaycaster* raycaster) {
+	const size_t tff_size = conversion.target == TextureFormat::kR8 ?
+		kTransferFunctionSize8 : kTransferFunctionSize16;
+	std::vector<uint8_t> tff_data;
+	if (!LoadTransferFunction("tff.dat", tff_size, &tff_data))
+		return false;
+
+	const uint8_t* texels =
+		GetLinearTexels(volume, conversion, texel_storage);
+	if (!CpuRaycaster::CreateCpuRaycaster(raycaster, texels, volume.info.dims,
+		conversion.target, tff_data)) {
+		return false;
+	}
+	raycaster->kernel = options.cpu_kernel;
+	raycaster->tile_size = options.cpu_tile_size;
+	raycaster->schedule = options.cpu_schedule;
+	raycaster->sampling_rate = options.sampling_rate;
+	return true;
+}
+
+bool RenderOnCpu(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, int width, int height, float angle) {
+	std::vector<uint8_t> texel_storage;
+	CpuRaycaster raycaster;
+	if (!CreateVolumeRaycaster(
+		options, volume, conversion, &texel_storage, &raycaster)) {
+		return false;
+	}
+
+	const CameraTransforms camera =
+		GetCameraTransforms(volume.info, angle, 0.0f, width, height);
+	PrintRaySampleCounts(CountRaySamples(
+		glm::inverse(camera.proj_from_view * camera.view_from_world *
+			camera.world_from_model),
+		volume.info.dims, SampleStepVoxels(options.sampling_rate, 0.0f),
+		width, height, nullptr));
+
+	std::vector<TileSchedule> schedules;
+	if (options.cpu_compare_schedules)
+		schedules = {TileSchedule::kStatic, TileSchedule::kWorkStealing};
+	else
+		schedules = {options.cpu_schedule};
+	Image image;
+	ResizeImage(&image, width, height);
+	std::vector<double> render_seconds;
+	for (TileSchedule schedule : schedules) {
+		raycaster.schedule = schedule;
+		TileScheduleStats stats;
+		CpuRaycaster::RenderImage(&raycaster, camera, &image, &stats);
+		std::cout << "Rendered " << width << "x" << height << " on "
+			<< ParallelThreadCount() << " threads with the "
+			<< RaycastKernelName(raycaster.kernel) << " kernel and "
+			<< TileScheduleName(schedule) << " " << raycaster.tile_size
+			<< "px tiles in "
+			<< stats.wall_seconds * 1000.0 << " ms ("
+			<< width * height / stats.wall_seconds / 1e6 << " Mrays/s)\n";
+		PrintTileScheduleStats(stats);
+		render_seconds.push_back(stats.wall_seconds);
+	}
+	if (render_seconds.size() == 2) {
+		std::cout << "Work stealing is " << render_seconds[0] / render_seconds[1]
+			<< "x as fast as the static split\n";
+	}
+
+	if (!WriteImage(options.cpu_render_path, image))
+		return false;
+	std::cout << "Wrote " << options.cpu_render_path << "\n";
+	return true;
+}
+
+bool RenderCameraList(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion) {
+	std::vector<CameraView> views;
+	if (!LoadCameraList(options.camera_list_path, &views))
+		return false;
+
+	std::vector<uint8_t> texel_storage;
+	CpuRaycaster raycaster;
+	if (!CreateVolumeRaycaster(
+		options, volume, conversion, &texel_storage, &raycaster)) {
+		return false;
+	}
+
+	const int width = static_cast<int>(options.render_size[0]);
+	const int height = static_cast<int>(options.render_size[1]);
+	Image image;
+	ResizeImage(&image, width, height);
+	double render_seconds = 0.0;
+	double write_seconds = 0.0;
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < views.size(); ++i) {
+		const CameraView& view = views[i];
+		const std::string path = GetViewImagePath(
+			view, i, options.render_prefix, options.image_extension);
+
+		TileScheduleStats stats;
+		CpuRaycaster::RenderImage(&raycaster, GetCameraTransforms(volume.info,
+			glm::radians(view.yaw_degrees), glm::radians(view.pitch_degrees),
+			width, height), &image, &stats);
+		render_seconds += stats.wall_seconds;
+
+		const auto write_start = std::chrono::steady_clock::now();
+		if (!WriteImage(path.c_str(), image))
+			return false;
+		const std::chrono::duration<double> write_elapsed =
+			std::chrono::steady_clock::now() - write_start;
+		write_seconds += write_elapsed.count();
+	}
+	const std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+
+	const double frame_count = static_cast<double>(views.size());
+	std::cout << "Rendered " << views.size() << " views of " << width << "x"
+		<< height << " in " << elapsed.count() << " s, "
+		<< frame_count / elapsed.count() << " frames/s ("
+		<< render_seconds * 1000.0 / frame_count << " ms rendering and "
+		<< write_seconds * 1000.0 / frame_count << " ms writing per frame, "
+		<< frame_count * width * height / render_seconds / 1e6
+		<< " Mrays/s) on " << ParallelThreadCount() << " threads with the "
+		<< RaycastKernelName(raycaster.kernel) << " kernel\n";
+	return true;
+}
+
+bool RenderViewsOnGpu(const Options& options, const VolumeInfo& info,
+	const Shader& back_shader, const Shader& front_shader,
+	const VertexData& vertex_data, const std::vector<CameraView>& views,
+	const std::function<bool(size_t, const Image&)>& on_frame,
+	GpuBatchTimes* times) {
+	*times = GpuBatchTimes();
+	if (views.empty())
+		return true;
+
+	// The frames have their own size, and so their own projection and exit
+	// points, bound to texture unit 0 instead of those of the window.
+	const int width = static_cast<int>(options.render_size[0]);
+	const int height = static_cast<int>(options.render_size[1]);
+	const float aspect_ratio = static_cast<float>(width) / height;
+	SetCameraUniforms(back_shader, aspect_ratio);
+	SetCameraUniforms(front_shader, aspect_ratio);
+	glUseProgram(front_shader.program_id);
+	glUniform2f(glGetUniformLocation(front_shader.program_id, "uScreenSize"),
+		static_cast<float>(width), static_cast<float>(height));
+	glUseProgram(0);
+	FrameBuffer back_face_buffer;
+	if (options.two_pass) {
+		glActiveTexture(GL_TEXTURE0);
+		if (!FrameBuffer::CreateFrameBuffer(
+			&back_face_buffer, width, height, GL_RGB)) {
+			return false;
+		}
+		glBindTexture(GL_TEXTURE_2D, back_face_buffer.texture.id);
+	}
+
+	// Frames are drawn unblended over a transparent background, which
+	// leaves the premultiplied colors the shader writes for an Image to hold,
+	// then read back to one of |frames_in_flight| pixel buffers. A frame is
+	// only mapped once that many more have been queued behind it, so the GPU
+	// renders and copies the next frames while the CPU writes the earlier
+	// ones.
+	glActiveTexture(GL_TEXTURE9);
+	FrameBuffer frame_buffer;
+	if (!FrameBuffer::CreateFrameBuffer(
+		&frame_buffer, width, height, GL_RGBA8)) {
+		return false;
+	}
+	const size_t slot_count =
+		std::min<size_t>(options.frames_in_flight, views.size());
+	const GLsizeiptr frame_bytes = static_cast<GLsizeiptr>(width) * height * 4;
+	PixelBuffers pixel_buffers;
+	if (!PixelBuffers::CreatePixelBuffers(
+		&pixel_buffers, slot_count, frame_bytes)) {
+		return false;
+	}
+	std::vector<GLsync>& fences = pixel_buffers.fences;
+
+	const GLuint model_mat_loc =
+		glGetUniformLocation(back_shader.program_id, "uWorldFromModel");
+	const GLuint model_mat_loc2 =
+		glGetUniformLocation(front_shader.program_id, "uWorldFromModel");
+	const GLuint model_from_view_loc =
+		glGetUniformLocation(front_shader.program_id, "uModelFromView");
+	const GLuint view_from_model_loc =
+		glGetUniformLocation(front_shader.program_id, "uViewFromModel");
+	glViewport(0, 0, width, height);
+	glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
+	glDisable(GL_BLEND);
+	glEnable(GL_CULL_FACE);
+	glFrontFace(GL_CCW);
+	glEnable(GL_DEPTH_TEST);
+	assert(CheckGlError());
+
+	Image image;
+	ResizeImage(&image, width, height);
+	times->frames_in_flight = slot_count;
+	// Waits for the frame of |view_index| and hands it to |on_frame|.
+	auto output_frame = [&](size_t view_index) {
+		const size_t slot = view_index % slot_count;
+		const auto wait_start = std::chrono::steady_clock::now();
+		GLenum wait_result = GL_TIMEOUT_EXPIRED;
+		while (wait_result == GL_TIMEOUT_EXPIRED) {
+			wait_result = glClientWaitSync(fences[slot],
+				GL_SYNC_FLUSH_COMMANDS_BIT, /* timeout_ns = */ 1000000000);
+		}
+		glDeleteSync(fences[slot]);
+		fences[slot] = nullptr;
+		if (wait_result == GL_WAIT_FAILED)
+			return false;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers.ids[slot]);
+		const uint8_t* pixels = static_cast<const uint8_t*>(glMapBufferRange(
+			GL_PIXEL_PACK_BUFFER, 0, frame_bytes, GL_MAP_READ_BIT));
+		if (!pixels) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			return false;
+		}
+		// GL rows go from the bottom up.
+		const size_t row_bytes = static_cast<size_t>(width) * 4;
+		for (int y = 0; y < height; ++y) {
+			std::copy(pixels + (height - 1 - y) * row_bytes,
+				pixels + (height - y) * row_bytes,
+				image.rgba.begin() + y * row_bytes);
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		const auto output_start = std::chrono::steady_clock::now();
+		const std::chrono::duration<double> wait_elapsed =
+			output_start - wait_start;
+		times->wait_seconds += wait_elapsed.count();
+
+		const bool output = on_frame(view_index, image);
+		const std::chrono::duration<double> output_elapsed =
+			std::chrono::steady_clock::now() - output_start;
+		times->output_seconds += output_elapsed.count();
+		return output;
+	};
+
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < views.size(); ++i) {
+		if (i >= slot_count && !output_frame(i - slot_count))
+			return false;
+
+		const auto queue_start = std::chrono::steady_clock::now();
+		const CameraView& view = views[i];
+		const CameraTransforms camera = GetCameraTransforms(info,
+			glm::radians(view.yaw_degrees), glm::radians(view.pitch_degrees),
+			width, height);
+		const glm::mat4& world_from_model = camera.world_from_model;
+		if (options.two_pass) {
+			glBindFramebuffer(GL_FRAMEBUFFER, back_face_buffer.id);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+			glUseProgram(back_shader.program_id);
+			glBindVertexArray(vertex_data.vao);
+			glCullFace(GL_FRONT);
+			glUniformMatrix4fv(model_mat_loc, 1, GL_FALSE, &world_from_model[0][0]);
+			glDrawElements(
+				GL_TRIANGLES, vertex_data.index_length, GL_UNSIGNED_BYTE, nullptr);
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, frame_buffer.id);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+		glUseProgram(front_shader.program_id);
+		glBindVertexArray(vertex_data.vao);
+		glUniformMatrix4fv(model_mat_loc2, 1, GL_FALSE, &world_from_model[0][0]);
+		const glm::mat4 view_from_model = camera.view_from_world * world_from_model;
+		const glm::mat4 model_from_view = glm::inverse(view_from_model);
+		glUniformMatrix4fv(
+			model_from_view_loc, 1, GL_FALSE, &model_from_view[0][0]);
+		glUniformMatrix4fv(
+			view_from_model_loc, 1, GL_FALSE, &view_from_model[0][0]);
+		glCullFace(GL_BACK);
+		glDrawElements(
+			GL_TRIANGLES, vertex_data.index_length, GL_UNSIGNED_BYTE, nullptr);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffers.ids[i % slot_count]);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		fences[i % slot_count] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		assert(CheckGlError());
+		const std::chrono::duration<double> queue_elapsed =
+			std::chrono::steady_clock::now() - queue_start;
+		times->queue_seconds += queue_elapsed.count();
+	}
+	for (size_t i = views.size() - slot_count; i < views.size(); ++i) {
+		if (!output_frame(i))
+			return false;
+	}
+	const std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+	times->total_seconds = elapsed.count();
+	return true;
+}
+
+bool RenderCameraListOnGpu(const Options& options, const VolumeInfo& info,
+	const Shader& back_shader, const Shader& front_shader,
+	const VertexData& vertex_data) {
+	std::vector<CameraView> views;
+	if (!LoadCameraList(options.camera_list_path, &views))
+		return false;
+
+	const auto write_frame = [&](size_t view_index, const Image& image) {
+		const std::string path = GetViewImagePath(views[view_index], view_index,
+			options.render_prefix, options.image_extension);
+		return WriteImage(path.c_str(), image);
+	};
+	GpuBatchTimes times;
+	if (!RenderViewsOnGpu(options, info, back_shader, front_shader,
+		vertex_data, views, write_frame, &times)) {
+		return false;
+	}
+
+	const double frame_count = static_cast<double>(views.size());
+	std::cout << "Rendered " << views.size() << " views of "
+		<< options.render_size[0] << "x" << options.render_size[1]
+		<< " on the GPU in " << times.total_seconds << " s, "
+		<< frame_count / times.total_seconds << " frames/s ("
+		<< times.queue_seconds * 1000.0 / frame_count << " ms queuing, "
+		<< times.wait_seconds * 1000.0 / frame_count
+		<< " ms waiting for the GPU and "
+		<< times.output_seconds * 1000.0 / frame_count << " ms writing per frame, "
+		<< times.frames_in_flight << " frames in flight)\n";
+	return true;
+}
+
+bool RunGoldenTest(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, const Shader& back_shader,
+	const Shader& front_shader, const VertexData& vertex_data) {
+	const std::vector<CameraView> views = GetGoldenViews();
+	const int width = static_cast<int>(options.render_size[0]);
+	const int height = static_cast<int>(options.render_size[1]);
+	GoldenThresholds thresholds;
+	thresholds.min_psnr = options.golden_min_psnr;
+	thresholds.min_ssim = options.golden_min_ssim;
+	// Goldens only match the rasterizer they were made with: software ones
+	// such as llvmpipe give the same images on every machine.
+	std::cout << "Golden test of " << views.size() << " views of " << width
+		<< "x" << height << " against " << options.golden_dir << " on "
+		<< glGetString(GL_RENDERER) << "\n";
+	std::vector<GoldenResult> results;
+
+	// The shading variants read the gradients of whichever kernel the CPU
+	// picks, which must not change them.
+	std::vector<uint8_t> gradient_texel_storage;
+	const bool gradients_passed = CheckGradientKernels(
+		GetLinearTexels(volume, conversion, &gradient_texel_storage),
+		volume.info.dims, conversion.target);
+
+	// The reference is the plain scalar raymarch at the default rate, one
+	// sample every half voxel.
+	Options reference_options = options;
+	reference_options.cpu_kernel = RaycastKernel::kScalar;
+	reference_options.sampling_rate = 1.0f;
+	std::vector<uint8_t> texel_storage;
+	CpuRaycaster raycaster;
+	if (!CreateVolumeRaycaster(
+		reference_options, volume, conversion, &texel_storage, &raycaster)) {
+		return false;
+	}
+	std::vector<Image> reference_images(views.size());
+	double reference_seconds = 0.0;
+	for (size_t i = 0; i < views.size(); ++i) {
+		ResizeImage(&reference_images[i], width, height);
+		TileScheduleStats stats;
+		CpuRaycaster::RenderImage(&raycaster, GetCameraTransforms(volume.info,
+			glm::radians(views[i].yaw_degrees),
+			glm::radians(views[i].pitch_degrees), width, height),
+			&reference_images[i], &stats);
+		reference_seconds += stats.wall_seconds;
+	}
+	GoldenResult reference_result;
+	reference_result.renderer = "cpu";
+	reference_result.variant = "reference";
+	reference_result.ms_per_view = reference_seconds * 1000.0 / views.size();
+	if (!CompareToGoldens(options.golden_dir, options.update_goldens,
+		thresholds, reference_images, nullptr, &reference_result)) {
+		return false;
+	}
+	results.push_back(reference_result);
+
+	const GLint step_loc =
+		glGetUniformLocation(front_shader.program_id, "uStepVoxels");
+	const GLint skip_empty_loc =
+		glGetUniformLocation(front_shader.program_id, "uSkipEmpty");
+	const GLint preintegrated_loc =
+		glGetUniformLocation(front_shader.program_id, "uPreintegrated");
+	const GLint two_pass_loc =
+		glGetUniformLocation(front_shader.program_id, "uTwoPass");
+	const GLint gradient_mode_loc =
+		glGetUniformLocation(front_shader.program_id, "uGradientMode");
+	// The precomputed gradients in each encoding, bound by the variants
+	// that read them.
+	Options rgba8_options = options;
+	rgba8_options.gradient_encoding = GradientEncoding::kRgba8;
+	Options octahedral_options = options;
+	octahedral_options.gradient_encoding = GradientEncoding::kOctahedral;
+	GLuint rgba8_gradient_tex_id = 0;
+	GLuint octahedral_gradient_tex_id = 0;
+	if (!CreateGradientTexture(
+			rgba8_options, volume, conversion, &rgba8_gradient_tex_id) ||
+		!CreateGradientTexture(octahedral_options, volume, conversion,
+			&octahedral_gradient_tex_id)) {
+		return false;
+	}
+	std::vector<std::vector<Image>> variant_images;
+	for (const GoldenVariant& variant : GetGoldenVariants()) {
+		Options variant_options = options;
+		variant_options.sampling_rate = variant.sampling_rate;
+		variant_options.skip_empty = variant.skip_empty;
+		variant_options.preintegrate = variant.preintegrate;
+		variant_options.shading = variant.shading;
+		variant_options.gradient_encoding = variant.gradient_encoding;
+		variant_options.two_pass = variant.two_pass;
+		glActiveTexture(GL_TEXTURE5);
+		glBindTexture(GL_TEXTURE_3D,
+			variant.gradient_encoding == GradientEncoding::kRgba8 ?
+				rgba8_gradient_tex_id : octahedral_gradient_tex_id);
+		glUseProgram(front_shader.program_id);
+		glUniform1f(step_loc, SampleStepVoxels(variant.sampling_rate, 0.0f));
+		glUniform1i(skip_empty_loc, variant.skip_empty ? 1 : 0);
+		glUniform1i(preintegrated_loc, variant.preintegrate ? 1 : 0);
+		glUniform1i(two_pass_loc, variant.two_pass ? 1 : 0);
+		glUniform1i(gradient_mode_loc,
+			GradientMode(variant_options, variant.precompute_gradients));
+		glUseProgram(0);
+
+		std::vector<Image> images(views.size());
+		const auto keep_frame = [&](size_t view_index, const Image& image) {
+			images[view_index] = image;
+			return true;
+		};
+		GpuBatchTimes times;
+		if (!RenderViewsOnGpu(variant_options, volume.info, back_shader,
+			front_shader, vertex_data, views, keep_frame, &times)) {
+			return false;
+		}
+		GoldenResult result;
+		result.renderer = "gl";
+		result.variant = variant.name;
+		result.matches_reference = variant.matches_cpu;
+		result.ms_per_view = times.total_seconds * 1000.0 / views.size();
+		if (!CompareToGoldens(options.golden_dir, options.update_goldens,
+			thresholds, images, &reference_images, &result)) {
+			return false;
+		}
+		results.push_back(result);
+		variant_images.push_back(std::move(images));
+	}
+	glDeleteTextures(1, &rgba8_gradient_tex_id);
+	glDeleteTextures(1, &octahedral_gradient_tex_id);
+
+	bool passed = PrintGoldenTable(results, thresholds);
+	// The orderings don't depend on the goldens, so new goldens keep them.
+	passed = CheckGoldenOrderings(variant_images) && passed;
+	passed = gradients_passed && passed;
+	if (options.update_goldens)
+		std::cout << "Wrote the goldens to " << options.golden_dir << "\n";
+	if (!passed)
+		std::cout << "Golden test FAILED\n";
+	return passed;
+}
+
+double AverageOrbitSamples(const Options& options, const VolumeInfo& info,
+	float volume_lod, const OccupancyGrid* occupancy_grid, int width,
+	int height) {
+	const int view_count = 8;
+	double samples = 0.0;
+	for (int i = 0; i < view_count; ++i) {
+		const CameraTransforms camera = GetCameraTransforms(info,
+			glm::radians(360.0f * i / view_count), 0.0f, width, height);
+		const RaySampleCounts counts = CountRaySamples(
+			glm::inverse(camera.proj_from_view * camera.view_from_world *
+				camera.world_from_model),
+			info.dims, SampleStepVoxels(options.sampling_rate, volume_lod),
+			width, height, occupancy_grid);
+		samples += occupancy_grid ? counts.occupied_samples : counts.samples;
+	}
+	return samples / view_count;
+}
+
+void SetVolumeUniforms(const Options& options, const VolumeInfo& info,
+	float volume_lod, bool precomputed_gradients, const Shader& front_shader) {
+	const GLuint program_id = front_shader.program_id;
+	glUseProgram(program_id);
+	glUniform1i(glGetUniformLocation(program_id, "uTwoPass"),
+		options.two_pass ? 1 : 0);
+	// Samplers of different types can't share a texture unit, even when
+	// they aren't read, so the optional textures keep their units when
+	// they are disabled.
+	glUniform1i(glGetUniformLocation(program_id, "occupancySampler"), 3);
+	glUniform1i(glGetUniformLocation(program_id, "preintegratedSampler"), 4);
+	glUniform1i(glGetUniformLocation(program_id, "gradientSampler"), 5);
+	glUniform1f(glGetUniformLocation(program_id, "uLoadedDepth"),
+		options.sync_load ? 1.0f : 0.0f);
+	glUniform1f(glGetUniformLocation(program_id, "uVolumeLod"), volume_lod);
+	glUniform1f(glGetUniformLocation(program_id, "uMinLod"), 0.0f);
+	// Step along the rays in voxels of the volume.
+	glUniform3f(glGetUniformLocation(program_id, "uVolumeDims"),
+		static_cast<float>(info.dims[0]), static_cast<float>(info.dims[1]),
+		static_cast<float>(info.dims[2]));
+	glUniform1f(glGetUniformLocation(program_id, "uStepVoxels"),
+		SampleStepVoxels(options.sampling_rate, 0.0f));
+	glUniform1f(glGetUniformLocation(program_id, "uReferenceStep"),
+		kReferenceStepVoxels);
+	glUniform1i(glGetUniformLocation(program_id, "uSkipEmpty"),
+		options.skip_empty ? 1 : 0);
+	glUniform1i(glGetUniformLocation(program_id, "uPreintegrated"),
+		options.preintegrate ? 1 : 0);
+	glUniform1i(glGetUniformLocation(program_id, "uGradientMode"),
+		GradientMode(options, precomputed_gradients));
+	if (options.shading) {
+		glUniform1f(glGetUniformLocation(program_id, "uMaxGradient"),
+			kMaxGradientMagnitude);
+		glUniform1f(glGetUniformLocation(program_id, "uFlatGradient"),
+			kFlatGradientMagnitude);
+	}
+	glUseProgram(0);
+}
+
+ViewUniforms GetViewUniforms(
+	const Shader& back_shader, const Shader& front_shader) {
+	ViewUniforms uniforms;
+	uniforms.back_world_from_model =
+		glGetUniformLocation(back_shader.program_id, "uWorldFromModel");
+	uniforms.world_from_model =
+		glGetUniformLocation(front_shader.program_id, "uWorldFromModel");
+	uniforms.model_from_view =
+		glGetUniformLocation(front_shader.program_id, "uModelFromView");
+	uniforms.view_from_model =
+		glGetUniformLocation(front_shader.program_id, "uViewFromModel");
+	uniforms.frame_index =
+		glGetUniformLocation(front_shader.program_id, "uFrameIndex");
+	return uniforms;
+}
+
+void UpdateOrbit(GLFWwindow* window, const Options& options,
+	int benchmark_frame, double time, float dt, Orbit* orbit) {
+	const double PI = std::acos(-1);
+	const double rotation_speed = PI / 2.0;
+	if (orbit->pause_key.Pressed(window, GLFW_KEY_SPACE))
+		orbit->rotating = !orbit->rotating;
+	float turn = orbit->rotating ? 1.0f : 0.0f;
+	if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+		turn -= 1.0f;
+	if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+		turn += 1.0f;
+	if (options.benchmark) {
+		orbit->angle = static_cast<float>(
+			2.0 * PI * benchmark_frame / options.benchmark_frames);
+		orbit->last_motion_time = time;
+	} else if (turn != 0.0f) {
+		orbit->angle += static_cast<float>(rotation_speed * turn * dt);
+		orbit->last_motion_time = time;
+	}
+}
+
+bool UpdateVolumeLoading(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, float volume_lod, double time,
+	float dt, const Shader& front_shader, VolumeTexture* volume_texture,
+	OccupancyTexture* occupancy, bool* scene_changed) {
+	VolumePyramid& pyramid = volume_texture->pyramid;
+	if (volume_texture->pyramid_pending && pyramid.IsReady()) {
+		volume_texture->pyramid_pending = false;
+		*scene_changed = true;
+		if (!VolumePyramid::UploadVolumePyramid(&pyramid, volume_texture->id))
+			return false;
+		if (pyramid.levels.empty()) {
+			std::cout << "Failed to build the volume pyramid.\n";
+		} else {
+			std::cout << "Pyramid of " << pyramid.levels.size()
+				<< " levels (" << MipFilterName(options.mip_filter) << ") ";
+			if (pyramid.from_cache) {
+				std::cout << "loaded from cache";
+			} else {
+				std::cout << "built in " << pyramid.build_seconds * 1000.0 << " ms";
+			}
+			std::cout << ", hashed in " << pyramid.hash_seconds * 1000.0
+				<< " ms, ready after " << time * 1000.0 << " ms\n";
+		}
+		if (volume_texture->streaming && !pyramid.levels.empty()) {
+			glUseProgram(front_shader.program_id);
+			glUniform1f(volume_texture->min_lod_loc, 1.0f);
+			if (!OccupancyTexture::SelectLod(
+				occupancy, std::max(volume_lod, 1.0f))) {
+				return false;
+			}
+		}
+	}
+
+	// Commit the slabs that finished loading since the last frame.
+	if (!volume_texture->streaming)
+		return true;
+	VolumeStreamer& streamer = volume_texture->streamer;
+	volume_texture->worst_loading_frame_time =
+		std::max(volume_texture->worst_loading_frame_time, dt);
+	*scene_changed = true;
+	if (!VolumeStreamer::UploadReadySlabs(&streamer, options.slabs_per_frame))
+		return false;
+	const bool coarse_preview =
+		!volume_texture->pyramid_pending && !pyramid.levels.empty();
+	glUseProgram(front_shader.program_id);
+	glUniform1f(volume_texture->loaded_depth_loc, coarse_preview ? 1.0f :
+		static_cast<float>(streamer.loaded_depth) / volume.info.dims[2]);
+	if (!streamer.IsComplete())
+		return true;
+	volume_texture->streaming = false;
+	glUniform1f(volume_texture->loaded_depth_loc, 1.0f);
+	glUniform1f(volume_texture->min_lod_loc, 0.0f);
+	if (!OccupancyTexture::SelectLod(occupancy, volume_lod))
+		return false;
+	std::cout << "Streamed " << volume.info.dims[0] << "x"
+		<< volume.info.dims[1] << "x" << volume.info.dims[2] << " "
+		<< VoxelTypeName(volume.info.type) << " volume ("
+		<< PayloadSize(volume.info) / (1024.0 * 1024.0) << " MB) in "
+		<< time * 1000.0 << " ms, first frame after "
+		<< volume_texture->first_frame_time * 1000.0 << " ms, worst frame while "
+		<< "loading " << volume_texture->worst_loading_frame_time * 1000.0
+		<< " ms\n";
+	if (!IsIdentityConversion(conversion)) {
+		std::cout << "Converted to " << TextureFormatName(conversion.target)
+			<< " at " << streamer.converted_bytes / 1e9 /
+			streamer.conversion_seconds << " GB/s ("
+			<< ConversionKernelName() << ")\n";
+	}
+	return true;
+}
+
+FrameResolution ChooseFrameResolution(const Options& options,
+	double still_ms, ResolutionGovernor* governor, int width, int height) {
+	FrameResolution resolution;
+	resolution.width = width;
+	resolution.height = height;
+	if (governor) {
+		ResolutionGovernor::Update(governor);
+		if (still_ms < options.refine_delay_ms) {
+			resolution.width = governor->ScaledSize(width);
+			resolution.height = governor->ScaledSize(height);
+		}
+	} else if (options.moving_scale > 1) {
+		if (still_ms == 0.0) {
+			resolution.width = width / options.moving_scale;
+			resolution.height = height / options.moving_scale;
+		} else if (still_ms < options.refine_delay_ms) {
+			resolution.width = width * 2 / options.moving_scale;
+			resolution.height = height * 2 / options.moving_scale;
+		}
+	}
+	resolution.reduced = resolution.width < width || resolution.height < height;
+	resolution.scale_x = static_cast<float>(resolution.width) / width;
+	resolution.scale_y = static_cast<float>(resolution.height) / height;
+	return resolution;
+}
+
+void DrawVolume(const Options& options, const Shader& back_shader,
+	const Shader& front_shader, const ViewUniforms& uniforms,
+	const VertexData& vertex_data, const FrameBuffer& back_face_buffer,
+	GLuint frame_buffer_id, bool blend, const glm::mat4& world_from_model,
+	const glm::mat4& view_from_model, int frame_index,
+	GpuPassTimer* pass_timer) {
+	// Enable back face culling. Front faces are CCW.
+	glEnable(GL_CULL_FACE);
+	glFrontFace(GL_CCW);
+
+	// First render pass, only in the two-pass mode.
+	if (options.two_pass) {
+		// Bind the first pass framebuffer.
+		glBindFramebuffer(GL_FRAMEBUFFER, back_face_buffer.id);
+		// Clear the curren viewport using the current clear color. The value
+		// passed to this function is a bitmask that defines which buffers
+		// are cleared. In this case only the color buffer is cleared.
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+		glEnable(GL_DEPTH_TEST);
+		// Setup the first pass.
+		glUseProgram(back_shader.program_id);
+		glBindVertexArray(vertex_data.vao);
+		// To render the inside of the cube, cull the front faces.
+		glCullFace(GL_FRONT);
+		// Rotate.
+		glUniformMatrix4fv(uniforms.back_world_from_model, 1, GL_FALSE,
+			&world_from_model[0][0]);
+		// Render first pass to texture.
+		glDrawElements(
+			GL_TRIANGLES, vertex_data.index_length, GL_UNSIGNED_BYTE, nullptr);
+		GpuPassTimer::EndPass(pass_timer, GpuPass::kBackFaces);
+	}
+
+	// Second render pass.
+	glBindFramebuffer(GL_FRAMEBUFFER, frame_buffer_id);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+	if (!blend)
+		glDisable(GL_BLEND);
+	// Setup the second pass.
+	glUseProgram(front_shader.program_id);
+	glBindVertexArray(vertex_data.vao);
+	// Rotate.
+	glUniformMatrix4fv(
+		uniforms.world_from_model, 1, GL_FALSE, &world_from_model[0][0]);
+	// The single-pass mode intersects the view rays with the cube in the
+	// volume's own space.
+	const glm::mat4 model_from_view = glm::inverse(view_from_model);
+	glUniformMatrix4fv(
+		uniforms.model_from_view, 1, GL_FALSE, &model_from_view[0][0]);
+	glUniformMatrix4fv(
+		uniforms.view_from_model, 1, GL_FALSE, &view_from_model[0][0]);
+	glUniform1i(uniforms.frame_index, frame_index);
+	// To render the outside of the cube, cull the back faces.
+	glCullFace(GL_BACK);
+	// Render the second pass to the main framebuffer.
+	glDrawElements(
+		GL_TRIANGLES, vertex_data.index_length, GL_UNSIGNED_BYTE, nullptr);
+	GpuPassTimer::EndPass(pass_timer, GpuPass::kRaymarch);
+}
+
+void UpdateFrameReport(GLFWwindow* window, const Options& options,
+	bool precomputed_gradients, double time, ResolutionGovernor* governor,
+	GpuPassTimer* pass_timer, FrameReport* report) {
+	// The pass times in the title are updated more often than the report.
+	const double report_interval = 5.0;
+	const double title_interval = 0.5;
+	if (options.gpu_timers_title && time - report->title_time >= title_interval) {
+		glfwSetWindowTitle(window, ("Voxels - " + pass_timer->Summary()).c_str());
+		report->title_time = time;
+	}
+	++report->frame_count;
+	if (time - report->time < report_interval)
+		return;
+
+	const int frame_count = report->frame_count;
+	std::cout << "Average frame time "
+		<< (time - report->time) * 1000.0 / frame_count
+		<< " ms over " << frame_count << " frames, "
+		<< (options.skip_empty ? "skipping" : "marching through")
+		<< " empty bricks, "
+		<< (!options.shading ? "unlit" : precomputed_gradients ?
+			"precomputed gradients" : "on-the-fly gradients") << ", "
+		<< 100 * report->reduced_frame_count / frame_count
+		<< "% at reduced resolution";
+	if (options.samples_per_pixel > 1) {
+		std::cout << ", " << 100 * report->converged_frame_count / frame_count
+			<< "% showing the converged average";
+	}
+	std::cout << "\n";
+	if (governor && governor->stats.frame_count > 0) {
+		const ResolutionGovernor::Stats& stats = governor->stats;
+		std::cout << "Resolution scale " << stats.scale_sum / stats.frame_count
+			<< " (" << stats.scale_min << " to " << stats.scale_max
+			<< ") for a " << options.target_frame_ms << " ms target, GPU "
+			<< stats.gpu_ms_sum / stats.frame_count << " ms average, "
+			<< stats.gpu_ms_max << " ms worst, CPU "
+			<< stats.cpu_ms_sum / stats.frame_count << " ms average over "
+			<< stats.frame_count << " timed frames\n";
+		governor->ResetStats();
+	}
+	const GpuPassTimer::Stats& pass_stats = pass_timer->stats;
+	if (pass_stats.frame_count > 0) {
+		std::cout << "GPU passes over " << pass_stats.frame_count
+			<< " timed frames:";
+		for (size_t pass = 0; pass < kGpuPassCount; ++pass) {
+			const int count = pass_stats.pass_counts[pass];
+			if (count == 0)
+				continue;
+			std::cout << " " << GpuPassName(static_cast<GpuPass>(pass)) << " "
+				<< pass_stats.pass_ms_sums[pass] / count << " ms ("
+				<< pass_stats.pass_ms_maxes[pass] << " worst)";
+		}
+		std::cout << ", " << pass_stats.frame_ms_sum / pass_stats.frame_count
+			<< " ms per frame\n";
+		pass_timer->ResetStats();
+	}
+	report->time = time;
+	report->frame_count = 0;
+	report->reduced_frame_count = 0;
+	report->converged_frame_count = 0;
+}
+
+bool EndBenchmarkFrame(const Options& options, bool loading,
+	BenchmarkRun* run) {
+	// Finish every frame so that its time is its own.
+	glFinish();
+	const double frame_end = glfwGetTime();
+	if (!loading) {
+		if (run->frame >= 0) {
+			run->benchmark.frame_ms.push_back(
+				static_cast<float>((frame_end - run->frame_end) * 1000.0));
+		}
+		++run->frame;
+	}
+	run->frame_end = frame_end;
+	return run->frame != static_cast<int>(options.benchmark_frames);
+}
+
+void FinishFrameBenchmark(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, const GLubyte* renderer,
+	float volume_lod, bool precomputed_gradients,
+	const OccupancyTexture& occupancy, int width, int height,
+	FrameBenchmark* benchmark) {
+	benchmark->renderer = reinterpret_cast<const char*>(renderer);
+	benchmark->volume_path = options.volume_path;
+	std::copy(volume.info.dims, volume.info.dims + 3, benchmark->dims);
+	benchmark->width = width;
+	benchmark->height = height;
+	benchmark->settings = {
+		{"texture_format", TextureFormatName(conversion.target), true},
+		{"sampling_rate", std::to_string(options.sampling_rate)},
+		{"volume_lod", std::to_string(volume_lod)},
+		{"two_pass", options.two_pass ? "true" : "false"},
+		{"skip_empty", options.skip_empty ? "true" : "false"},
+		{"preintegrate", options.preintegrate ? "true" : "false"},
+		{"shading", !options.shading ? "off" : precomputed_gradients ?
+			"precomputed" : "on-the-fly", true},
+		{"samples_per_pixel", std::to_string(options.samples_per_pixel)},
+	};
+	benchmark->warmup_frames = static_cast<int>(options.benchmark_warmup);
+	benchmark->samples_per_frame = AverageOrbitSamples(options, volume.info,
+		volume_lod, occupancy.GridForLod(volume_lod), width, height);
+	PrintFrameBenchmark(*benchmark);
+	WriteFrameBenchmarkJson(options.benchmark_json_path, *benchmark);
+}
+
+float VolumeLod(const uint32_t dims[3], int height) {
+	// The longest side of the volume is 3 units long and 10 units away from
+	// a camera with a vertical field of view of 45 degrees.
+	const float longest_side_pixels =
+		3.0f / (2.0f * 10.0f * std::tan(glm::radians(22.5f))) * height;
+	const float longest_side_voxels = static_cast<float>(
+		std::max(dims[0], std::max(dims[1], dims[2])));
+	return std::max(std::log2(longest_side_voxels / longest_side_pixels), 0.0f);
+}
+
 bool CreateFrameBufferTexture(
 	const Shader& shader, int width, int height, FrameBuffer* frame_buffer) {
-	if (!FrameBuffer::CreateFrameBuffer(frame_buffer, width, height)) {
+	if (!FrameBuffer::CreateFrameBuffer(frame_buffer, width, height, GL_RGB)) {
 		assert(false);
 		return false;
 	}
@@ -449,15 +1980,16 @@ bool CreateFrameBufferTexture(
 	// Unbind the program for cleanup.
 	// Don't unbind the texture from the unit 0.
 	glUseProgram(0);
-	assert(CheckGlError());
+	return CheckGlError();
 }
 
 // TODO(dandov): Modify this to have mipmaps and other stuff when needed.
-bool Texture::CreateTexture(Texture* texture, int width, int height, void* data) {
+bool Texture::CreateTexture(Texture* texture, int width, int height,
+	GLint internal_format, void* data) {
 	// Create the texture.
 	glGenTextures(1, &texture->id);
 	glBindTexture(GL_TEXTURE_2D, texture->id);
-	glTexImage2D(GL_TEXTURE_2D, /* level = */ 0, GL_RGB, width, height,
+	glTexImage2D(GL_TEXTURE_2D, /* level = */ 0, internal_format, width, height,
 		/* border = */ 0, GL_RGB, GL_FLOAT, data);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -473,11 +2005,13 @@ void Texture::DestroyTexture(Texture* texture) {
 }
 
 
-bool FrameBuffer::CreateFrameBuffer(FrameBuffer* frame_buffer, int width, int height) {
+bool FrameBuffer::CreateFrameBuffer(FrameBuffer* frame_buffer, int width,
+	int height, GLint internal_format) {
 	glGenFramebuffers(1, &frame_buffer->id);
 	glBindFramebuffer(GL_FRAMEBUFFER, frame_buffer->id);
 
-	if (!Texture::CreateTexture(&frame_buffer->texture, width, height, nullptr)) {
+	if (!Texture::CreateTexture(
+		&frame_buffer->texture, width, height, internal_format, nullptr)) {
 		assert(false);
 		return false;
 	}
@@ -512,6 +2046,421 @@ bool FrameBuffer::CreateFrameBuffer(FrameBuffer* frame_buffer, int width, int he
 void FrameBuffer::DestroyFrameBuffer(FrameBuffer* frame_buffer) {
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	glDeleteFramebuffers(1, &frame_buffer->id);
+	glDeleteRenderbuffers(1, &frame_buffer->depth_stencil_renderbuffer_id);
+}
+
+bool PixelBuffers::CreatePixelBuffers(
+	PixelBuffers* pixel_buffers, size_t count, GLsizeiptr size) {
+	pixel_buffers->ids.resize(count);
+	pixel_buffers->fences.assign(count, nullptr);
+	glGenBuffers(static_cast<GLsizei>(count), pixel_buffers->ids.data());
+	for (GLuint id : pixel_buffers->ids) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, id);
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	return CheckGlError();
+}
+
+void PixelBuffers::DestroyPixelBuffers(PixelBuffers* pixel_buffers) {
+	// Frames still in flight when a batch stops early.
+	for (GLsync fence : pixel_buffers->fences) {
+		if (fence)
+			glDeleteSync(fence);
+	}
+	glDeleteBuffers(static_cast<GLsizei>(pixel_buffers->ids.size()),
+		pixel_buffers->ids.data());
+}
+
+bool KeyPress::Pressed(GLFWwindow* window, int key) {
+	const bool was_down = down;
+	down = glfwGetKey(window, key) == GLFW_PRESS;
+	return down && !was_down;
+}
+
+bool ReducedFrame::CreateReducedFrame(ReducedFrame* reduced_frame, int width,
+	int height, bool accumulate) {
+	if (!FrameBuffer::CreateFrameBuffer(&reduced_frame->buffer, width, height,
+			accumulate ? GL_RGBA16F : GL_RGB) ||
+		!Shader::CreateShaders(&reduced_frame->shader,
+			shaders::UPSAMPLE_VERTEX_SHADER, shaders::UPSAMPLE_FRAGMENT_SHADER)) {
+		return false;
+	}
+	const GLuint program_id = reduced_frame->shader.program_id;
+	glActiveTexture(GL_TEXTURE6);
+	glBindTexture(GL_TEXTURE_2D, reduced_frame->buffer.texture.id);
+	glUseProgram(program_id);
+	glUniform1i(glGetUniformLocation(program_id, "reducedSampler"), 6);
+	glUniform2f(glGetUniformLocation(program_id, "uScreenSize"),
+		static_cast<float>(width), static_cast<float>(height));
+	reduced_frame->scale_loc = glGetUniformLocation(program_id, "uReducedScale");
+	glUseProgram(0);
+	return CheckGlError();
+}
+
+void ReducedFrame::DrawToWindow(const ReducedFrame& reduced_frame, int width,
+	int height, float scale_x, float scale_y) {
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, width, height);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glUseProgram(reduced_frame.shader.program_id);
+	glUniform2f(reduced_frame.scale_loc, scale_x, scale_y);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glEnable(GL_BLEND);
+}
+
+bool Accumulator::CreateAccumulator(Accumulator* accumulator, int width,
+	int height, float aspect_ratio, int samples_per_pixel,
+	const Shader& front_shader, const ReducedFrame& reduced_frame) {
+	accumulator->width = width;
+	accumulator->height = height;
+	accumulator->proj_from_view = GetProjFromView(aspect_ratio);
+	accumulator->samples_per_pixel = samples_per_pixel;
+
+	// Creating the textures unbinds the active unit.
+	glActiveTexture(GL_TEXTURE7);
+	if (!FrameBuffer::CreateFrameBuffer(
+			&accumulator->history_buffers[0], width, height, GL_RGBA16F) ||
+		!FrameBuffer::CreateFrameBuffer(
+			&accumulator->history_buffers[1], width, height, GL_RGBA16F) ||
+		!Shader::CreateShaders(&accumulator->shader,
+			shaders::UPSAMPLE_VERTEX_SHADER,
+			shaders::ACCUMULATE_FRAGMENT_SHADER)) {
+		return false;
+	}
+	glBindTexture(GL_TEXTURE_2D, accumulator->history_buffers[0].texture.id);
+	const GLuint program_id = accumulator->shader.program_id;
+	glUseProgram(program_id);
+	glUniform1i(glGetUniformLocation(program_id, "frameSampler"), 6);
+	glUniform1i(glGetUniformLocation(program_id, "historySampler"), 7);
+	glUniform2f(glGetUniformLocation(program_id, "uScreenSize"),
+		static_cast<float>(width), static_cast<float>(height));
+	glUniform2f(glGetUniformLocation(program_id, "uProjScale"),
+		accumulator->proj_from_view[0][0], accumulator->proj_from_view[1][1]);
+	accumulator->scale_loc = glGetUniformLocation(program_id, "uReducedScale");
+	accumulator->frame_weight_loc =
+		glGetUniformLocation(program_id, "uFrameWeight");
+	accumulator->reproject_loc = glGetUniformLocation(program_id, "uReproject");
+	accumulator->previous_clip_from_view_loc =
+		glGetUniformLocation(program_id, "uPreviousClipFromView");
+	// The window shows the latest average.
+	glUseProgram(reduced_frame.shader.program_id);
+	glUniform1i(glGetUniformLocation(
+		reduced_frame.shader.program_id, "reducedSampler"), 7);
+
+	const double noise_start_time = glfwGetTime();
+	std::vector<uint16_t> blue_noise;
+	GenerateBlueNoise(kBlueNoiseSize, &blue_noise);
+	const double noise_seconds = glfwGetTime() - noise_start_time;
+	glGenTextures(1, &accumulator->blue_noise_tex_id);
+	glActiveTexture(GL_TEXTURE8);
+	glBindTexture(GL_TEXTURE_2D, accumulator->blue_noise_tex_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, kBlueNoiseSize, kBlueNoiseSize,
+		0, GL_RED, GL_UNSIGNED_SHORT, blue_noise.data());
+	std::cout << "Generated " << kBlueNoiseSize << "x" << kBlueNoiseSize
+		<< " blue noise in " << noise_seconds * 1000.0 << " ms, up to "
+		<< samples_per_pixel << " frames per pixel\n";
+	glUseProgram(front_shader.program_id);
+	glUniform1i(
+		glGetUniformLocation(front_shader.program_id, "blueNoiseSampler"), 8);
+	glUniform1i(glGetUniformLocation(front_shader.program_id, "uJitter"), 1);
+	glUniform1i(glGetUniformLocation(front_shader.program_id, "uWriteDepth"), 1);
+	glUseProgram(0);
+	return CheckGlError();
+}
+
+void Accumulator::BeginFrame(Accumulator* accumulator, bool reduced,
+	bool moving, bool scene_changed) {
+	// Frames at a reduced resolution replace the history, its blur is worse
+	// than their noise. At full resolution each frame takes a fixed share of
+	// the reprojected history while the view moves, and once it is still the
+	// frames are averaged evenly, from the first one, until every pixel has
+	// its samples.
+	const float moving_frame_weight = 0.5f;
+	accumulator->frame_weight = 1.0f;
+	accumulator->reproject = false;
+	accumulator->converged = false;
+	if (reduced) {
+		accumulator->accumulated_frames = 0;
+	} else if (moving) {
+		accumulator->accumulated_frames = 0;
+		accumulator->reproject = accumulator->history_valid;
+		if (accumulator->history_valid)
+			accumulator->frame_weight = moving_frame_weight;
+	} else {
+		if (scene_changed)
+			accumulator->accumulated_frames = 0;
+		accumulator->converged =
+			accumulator->accumulated_frames >= accumulator->samples_per_pixel;
+		if (!accumulator->converged)
+			accumulator->frame_weight = 1.0f / ++accumulator->accumulated_frames;
+	}
+}
+
+void Accumulator::BlendFrame(Accumulator* accumulator,
+	const glm::mat4& view_from_model, float scale_x, float scale_y) {
+	const int history_index = accumulator->history_index;
+	glBindFramebuffer(
+		GL_FRAMEBUFFER, accumulator->history_buffers[1 - history_index].id);
+	glViewport(0, 0, accumulator->width, accumulator->height);
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(accumulator->shader.program_id);
+	glUniform2f(accumulator->scale_loc, scale_x, scale_y);
+	glUniform1f(accumulator->frame_weight_loc, accumulator->frame_weight);
+	glUniform1i(accumulator->reproject_loc, accumulator->reproject ? 1 : 0);
+	const glm::mat4 previous_clip_from_view = accumulator->proj_from_view *
+		accumulator->previous_view_from_model * glm::inverse(view_from_model);
+	glUniformMatrix4fv(accumulator->previous_clip_from_view_loc, 1, GL_FALSE,
+		&previous_clip_from_view[0][0]);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	accumulator->history_index = 1 - history_index;
+	accumulator->history_valid = true;
+	accumulator->previous_view_from_model = view_from_model;
+	glActiveTexture(GL_TEXTURE7);
+	glBindTexture(GL_TEXTURE_2D,
+		accumulator->history_buffers[accumulator->history_index].texture.id);
+}
+
+void Accumulator::DestroyAccumulator(Accumulator* accumulator) {
+	glDeleteTextures(1, &accumulator->blue_noise_tex_id);
+}
+
+bool TransferFunctionTextures::CreateTransferFunctionTextures(
+	TransferFunctionTextures* transfer_function, TextureFormat target,
+	bool preintegrate, const Shader& front_shader) {
+	// Read the transfer function. Volumes with more than 8 bits per voxel
+	// get a bigger table so that their precision isn't thrown away.
+	const size_t tff_size = target == TextureFormat::kR8 ?
+		kTransferFunctionSize8 : kTransferFunctionSize16;
+	std::vector<uint8_t>& tff_data = transfer_function->data;
+	if (!LoadTransferFunction("tff.dat", tff_size, &tff_data))
+		return false;
+
+	// Create texture and upload data to GPU.
+	glGenTextures(1, &transfer_function->tff_tex_id);
+	glBindTexture(GL_TEXTURE_1D, transfer_function->tff_tex_id);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	// For debugging GL_NEAREST makes 1.0 wrap to the initial value (a purplish color).
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	// Sets how to read pixels. In this case reading 1 byte pixels.
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA8, static_cast<GLsizei>(tff_size),
+		0, GL_RGBA, GL_UNSIGNED_BYTE, tff_data.data());
+
+	// Set the TFF texture uniform and bind it to texture unit 1.
+	glUseProgram(front_shader.program_id);
+	const GLuint tff_mat_loc =
+		glGetUniformLocation(front_shader.program_id, "tffSampler");
+	glActiveTexture(GL_TEXTURE0 + 1); // This is the same as GL_TEXTURE1.
+	glBindTexture(GL_TEXTURE_1D, transfer_function->tff_tex_id);
+	// Assign the texture unit to the sampler. 0 matches the active texture
+	// GL_TEXTURE1.
+	glUniform1i(tff_mat_loc, 1);
+	glUseProgram(0);
+	if (!CheckGlError())
+		return false;
+
+	// Pre-integrate the transfer function into a 2D table of segments.
+	transfer_function->preintegrated_size = static_cast<GLsizei>(
+		std::min(tff_data.size() / 4, kPreintegratedTableSize));
+	if (!preintegrate)
+		return true;
+	const GLsizei preintegrated_size = transfer_function->preintegrated_size;
+	const double build_start_time = glfwGetTime();
+	PreintegrateTransferFunction(
+		tff_data, preintegrated_size, &transfer_function->preintegrated_table);
+	const double build_seconds = glfwGetTime() - build_start_time;
+	glGenTextures(1, &transfer_function->preintegrated_tex_id);
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_2D, transfer_function->preintegrated_tex_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, preintegrated_size,
+		preintegrated_size, 0, GL_RGBA, GL_FLOAT,
+		transfer_function->preintegrated_table.data());
+	std::cout << "Pre-integrated the transfer function into a "
+		<< preintegrated_size << "x" << preintegrated_size << " table in "
+		<< build_seconds * 1000.0 << " ms\n";
+	return CheckGlError();
+}
+
+void TransferFunctionTextures::UpdateTransferFunctionTextures(
+	TransferFunctionTextures* transfer_function) {
+	const std::vector<uint8_t>& tff_data = transfer_function->data;
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_1D, transfer_function->tff_tex_id);
+	glTexSubImage1D(GL_TEXTURE_1D, 0, 0,
+		static_cast<GLsizei>(tff_data.size() / 4), GL_RGBA,
+		GL_UNSIGNED_BYTE, tff_data.data());
+	if (transfer_function->preintegrated_tex_id == 0)
+		return;
+	const GLsizei preintegrated_size = transfer_function->preintegrated_size;
+	const double build_start_time = glfwGetTime();
+	PreintegrateTransferFunction(
+		tff_data, preintegrated_size, &transfer_function->preintegrated_table);
+	const double build_seconds = glfwGetTime() - build_start_time;
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_2D, transfer_function->preintegrated_tex_id);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, preintegrated_size,
+		preintegrated_size, GL_RGBA, GL_FLOAT,
+		transfer_function->preintegrated_table.data());
+	std::cout << ", pre-integrated in " << build_seconds * 1000.0 << " ms";
+}
+
+void TransferFunctionTextures::DestroyTransferFunctionTextures(
+	TransferFunctionTextures* transfer_function) {
+	glDeleteTextures(1, &transfer_function->tff_tex_id);
+	glDeleteTextures(1, &transfer_function->preintegrated_tex_id);
+}
+
+bool OccupancyTexture::CreateOccupancyTexture(OccupancyTexture* occupancy,
+	const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, const std::vector<uint8_t>& tff_data,
+	float max_lod, float lod, const Shader& front_shader) {
+	std::vector<OccupancyGrid>& grids = occupancy->grids;
+	std::vector<uint8_t> texel_storage;
+	const uint8_t* texels = GetLinearTexels(volume, conversion, &texel_storage);
+	grids.resize(static_cast<size_t>(std::ceil(max_lod)) + 1);
+	if (!OccupancyGrid::CreateOccupancyGrid(
+		&grids[0], texels, volume.info.dims, conversion.target)) {
+		return false;
+	}
+	for (size_t i = 1; i < grids.size(); ++i) {
+		OccupancyGrid::CreateMipOccupancyGrid(&grids[i], grids[0],
+			volume.info.dims, options.mip_filter, static_cast<uint32_t>(i));
+	}
+	for (OccupancyGrid& grid : grids)
+		OccupancyGrid::UpdateOccupancy(&grid, tff_data);
+	glGenTextures(1, &occupancy->texture_id);
+	occupancy->index = occupancy->GridIndex(lod);
+	if (!OccupancyGrid::UploadOccupancy(
+		&grids[occupancy->index], occupancy->texture_id)) {
+		return false;
+	}
+	const OccupancyGrid::Level& bricks = grids[0].levels[0];
+	std::cout << "Occupancy hierarchy of " << grids[0].levels.size()
+		<< " levels over " << bricks.dims[0] << "x" << bricks.dims[1] << "x"
+		<< bricks.dims[2] << " bricks built in "
+		<< grids[0].build_seconds * 1000.0 << " ms, "
+		<< grids[0].occupied_count << " visible, updated in "
+		<< grids[0].update_seconds * 1000.0 << " ms\n";
+	for (size_t i = 1; i < grids.size(); ++i) {
+		std::cout << "Occupancy of mip level " << i << " built in "
+			<< grids[i].build_seconds * 1000.0 << " ms, "
+			<< grids[i].occupied_count << " visible\n";
+	}
+	// Bind the occupancy texture to texture unit 3.
+	glUseProgram(front_shader.program_id);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_3D, occupancy->texture_id);
+	glUniform1f(glGetUniformLocation(front_shader.program_id, "uBrickSize"),
+		static_cast<float>(kOccupancyBrickSize));
+	glUniform3i(glGetUniformLocation(front_shader.program_id, "uBrickCounts"),
+		bricks.dims[0], bricks.dims[1], bricks.dims[2]);
+	glUniform1i(
+		glGetUniformLocation(front_shader.program_id, "uOccupancyLevels"),
+		static_cast<GLint>(grids[0].levels.size()));
+	glUseProgram(0);
+	return CheckGlError();
+}
+
+bool OccupancyTexture::UpdateOccupancyTexture(
+	OccupancyTexture* occupancy, const std::vector<uint8_t>& tff_data) {
+	if (occupancy->grids.empty())
+		return true;
+	// The grids of the other levels are uploaded whole when the rays sample
+	// them.
+	for (OccupancyGrid& grid : occupancy->grids)
+		OccupancyGrid::UpdateOccupancy(&grid, tff_data);
+	OccupancyGrid* grid = &occupancy->grids[occupancy->index];
+	if (!OccupancyGrid::UploadOccupancy(grid, occupancy->texture_id))
+		return false;
+	std::cout << ", " << grid->changed_count << " bricks changed in "
+		<< grid->update_seconds * 1000.0 << " ms, "
+		<< grid->occupied_count << " visible";
+	return true;
+}
+
+bool OccupancyTexture::SelectLod(OccupancyTexture* occupancy, float lod) {
+	if (occupancy->grids.empty())
+		return true;
+	const size_t index = occupancy->GridIndex(lod);
+	if (index == occupancy->index)
+		return true;
+	occupancy->index = index;
+	// The texture holds another grid, this one is uploaded whole.
+	OccupancyGrid* grid = &occupancy->grids[index];
+	grid->uploaded = false;
+	return OccupancyGrid::UploadOccupancy(grid, occupancy->texture_id);
+}
+
+const OccupancyGrid* OccupancyTexture::GridForLod(float lod) const {
+	return grids.empty() ? nullptr : &grids[GridIndex(lod)];
+}
+
+size_t OccupancyTexture::GridIndex(float lod) const {
+	return std::min(static_cast<size_t>(std::ceil(lod)), grids.size() - 1);
+}
+
+void OccupancyTexture::DestroyOccupancyTexture(OccupancyTexture* occupancy) {
+	glDeleteTextures(1, &occupancy->texture_id);
+}
+
+bool VolumeTexture::CreateVolumeTexture(VolumeTexture* volume_texture,
+	const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, const Shader& front_shader) {
+	// Create texture and upload the mapped voxels to the GPU.
+	const double load_start_time = glfwGetTime();
+	glGenTextures(1, &volume_texture->id);
+	glBindTexture(GL_TEXTURE_3D, volume_texture->id);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	// Only the base level exists until the pyramid is uploaded.
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+	assert(CheckGlError());
+	volume_texture->streaming = !options.sync_load;
+	if (options.sync_load) {
+		if (!UploadVolumeTexture(volume, conversion))
+			return false;
+		std::cout << "Uploaded " << volume.info.dims[0] << "x"
+			<< volume.info.dims[1] << "x" << volume.info.dims[2] << " "
+			<< VoxelTypeName(volume.info.type) << " volume ("
+			<< PayloadSize(volume.info) / (1024.0 * 1024.0) << " MB) as "
+			<< TextureFormatName(conversion.target) << " in "
+			<< (glfwGetTime() - load_start_time) * 1000.0 << " ms\n";
+	} else if (!VolumeStreamer::CreateVolumeStreamer(&volume_texture->streamer,
+		&volume, conversion, volume_texture->id, /* buffer_count = */ 4)) {
+		return false;
+	}
+	// Set the voxel texture uniform and bind it to texture unit 2.
+	glUseProgram(front_shader.program_id);
+	const GLuint voxel_tex_loc =
+		glGetUniformLocation(front_shader.program_id, "voxelSampler");
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_3D, volume_texture->id);
+	// Assign the texture unit to the sampler. 0 matches the active texture
+	// GL_TEXTURE1.
+	glUniform1i(voxel_tex_loc, 2);
+	volume_texture->loaded_depth_loc =
+		glGetUniformLocation(front_shader.program_id, "uLoadedDepth");
+	volume_texture->min_lod_loc =
+		glGetUniformLocation(front_shader.program_id, "uMinLod");
+	glUseProgram(0);
+	return CheckGlError();
+}
+
+void VolumeTexture::DestroyVolumeTexture(VolumeTexture* volume_texture) {
+	glDeleteTextures(1, &volume_texture->id);
 }
 
 bool CheckShaderStatus(GLuint shader) {
@@ -591,6 +2540,9 @@ bool Shader::CreateShaders(Shader* shader, const GLchar* vertex,
 }
 
 void Shader::DestroyShaders(Shader* shader) {
+	// Shaders only created for some options may never have been.
+	if (shader->program_id == 0)
+		return;
 	// Unbind the program in case it is being used.
 	glUseProgram(0);
 	// Detach the shaders from the program and delete them.
@@ -741,4 +2693,102 @@ bool Window::CreateWindow(Window* window, int width, int height) {
 void Window::DestroyWindow(Window* window) {
 	glfwDestroyWindow(window->handle);
 	glfwTerminate();
-}
\ No newline at end of file
+}
+
+bool UploadVolumeTexture(
+	const VolumeFile& volume, const VoxelConversion& conversion) {
+	const ProfileScope scope("UploadVolumeTexture");
+	const VolumeInfo& info = volume.info;
+	GLint internal_format;
+	GLenum pixel_type;
+	GetGlTextureFormat(conversion.target, &internal_format, &pixel_type);
+
+	// Convert the whole payload up front if the texture format differs.
+	const uint8_t* voxels = volume.voxels;
+	std::vector<uint8_t> converted;
+	if (!IsIdentityConversion(conversion)) {
+		const size_t voxel_count =
+			PayloadSize(info) / VoxelTypeSize(info.type);
+		converted.resize(voxel_count * TextureFormatSize(conversion.target));
+		const double start_time = glfwGetTime();
+		ConvertVoxels(conversion, volume.voxels, converted.data(), voxel_count);
+		std::cout << "Converted to " << TextureFormatName(conversion.target)
+			<< " at " << PayloadSize(info) / 1e9 / (glfwGetTime() - start_time)
+			<< " GB/s (" << ConversionKernelName() << ")\n";
+		voxels = converted.data();
+	}
+	// Voxels are tightly packed.
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	if (!IsBricked(info)) {
+		glTexImage3D(GL_TEXTURE_3D, 0, internal_format, info.dims[0],
+			info.dims[1], info.dims[2], 0, GL_RED, pixel_type, voxels);
+		return CheckGlError();
+	}
+
+	// Allocate the texture and copy each brick into place. The bricks on the
+	// upper edges are padded, so the unpack row length and image height are
+	// set to the brick size and only the part inside the volume is copied.
+	glTexImage3D(GL_TEXTURE_3D, 0, internal_format, info.dims[0],
+		info.dims[1], info.dims[2], 0, GL_RED, pixel_type, nullptr);
+	const uint32_t* brick = info.brick_dims;
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, brick[0]);
+	glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, brick[1]);
+	const size_t brick_size =
+		static_cast<size_t>(brick[0]) * brick[1] * brick[2] *
+		TextureFormatSize(conversion.target);
+	const uint8_t* brick_data = voxels;
+	for (uint32_t z = 0; z < info.dims[2]; z += brick[2]) {
+		for (uint32_t y = 0; y < info.dims[1]; y += brick[1]) {
+			for (uint32_t x = 0; x < info.dims[0]; x += brick[0]) {
+				glTexSubImage3D(GL_TEXTURE_3D, 0, x, y, z,
+					std::min(brick[0], info.dims[0] - x),
+					std::min(brick[1], info.dims[1] - y),
+					std::min(brick[2], info.dims[2] - z),
+					GL_RED, pixel_type, brick_data);
+				brick_data += brick_size;
+			}
+		}
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+
+	return CheckGlError();
+}
+
+bool CreateGradientTexture(const Options& options, const VolumeFile& volume,
+	const VoxelConversion& conversion, GLuint* texture_id) {
+	std::vector<uint8_t> texel_storage;
+	const uint8_t* texels = GetLinearTexels(volume, conversion, &texel_storage);
+	GradientVolume gradients;
+	if (!GradientVolume::CreateGradientVolume(&gradients, texels,
+		volume.info.dims, conversion.target, options.gradient_filter,
+		options.gradient_encoding)) {
+		return false;
+	}
+	glGenTextures(1, texture_id);
+	if (!GradientVolume::UploadGradientVolume(gradients, *texture_id))
+		return false;
+	glActiveTexture(GL_TEXTURE5);
+	glBindTexture(GL_TEXTURE_3D, *texture_id);
+
+	const double volume_size = static_cast<double>(volume.info.dims[0]) *
+		volume.info.dims[1] * volume.info.dims[2] *
+		TextureFormatSize(conversion.target);
+	std::cout << "Gradients (" << GradientFilterName(gradients.filter) << ", "
+		<< GradientEncodingName(gradients.encoding) << ") built in "
+		<< gradients.build_seconds * 1000.0 << " ms (" << gradients.kernel_name
+		<< ", " << ParallelThreadCount() << " threads), "
+		<< gradients.SizeInBytes() / (1024.0 * 1024.0) << " MB more on the GPU, "
+		<< 100.0 * gradients.SizeInBytes() / volume_size
+		<< "% of the volume texture\n";
+	return CheckGlError();
+}
+
+int GradientMode(const Options& options, bool precomputed) {
+	if (!options.shading)
+		return 0;
+	if (!precomputed)
+		return 1;
+	return options.gradient_encoding == GradientEncoding::kRgba8 ? 2 : 3;
+}
@@ -0,0 +1,465 @@
+#include "occupancy_grid.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+
+#include "parallel.h"
+#include "profiler.h"
+#include "voxel_simd.h"
+
+namespace {
+
+using namespace simd;
+
+// Fills the value ranges of the bricks of |grid|. Each brick covers the
+// voxels it contains plus one on every side, the neighbours a trilinear
+// sample inside the brick can blend in.
+template <typename T>
+void ComputeBrickRanges(const uint8_t* texel_bytes, const uint32_t dims[3],
+	float scale, OccupancyGrid* grid) {
+	const T* texels = reinterpret_cast<const T*>(texel_bytes);
+	const uint32_t* brick_dims = grid->levels[0].dims;
+	const size_t brick_rows = static_cast<size_t>(brick_dims[1]) * brick_dims[2];
+	ParallelFor(brick_rows, 1, [&](size_t begin, size_t end) {
+		for (size_t row = begin; row < end; ++row) {
+			const uint32_t by = static_cast<uint32_t>(row % brick_dims[1]);
+			const uint32_t bz = static_cast<uint32_t>(row / brick_dims[1]);
+			// Voxels [begin, end) covered by the brick at |b| along an axis.
+			auto apron_begin = [](uint32_t b) {
+				return b * kOccupancyBrickSize == 0 ? 0 : b * kOccupancyBrickSize - 1;
+			};
+			auto apron_end = [](uint32_t b, uint32_t size) {
+				return std::min((b + 1) * kOccupancyBrickSize + 1, size);
+			};
+			const uint32_t y_begin = apron_begin(by);
+			const uint32_t y_end = apron_end(by, dims[1]);
+			const uint32_t z_begin = apron_begin(bz);
+			const uint32_t z_end = apron_end(bz, dims[2]);
+			for (uint32_t bx = 0; bx < brick_dims[0]; ++bx) {
+				const uint32_t x_begin = apron_begin(bx);
+				const uint32_t x_end = apron_end(bx, dims[0]);
+				float min_value = LoadScalar(texels +
+					(static_cast<size_t>(z_begin) * dims[1] + y_begin) * dims[0] +
+					x_begin, false);
+				float max_value = min_value;
+				for (uint32_t z = z_begin; z < z_end; ++z) {
+					for (uint32_t y = y_begin; y < y_end; ++y) {
+						const T* voxel_row =
+							texels + (static_cast<size_t>(z) * dims[1] + y) * dims[0];
+						for (uint32_t x = x_begin; x < x_end; ++x) {
+							const float value = LoadScalar(voxel_row + x, false);
+							min_value = std::min(min_value, value);
+							max_value = std::max(max_value, value);
+						}
+					}
+				}
+				const size_t brick = row * brick_dims[0] + bx;
+				grid->min_values[brick] = min_value * scale;
+				grid->max_values[brick] = max_value * scale;
+			}
+		}
+	});
+}
+
+// Returns in |first| and |last| the bricks along an axis of |size| voxels
+// that hold the voxels the samples in brick |brick| read at mip levels 0 to
+// |lod| of a pyramid reduced with |filter|.
+void GetBrickFootprint(uint32_t size, MipFilter filter, uint32_t lod,
+	uint32_t brick, uint32_t* first, uint32_t* last) {
+	// Sizes of the levels along the axis, halved and rounded down like
+	// NextLevelDims() does.
+	std::vector<int64_t> sizes(1, size);
+	while (sizes.size() <= lod)
+		sizes.push_back(std::max<int64_t>(sizes.back() / 2, 1));
+	const double begin = static_cast<double>(brick) * kOccupancyBrickSize;
+	const double end = std::min<double>(begin + kOccupancyBrickSize, size);
+	// GL only resolves a fraction of a texel, the texels at the boundary of
+	// the samples are included either way.
+	const double epsilon = 1.0 / 256.0;
+	int64_t voxel_first = size;
+	int64_t voxel_last = 0;
+	for (uint32_t level = 0; level <= lod; ++level) {
+		// Texels of the level the trilinear samples in the brick blend, the
+		// texture coordinates being the same for every level.
+		const double scale = static_cast<double>(sizes[level]) / size;
+		int64_t texel_first = static_cast<int64_t>(
+			std::floor(begin * scale - 0.5 - epsilon));
+		int64_t texel_last = static_cast<int64_t>(
+			std::floor(end * scale - 0.5 + epsilon)) + 1;
+		// Follow the taps of the filter, clamped to the edge, down to the full
+		// resolution level.
+		for (uint32_t child = level + 1; child-- > 0;) {
+			texel_first = std::min(std::max<int64_t>(texel_first, 0),
+				sizes[child] - 1);
+			texel_last = std::min(std::max<int64_t>(texel_last, 0),
+				sizes[child] - 1);
+			if (child == 0)
+				break;
+			texel_first = 2 * texel_first - (filter == MipFilter::kGaussian ? 1 : 0);
+			texel_last = 2 * texel_last + 1;
+		}
+		voxel_first = std::min(voxel_first, texel_first);
+		voxel_last = std::max(voxel_last, texel_last);
+	}
+	// The range of a brick already covers the voxels one past its faces.
+	const int64_t brick_count = (size + kOccupancyBrickSize - 1) /
+		kOccupancyBrickSize;
+	const int64_t brick_first =
+		std::min<int64_t>((voxel_first + 1) / kOccupancyBrickSize, brick_count - 1);
+	*first = static_cast<uint32_t>(brick_first);
+	*last = static_cast<uint32_t>(
+		std::max<int64_t>((voxel_last - 1) / kOccupancyBrickSize, brick_first));
+}
+
+// Replaces the range of every brick with the union of the ranges of the
+// bricks [first[i], last[i]] of its row along |axis|, i being its coordinate
+// along the axis. A NaN range, which keeps its brick visible, spreads to
+// the whole union.
+void DilateRanges(const uint32_t brick_dims[3], int axis,
+	const std::vector<uint32_t>& first, const std::vector<uint32_t>& last,
+	std::vector<float>* min_values, std::vector<float>* max_values) {
+	const std::vector<float> source_min = *min_values;
+	const std::vector<float> source_max = *max_values;
+	size_t stride = 1;
+	for (int i = 0; i < axis; ++i)
+		stride *= brick_dims[i];
+	ParallelFor(min_values->size(), 4096, [&](size_t begin, size_t end) {
+		for (size_t brick = begin; brick < end; ++brick) {
+			const uint32_t coordinate =
+				static_cast<uint32_t>(brick / stride % brick_dims[axis]);
+			const size_t row = brick - coordinate * stride;
+			float min_value = source_min[row + first[coordinate] * stride];
+			float max_value = source_max[row + first[coordinate] * stride];
+			for (uint32_t i = first[coordinate] + 1; i <= last[coordinate]; ++i) {
+				const float other_min = source_min[row + i * stride];
+				const float other_max = source_max[row + i * stride];
+				if (!(max_value >= min_value) || !(other_max >= other_min)) {
+					min_value = max_value = std::numeric_limits<float>::quiet_NaN();
+					break;
+				}
+				min_value = std::min(min_value, other_min);
+				max_value = std::max(max_value, other_max);
+			}
+			(*min_values)[brick] = min_value;
+			(*max_values)[brick] = max_value;
+		}
+	});
+}
+
+// Returns true if any of the entries [first, last] of a table counted by
+// |prefix|, the number of counted entries before each entry, is counted.
+// Indices are taken modulo the size of the table as GL_REPEAT does.
+bool AnyInRange(const std::vector<uint32_t>& prefix, int64_t first,
+	int64_t last) {
+	const int64_t size = static_cast<int64_t>(prefix.size()) - 1;
+	if (last - first + 1 >= size)
+		return prefix[size] != 0;
+	const int64_t begin = ((first % size) + size) % size;
+	const int64_t end = ((last % size) + size) % size + 1;
+	if (begin < end)
+		return prefix[end] != prefix[begin];
+	// The range wraps around the end of the table.
+	return prefix[size] != prefix[begin] || prefix[end] != 0;
+}
+
+void ClearDirty(OccupancyGrid::Level* level) {
+	for (int axis = 0; axis < 3; ++axis) {
+		level->dirty_begin[axis] = level->dims[axis];
+		level->dirty_end[axis] = 0;
+	}
+}
+
+// Grows the dirty box of |level| to hold the node at |index|.
+void MarkDirty(OccupancyGrid::Level* level, size_t index) {
+	const uint32_t coordinates[3] = {
+		static_cast<uint32_t>(index % level->dims[0]),
+		static_cast<uint32_t>(index / level->dims[0] % level->dims[1]),
+		static_cast<uint32_t>(index / level->dims[0] / level->dims[1])};
+	for (int axis = 0; axis < 3; ++axis) {
+		level->dirty_begin[axis] =
+			std::min(level->dirty_begin[axis], coordinates[axis]);
+		level->dirty_end[axis] =
+			std::max(level->dirty_end[axis], coordinates[axis] + 1);
+	}
+}
+
+// Recomputes the parents in |level| of the nodes |children| of the level
+// below, which changed, and replaces |children| with the parents that
+// changed in turn.
+void UpdateParents(const OccupancyGrid::Level& child_level,
+	OccupancyGrid::Level* level, std::vector<size_t>* children) {
+	const uint32_t* child_dims = child_level.dims;
+	std::vector<size_t> parents;
+	parents.reserve(children->size());
+	for (size_t child : *children) {
+		const size_t x = child % child_dims[0] / 2;
+		const size_t y = child / child_dims[0] % child_dims[1] / 2;
+		const size_t z = child / child_dims[0] / child_dims[1] / 2;
+		parents.push_back((z * level->dims[1] + y) * level->dims[0] + x);
+	}
+	std::sort(parents.begin(), parents.end());
+	parents.erase(std::unique(parents.begin(), parents.end()), parents.end());
+
+	children->clear();
+	for (size_t parent : parents) {
+		const uint32_t x = static_cast<uint32_t>(parent % level->dims[0]);
+		const uint32_t y =
+			static_cast<uint32_t>(parent / level->dims[0] % level->dims[1]);
+		const uint32_t z =
+			static_cast<uint32_t>(parent / level->dims[0] / level->dims[1]);
+		uint8_t occupancy = 0;
+		for (uint32_t cz = 2 * z; cz < std::min(2 * z + 2, child_dims[2]); ++cz) {
+			for (uint32_t cy = 2 * y; cy < std::min(2 * y + 2, child_dims[1]); ++cy) {
+				for (uint32_t cx = 2 * x; cx < std::min(2 * x + 2, child_dims[0]);
+					++cx) {
+					occupancy |= child_level.occupancy[
+						(static_cast<size_t>(cz) * child_dims[1] + cy) * child_dims[0] +
+						cx];
+				}
+			}
+		}
+		if (occupancy != level->occupancy[parent]) {
+			level->occupancy[parent] = occupancy;
+			MarkDirty(level, parent);
+			children->push_back(parent);
+		}
+	}
+}
+
+}  // namespace
+
+bool OccupancyGrid::CreateOccupancyGrid(OccupancyGrid* grid,
+	const uint8_t* texels, const uint32_t dims[3], TextureFormat format) {
+	const ProfileScope scope("OccupancyGrid::CreateOccupancyGrid");
+	if (dims[0] == 0 || dims[1] == 0 || dims[2] == 0) {
+		std::cout << "Can't build the occupancy grid of an empty volume.\n";
+		return false;
+	}
+	const auto start = std::chrono::steady_clock::now();
+	// Halve the bricks until a single node covers the volume. Every node is
+	// visible until a transfer function says otherwise.
+	grid->levels.clear();
+	OccupancyGrid::Level level;
+	for (int axis = 0; axis < 3; ++axis) {
+		level.dims[axis] =
+			(dims[axis] + kOccupancyBrickSize - 1) / kOccupancyBrickSize;
+	}
+	while (true) {
+		level.occupancy.assign(
+			static_cast<size_t>(level.dims[0]) * level.dims[1] * level.dims[2], 255);
+		ClearDirty(&level);
+		grid->levels.push_back(level);
+		if (level.dims[0] == 1 && level.dims[1] == 1 && level.dims[2] == 1)
+			break;
+		for (int axis = 0; axis < 3; ++axis)
+			level.dims[axis] = (level.dims[axis] + 1) / 2;
+	}
+	const size_t brick_count = grid->levels[0].occupancy.size();
+	grid->min_values.resize(brick_count);
+	grid->max_values.resize(brick_count);
+	grid->occupied_count = brick_count;
+	grid->visible_entries.clear();
+	grid->uploaded = false;
+
+	const float scale = TextureFormatScale(format);
+	switch (format) {
+	case TextureFormat::kR8:
+		ComputeBrickRanges<uint8_t>(texels, dims, scale, grid);
+		break;
+	case TextureFormat::kR16:
+		ComputeBrickRanges<uint16_t>(texels, dims, scale, grid);
+		break;
+	case TextureFormat::kR16F:
+		ComputeBrickRanges<Half>(texels, dims, scale, grid);
+		break;
+	case TextureFormat::kR32F:
+		ComputeBrickRanges<float>(texels, dims, scale, grid);
+		break;
+	}
+	const std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+	grid->build_seconds = elapsed.count();
+	return true;
+}
+
+void OccupancyGrid::CreateMipOccupancyGrid(OccupancyGrid* grid,
+	const OccupancyGrid& base, const uint32_t dims[3], MipFilter filter,
+	uint32_t lod) {
+	const ProfileScope scope("OccupancyGrid::CreateMipOccupancyGrid");
+	const auto start = std::chrono::steady_clock::now();
+	grid->levels = base.levels;
+	for (Level& level : grid->levels) {
+		std::fill(level.occupancy.begin(), level.occupancy.end(), 255);
+		ClearDirty(&level);
+	}
+	grid->min_values = base.min_values;
+	grid->max_values = base.max_values;
+	// The footprints are boxes of bricks, grown one axis after the other.
+	const uint32_t* brick_dims = grid->levels[0].dims;
+	for (int axis = 0; axis < 3; ++axis) {
+		std::vector<uint32_t> first(brick_dims[axis]);
+		std::vector<uint32_t> last(brick_dims[axis]);
+		for (uint32_t brick = 0; brick < brick_dims[axis]; ++brick) {
+			GetBrickFootprint(
+				dims[axis], filter, lod, brick, &first[brick], &last[brick]);
+		}
+		DilateRanges(brick_dims, axis, first, last, &grid->min_values,
+			&grid->max_values);
+	}
+	grid->occupied_count = grid->levels[0].occupancy.size();
+	grid->changed_count = 0;
+	grid->visible_entries.clear();
+	grid->uploaded = false;
+	const std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+	grid->build_seconds = elapsed.count();
+}
+
+void OccupancyGrid::UpdateOccupancy(OccupancyGrid* grid,
+	const std::vector<uint8_t>& transfer_function) {
+	const ProfileScope scope("OccupancyGrid::UpdateOccupancy");
+	const auto start = std::chrono::steady_clock::now();
+	const size_t entry_count = transfer_function.size() / 4;
+	std::vector<uint8_t> visible_entries(entry_count);
+	for (size_t i = 0; i < entry_count; ++i)
+		visible_entries[i] = transfer_function[4 * i + 3] != 0 ? 1 : 0;
+	// Only the bricks that cover an entry that changed can change. The
+	// first transfer function changes them all.
+	const bool first_update = grid->visible_entries.size() != entry_count;
+	std::vector<uint32_t> visible_prefix(entry_count + 1, 0);
+	std::vector<uint32_t> changed_prefix(entry_count + 1, 0);
+	for (size_t i = 0; i < entry_count; ++i) {
+		visible_prefix[i + 1] = visible_prefix[i] + visible_entries[i];
+		changed_prefix[i + 1] = changed_prefix[i] + (first_update ||
+			visible_entries[i] != grid->visible_entries[i] ? 1 : 0);
+	}
+	grid->visible_entries.swap(visible_entries);
+
+	// Test the bricks again, each chunk of ParallelFor() lists the ones that
+	// changed.
+	Level* bricks = &grid->levels[0];
+	const size_t brick_count = bricks->occupancy.size();
+	const size_t grain = 4096;
+	std::vector<std::vector<size_t>> changed_chunks(
+		(brick_count + grain - 1) / grain);
+	if (entry_count > 0 && changed_prefix[entry_count] != 0) {
+		ParallelFor(brick_count, grain, [&](size_t begin, size_t end) {
+			std::vector<size_t>* changed = &changed_chunks[begin / grain];
+			for (size_t brick = begin; brick < end; ++brick) {
+				const float min_value = grid->min_values[brick];
+				const float max_value = grid->max_values[brick];
+				// NaNs fail the test and keep the brick visible.
+				if (!(max_value >= min_value))
+					continue;
+				// The range is widened by one entry on both sides for the
+				// rounding of the filtering and of the lookup.
+				int64_t first = 0;
+				int64_t last = static_cast<int64_t>(entry_count) - 1;
+				if (max_value - min_value < 1.0f) {
+					first = static_cast<int64_t>(
+						std::floor(static_cast<double>(min_value) * entry_count)) - 1;
+					last = static_cast<int64_t>(
+						std::floor(static_cast<double>(max_value) * entry_count)) + 1;
+				}
+				if (!AnyInRange(changed_prefix, first, last))
+					continue;
+				const uint8_t occupancy =
+					AnyInRange(visible_prefix, first, last) ? 255 : 0;
+				if (occupancy != bricks->occupancy[brick]) {
+					bricks->occupancy[brick] = occupancy;
+					changed->push_back(brick);
+				}
+			}
+		});
+	}
+
+	std::vector<size_t> changed;
+	for (const std::vector<size_t>& chunk : changed_chunks)
+		changed.insert(changed.end(), chunk.begin(), chunk.end());
+	grid->changed_count = changed.size();
+	for (size_t brick : changed) {
+		MarkDirty(bricks, brick);
+		if (bricks->occupancy[brick] != 0)
+			++grid->occupied_count;
+		else
+			--grid->occupied_count;
+	}
+	// Rebuild the ancestors of the bricks that changed, up to the first
+	// level where nothing does.
+	for (size_t level = 1; level < grid->levels.size() && !changed.empty();
+		++level) {
+		UpdateParents(grid->levels[level - 1], &grid->levels[level], &changed);
+	}
+
+	const std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+	grid->update_seconds = elapsed.count();
+}
+
+bool OccupancyGrid::UploadOccupancy(OccupancyGrid* grid, GLuint texture_id) {
+	const ProfileScope scope("OccupancyGrid::UploadOccupancy");
+	GLint previous_texture;
+	glGetIntegerv(GL_TEXTURE_BINDING_3D, &previous_texture);
+	glBindTexture(GL_TEXTURE_3D, texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (!grid->uploaded) {
+		// The shader reads whole nodes with texelFetch(), the filters only
+		// matter for the texture to be complete.
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(
+			GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL,
+			static_cast<GLint>(grid->levels.size() - 1));
+		// GL rounds the mip levels down while the nodes of a coarser level
+		// round up to cover the whole volume. The texture is padded to a
+		// multiple of the coarsest node so that every level fits in its mip
+		// level, and the padding is never read.
+		const uint32_t top_level = static_cast<uint32_t>(grid->levels.size() - 1);
+		const uint32_t top_node = 1u << top_level;
+		uint32_t padded_dims[3];
+		for (int axis = 0; axis < 3; ++axis) {
+			padded_dims[axis] = (grid->levels[0].dims[axis] + top_node - 1) /
+				top_node * top_node;
+		}
+		for (uint32_t i = 0; i <= top_level; ++i) {
+			Level* level = &grid->levels[i];
+			glTexImage3D(GL_TEXTURE_3D, static_cast<GLint>(i), GL_R8,
+				std::max(padded_dims[0] >> i, 1u), std::max(padded_dims[1] >> i, 1u),
+				std::max(padded_dims[2] >> i, 1u), 0, GL_RED, GL_UNSIGNED_BYTE,
+				nullptr);
+			glTexSubImage3D(GL_TEXTURE_3D, static_cast<GLint>(i), 0, 0, 0,
+				level->dims[0], level->dims[1], level->dims[2], GL_RED,
+				GL_UNSIGNED_BYTE, level->occupancy.data());
+			ClearDirty(level);
+		}
+		grid->uploaded = true;
+	} else {
+		// Copy the box of nodes that changed out of the whole level.
+		for (size_t i = 0; i < grid->levels.size(); ++i) {
+			Level* level = &grid->levels[i];
+			if (level->dirty_begin[0] >= level->dirty_end[0])
+				continue;
+			const uint32_t* begin = level->dirty_begin;
+			const uint32_t* end = level->dirty_end;
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, level->dims[0]);
+			glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, level->dims[1]);
+			glTexSubImage3D(GL_TEXTURE_3D, static_cast<GLint>(i), begin[0],
+				begin[1], begin[2], end[0] - begin[0], end[1] - begin[1],
+				end[2] - begin[2], GL_RED, GL_UNSIGNED_BYTE,
+				level->occupancy.data() + (static_cast<size_t>(begin[2]) *
+					level->dims[1] + begin[1]) * level->dims[0] + begin[0]);
+			ClearDirty(level);
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+	}
+	glBindTexture(GL_TEXTURE_3D, previous_texture);
+	return CheckGlError();
+}
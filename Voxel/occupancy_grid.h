@@ -0,0 +1,97 @@
+#ifndef VOXEL_OCCUPANCY_GRID
+#define VOXEL_OCCUPANCY_GRID
+
+#include <cstdint>
+#include <vector>
+
+#include "gl_utils.h"
+#include "volume_pyramid.h"
+#include "voxel_convert.h"
+
+// Size in voxels of the bricks of an OccupancyGrid along each axis.
+const uint32_t kOccupancyBrickSize = 8;
+
+// A hierarchy of coarse grids over the volume that tells which regions the
+// transfer function makes visible, for rays to jump over the others.
+//
+// The finest level has one node per brick. It keeps the range of values of
+// every brick, including the voxels one past its faces as trilinear
+// filtering blends them in. Whenever the transfer function changes, a brick
+// is visible if any entry its range maps to has some opacity, which a prefix
+// sum of the opacities answers in constant time per brick. Every coarser
+// level halves the nodes along each axis and a node is visible if any of its
+// 8 children is, like the mip levels of a texture, so rays can leave large
+// empty regions in one step and still stop at every visible brick.
+//
+// Samples of the coarser mip levels of the volume blend voxels further out,
+// so each of them gets its own grid with wider ranges over the same bricks.
+class OccupancyGrid {
+  public:
+	// One level of the hierarchy, 255 for each visible node and 0 for the
+	// empty ones, x fastest. Nodes of level l are kOccupancyBrickSize << l
+	// voxels wide.
+	struct Level {
+		uint32_t dims[3];
+		std::vector<uint8_t> occupancy;
+		// Box [dirty_begin, dirty_end) of the nodes that changed since the
+		// last upload, empty when dirty_begin[0] >= dirty_end[0].
+		uint32_t dirty_begin[3];
+		uint32_t dirty_end[3];
+	};
+
+	// Computes the value ranges of the bricks of |texels|, a linear
+	// x-fastest volume of size |dims| in |format| as returned by
+	// GetLinearTexels(), on all the threads of ParallelFor(). Values are
+	// normalized like GL does, the way the shader sees them. Every node is
+	// visible until UpdateOccupancy() is called.
+	static bool CreateOccupancyGrid(OccupancyGrid* grid, const uint8_t* texels,
+		const uint32_t dims[3], TextureFormat format);
+
+	// Builds in |grid| the grid of sampling the volume of size |dims| that
+	// |base| was created from at mip level |lod| of its pyramid, reduced with
+	// |filter|. The range of every brick grows to the ranges of the bricks
+	// holding the voxels that the samples in it read through the levels 0 to
+	// |lod|: trilinear mipmapping blends the two levels around a fractional
+	// level, and the texture only has level 0 until the pyramid is uploaded.
+	// Every node is visible until UpdateOccupancy() is called.
+	static void CreateMipOccupancyGrid(OccupancyGrid* grid,
+		const OccupancyGrid& base, const uint32_t dims[3], MipFilter filter,
+		uint32_t lod);
+
+	// Marks the nodes in which |transfer_function|, a table of RGBA8 entries
+	// looked up with GL_NEAREST and GL_REPEAT, gives some voxel an opacity.
+	// Only the bricks whose range covers an entry that became visible or
+	// transparent since the last call are tested again, and only the
+	// ancestors of the bricks that changed are rebuilt.
+	static void UpdateOccupancy(OccupancyGrid* grid,
+		const std::vector<uint8_t>& transfer_function);
+
+	// Uploads the levels to |texture_id| as the mip levels of a GL_R8 3D
+	// texture, padded past the last node of each level. The first upload
+	// allocates them, later ones only copy the nodes that changed since.
+	static bool UploadOccupancy(OccupancyGrid* grid, GLuint texture_id);
+
+	// Returns true if the node at |x|, |y|, |z| of |level| is visible.
+	bool IsOccupied(size_t level, uint32_t x, uint32_t y, uint32_t z) const {
+		const Level& grid_level = levels[level];
+		return grid_level.occupancy[(static_cast<size_t>(z) *
+			grid_level.dims[1] + y) * grid_level.dims[0] + x] != 0;
+	}
+
+	// Levels from the bricks, levels[0], to a single node.
+	std::vector<Level> levels;
+	// Smallest and largest value of each brick, x fastest.
+	std::vector<float> min_values;
+	std::vector<float> max_values;
+	// Entries of the last transfer function with some opacity, 1 or 0.
+	std::vector<uint8_t> visible_entries;
+	// Number of visible bricks, and of bricks that changed in the last
+	// update.
+	size_t occupied_count = 0;
+	size_t changed_count = 0;
+	bool uploaded = false;
+	double build_seconds = 0.0;
+	double update_seconds = 0.0;
+};
+
+#endif  // VOXEL_OCCUPANCY_GRID
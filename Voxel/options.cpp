@@ -0,0 +1,387 @@
+#include "options.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+void PrintUsage(const char* program) {
+	std::cout << "Usage: " << program << " [volume] [options]\n"
+		<< "  volume              .vox file or raw voxels (default teddy.raw)\n"
+		<< "  --dims X Y Z        size of a raw volume in voxels\n"
+		<< "  --type T            voxel type of a raw volume: uint8, uint16,\n"
+		<< "                      float32 (default uint8)\n"
+		<< "  --spacing X Y Z     voxel spacing of a raw volume (default 1 1 1)\n"
+		<< "  --big-endian        a raw volume is stored big endian\n"
+		<< "  --window MIN MAX    stretch voxel values in [MIN, MAX] over the\n"
+		<< "                      transfer function (float volumes default to\n"
+		<< "                      their value range)\n"
+		<< "  --float-format F    texture format of float volumes: r16f, r32f\n"
+		<< "                      (default r16f)\n"
+		<< "  --convert OUT.vox   write the volume as a .vox file and exit\n"
+		<< "  --brick N           brick size in voxels used by --convert\n"
+		<< "  --sync-load         upload the volume before the first frame\n"
+		<< "  --slabs-per-frame N streamed slabs uploaded per frame (default 4)\n"
+		<< "  --mip-filter F      filter of the mip levels: box, gaussian\n"
+		<< "                      (default box)\n"
+		<< "  --no-pyramid        only render the full resolution level\n"
+		<< "  --two-pass          find the ray exits with a back face pass\n"
+		<< "  --sampling-rate R   samples per half voxel along the rays\n"
+		<< "                      (default 1)\n"
+		<< "  --no-skip           march through the bricks the transfer function\n"
+		<< "                      leaves empty instead of skipping them\n"
+		<< "  --no-preintegration classify each sample with the transfer\n"
+		<< "                      function instead of the segments between them\n"
+		<< "  --no-shading        don't light the samples with the gradients of\n"
+		<< "                      the volume\n"
+		<< "  --on-the-fly-gradients\n"
+		<< "                      estimate the gradients with central\n"
+		<< "                      differences in the shader instead of reading\n"
+		<< "                      them from a precomputed texture (G switches)\n"
+		<< "  --gradient-filter F stencil of the precomputed gradients: central,\n"
+		<< "                      sobel (default central)\n"
+		<< "  --gradient-format F texels of the precomputed gradients: rgba8,\n"
+		<< "                      octahedral (default rgba8)\n"
+		<< "  --moving-scale N    divide the resolution by N while the view\n"
+		<< "                      moves: 1, 2, 4 (default 4, 1 disables)\n"
+		<< "  --refine-delay MS   time the view stays still before frames are\n"
+		<< "                      rendered at full resolution (default 250)\n"
+		<< "  --target-frame-ms MS\n"
+		<< "                      scale the resolution to keep the GPU time of\n"
+		<< "                      the frames at MS until the view is still,\n"
+		<< "                      instead of --moving-scale\n"
+		<< "  --governor-log OUT  write the scale and time of every frame timed\n"
+		<< "                      by --target-frame-ms to a .csv\n"
+		<< "  --gpu-timers        time each pass of the frames on the GPU\n"
+		<< "  --gpu-timers-csv OUT\n"
+		<< "                      append the pass times of every frame to a .csv\n"
+		<< "  --gpu-timers-json OUT\n"
+		<< "                      write their summary to a .json on exit\n"
+		<< "  --gpu-timers-title  show them in the title of the window\n"
+		<< "  --profile OUT       write a Chrome trace of the CPU work to a .json\n"
+		<< "                      on exit\n"
+		<< "  --samples-per-pixel N\n"
+		<< "                      jittered frames averaged into each pixel while\n"
+		<< "                      the view is still (default 8, 1 disables the\n"
+		<< "                      jitter), lower --sampling-rate to match\n"
+		<< "  --cpu-render OUT    render one frame on the CPU to a .ppm or .png\n"
+		<< "                      and exit\n"
+		<< "  --angle DEGREES     rotation of the frame rendered on the CPU\n"
+		<< "  --render-cameras F  render the views listed in F on the CPU, one\n"
+		<< "                      per line as YAW [PITCH] [OUT] in degrees, or\n"
+		<< "                      every frame between keys given as\n"
+		<< "                      key FRAME YAW [PITCH], and exit\n"
+		<< "  --render-prefix P   path the views without an OUT are written to,\n"
+		<< "                      followed by their index (default frame_)\n"
+		<< "  --image-format F    format of those views: png, ppm (default png)\n"
+		<< "  --render-size W H   size of the frames rendered without a window\n"
+		<< "                      (default 1080 1080)\n"
+		<< "  --render-on-gpu     render the views of --render-cameras on the GPU\n"
+		<< "  --frames-in-flight N\n"
+		<< "                      views rendered on the GPU ahead of the one\n"
+		<< "                      being written (default 3)\n"
+		<< "  --cpu-kernel K      ray marching of the CPU renderer: scalar,\n"
+		<< "                      sse4.1, avx2, avx512 (default the widest the\n"
+		<< "                      CPU supports)\n"
+		<< "  --cpu-tile N        size of the tiles of the CPU renderer in\n"
+		<< "                      pixels (default 32)\n"
+		<< "  --cpu-schedule S    how the CPU renderer shares its tiles between\n"
+		<< "                      threads: static, stealing (default stealing)\n"
+		<< "  --cpu-compare-schedules\n"
+		<< "                      render the CPU frame with both schedules and\n"
+		<< "                      report the speedup\n"
+		<< "  --layout-benchmark  compare the speed of sampling the volume in\n"
+		<< "                      each memory layout and exit\n"
+		<< "  --benchmark         time the frames of one orbit at full\n"
+		<< "                      resolution, report them as JSON and exit\n"
+		<< "  --benchmark-frames N\n"
+		<< "                      frames timed by --benchmark (default 360)\n"
+		<< "  --benchmark-warmup N\n"
+		<< "                      frames rendered before them (default 30)\n"
+		<< "  --benchmark-json OUT\n"
+		<< "                      file the JSON report is written to instead\n"
+		<< "                      of printed\n"
+		<< "  --golden DIR        render fixed views on the GPU with each feature\n"
+		<< "                      and on the CPU as the reference, compare them\n"
+		<< "                      to the golden images in DIR and exit\n"
+		<< "                      (--render-size defaults to 256 256), the\n"
+		<< "                      goldens of llvmpipe are in Voxel/goldens\n"
+		<< "  --update-goldens    write the images to DIR as the new goldens,\n"
+		<< "                      after a change to the images or to make\n"
+		<< "                      goldens for another rasterizer\n"
+		<< "  --golden-psnr DB    smallest PSNR that passes (default 40)\n"
+		<< "  --golden-ssim S     smallest SSIM that passes, up to 1\n"
+		<< "                      (default 0.98)\n";
+}
+
+bool EndsWith(const char* text, const char* suffix) {
+	const size_t text_length = std::strlen(text);
+	const size_t suffix_length = std::strlen(suffix);
+	return text_length >= suffix_length &&
+		std::strcmp(text + text_length - suffix_length, suffix) == 0;
+}
+
+// Parses |count| positive integers starting at argv[*index + 1] into
+// |values| and advances |index| past them.
+bool ParseUints(int argc, char* argv[], int* index, int count, uint32_t* values) {
+	if (*index + count >= argc)
+		return false;
+	for (int i = 0; i < count; ++i) {
+		const long value = std::strtol(argv[++*index], nullptr, 10);
+		if (value <= 0)
+			return false;
+		values[i] = static_cast<uint32_t>(value);
+	}
+	return true;
+}
+
+bool ParseFloats(int argc, char* argv[], int* index, int count, float* values) {
+	if (*index + count >= argc)
+		return false;
+	for (int i = 0; i < count; ++i) {
+		values[i] = static_cast<float>(std::atof(argv[++*index]));
+		if (values[i] <= 0.0f)
+			return false;
+	}
+	return true;
+}
+
+}  // namespace
+
+bool ParseOptions(int argc, char* argv[], Options* options) {
+	// teddy.raw, the default volume, is 128x128x62 8-bit voxels.
+	options->raw_info.dims[0] = 128;
+	options->raw_info.dims[1] = 128;
+	options->raw_info.dims[2] = 62;
+	options->raw_info.value_min = 0.0f;
+	options->raw_info.value_max = 255.0f;
+
+	bool has_volume_path = false;
+	bool has_dims = false;
+	bool has_render_size = false;
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		bool valid = true;
+		if (std::strcmp(arg, "--dims") == 0) {
+			valid = ParseUints(argc, argv, &i, 3, options->raw_info.dims);
+			has_dims = true;
+		} else if (std::strcmp(arg, "--type") == 0) {
+			valid = i + 1 < argc &&
+				ParseVoxelType(argv[++i], &options->raw_info.type);
+		} else if (std::strcmp(arg, "--spacing") == 0) {
+			valid = ParseFloats(argc, argv, &i, 3, options->raw_info.spacing);
+		} else if (std::strcmp(arg, "--big-endian") == 0) {
+			options->raw_info.big_endian = true;
+		} else if (std::strcmp(arg, "--window") == 0) {
+			valid = i + 2 < argc;
+			if (valid) {
+				options->windowed = true;
+				options->window_min = static_cast<float>(std::atof(argv[++i]));
+				options->window_max = static_cast<float>(std::atof(argv[++i]));
+				valid = options->window_min < options->window_max;
+			}
+		} else if (std::strcmp(arg, "--float-format") == 0) {
+			TextureFormat format;
+			valid = i + 1 < argc && ParseTextureFormat(argv[++i], &format) &&
+				(format == TextureFormat::kR16F || format == TextureFormat::kR32F);
+			if (valid)
+				options->float_texture_format = format;
+		} else if (std::strcmp(arg, "--convert") == 0) {
+			valid = i + 1 < argc;
+			if (valid)
+				options->convert_path = argv[++i];
+		} else if (std::strcmp(arg, "--brick") == 0) {
+			valid = ParseUints(argc, argv, &i, 1, &options->convert_brick_size);
+		} else if (std::strcmp(arg, "--sync-load") == 0) {
+			options->sync_load = true;
+		} else if (std::strcmp(arg, "--slabs-per-frame") == 0) {
+			uint32_t slabs = 0;
+			valid = ParseUints(argc, argv, &i, 1, &slabs);
+			options->slabs_per_frame = static_cast<int>(slabs);
+		} else if (std::strcmp(arg, "--mip-filter") == 0) {
+			valid = i + 1 < argc && ParseMipFilter(argv[++i], &options->mip_filter);
+		} else if (std::strcmp(arg, "--no-pyramid") == 0) {
+			options->build_pyramid = false;
+		} else if (std::strcmp(arg, "--two-pass") == 0) {
+			options->two_pass = true;
+		} else if (std::strcmp(arg, "--sampling-rate") == 0) {
+			valid = ParseFloats(argc, argv, &i, 1, &options->sampling_rate);
+		} else if (std::strcmp(arg, "--no-skip") == 0) {
+			options->skip_empty = false;
+		} else if (std::strcmp(arg, "--no-preintegration") == 0) {
+			options->preintegrate = false;
+		} else if (std::strcmp(arg, "--no-shading") == 0) {
+			options->shading = false;
+		} else if (std::strcmp(arg, "--on-the-fly-gradients") == 0) {
+			options->precompute_gradients = false;
+		} else if (std::strcmp(arg, "--gradient-filter") == 0) {
+			valid = i + 1 < argc &&
+				ParseGradientFilter(argv[++i], &options->gradient_filter);
+		} else if (std::strcmp(arg, "--gradient-format") == 0) {
+			valid = i + 1 < argc &&
+				ParseGradientEncoding(argv[++i], &options->gradient_encoding);
+		} else if (std::strcmp(arg, "--moving-scale") == 0) {
+			uint32_t scale = 0;
+			valid = ParseUints(argc, argv, &i, 1, &scale) &&
+				(scale == 1 || scale == 2 || scale == 4);
+			options->moving_scale = static_cast<int>(scale);
+		} else if (std::strcmp(arg, "--refine-delay") == 0) {
+			valid = ParseFloats(argc, argv, &i, 1, &options->refine_delay_ms);
+		} else if (std::strcmp(arg, "--target-frame-ms") == 0) {
+			valid = ParseFloats(argc, argv, &i, 1, &options->target_frame_ms);
+		} else if (std::strcmp(arg, "--governor-log") == 0) {
+			valid = i + 1 < argc;
+			if (valid)
+				options->governor_log_path = argv[++i];
+		} else if (std::strcmp(arg, "--gpu-timers") == 0) {
+			options->gpu_timers = true;
+		} else if (std::strcmp(arg, "--gpu-timers-csv") == 0) {
+			valid = i + 1 < argc;
+			if (valid) {
+				options->gpu_timers_csv_path = argv[++i];
+				options->gpu_timers = true;
+			}
+		} else if (std::strcmp(arg, "--gpu-timers-json") == 0) {
+			valid = i + 1 < argc;
+			if (valid) {
+				options->gpu_timers_json_path = argv[++i];
+				options->gpu_timers = true;
+			}
+		} else if (std::strcmp(arg, "--gpu-timers-title") == 0) {
+			options->gpu_timers_title = true;
+			options->gpu_timers = true;
+		} else if (std::strcmp(arg, "--profile") == 0) {
+			valid = i + 1 < argc;
+			if (valid)
+				options->profile_path = argv[++i];
+		} else if (std::strcmp(arg, "--samples-per-pixel") == 0) {
+			uint32_t samples = 0;
+			valid = ParseUints(argc, argv, &i, 1, &samples);
+			options->samples_per_pixel = static_cast<int>(samples);
+		} else if (std::strcmp(arg, "--cpu-render") == 0) {
+			valid = i + 1 < argc;
+			if (valid)
+				options->cpu_render_path = argv[++i];
+		} else if (std::strcmp(arg, "--render-cameras") == 0) {
+			valid = i + 1 < argc;
+			if (valid)
+				options->camera_list_path = argv[++i];
+		} else if (std::strcmp(arg, "--render-prefix") == 0) {
+			valid = i + 1 < argc;
+			if (valid)
+				options->render_prefix = argv[++i];
+		} else if (std::strcmp(arg, "--image-format") == 0) {
+			valid = i + 1 < argc;
+			if (valid) {
+				const char* format = argv[++i];
+				if (std::strcmp(format, "png") == 0)
+					options->image_extension = ".png";
+				else if (std::strcmp(format, "ppm") == 0)
+					options->image_extension = ".ppm";
+				else
+					valid = false;
+			}
+		} else if (std::strcmp(arg, "--render-size") == 0) {
+			valid = ParseUints(argc, argv, &i, 2, options->render_size);
+			has_render_size = true;
+		} else if (std::strcmp(arg, "--render-on-gpu") == 0) {
+			options->render_on_gpu = true;
+		} else if (std::strcmp(arg, "--frames-in-flight") == 0) {
+			valid = ParseUints(argc, argv, &i, 1, &options->frames_in_flight);
+		} else if (std::strcmp(arg, "--angle") == 0) {
+			valid = i + 1 < argc;
+			if (valid)
+				options->angle = static_cast<float>(std::atof(argv[++i]));
+		} else if (std::strcmp(arg, "--cpu-kernel") == 0) {
+			valid = i + 1 < argc &&
+				ParseRaycastKernel(argv[++i], &options->cpu_kernel) &&
+				IsRaycastKernelSupported(options->cpu_kernel);
+		} else if (std::strcmp(arg, "--cpu-tile") == 0) {
+			uint32_t tile_size = 0;
+			valid = ParseUints(argc, argv, &i, 1, &tile_size);
+			options->cpu_tile_size = static_cast<int>(tile_size);
+		} else if (std::strcmp(arg, "--cpu-schedule") == 0) {
+			valid = i + 1 < argc &&
+				ParseTileSchedule(argv[++i], &options->cpu_schedule);
+		} else if (std::strcmp(arg, "--cpu-compare-schedules") == 0) {
+			options->cpu_compare_schedules = true;
+		} else if (std::strcmp(arg, "--layout-benchmark") == 0) {
+			options->layout_benchmark = true;
+		} else if (std::strcmp(arg, "--benchmark") == 0) {
+			options->benchmark = true;
+		} else if (std::strcmp(arg, "--benchmark-frames") == 0) {
+			valid = ParseUints(argc, argv, &i, 1, &options->benchmark_frames);
+		} else if (std::strcmp(arg, "--benchmark-warmup") == 0) {
+			valid = i + 1 < argc;
+			if (valid) {
+				options->benchmark_warmup =
+					static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			}
+		} else if (std::strcmp(arg, "--benchmark-json") == 0) {
+			valid = i + 1 < argc;
+			if (valid)
+				options->benchmark_json_path = argv[++i];
+		} else if (std::strcmp(arg, "--golden") == 0) {
+			valid = i + 1 < argc;
+			if (valid)
+				options->golden_dir = argv[++i];
+		} else if (std::strcmp(arg, "--update-goldens") == 0) {
+			options->update_goldens = true;
+		} else if (std::strcmp(arg, "--golden-psnr") == 0) {
+			valid = ParseFloats(argc, argv, &i, 1, &options->golden_min_psnr);
+		} else if (std::strcmp(arg, "--golden-ssim") == 0) {
+			valid = ParseFloats(argc, argv, &i, 1, &options->golden_min_ssim) &&
+				options->golden_min_ssim <= 1.0f;
+		} else if (arg[0] != '-' && !has_volume_path) {
+			options->volume_path = arg;
+			has_volume_path = true;
+		} else {
+			valid = false;
+		}
+
+		if (!valid) {
+			std::cout << "Invalid argument: " << arg << "\n";
+			PrintUsage(argv[0]);
+			return false;
+		}
+	}
+
+	// The default dimensions only describe teddy.raw, any other raw file
+	// must say how big it is.
+	if (has_volume_path && !has_dims && !EndsWith(options->volume_path, ".vox") &&
+		std::strcmp(options->volume_path, "teddy.raw") != 0) {
+		std::cout << "Raw volumes need --dims.\n";
+		PrintUsage(argv[0]);
+		return false;
+	}
+
+	// The scalar CPU reference is far too slow for full size frames.
+	if (options->golden_dir && !has_render_size) {
+		options->render_size[0] = 256;
+		options->render_size[1] = 256;
+	}
+
+	// The value range of raw files is the full range of their type. The
+	// real range is computed when they are converted.
+	switch (options->raw_info.type) {
+	case VoxelType::kUint8:
+		options->raw_info.value_max = 255.0f;
+		break;
+	case VoxelType::kUint16:
+		options->raw_info.value_max = 65535.0f;
+		break;
+	case VoxelType::kFloat32:
+		options->raw_info.value_max = 1.0f;
+		break;
+	}
+
+	return true;
+}
+
+bool OpenVolume(const Options& options, VolumeFile* file) {
+	if (EndsWith(options.volume_path, ".vox"))
+		return VolumeFile::OpenVolumeFile(file, options.volume_path);
+	return VolumeFile::OpenRawVolumeFile(
+		file, options.volume_path, options.raw_info);
+}
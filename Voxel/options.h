@@ -0,0 +1,144 @@
+#ifndef VOXEL_OPTIONS
+#define VOXEL_OPTIONS
+
+#include "gradient_volume.h"
+#include "ray_packets.h"
+#include "tile_scheduler.h"
+#include "volume_format.h"
+#include "volume_pyramid.h"
+#include "voxel_convert.h"
+
+// Command line options of the viewer.
+struct Options {
+	// Volume to render. Files ending in ".vox" describe themselves, any
+	// other file is read as raw voxels laid out as |raw_info|.
+	const char* volume_path = "teddy.raw";
+	// Layout of raw volume files. Defaults to the shipped teddy.raw.
+	VolumeInfo raw_info;
+	// When set, the volume is written as a .vox file to this path and the
+	// program exits without rendering.
+	const char* convert_path = nullptr;
+	// Brick size used when converting, 0 writes a linear payload.
+	uint32_t convert_brick_size = 0;
+	// Upload the whole volume before the first frame instead of streaming
+	// it in the background.
+	bool sync_load = false;
+	// Number of streamed slabs uploaded per frame.
+	int slabs_per_frame = 4;
+	// When set, voxel values in [window_min, window_max] are stretched over
+	// the whole transfer function.
+	bool windowed = false;
+	float window_min = 0.0f;
+	float window_max = 1.0f;
+	// Texture format of float volumes, kR16F or kR32F.
+	TextureFormat float_texture_format = TextureFormat::kR16F;
+	// Build the mip levels of the volume, or load them from the sidecar
+	// next to it, and sample them when the volume is minified.
+	bool build_pyramid = true;
+	MipFilter mip_filter = MipFilter::kBox;
+	// Draw the back faces of the cube to a texture to find where the rays
+	// leave the volume, instead of intersecting them in the shader.
+	bool two_pass = false;
+	// Samples per Nyquist step (half a voxel) along the rays.
+	float sampling_rate = 1.0f;
+	// Jump over the bricks of the volume the transfer function makes
+	// transparent.
+	bool skip_empty = true;
+	// Classify the segments between samples with the pre-integrated
+	// transfer function instead of the samples alone.
+	bool preintegrate = true;
+	// Light the samples with the gradients of the volume, read from a
+	// texture computed at load time or estimated in the shader.
+	bool shading = true;
+	bool precompute_gradients = true;
+	GradientFilter gradient_filter = GradientFilter::kCentralDifference;
+	GradientEncoding gradient_encoding = GradientEncoding::kRgba8;
+	// While the view moves, frames are rendered at 1 / |moving_scale| of the
+	// window resolution and stretched over it. Once it stops the resolution
+	// doubles, and it is full after the view has been still for
+	// |refine_delay_ms|.
+	int moving_scale = 4;
+	float refine_delay_ms = 250.0f;
+	// When positive, frames are rendered at the resolution that keeps
+	// their GPU time at |target_frame_ms| instead of |moving_scale|, until
+	// the view has been still for |refine_delay_ms|. Every timed frame is
+	// appended to |governor_log_path| if set.
+	float target_frame_ms = 0.0f;
+	const char* governor_log_path = nullptr;
+	// Time every pass of the frames on the GPU. The times of each frame are
+	// appended to |gpu_timers_csv_path| and their summary written to
+	// |gpu_timers_json_path| on exit if set, and shown in the title of the
+	// window if |gpu_timers_title|.
+	bool gpu_timers = false;
+	const char* gpu_timers_csv_path = nullptr;
+	const char* gpu_timers_json_path = nullptr;
+	bool gpu_timers_title = false;
+	// When set, the scopes of every thread are recorded and written to this
+	// path as a Chrome trace on exit.
+	const char* profile_path = nullptr;
+	// Rays start a blue noise fraction of a step in, different every frame,
+	// and frames are averaged until each pixel has |samples_per_pixel| of
+	// them while the view is still, then the average is shown as is. While
+	// it moves at full resolution the average follows the volume. 1
+	// disables both.
+	int samples_per_pixel = 8;
+	// When set, a single frame is rendered on the CPU to this path, rotated
+	// by |angle| degrees, and the program exits without opening a window.
+	const char* cpu_render_path = nullptr;
+	float angle = 0.0f;
+	// When set, the views listed in this file are rendered on the CPU and
+	// written as images, then the program exits without opening a window.
+	// Views that don't name their image are written to |render_prefix|
+	// followed by their index and |image_extension|.
+	const char* camera_list_path = nullptr;
+	const char* render_prefix = "frame_";
+	const char* image_extension = ".png";
+	// Size in pixels of the frames rendered without a window.
+	uint32_t render_size[2] = {1080, 1080};
+	// Renders the views on the GPU instead, to offscreen framebuffers of a
+	// hidden window, with up to |frames_in_flight| frames being rendered or
+	// read back while the earlier ones are written.
+	bool render_on_gpu = false;
+	uint32_t frames_in_flight = 3;
+	// How the CPU renderer marches its rays.
+	RaycastKernel cpu_kernel = GetBestRaycastKernel();
+	// Size of the tiles the CPU renderer shares between its threads, and
+	// how it shares them.
+	int cpu_tile_size = 32;
+	TileSchedule cpu_schedule = TileSchedule::kWorkStealing;
+	// Render the CPU frame with every schedule and report the speedup of
+	// work stealing over the static split.
+	bool cpu_compare_schedules = false;
+	// Benchmark sampling the volume on the CPU in every VoxelLayout and
+	// exit without opening a window.
+	bool layout_benchmark = false;
+	// Benchmark the window instead: the volume turns by a fixed step every
+	// frame, one orbit over the |benchmark_frames| frames that are timed
+	// after |benchmark_warmup| more, then the frame times are reported and
+	// written as JSON to |benchmark_json_path|, or printed if it is null.
+	bool benchmark = false;
+	uint32_t benchmark_frames = 360;
+	uint32_t benchmark_warmup = 30;
+	const char* benchmark_json_path = nullptr;
+	// When set, fixed views are rendered with every GoldenVariant on the GPU
+	// and with the scalar CPU renderer as the reference, at |render_size|
+	// (256x256 unless it is given), and compared to the golden images in
+	// this directory, or written there if |update_goldens|. The program
+	// exits without opening a window, failing if an image is further from
+	// its golden than |golden_min_psnr| and |golden_min_ssim| allow. The
+	// goldens of teddy.raw rendered by llvmpipe are in Voxel/goldens.
+	const char* golden_dir = nullptr;
+	bool update_goldens = false;
+	float golden_min_psnr = 40.0f;
+	float golden_min_ssim = 0.98f;
+};
+
+// Parses the command line into |options|. Prints the usage and returns false
+// if the arguments are invalid.
+bool ParseOptions(int argc, char* argv[], Options* options);
+
+// Opens the volume named by |options| into |file|. Returns false if the
+// volume can't be opened.
+bool OpenVolume(const Options& options, VolumeFile* file);
+
+#endif  // VOXEL_OPTIONS
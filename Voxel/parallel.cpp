@@ -0,0 +1,186 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+
+namespace {
+
+// True on the threads of the pool and while a thread runs a ParallelFor()
+// body, to run nested loops serially instead of deadlocking.
+thread_local bool in_parallel_for = false;
+// Index of the thread in the pool, 0 for the thread that calls into it.
+thread_local int pool_thread_index = 0;
+// Threads the loops run on, 0 for all the hardware threads.
+std::atomic<int> thread_limit{0};
+
+int HardwareThreadCount() {
+	static const int thread_count =
+		std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	return thread_count;
+}
+
+// A fixed set of worker threads that help with one ParallelFor() at a time.
+class ThreadPool {
+  public:
+	ThreadPool() {
+		const int worker_count = HardwareThreadCount() - 1;
+		for (int i = 0; i < worker_count; ++i)
+			workers.emplace_back(&ThreadPool::RunWorker, this, i + 1);
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		work_available.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	// Runs |body| over [0, count) in chunks of |grain| items on the first
+	// |thread_count| threads of the pool. When |once_per_thread| is set,
+	// every thread instead runs the single chunk starting at its own index.
+	void Run(int thread_count, size_t count, size_t grain,
+		bool once_per_thread, const std::function<void(size_t, size_t)>& body) {
+		// Only one loop at a time uses the workers.
+		std::lock_guard<std::mutex> run_lock(run_mutex);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job_body = &body;
+			job_count = count;
+			job_grain = grain;
+			job_once_per_thread = once_per_thread;
+			job_thread_count = thread_count;
+			next_item = 0;
+			busy_workers = thread_count - 1;
+			++generation;
+		}
+		work_available.notify_all();
+
+		RunChunks();
+
+		std::unique_lock<std::mutex> lock(mutex);
+		work_done.wait(lock, [this] { return busy_workers == 0; });
+		job_body = nullptr;
+	}
+
+  private:
+	void RunWorker(int thread_index) {
+		NameProfilerThread(("worker " + std::to_string(thread_index)).c_str());
+		in_parallel_for = true;
+		pool_thread_index = thread_index;
+		uint64_t seen_generation = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				work_available.wait(lock, [&] {
+					return stop || generation != seen_generation;
+				});
+				if (stop)
+					return;
+				seen_generation = generation;
+				// Threads past the limit sit the loop out.
+				if (thread_index >= job_thread_count)
+					continue;
+			}
+
+			RunChunks();
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--busy_workers == 0)
+				work_done.notify_one();
+		}
+	}
+
+	// Runs chunks of the current job until there are none left.
+	void RunChunks() {
+		if (job_once_per_thread) {
+			const size_t begin = static_cast<size_t>(pool_thread_index);
+			const ProfileScope scope("ParallelFor chunk");
+			(*job_body)(begin, begin + 1);
+			return;
+		}
+		while (true) {
+			const size_t begin = next_item.fetch_add(job_grain);
+			if (begin >= job_count)
+				return;
+			const ProfileScope scope("ParallelFor chunk");
+			(*job_body)(begin, std::min(begin + job_grain, job_count));
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::mutex run_mutex;
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable work_done;
+	bool stop = false;
+	uint64_t generation = 0;
+	int busy_workers = 0;
+
+	const std::function<void(size_t, size_t)>* job_body = nullptr;
+	size_t job_count = 0;
+	size_t job_grain = 1;
+	bool job_once_per_thread = false;
+	int job_thread_count = 1;
+	std::atomic<size_t> next_item{0};
+};
+
+// The pool is only started by the first parallel call.
+ThreadPool& GetThreadPool() {
+	static ThreadPool pool;
+	return pool;
+}
+
+}  // namespace
+
+int ParallelThreadCount() {
+	const int limit = thread_limit.load(std::memory_order_relaxed);
+	return limit > 0 ?
+		std::min(limit, HardwareThreadCount()) : HardwareThreadCount();
+}
+
+void SetParallelThreadLimit(int count) {
+	thread_limit.store(std::max(count, 0), std::memory_order_relaxed);
+}
+
+void ParallelFor(size_t count, size_t grain,
+	const std::function<void(size_t begin, size_t end)>& body) {
+	grain = std::max<size_t>(grain, 1);
+	if (count == 0)
+		return;
+	if (in_parallel_for || count <= grain || ParallelThreadCount() == 1) {
+		for (size_t begin = 0; begin < count; begin += grain)
+			body(begin, std::min(begin + grain, count));
+		return;
+	}
+
+	in_parallel_for = true;
+	GetThreadPool().Run(ParallelThreadCount(), count, grain, false, body);
+	in_parallel_for = false;
+}
+
+void ParallelForEachThread(const std::function<void(int thread_index)>& body) {
+	const int thread_count = ParallelThreadCount();
+	const std::function<void(size_t, size_t)> run_thread =
+		[&body](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+			body(static_cast<int>(i));
+	};
+	if (in_parallel_for || thread_count == 1) {
+		run_thread(0, thread_count);
+		return;
+	}
+
+	in_parallel_for = true;
+	GetThreadPool().Run(thread_count, thread_count, 1, true, run_thread);
+	in_parallel_for = false;
+}
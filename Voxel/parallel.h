@@ -0,0 +1,30 @@
+#ifndef VOXEL_PARALLEL
+#define VOXEL_PARALLEL
+
+#include <cstddef>
+#include <functional>
+
+// Returns the number of threads ParallelFor() runs on, the number of
+// hardware threads of the machine unless limited.
+int ParallelThreadCount();
+
+// Limits ParallelFor() and ParallelForEachThread() to |count| threads, at
+// most the hardware threads, or lets them use all of them again if |count|
+// is 0. Must not be called while a parallel loop runs.
+void SetParallelThreadLimit(int count);
+
+// Calls |body| with consecutive ranges [begin, end) that together cover
+// [0, count), from all the threads of a shared pool including the calling
+// one, and returns once every range is done. Ranges are |grain| items long
+// (except the last) and are handed out dynamically, so uneven work still
+// balances. Calls made from inside |body| run on the calling thread only.
+void ParallelFor(size_t count, size_t grain,
+	const std::function<void(size_t begin, size_t end)>& body);
+
+// Calls |body| once on every thread of the pool, the calling one included,
+// with a distinct |thread_index| in [0, ParallelThreadCount()), and returns
+// once they all are done. For schedulers that keep per-thread state. Calls
+// made from inside a parallel body run every index on the calling thread.
+void ParallelForEachThread(const std::function<void(int thread_index)>& body);
+
+#endif  // VOXEL_PARALLEL
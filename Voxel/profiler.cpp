@@ -0,0 +1,150 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "json_writer.h"
+
+namespace {
+
+const uint64_t kNotRecording = ~uint64_t{0};
+
+struct ProfileEvent {
+	const char* name;
+	uint64_t start_ns;
+	uint64_t end_ns;
+};
+
+// The events of one thread. Only that thread writes them, |event_count|
+// is published with a release store for WriteChromeTrace() to read.
+struct ThreadTrace {
+	int thread_id = 0;
+	std::string name;
+	std::vector<ProfileEvent> events;
+	std::atomic<uint64_t> event_count{0};
+};
+
+std::atomic<bool> profiler_started{false};
+std::chrono::steady_clock::time_point profiler_start;
+// Every thread that recorded an event, kept after the thread exits.
+std::mutex traces_mutex;
+std::vector<std::unique_ptr<ThreadTrace>> traces;
+thread_local ThreadTrace* thread_trace = nullptr;
+
+// Returns the trace of the calling thread, registering it the first time.
+ThreadTrace* GetThreadTrace() {
+	if (!thread_trace) {
+		std::unique_ptr<ThreadTrace> trace(new ThreadTrace);
+		trace->events.resize(kProfilerEventsPerThread);
+		std::lock_guard<std::mutex> lock(traces_mutex);
+		trace->thread_id = static_cast<int>(traces.size());
+		thread_trace = trace.get();
+		traces.push_back(std::move(trace));
+	}
+	return thread_trace;
+}
+
+uint64_t NowNs() {
+	return static_cast<uint64_t>(std::chrono::duration_cast<
+		std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - profiler_start).count());
+}
+
+}  // namespace
+
+void StartProfiler() {
+	profiler_start = std::chrono::steady_clock::now();
+	profiler_started.store(true, std::memory_order_release);
+}
+
+bool IsProfilerStarted() {
+	return profiler_started.load(std::memory_order_relaxed);
+}
+
+void NameProfilerThread(const char* name) {
+	if (IsProfilerStarted())
+		GetThreadTrace()->name = name;
+}
+
+bool WriteChromeTrace(const char* path) {
+	std::ofstream file(path, std::ofstream::out | std::ofstream::trunc);
+	if (!file) {
+		std::cout << "Failed to open " << path << "\n";
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(traces_mutex);
+	size_t event_total = 0;
+	size_t dropped_total = 0;
+	file << std::fixed << std::setprecision(3)
+		<< "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+	bool first = true;
+	for (const std::unique_ptr<ThreadTrace>& trace : traces) {
+		if (!trace->name.empty()) {
+			file << (first ? "\n" : ",\n")
+				<< "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, "
+				<< "\"tid\": " << trace->thread_id << ", \"args\": {\"name\": ";
+			WriteJsonString(file, trace->name);
+			file << "}}";
+			first = false;
+		}
+		const uint64_t count =
+			trace->event_count.load(std::memory_order_acquire);
+		const uint64_t kept =
+			std::min<uint64_t>(count, kProfilerEventsPerThread);
+		dropped_total += static_cast<size_t>(count - kept);
+		for (uint64_t i = count - kept; i < count; ++i) {
+			const ProfileEvent& event =
+				trace->events[i % kProfilerEventsPerThread];
+			// Times are in microseconds.
+			file << (first ? "\n" : ",\n") << "{\"ph\": \"X\", \"name\": ";
+			WriteJsonString(file, event.name);
+			file << ", \"pid\": 1, \"tid\": " << trace->thread_id
+				<< ", \"ts\": " << event.start_ns / 1000.0 << ", \"dur\": "
+				<< (event.end_ns - event.start_ns) / 1000.0 << "}";
+			first = false;
+		}
+		event_total += static_cast<size_t>(kept);
+	}
+	file << "\n]}\n";
+	std::cout << "Wrote " << event_total << " events of " << traces.size()
+		<< " threads to " << path;
+	if (dropped_total > 0)
+		std::cout << ", " << dropped_total << " older ones were overwritten";
+	std::cout << "\n";
+	return static_cast<bool>(file);
+}
+
+ProfileScope::ProfileScope(const char* event_name)
+	: name(event_name),
+	start_ns(IsProfilerStarted() ? NowNs() : kNotRecording) {}
+
+void ProfileScope::End() {
+	if (start_ns == kNotRecording)
+		return;
+	ThreadTrace* trace = GetThreadTrace();
+	const uint64_t index = trace->event_count.load(std::memory_order_relaxed);
+	trace->events[index % kProfilerEventsPerThread] = {name, start_ns, NowNs()};
+	trace->event_count.store(index + 1, std::memory_order_release);
+	start_ns = kNotRecording;
+}
+
+ProfileSession::ProfileSession(const char* trace_path) : path(trace_path) {
+	if (path) {
+		StartProfiler();
+		NameProfilerThread("main");
+	}
+}
+
+ProfileSession::~ProfileSession() {
+	if (path)
+		WriteChromeTrace(path);
+}
@@ -0,0 +1,58 @@
+#ifndef VOXEL_PROFILER
+#define VOXEL_PROFILER
+
+#include <cstddef>
+#include <cstdint>
+
+// Events each thread keeps before overwriting its oldest ones.
+const size_t kProfilerEventsPerThread = 1 << 16;
+
+// Starts recording the ProfileScopes of every thread. Until then they cost a
+// single relaxed load.
+void StartProfiler();
+
+// Returns whether the profiler records.
+bool IsProfilerStarted();
+
+// Names the calling thread in the trace.
+void NameProfilerThread(const char* name);
+
+// Writes the events of every thread to |path| in the Chrome trace_event
+// JSON format, for chrome://tracing or Perfetto. Events still being
+// recorded by other threads while it runs may be torn or missing.
+bool WriteChromeTrace(const char* path);
+
+// Records the time from its construction to its destruction, or to End(),
+// as an event named |event_name| on the calling thread. |event_name| must
+// outlive the profiler, a string literal.
+//
+// Each thread appends its events to its own ring buffer, so recording takes
+// no lock and no allocation: two reads of the clock and a store.
+class ProfileScope {
+  public:
+	explicit ProfileScope(const char* event_name);
+	~ProfileScope() {
+		End();
+	}
+
+	// Ends the scope before its destruction.
+	void End();
+
+  private:
+	const char* name;
+	// Start in nanoseconds since StartProfiler(), or ~0 if not recording.
+	uint64_t start_ns;
+};
+
+// Starts the profiler if |trace_path| isn't null, and writes its trace there
+// once destroyed, however the scope it lives in is left.
+class ProfileSession {
+  public:
+	explicit ProfileSession(const char* trace_path);
+	~ProfileSession();
+
+  private:
+	const char* path;
+};
+
+#endif  // VOXEL_PROFILER
@@ -0,0 +1,138 @@
+// The ray packet kernel, written once for any packet width.
+//
+// This file has no include guard: ray_packets.cpp includes it once per
+// instruction set, after defining
+//   VOXEL_PACKET_NAMESPACE  namespace of this copy of the kernel,
+//   VOXEL_PACKET_TARGET     features it is compiled for (see VOXEL_TARGET),
+//   VOXEL_PACKET_OPS        struct with the SIMD operations of that set.
+// Intrinsics only inline into functions compiled for the same features, so
+// every instruction set needs its own copy.
+
+namespace VOXEL_PACKET_NAMESPACE {
+
+typedef VOXEL_PACKET_OPS Ops;
+typedef Ops::Float Float;
+typedef Ops::Int Int;
+typedef Ops::Mask Mask;
+
+// Returns the trilinearly filtered value of the volume at |x|, |y|, |z| in
+// model space, clamping to the edge like GL_CLAMP_TO_EDGE.
+template <typename T>
+VOXEL_TARGET(VOXEL_PACKET_TARGET) inline Float SampleVolume(
+	const PacketVolume& volume, Float x, Float y, Float z) {
+	const T* texels = reinterpret_cast<const T*>(volume.texels);
+	const Float position[3] = {x, y, z};
+	Int lower[3];
+	Int upper[3];
+	Float weights[3];
+	for (int axis = 0; axis < 3; ++axis) {
+		// Texel centers are at (i + 0.5) / size.
+		const Float coordinate = Ops::Sub(
+			Ops::Mul(position[axis], Ops::Set(static_cast<float>(volume.dims[axis]))),
+			Ops::Set(0.5f));
+		const Float floor = Ops::Floor(coordinate);
+		const Int index = Ops::ToInt(floor);
+		const Int last = Ops::SetInt(volume.dims[axis] - 1);
+		lower[axis] = Ops::ClampInt(index, Ops::SetInt(0), last);
+		upper[axis] =
+			Ops::ClampInt(Ops::AddInt(index, Ops::SetInt(1)), Ops::SetInt(0), last);
+		weights[axis] = Ops::Mul(Ops::Round(Ops::Mul(Ops::Sub(coordinate, floor),
+			Ops::Set(kFilterWeightSteps))), Ops::Set(1.0f / kFilterWeightSteps));
+	}
+
+	const Int row = Ops::SetInt(volume.dims[0]);
+	const Int slice = Ops::SetInt(volume.dims[0] * volume.dims[1]);
+	Float along_z[2];
+	for (int k = 0; k < 2; ++k) {
+		const Int z_offset = Ops::MulInt(k == 0 ? lower[2] : upper[2], slice);
+		Float along_y[2];
+		for (int j = 0; j < 2; ++j) {
+			const Int line = Ops::AddInt(z_offset,
+				Ops::MulInt(j == 0 ? lower[1] : upper[1], row));
+			const Float left =
+				Ops::GatherTexel(texels, Ops::AddInt(line, lower[0]));
+			const Float right =
+				Ops::GatherTexel(texels, Ops::AddInt(line, upper[0]));
+			along_y[j] = Ops::MulAdd(Ops::Sub(right, left), weights[0], left);
+		}
+		along_z[k] = Ops::MulAdd(
+			Ops::Sub(along_y[1], along_y[0]), weights[1], along_y[0]);
+	}
+	const Float value =
+		Ops::MulAdd(Ops::Sub(along_z[1], along_z[0]), weights[2], along_z[0]);
+	return Ops::Mul(value, Ops::Set(volume.value_scale));
+}
+
+template <typename T>
+VOXEL_TARGET(VOXEL_PACKET_TARGET) void TracePacket(const PacketVolume& volume,
+	const PacketRays& rays, int max_sample_count, float opaque_alpha,
+	PacketColors* colors) {
+	Float entry[3];
+	Float direction[3];
+	for (int axis = 0; axis < 3; ++axis) {
+		entry[axis] = Ops::Load(rays.entry[axis]);
+		direction[axis] = Ops::Load(rays.direction[axis]);
+	}
+	const Float step_size = Ops::Load(rays.step_size);
+	const Float sample_count = Ops::Load(rays.sample_count);
+	const Float table_scale =
+		Ops::Set(static_cast<float>(volume.transfer_function_size));
+	const Int table_last = Ops::SetInt(volume.transfer_function_size - 1);
+
+	Float color[3] = {Ops::Set(0.0f), Ops::Set(0.0f), Ops::Set(0.0f)};
+	Float alpha = Ops::Set(0.0f);
+	for (int i = 0; i < max_sample_count; ++i) {
+		// Lanes drop out once they are opaque or past their last sample, the
+		// packet stops once they all have.
+		const Float sample = Ops::Set(static_cast<float>(i));
+		const Mask active = Ops::And(Ops::Greater(sample_count, sample),
+			Ops::LessEqual(alpha, Ops::Set(opaque_alpha)));
+		if (!Ops::Any(active))
+			break;
+		const Float distance =
+			Ops::Mul(step_size, Ops::Set(i + kFirstSampleOffset));
+		const Float voxel = SampleVolume<T>(volume,
+			Ops::MulAdd(direction[0], distance, entry[0]),
+			Ops::MulAdd(direction[1], distance, entry[1]),
+			Ops::MulAdd(direction[2], distance, entry[2]));
+
+		// GL_NEAREST with GL_REPEAT.
+		const Float wrapped = Ops::Sub(voxel, Ops::Floor(voxel));
+		const Int entry_index = Ops::MulInt(Ops::SetInt(4),
+			Ops::ClampInt(Ops::ToInt(Ops::Mul(wrapped, table_scale)),
+				Ops::SetInt(0), table_last));
+		const Float voxel_alpha = Ops::GatherTexel(volume.transfer_function,
+			Ops::AddInt(entry_index, Ops::SetInt(3)));
+		const Float transparency = Ops::Sub(Ops::Set(1.0f), alpha);
+		for (int c = 0; c < 3; ++c) {
+			const Float voxel_color = Ops::Mul(voxel_alpha,
+				Ops::GatherTexel(volume.transfer_function,
+					Ops::AddInt(entry_index, Ops::SetInt(c))));
+			color[c] = Ops::Select(active,
+				Ops::MulAdd(transparency, voxel_color, color[c]), color[c]);
+		}
+		alpha = Ops::Select(active,
+			Ops::MulAdd(transparency, voxel_alpha, alpha), alpha);
+	}
+
+	for (int c = 0; c < 3; ++c)
+		Ops::Store(colors->rgba[c], color[c]);
+	Ops::Store(colors->rgba[3], alpha);
+}
+
+// Returns the kernel for texels in |format|.
+inline TracePacketFunction GetTracePacket(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::kR8:
+		return TracePacket<uint8_t>;
+	case TextureFormat::kR16:
+		return TracePacket<uint16_t>;
+	case TextureFormat::kR16F:
+		return TracePacket<Half>;
+	case TextureFormat::kR32F:
+		return TracePacket<float>;
+	}
+	return nullptr;
+}
+
+}  // namespace VOXEL_PACKET_NAMESPACE
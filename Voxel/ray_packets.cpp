@@ -0,0 +1,399 @@
+#include "ray_packets.h"
+
+#include <cstring>
+
+#include "cpu_features.h"
+#include "ray_sampling.h"
+#include "voxel_simd.h"
+
+namespace {
+
+using namespace simd;
+
+#ifdef VOXEL_X86
+
+// The operations the packet kernel is written with, for each instruction
+// set. Float holds one float per lane, Int one 32-bit integer per lane and
+// Mask one bool per lane. GatherTexel() loads the texel at the index of each
+// lane as a float, without normalization.
+
+struct Sse41Ops {
+	typedef __m128 Float;
+	typedef __m128i Int;
+	typedef __m128 Mask;
+
+	static VOXEL_TARGET("sse4.1") Float Set(float value) {
+		return _mm_set1_ps(value);
+	}
+	static VOXEL_TARGET("sse4.1") Float Load(const float* values) {
+		return _mm_loadu_ps(values);
+	}
+	static VOXEL_TARGET("sse4.1") void Store(float* values, Float value) {
+		_mm_storeu_ps(values, value);
+	}
+	static VOXEL_TARGET("sse4.1") Float Sub(Float a, Float b) {
+		return _mm_sub_ps(a, b);
+	}
+	static VOXEL_TARGET("sse4.1") Float Mul(Float a, Float b) {
+		return _mm_mul_ps(a, b);
+	}
+	// Returns a * b + c.
+	static VOXEL_TARGET("sse4.1") Float MulAdd(Float a, Float b, Float c) {
+		return _mm_add_ps(_mm_mul_ps(a, b), c);
+	}
+	static VOXEL_TARGET("sse4.1") Float Floor(Float value) {
+		return _mm_floor_ps(value);
+	}
+	// Rounds to the nearest integer, ties to even.
+	static VOXEL_TARGET("sse4.1") Float Round(Float value) {
+		return _mm_round_ps(value, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	}
+	static VOXEL_TARGET("sse4.1") Int SetInt(int value) {
+		return _mm_set1_epi32(value);
+	}
+	// Truncates towards zero.
+	static VOXEL_TARGET("sse4.1") Int ToInt(Float value) {
+		return _mm_cvttps_epi32(value);
+	}
+	static VOXEL_TARGET("sse4.1") Int AddInt(Int a, Int b) {
+		return _mm_add_epi32(a, b);
+	}
+	static VOXEL_TARGET("sse4.1") Int MulInt(Int a, Int b) {
+		return _mm_mullo_epi32(a, b);
+	}
+	static VOXEL_TARGET("sse4.1") Int ClampInt(Int value, Int min, Int max) {
+		return _mm_min_epi32(_mm_max_epi32(value, min), max);
+	}
+	static VOXEL_TARGET("sse4.1") Mask Greater(Float a, Float b) {
+		return _mm_cmpgt_ps(a, b);
+	}
+	static VOXEL_TARGET("sse4.1") Mask LessEqual(Float a, Float b) {
+		return _mm_cmple_ps(a, b);
+	}
+	static VOXEL_TARGET("sse4.1") Mask And(Mask a, Mask b) {
+		return _mm_and_ps(a, b);
+	}
+	static VOXEL_TARGET("sse4.1") bool Any(Mask mask) {
+		return _mm_movemask_ps(mask) != 0;
+	}
+	// Returns |if_set| in the lanes of |mask| and |if_clear| elsewhere.
+	static VOXEL_TARGET("sse4.1") Float Select(Mask mask, Float if_set,
+		Float if_clear) {
+		return _mm_blendv_ps(if_clear, if_set, mask);
+	}
+	// SSE has no gathers, the lanes are loaded one by one.
+	template <typename T>
+	static VOXEL_TARGET("sse4.1") Float GatherTexel(const T* texels, Int index) {
+		alignas(16) int32_t indices[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(indices), index);
+		return _mm_setr_ps(LoadScalar(texels + indices[0], false),
+			LoadScalar(texels + indices[1], false),
+			LoadScalar(texels + indices[2], false),
+			LoadScalar(texels + indices[3], false));
+	}
+};
+
+struct Avx2Ops {
+	typedef __m256 Float;
+	typedef __m256i Int;
+	typedef __m256 Mask;
+
+	static VOXEL_TARGET(VOXEL_AVX2) Float Set(float value) {
+		return _mm256_set1_ps(value);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Float Load(const float* values) {
+		return _mm256_loadu_ps(values);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) void Store(float* values, Float value) {
+		_mm256_storeu_ps(values, value);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Float Sub(Float a, Float b) {
+		return _mm256_sub_ps(a, b);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Float Mul(Float a, Float b) {
+		return _mm256_mul_ps(a, b);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Float MulAdd(Float a, Float b, Float c) {
+		return _mm256_fmadd_ps(a, b, c);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Float Floor(Float value) {
+		return _mm256_floor_ps(value);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Float Round(Float value) {
+		return _mm256_round_ps(
+			value, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Int SetInt(int value) {
+		return _mm256_set1_epi32(value);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Int ToInt(Float value) {
+		return _mm256_cvttps_epi32(value);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Int AddInt(Int a, Int b) {
+		return _mm256_add_epi32(a, b);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Int MulInt(Int a, Int b) {
+		return _mm256_mullo_epi32(a, b);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Int ClampInt(Int value, Int min, Int max) {
+		return _mm256_min_epi32(_mm256_max_epi32(value, min), max);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Mask Greater(Float a, Float b) {
+		return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Mask LessEqual(Float a, Float b) {
+		return _mm256_cmp_ps(a, b, _CMP_LE_OQ);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Mask And(Mask a, Mask b) {
+		return _mm256_and_ps(a, b);
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) bool Any(Mask mask) {
+		return _mm256_movemask_ps(mask) != 0;
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Float Select(Mask mask, Float if_set,
+		Float if_clear) {
+		return _mm256_blendv_ps(if_clear, if_set, mask);
+	}
+
+	// Gathers the 32 bits ending at byte |offset| + |size| of every lane and
+	// keeps the top |size| bytes. Reading backwards (and forwards for the
+	// first texels) never touches memory outside the volume, as long as it
+	// is at least 4 bytes long.
+	static VOXEL_TARGET(VOXEL_AVX2) Int GatherSmall(const void* texels,
+		Int offset, int size) {
+		const Int start = _mm256_max_epi32(
+			_mm256_sub_epi32(offset, _mm256_set1_epi32(4 - size)),
+			_mm256_setzero_si256());
+		const Int shift =
+			_mm256_slli_epi32(_mm256_sub_epi32(offset, start), 3);
+		const Int words = _mm256_i32gather_epi32(
+			static_cast<const int*>(texels), start, 1);
+		return _mm256_and_si256(_mm256_srlv_epi32(words, shift),
+			_mm256_set1_epi32(size == 1 ? 0xff : 0xffff));
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Float GatherTexel(const uint8_t* texels,
+		Int index) {
+		return _mm256_cvtepi32_ps(GatherSmall(texels, index, 1));
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Float GatherTexel(const uint16_t* texels,
+		Int index) {
+		return _mm256_cvtepi32_ps(
+			GatherSmall(texels, _mm256_slli_epi32(index, 1), 2));
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Float GatherTexel(const Half* texels,
+		Int index) {
+		const Int words = GatherSmall(texels, _mm256_slli_epi32(index, 1), 2);
+		// Pack the halves into 16-bit words, in lane order.
+		const Int packed = _mm256_permute4x64_epi64(
+			_mm256_packus_epi32(words, words), _MM_SHUFFLE(3, 1, 2, 0));
+		return _mm256_cvtph_ps(_mm256_castsi256_si128(packed));
+	}
+	static VOXEL_TARGET(VOXEL_AVX2) Float GatherTexel(const float* texels,
+		Int index) {
+		return _mm256_i32gather_ps(texels, index, 4);
+	}
+};
+
+#define VOXEL_AVX512 "avx512f,avx2,fma,f16c"
+
+struct Avx512Ops {
+	typedef __m512 Float;
+	typedef __m512i Int;
+	typedef __mmask16 Mask;
+
+	static VOXEL_TARGET(VOXEL_AVX512) Float Set(float value) {
+		return _mm512_set1_ps(value);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Float Load(const float* values) {
+		return _mm512_loadu_ps(values);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) void Store(float* values, Float value) {
+		_mm512_storeu_ps(values, value);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Float Sub(Float a, Float b) {
+		return _mm512_sub_ps(a, b);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Float Mul(Float a, Float b) {
+		return _mm512_mul_ps(a, b);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Float MulAdd(Float a, Float b, Float c) {
+		return _mm512_fmadd_ps(a, b, c);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Float Floor(Float value) {
+		return _mm512_roundscale_ps(value, _MM_FROUND_TO_NEG_INF);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Float Round(Float value) {
+		return _mm512_roundscale_ps(
+			value, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Int SetInt(int value) {
+		return _mm512_set1_epi32(value);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Int ToInt(Float value) {
+		return _mm512_cvttps_epi32(value);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Int AddInt(Int a, Int b) {
+		return _mm512_add_epi32(a, b);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Int MulInt(Int a, Int b) {
+		return _mm512_mullo_epi32(a, b);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Int ClampInt(Int value, Int min, Int max) {
+		return _mm512_min_epi32(_mm512_max_epi32(value, min), max);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Mask Greater(Float a, Float b) {
+		return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Mask LessEqual(Float a, Float b) {
+		return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Mask And(Mask a, Mask b) {
+		return static_cast<Mask>(a & b);
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) bool Any(Mask mask) {
+		return mask != 0;
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Float Select(Mask mask, Float if_set,
+		Float if_clear) {
+		return _mm512_mask_blend_ps(mask, if_clear, if_set);
+	}
+
+	// See Avx2Ops::GatherSmall().
+	static VOXEL_TARGET(VOXEL_AVX512) Int GatherSmall(const void* texels,
+		Int offset, int size) {
+		const Int start = _mm512_max_epi32(
+			_mm512_sub_epi32(offset, _mm512_set1_epi32(4 - size)),
+			_mm512_setzero_si512());
+		const Int shift =
+			_mm512_slli_epi32(_mm512_sub_epi32(offset, start), 3);
+		const Int words = _mm512_i32gather_epi32(start, texels, 1);
+		return _mm512_and_si512(_mm512_srlv_epi32(words, shift),
+			_mm512_set1_epi32(size == 1 ? 0xff : 0xffff));
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Float GatherTexel(const uint8_t* texels,
+		Int index) {
+		return _mm512_cvtepi32_ps(GatherSmall(texels, index, 1));
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Float GatherTexel(const uint16_t* texels,
+		Int index) {
+		return _mm512_cvtepi32_ps(
+			GatherSmall(texels, _mm512_slli_epi32(index, 1), 2));
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Float GatherTexel(const Half* texels,
+		Int index) {
+		const Int words = GatherSmall(texels, _mm512_slli_epi32(index, 1), 2);
+		return _mm512_cvtph_ps(_mm512_cvtepi32_epi16(words));
+	}
+	static VOXEL_TARGET(VOXEL_AVX512) Float GatherTexel(const float* texels,
+		Int index) {
+		return _mm512_i32gather_ps(index, texels, 4);
+	}
+};
+
+#define VOXEL_PACKET_NAMESPACE sse41
+#define VOXEL_PACKET_TARGET "sse4.1"
+#define VOXEL_PACKET_OPS Sse41Ops
+#include "ray_packet_kernel.h"
+#undef VOXEL_PACKET_NAMESPACE
+#undef VOXEL_PACKET_TARGET
+#undef VOXEL_PACKET_OPS
+
+#define VOXEL_PACKET_NAMESPACE avx2
+#define VOXEL_PACKET_TARGET VOXEL_AVX2
+#define VOXEL_PACKET_OPS Avx2Ops
+#include "ray_packet_kernel.h"
+#undef VOXEL_PACKET_NAMESPACE
+#undef VOXEL_PACKET_TARGET
+#undef VOXEL_PACKET_OPS
+
+#define VOXEL_PACKET_NAMESPACE avx512
+#define VOXEL_PACKET_TARGET VOXEL_AVX512
+#define VOXEL_PACKET_OPS Avx512Ops
+#include "ray_packet_kernel.h"
+#undef VOXEL_PACKET_NAMESPACE
+#undef VOXEL_PACKET_TARGET
+#undef VOXEL_PACKET_OPS
+
+#endif  // VOXEL_X86
+
+}  // namespace
+
+const char* RaycastKernelName(RaycastKernel kernel) {
+	switch (kernel) {
+	case RaycastKernel::kScalar:
+		return "scalar";
+	case RaycastKernel::kSse41:
+		return "sse4.1";
+	case RaycastKernel::kAvx2:
+		return "avx2";
+	case RaycastKernel::kAvx512:
+		return "avx512";
+	}
+	return "unknown";
+}
+
+bool ParseRaycastKernel(const char* name, RaycastKernel* kernel) {
+	for (RaycastKernel candidate : {RaycastKernel::kScalar,
+		RaycastKernel::kSse41, RaycastKernel::kAvx2, RaycastKernel::kAvx512}) {
+		if (std::strcmp(name, RaycastKernelName(candidate)) == 0) {
+			*kernel = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool IsRaycastKernelSupported(RaycastKernel kernel) {
+	const CpuFeatures& features = GetCpuFeatures();
+	const bool avx2 = features.avx2 && features.fma && features.f16c;
+	switch (kernel) {
+	case RaycastKernel::kScalar:
+		return true;
+	case RaycastKernel::kSse41:
+		return features.sse41;
+	case RaycastKernel::kAvx2:
+		return avx2;
+	case RaycastKernel::kAvx512:
+		return avx2 && features.avx512f;
+	}
+	return false;
+}
+
+RaycastKernel GetBestRaycastKernel() {
+	for (RaycastKernel kernel : {RaycastKernel::kAvx512, RaycastKernel::kAvx2,
+		RaycastKernel::kSse41}) {
+		if (IsRaycastKernelSupported(kernel))
+			return kernel;
+	}
+	return RaycastKernel::kScalar;
+}
+
+int RaycastKernelWidth(RaycastKernel kernel) {
+	switch (kernel) {
+	case RaycastKernel::kScalar:
+		return 1;
+	case RaycastKernel::kSse41:
+		return 4;
+	case RaycastKernel::kAvx2:
+		return 8;
+	case RaycastKernel::kAvx512:
+		return 16;
+	}
+	return 1;
+}
+
+TracePacketFunction GetTracePacketFunction(
+	RaycastKernel kernel, TextureFormat format) {
+	switch (kernel) {
+#ifdef VOXEL_X86
+	case RaycastKernel::kSse41:
+		return sse41::GetTracePacket(format);
+	case RaycastKernel::kAvx2:
+		return avx2::GetTracePacket(format);
+	case RaycastKernel::kAvx512:
+		return avx512::GetTracePacket(format);
+#endif
+	default:
+		return nullptr;
+	}
+}
@@ -0,0 +1,84 @@
+#ifndef VOXEL_RAY_PACKETS
+#define VOXEL_RAY_PACKETS
+
+#include <cstdint>
+
+#include "voxel_convert.h"
+
+// Ways the CPU raycaster can march its rays.
+enum class RaycastKernel {
+	// One ray at a time.
+	kScalar,
+	// Packets of 4, 8 or 16 rays, one per SIMD lane.
+	kSse41,
+	kAvx2,
+	kAvx512,
+};
+
+// Returns the name used for |kernel| on the command line ("avx2", ...).
+const char* RaycastKernelName(RaycastKernel kernel);
+
+// Parses a name returned by RaycastKernelName() into |kernel|.
+bool ParseRaycastKernel(const char* name, RaycastKernel* kernel);
+
+// Returns true if the CPU can run |kernel|.
+bool IsRaycastKernelSupported(RaycastKernel kernel);
+
+// Returns the widest kernel the CPU supports.
+RaycastKernel GetBestRaycastKernel();
+
+// Returns the number of rays |kernel| marches together.
+int RaycastKernelWidth(RaycastKernel kernel);
+
+// The widest packet of any kernel.
+const int kMaxPacketWidth = 16;
+
+// Steps of the trilinear weights of the volume. Texture units round them to
+// 8 bits, which decides on which side of a sharp edge of the transfer
+// function a sample lands, so the CPU kernels round them the same way.
+const float kFilterWeightSteps = 256.0f;
+
+// Everything a packet needs to know about the volume.
+struct PacketVolume {
+	// Linear x-fastest texels. Their index must fit in a signed 32-bit
+	// integer, as the SIMD gathers take 32-bit offsets.
+	const uint8_t* texels;
+	int dims[3];
+	// Multiplier that normalizes integer texels to [0, 1].
+	float value_scale;
+	// RGBA floats, 4 per entry, opacities corrected for the step.
+	const float* transfer_function;
+	int transfer_function_size;
+};
+
+// The rays of a packet, one per lane, laid out as structures of arrays. Only
+// the first RaycastKernelWidth() entries of each array are used.
+struct PacketRays {
+	// Start of each ray in model space.
+	float entry[3][kMaxPacketWidth];
+	// Normalized direction of each ray.
+	float direction[3][kMaxPacketWidth];
+	// Distance between two samples.
+	float step_size[kMaxPacketWidth];
+	// Samples to take along each ray, 0 for the lanes left empty.
+	float sample_count[kMaxPacketWidth];
+};
+
+// Colors written by a packet as fragColor would be.
+struct PacketColors {
+	float rgba[4][kMaxPacketWidth];
+};
+
+// Marches the rays of |rays| through |volume| with the SIMD kernel
+// |kernel|, stopping lanes once their opacity goes over |opaque_alpha|.
+// |max_sample_count| is the largest sample count of the packet.
+typedef void (*TracePacketFunction)(const PacketVolume& volume,
+	const PacketRays& rays, int max_sample_count, float opaque_alpha,
+	PacketColors* colors);
+
+// Returns the packet kernel |kernel| for texels in |format|, or nullptr for
+// RaycastKernel::kScalar.
+TracePacketFunction GetTracePacketFunction(
+	RaycastKernel kernel, TextureFormat format);
+
+#endif  // VOXEL_RAY_PACKETS
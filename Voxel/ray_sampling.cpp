@@ -0,0 +1,161 @@
+#include "ray_sampling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "occupancy_grid.h"
+
+namespace {
+
+// Pixels along each side of the blocks CountRaySamples() traces one ray of.
+const int kCountBlock = 4;
+
+// Marches |sample_count| samples spaced |step| apart from |first_sample|
+// along |direction|, in voxels, through |occupancy| the way the shader does,
+// climbing up to |top_level| after each jump over an empty node. Adds the
+// samples taken in visible bricks to |samples| and the jumps to |jumps|.
+void TraceOccupancy(const OccupancyGrid& occupancy,
+	const glm::vec3& first_sample, const glm::vec3& direction, float step,
+	int64_t sample_count, int top_level, uint64_t* samples, uint64_t* jumps) {
+	int skip_level = top_level;
+	for (int64_t i = 0; i < sample_count; ++i) {
+		const glm::vec3 position = first_sample + direction * (step * i);
+		int level = skip_level;
+		float node_size = 0.0f;
+		glm::vec3 node;
+		for (; level >= 0; --level) {
+			const OccupancyGrid::Level& grid_level = occupancy.levels[level];
+			node_size = static_cast<float>(kOccupancyBrickSize << level);
+			node = glm::clamp(glm::floor(position / node_size), glm::vec3(0.0f),
+				glm::vec3(grid_level.dims[0] - 1, grid_level.dims[1] - 1,
+					grid_level.dims[2] - 1));
+			if (!occupancy.IsOccupied(level, static_cast<uint32_t>(node.x),
+				static_cast<uint32_t>(node.y), static_cast<uint32_t>(node.z))) {
+				break;
+			}
+		}
+		if (level < 0) {
+			++*samples;
+			skip_level = 0;
+			continue;
+		}
+		++*jumps;
+		float t_exit = 1e30f;
+		for (int axis = 0; axis < 3; ++axis) {
+			const float to_face = direction[axis] >= 0.0f ?
+				(node[axis] + 1.0f) * node_size - position[axis] :
+				position[axis] - node[axis] * node_size;
+			t_exit = std::min(t_exit,
+				to_face / std::max(std::abs(direction[axis]), 1e-6f));
+		}
+		i = std::max(i, static_cast<int64_t>(std::ceil(i + t_exit / step)) - 1);
+		skip_level = std::min(level + 1, top_level);
+	}
+}
+
+}  // namespace
+
+float SampleStepVoxels(float rate, float lod) {
+	return kNyquistStepVoxels / rate * std::exp2(std::max(lod, 0.0f));
+}
+
+float OpacityCorrectionExponent(float step_voxels) {
+	return step_voxels / kReferenceStepVoxels;
+}
+
+void CorrectOpacities(float step_voxels, std::vector<float>* rgba) {
+	const float exponent = OpacityCorrectionExponent(step_voxels);
+	for (size_t i = 3; i < rgba->size(); i += 4)
+		(*rgba)[i] = 1.0f - std::pow(1.0f - (*rgba)[i], exponent);
+}
+
+bool IntersectUnitCube(const glm::vec3& origin, const glm::vec3& direction,
+	float* t_near, float* t_far) {
+	const glm::vec3 inverse_direction = 1.0f / direction;
+	const glm::vec3 t0 = -origin * inverse_direction;
+	const glm::vec3 t1 = (glm::vec3(1.0f) - origin) * inverse_direction;
+	const glm::vec3 t_min = glm::min(t0, t1);
+	const glm::vec3 t_max = glm::max(t0, t1);
+	*t_near = std::max(std::max(t_min.x, t_min.y), std::max(t_min.z, 0.0f));
+	*t_far = std::min(std::min(t_max.x, t_max.y), t_max.z);
+	return *t_near < *t_far;
+}
+
+RaySampleCounts CountRaySamples(const glm::mat4& model_from_clip,
+	const uint32_t dims[3], float step_voxels, int width, int height,
+	const OccupancyGrid* occupancy) {
+	const glm::vec3 voxels_per_unit(dims[0], dims[1], dims[2]);
+	RaySampleCounts counts;
+	counts.skipping = occupancy != nullptr;
+	for (int y = 0; y < height; y += kCountBlock) {
+		for (int x = 0; x < width; x += kCountBlock) {
+			const float ndc_x = 2.0f * (x + 0.5f * kCountBlock) / width - 1.0f;
+			const float ndc_y = 1.0f - 2.0f * (y + 0.5f * kCountBlock) / height;
+			const glm::vec4 near_point =
+				model_from_clip * glm::vec4(ndc_x, ndc_y, -1.0f, 1.0f);
+			const glm::vec4 far_point =
+				model_from_clip * glm::vec4(ndc_x, ndc_y, 1.0f, 1.0f);
+			const glm::vec3 origin = glm::vec3(near_point) / near_point.w;
+			const glm::vec3 direction = glm::vec3(far_point) / far_point.w - origin;
+			float t_near;
+			float t_far;
+			if (!IntersectUnitCube(origin, direction, &t_near, &t_far))
+				continue;
+			const uint64_t pixels = static_cast<uint64_t>(
+				std::min(kCountBlock, width - x) * std::min(kCountBlock, height - y));
+			const float length_voxels =
+				glm::length(direction * voxels_per_unit) * (t_far - t_near);
+			const uint64_t samples =
+				static_cast<uint64_t>(
+					std::ceil(length_voxels / step_voxels - kFirstSampleOffset));
+			counts.rays += pixels;
+			counts.samples += pixels * samples;
+			counts.fixed_samples += pixels * kFixedSampleCount;
+			if (occupancy) {
+				const glm::vec3 voxel_direction =
+					glm::normalize(direction * voxels_per_unit);
+				const glm::vec3 first_sample =
+					(origin + direction * t_near) * voxels_per_unit +
+					voxel_direction * (step_voxels * kFirstSampleOffset);
+				uint64_t occupied_samples = 0;
+				uint64_t brick_jumps = 0;
+				uint64_t hierarchy_jumps = 0;
+				TraceOccupancy(*occupancy, first_sample, voxel_direction,
+					step_voxels, samples, 0, &occupied_samples, &brick_jumps);
+				occupied_samples = 0;
+				TraceOccupancy(*occupancy, first_sample, voxel_direction,
+					step_voxels, samples,
+					static_cast<int>(occupancy->levels.size()) - 1,
+					&occupied_samples, &hierarchy_jumps);
+				counts.occupied_samples += pixels * occupied_samples;
+				counts.brick_jumps += pixels * brick_jumps;
+				counts.hierarchy_jumps += pixels * hierarchy_jumps;
+			}
+		}
+	}
+	return counts;
+}
+
+void PrintRaySampleCounts(const RaySampleCounts& counts) {
+	if (counts.rays == 0)
+		return;
+	std::cout << "Rays take " << counts.samples / 1e6 << "M samples per frame, "
+		<< static_cast<double>(counts.samples) / counts.rays << " per ray, "
+		<< "instead of " << counts.fixed_samples / 1e6 << "M with "
+		<< kFixedSampleCount << " per ray ("
+		<< 100.0 * (1.0 - static_cast<double>(counts.samples) /
+			counts.fixed_samples) << "% saved)\n";
+	if (counts.skipping) {
+		std::cout << "Skipping empty space leaves "
+			<< counts.occupied_samples / 1e6 << "M samples per frame, "
+			<< static_cast<double>(counts.occupied_samples) / counts.rays
+			<< " per ray (" << 100.0 * (1.0 - static_cast<double>(
+				counts.occupied_samples) / std::max<uint64_t>(counts.samples, 1))
+			<< "% fewer), with "
+			<< static_cast<double>(counts.hierarchy_jumps) / counts.rays
+			<< " jumps per ray through the hierarchy instead of "
+			<< static_cast<double>(counts.brick_jumps) / counts.rays
+			<< " from brick to brick\n";
+	}
+}
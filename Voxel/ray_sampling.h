@@ -0,0 +1,77 @@
+#ifndef VOXEL_RAY_SAMPLING
+#define VOXEL_RAY_SAMPLING
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class OccupancyGrid;
+
+// How far apart rays sample the volume. Steps are measured in voxels of the
+// full resolution level, so every ray samples the volume equally densely
+// whatever its length or direction.
+
+// Half a voxel, the longest step that doesn't alias the voxels.
+const float kNyquistStepVoxels = 0.5f;
+// The step the opacities of the transfer functions were chosen for: the
+// fixed 1000 samples per ray that used to cross the 128 voxels of teddy.raw.
+const float kReferenceStepVoxels = 0.125f;
+// Samples per ray of the fixed sampling, to report what the steps save.
+const int kFixedSampleCount = 1000;
+// Distance in steps from the entry of a ray to its first sample. Samples sit
+// in the middle of their steps, where the jittered ones fall on average.
+// From the entry, rays along an axis would sample every boundary between two
+// voxels, where the filtering averages them, and never a voxel itself.
+const float kFirstSampleOffset = 0.5f;
+
+// Returns the step in voxels of sampling mip level |lod| at |rate| times
+// its Nyquist rate.
+float SampleStepVoxels(float rate, float lod);
+
+// Returns the exponent that corrects opacities for steps of |step_voxels|,
+// alpha' = 1 - (1 - alpha)^exponent, so that the same thickness of a
+// material stays as opaque whatever the step.
+float OpacityCorrectionExponent(float step_voxels);
+
+// Applies OpacityCorrectionExponent(|step_voxels|) to the alpha of every
+// entry of |rgba|, a table of 4 floats per entry.
+void CorrectOpacities(float step_voxels, std::vector<float>* rgba);
+
+// Intersects the ray |origin| + t * |direction| with the unit cube and
+// stores the range of t inside it in |t_near| and |t_far|, from 0 at the
+// earliest. Returns false if the ray misses the cube.
+bool IntersectUnitCube(const glm::vec3& origin, const glm::vec3& direction,
+	float* t_near, float* t_far);
+
+// Total samples of the rays of one frame, before rays stop early.
+struct RaySampleCounts {
+	uint64_t rays = 0;
+	// With steps of the given length.
+	uint64_t samples = 0;
+	// With kFixedSampleCount samples per ray.
+	uint64_t fixed_samples = 0;
+	// Of the samples with steps of the given length, the ones in visible
+	// bricks of the occupancy grid, if one was given, and the jumps over
+	// empty nodes of its hierarchy, or only over its bricks, that skip the
+	// others.
+	uint64_t occupied_samples = 0;
+	uint64_t hierarchy_jumps = 0;
+	uint64_t brick_jumps = 0;
+	bool skipping = false;
+};
+
+// Counts the samples the rays through a |width| x |height| image of the
+// unit cube, seen through |model_from_clip|, take along a volume of size
+// |dims| with steps of |step_voxels|. Only one ray in 4x4 pixels is traced,
+// so the counts are estimates. When |occupancy| isn't null, the samples that
+// fall in its visible bricks and the jumps over the others are counted too.
+RaySampleCounts CountRaySamples(const glm::mat4& model_from_clip,
+	const uint32_t dims[3], float step_voxels, int width, int height,
+	const OccupancyGrid* occupancy);
+
+// Prints the samples per frame of |counts| and how many the steps and the
+// skipping of empty bricks save over the fixed sampling.
+void PrintRaySampleCounts(const RaySampleCounts& counts);
+
+#endif  // VOXEL_RAY_SAMPLING
@@ -0,0 +1,113 @@
+#include "resolution_governor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+
+// Resolutions are multiples of this many pixels.
+const int kSizeGranularity = 8;
+
+}  // namespace
+
+bool ResolutionGovernor::CreateResolutionGovernor(ResolutionGovernor* governor,
+	float target_ms, const char* log_path) {
+	governor->target_ms = target_ms;
+	glGenQueries(static_cast<GLsizei>(kGovernorQueryCount), governor->queries);
+	if (log_path) {
+		governor->log.open(log_path, std::ofstream::out | std::ofstream::trunc);
+		if (!governor->log) {
+			std::cout << "Failed to open " << log_path << "\n";
+			return false;
+		}
+		governor->log << "frame,scale,gpu_ms,cpu_ms,full_frame_ms,next_scale\n";
+	}
+	return CheckGlError();
+}
+
+void ResolutionGovernor::BeginFrame(ResolutionGovernor* governor, float scale) {
+	governor->timing = governor->pending_count < kGovernorQueryCount;
+	if (!governor->timing)
+		return;
+	const size_t query = (governor->first_query + governor->pending_count) %
+		kGovernorQueryCount;
+	governor->query_scales[query] = scale;
+	glBeginQuery(GL_TIME_ELAPSED, governor->queries[query]);
+}
+
+void ResolutionGovernor::EndFrame(ResolutionGovernor* governor, float cpu_ms) {
+	if (!governor->timing)
+		return;
+	glEndQuery(GL_TIME_ELAPSED);
+	const size_t query = (governor->first_query + governor->pending_count) %
+		kGovernorQueryCount;
+	governor->query_cpu_ms[query] = cpu_ms;
+	++governor->pending_count;
+	governor->timing = false;
+}
+
+void ResolutionGovernor::Update(ResolutionGovernor* governor) {
+	while (governor->pending_count > 0) {
+		const size_t query = governor->first_query;
+		GLint available = 0;
+		glGetQueryObjectiv(
+			governor->queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+		// Queries finish in order.
+		if (!available)
+			break;
+		GLuint64 elapsed_ns = 0;
+		glGetQueryObjectui64v(
+			governor->queries[query], GL_QUERY_RESULT, &elapsed_ns);
+		governor->first_query = (query + 1) % kGovernorQueryCount;
+		--governor->pending_count;
+
+		// The cost of a frame follows its pixels, the square of its scale.
+		const float gpu_ms = static_cast<float>(elapsed_ns / 1e6);
+		const float frame_scale = governor->query_scales[query];
+		governor->recent_full_ms[governor->recent_index] =
+			gpu_ms / (frame_scale * frame_scale);
+		governor->recent_index = (governor->recent_index + 1) % kGovernorWindow;
+		governor->recent_count =
+			std::min(governor->recent_count + 1, kGovernorWindow);
+		// The lower median, so that the first slow frames don't count.
+		float recent[kGovernorWindow];
+		std::copy(governor->recent_full_ms,
+			governor->recent_full_ms + governor->recent_count, recent);
+		float* median = recent + (governor->recent_count - 1) / 2;
+		std::nth_element(recent, median, recent + governor->recent_count);
+		governor->full_frame_ms = *median;
+		governor->scale = std::min(std::max(
+			std::sqrt(governor->target_ms / governor->full_frame_ms),
+			kMinResolutionScale), 1.0f);
+
+		Stats& stats = governor->stats;
+		++stats.frame_count;
+		stats.scale_sum += frame_scale;
+		stats.scale_min = std::min(stats.scale_min, frame_scale);
+		stats.scale_max = std::max(stats.scale_max, frame_scale);
+		stats.gpu_ms_sum += gpu_ms;
+		stats.gpu_ms_max = std::max(stats.gpu_ms_max, gpu_ms);
+		stats.cpu_ms_sum += governor->query_cpu_ms[query];
+		if (governor->log.is_open()) {
+			governor->log << governor->frame_index << "," << frame_scale << ","
+				<< gpu_ms << "," << governor->query_cpu_ms[query] << ","
+				<< governor->full_frame_ms << "," << governor->scale << "\n";
+		}
+		++governor->frame_index;
+	}
+}
+
+int ResolutionGovernor::ScaledSize(int size) const {
+	const int scaled = static_cast<int>(std::lround(
+		size * scale / kSizeGranularity)) * kSizeGranularity;
+	return std::min(std::max(scaled, kSizeGranularity), size);
+}
+
+void ResolutionGovernor::DestroyResolutionGovernor(
+	ResolutionGovernor* governor) {
+	if (governor->queries[0] != 0) {
+		glDeleteQueries(
+			static_cast<GLsizei>(kGovernorQueryCount), governor->queries);
+	}
+}
@@ -0,0 +1,95 @@
+#ifndef VOXEL_RESOLUTION_GOVERNOR
+#define VOXEL_RESOLUTION_GOVERNOR
+
+#include <cstddef>
+#include <fstream>
+
+#include "gl_utils.h"
+
+// Smallest share of the window resolution along each axis frames are
+// rendered at.
+const float kMinResolutionScale = 0.25f;
+// Frames the GPU can be behind before frames stop being timed.
+const size_t kGovernorQueryCount = 4;
+// Number of the latest frames the cost of a frame is the median of.
+const size_t kGovernorWindow = 5;
+
+// Scales the resolution of the frames to keep the time the GPU spends on
+// each of them at a target.
+//
+// The GL commands of every frame are timed with a GL_TIME_ELAPSED query,
+// read back a few frames later so the CPU never waits for the GPU. Dividing
+// each time by the share of the pixels the frame had gives the time a full
+// resolution frame would take. Its median over the last few frames, which
+// ignores a frame slowed down by a shader compile or an upload, gives the
+// scale whose pixels fit in the target.
+class ResolutionGovernor {
+  public:
+	~ResolutionGovernor() {
+		DestroyResolutionGovernor(this);
+	}
+
+	// Statistics of the frames read back since the last ResetStats().
+	struct Stats {
+		int frame_count = 0;
+		float scale_sum = 0.0f;
+		float scale_min = 1.0f;
+		float scale_max = 0.0f;
+		float gpu_ms_sum = 0.0f;
+		float gpu_ms_max = 0.0f;
+		float cpu_ms_sum = 0.0f;
+	};
+
+	// Aims at frames taking |target_ms| on the GPU. If |log_path| isn't
+	// null, every frame read back is appended to it as a CSV row.
+	static bool CreateResolutionGovernor(ResolutionGovernor* governor,
+		float target_ms, const char* log_path);
+
+	// Bracket the GL commands of a frame rendered at |scale| of the window
+	// resolution along each axis. |cpu_ms| is the time the CPU took to
+	// issue them, logged with the frame. Frames started while every query
+	// is in flight aren't timed.
+	static void BeginFrame(ResolutionGovernor* governor, float scale);
+	static void EndFrame(ResolutionGovernor* governor, float cpu_ms);
+
+	// Reads back the frames the GPU finished, without waiting for the
+	// others, and updates |scale|.
+	static void Update(ResolutionGovernor* governor);
+
+	// Returns |size| pixels at |scale|, rounded to a multiple of 8 pixels
+	// so that the resolution doesn't change for every small correction.
+	int ScaledSize(int size) const;
+
+	void ResetStats() {
+		stats = Stats();
+	}
+
+	float target_ms = 0.0f;
+	// Scale of the next frames along each axis.
+	float scale = 1.0f;
+	// GPU time of a frame at full resolution, 0 until the first frame is
+	// read back.
+	float full_frame_ms = 0.0f;
+	Stats stats;
+
+  private:
+	static void DestroyResolutionGovernor(ResolutionGovernor* governor);
+
+	GLuint queries[kGovernorQueryCount] = {};
+	// Scale and CPU time of the frame of each query.
+	float query_scales[kGovernorQueryCount] = {};
+	float query_cpu_ms[kGovernorQueryCount] = {};
+	// Full resolution times of the latest frames read back.
+	float recent_full_ms[kGovernorWindow] = {};
+	size_t recent_index = 0;
+	size_t recent_count = 0;
+	// Oldest query in flight and number of queries in flight. A query is
+	// in flight from BeginFrame() until it is read back.
+	size_t first_query = 0;
+	size_t pending_count = 0;
+	bool timing = false;
+	size_t frame_index = 0;
+	std::ofstream log;
+};
+
+#endif  // VOXEL_RESOLUTION_GOVERNOR
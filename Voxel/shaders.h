@@ -60,43 +60,260 @@ in vec3 oEntryPoint;
 out vec4 fragColor;
 
 uniform sampler1D tffSampler;
+// The transfer function averaged over the segments between two samples,
+// indexed by the values at their front and back. Color in rgb and extinction
+// per reference step in alpha.
+uniform sampler2D preintegratedSampler;
+uniform bool uPreintegrated;
 uniform sampler2D firstPassSampler;
 uniform sampler3D voxelSampler;
+// One texel per brick of the volume, 0 where the transfer function makes the
+// whole brick transparent. Each mip level halves the nodes along each axis
+// and is 0 where all 8 children are.
+uniform sampler3D occupancySampler;
+// Read the exit points from the back faces drawn by the first pass instead
+// of intersecting the view rays with the cube.
+uniform bool uTwoPass;
+// Size of the first pass texture. Frames rendered at a reduced resolution
+// only cover its corner.
+uniform vec2 uScreenSize;
+// Inverse of uViewFromWorld * uWorldFromModel, places the camera in the
+// volume.
+uniform mat4 uModelFromView;
+// Slices of the volume above this depth haven't been streamed in yet.
+uniform float uLoadedDepth;
+// Mip level matching the screen footprint of a voxel, and the finest level
+// that is loaded.
+uniform float uVolumeLod;
+uniform float uMinLod;
+// Size of the full resolution level in voxels.
+uniform vec3 uVolumeDims;
+// Distance between samples in voxels of the full resolution level when
+// sampling it, doubled for every coarser level.
+uniform float uStepVoxels;
+// Step the opacities of the transfer function are meant for.
+uniform float uReferenceStep;
+// Jump over the empty nodes of occupancySampler. Its bricks are this many
+// voxels wide, there are this many of them along each axis, and it has this
+// many levels. Mip levels are padded past the last node.
+uniform bool uSkipEmpty;
+uniform float uBrickSize;
+uniform ivec3 uBrickCounts;
+uniform int uOccupancyLevels;
+// Lighting of the samples by a headlight: 0 leaves them unlit, 1 estimates
+// the gradients with central differences of voxelSampler, 2 and 3 read them
+// from gradientSampler packed as RGBA8 (with the magnitude, up to
+// uMaxGradient, in a) or as an octahedral RG8 normal, (0, 0) where it is
+// flat. Gradients are in values per voxel of the full resolution level, and
+// those weaker than uFlatGradient, mostly noise, fade towards the unlit color.
+uniform int uGradientMode;
+uniform sampler3D gradientSampler;
+uniform float uMaxGradient;
+uniform float uFlatGradient;
+// Inverse of uModelFromView, to bring the rays and normals to the view.
+uniform mat4 uViewFromModel;
+// Start each ray a fraction of a step in, read from blueNoiseSampler, a
+// tile of blue noise repeated over the window and shifted every frame by
+// uFrameIndex. The banding of a fixed step becomes fine noise that the
+// accumulation of the frames averages away.
+uniform bool uJitter;
+uniform sampler2D blueNoiseSampler;
+uniform int uFrameIndex;
+// Composite over the white background here instead of blending, and write
+// in alpha the view depth of the samples weighted by what they add to the
+// pixel, 0 where nothing is hit, for the accumulation pass to reproject.
+uniform bool uWriteDepth;
+
+// Blinn-Phong terms. With the light at the camera the half vector is the
+// view direction.
+const float kAmbient = 0.3;
+const float kDiffuse = 0.7;
+const float kSpecular = 0.3;
+const float kShininess = 32.0;
 
 void main() {
-	// TODO(dandov): Pass this as uniform.
-	vec2 screenSize = vec2(1080.0, 1080.0);
-	// Calculate the texture coordinates by dividing by the screen size.
-	vec2 uv = gl_FragCoord.xy / screenSize;
-	// Sample the first pass texture to obtain the exit point of the ray.
-	vec3 exitPoint = texture(firstPassSampler, uv).rgb;
-
-	vec3 rayDir = exitPoint - oEntryPoint;
+	vec3 entryPoint = oEntryPoint;
+	vec3 exitPoint;
+	if (uTwoPass) {
+		// Calculate the texture coordinates by dividing by the screen size.
+		vec2 uv = gl_FragCoord.xy / uScreenSize;
+		// Sample the first pass texture to obtain the exit point of the ray.
+		exitPoint = texture(firstPassSampler, uv).rgb;
+	} else {
+		// Slab test of the ray from the camera through this fragment against
+		// the unit cube, t = 1 at the interpolated entry point.
+		vec3 cameraPos = (uModelFromView * vec4(0.0, 0.0, 0.0, 1.0)).xyz;
+		vec3 viewDir = oEntryPoint - cameraPos;
+		vec3 t0 = -cameraPos / viewDir;
+		vec3 t1 = (1.0 - cameraPos) / viewDir;
+		vec3 tMin = min(t0, t1);
+		vec3 tMax = max(t0, t1);
+		float tNear = max(max(tMin.x, tMin.y), max(tMin.z, 0.0));
+		float tFar = min(min(tMax.x, tMax.y), tMax.z);
+		entryPoint = cameraPos + viewDir * tNear;
+		exitPoint = cameraPos + viewDir * tFar;
+	}
+
+	vec3 rayDir = exitPoint - entryPoint;
 	vec3 normRayDir = normalize(rayDir);
-	
-	// TODO(dandov): Pass these as uniforms.
-	float sampleCount = 1000.0;
-	// TODO(dandov): Maybe do something smarter here because it is a waste to
-	// to sample so many times in fragments that have small lenghts.
-	float stepSize = length(rayDir) / sampleCount;
+
+	// Derivatives are undefined inside the loop so the level is explicit.
+	float lod = max(uVolumeLod, uMinLod);
+	// Step the same distance in voxels along every ray, so short rays take
+	// few samples, and correct the opacities for the step length.
+	float stepVoxels = uStepVoxels * exp2(lod);
+	float rayVoxels = length(rayDir * uVolumeDims);
+	// Offset of the samples in their steps, the middle of them unless they
+	// are jittered, like kFirstSampleOffset of the CPU reference.
+	float jitter = 0.5;
+	if (uJitter) {
+		ivec2 noiseTexel =
+			ivec2(gl_FragCoord.xy) % textureSize(blueNoiseSampler, 0);
+		// Golden ratio shifts keep the offsets of a pixel well spread over
+		// consecutive frames.
+		jitter = fract(texelFetch(blueNoiseSampler, noiseTexel, 0).r +
+			0.61803399 * float(uFrameIndex));
+	}
+	int sampleCount = int(ceil(rayVoxels / stepVoxels - jitter));
+	float stepSize = length(rayDir) * stepVoxels / rayVoxels;
+	float opacityExponent = stepVoxels / uReferenceStep;
 	vec4 backgroundColor = vec4(1.0, 1.0, 1.0, 0.0);
+	vec3 voxelRayDir = normRayDir * uVolumeDims;
+	// Level of occupancySampler the next sample is tested from. It climbs
+	// after every jump, to leave large empty regions in few steps, and goes
+	// back to the bricks once a sample is taken.
+	int skipLevel = uOccupancyLevels - 1;
+
+	// Normals go to the view by the inverse transpose of uViewFromModel.
+	mat3 normalToView = transpose(mat3(uModelFromView));
+	vec3 viewRayDir = normalize(mat3(uViewFromModel) * normRayDir);
+
+	// Value and index of the last sample, the front of the next segment.
+	float previousVoxel = 0.0;
+	int previousIndex = -1;
+	// Sample that can't be skipped.
+	int forcedIndex = -1;
+
+	// Distance along the ray of the samples weighted by their contribution.
+	float depthSum = 0.0;
+	float weightSum = 0.0;
 
 	vec3 finalColor = vec3(0.0);
 	float finalAlpha = 0.0;
 	for (int i = 0; i < sampleCount; i++) {
-		if (finalAlpha > 1.0) {
+		// Stop once the ray is opaque, nothing behind would show.
+		if (finalAlpha > 0.99) {
 			break;
 		}
 		// Update the ray and sample the volume.
-		vec3 currentPos = oEntryPoint + (normRayDir * (stepSize * i));
-		float voxel = texture(voxelSampler, currentPos).r;
+		float t = stepSize * (float(i) + jitter);
+		vec3 currentPos = entryPoint + (normRayDir * t);
+		if (currentPos.z > uLoadedDepth) {
+			continue;
+		}
+		bool occupied = true;
+		// The grid bound is the one of the level sampled, its bricks are in
+		// voxels of the full resolution level all the same.
+		if (uSkipEmpty) {
+			vec3 voxelPos = currentPos * uVolumeDims;
+			float nodeSize = uBrickSize * float(1 << skipLevel);
+			vec3 node = clamp(floor(voxelPos / nodeSize), vec3(0.0),
+				vec3((uBrickCounts - 1) >> skipLevel));
+			occupied =
+				texelFetch(occupancySampler, ivec3(node), skipLevel).r != 0.0;
+			if (!occupied && i != forcedIndex) {
+				// Resume at the first sample past the node, so the samples
+				// taken are the same as without skipping.
+				vec3 toFace = mix(voxelPos - node * nodeSize,
+					(node + 1.0) * nodeSize - voxelPos,
+					greaterThanEqual(voxelRayDir, vec3(0.0)));
+				vec3 tFaces = toFace / max(abs(voxelRayDir), vec3(1e-6));
+				float tExit = min(min(tFaces.x, tFaces.y), tFaces.z);
+				i = max(i, int(ceil(float(i) + tExit / stepSize)) - 1);
+				skipLevel = min(skipLevel + 1, uOccupancyLevels - 1);
+				continue;
+			}
+			if (occupied && skipLevel > 0) {
+				// Test the same sample again one level closer to the bricks.
+				skipLevel--;
+				i--;
+				continue;
+			}
+		}
+		// A segment can start in a visible brick and end in an empty one, so
+		// the sample after one in a visible brick is never skipped.
+		forcedIndex = uPreintegrated && occupied ? i + 1 : -1;
+		float voxel = textureLod(voxelSampler, currentPos, lod).r;
 	
 		// Transform the voxel into a color using the transfer function.
-		vec4 voxelColor = texture(tffSampler, voxel);
+		vec4 voxelColor;
+		if (uPreintegrated) {
+			// Classify the segment from the previous sample, which has to be
+			// read again after a jump. The first sample is a point.
+			float frontVoxel = voxel;
+			if (i > 0) {
+				frontVoxel = previousIndex == i - 1 ? previousVoxel :
+					textureLod(voxelSampler, currentPos - normRayDir * stepSize,
+						lod).r;
+			}
+			previousVoxel = voxel;
+			previousIndex = i;
+			vec4 segment = texture(preintegratedSampler, vec2(frontVoxel, voxel));
+			voxelColor = vec4(segment.rgb,
+				1.0 - exp(-segment.a * opacityExponent));
+		} else {
+			voxelColor = texture(tffSampler, voxel);
+			voxelColor.a = 1.0 - pow(1.0 - voxelColor.a, opacityExponent);
+		}
+		if (uGradientMode != 0 && voxelColor.a > 0.0) {
+			vec3 gradient;
+			// How much of the lighting applies, none where the volume is flat.
+			float lit = 1.0;
+			if (uGradientMode == 1) {
+				// Six more fetches, one voxel of the sampled level apart.
+				vec3 offset = exp2(lod) / uVolumeDims;
+				gradient = vec3(
+					textureLod(voxelSampler, currentPos + vec3(offset.x, 0.0, 0.0), lod).r -
+					textureLod(voxelSampler, currentPos - vec3(offset.x, 0.0, 0.0), lod).r,
+					textureLod(voxelSampler, currentPos + vec3(0.0, offset.y, 0.0), lod).r -
+					textureLod(voxelSampler, currentPos - vec3(0.0, offset.y, 0.0), lod).r,
+					textureLod(voxelSampler, currentPos + vec3(0.0, 0.0, offset.z), lod).r -
+					textureLod(voxelSampler, currentPos - vec3(0.0, 0.0, offset.z), lod).r) *
+					(0.5 / exp2(lod));
+				lit = clamp(length(gradient) / uFlatGradient, 0.0, 1.0);
+			} else if (uGradientMode == 2) {
+				vec4 packedGradient = textureLod(gradientSampler, currentPos, 0.0);
+				gradient = packedGradient.rgb * 2.0 - 1.0;
+				lit = clamp(packedGradient.a * uMaxGradient / uFlatGradient, 0.0, 1.0);
+			} else {
+				// No fade without the magnitude, only the flat code is unlit.
+				// Unfold the lower half of the octahedron from the corners.
+				vec2 packedGradient = textureLod(gradientSampler, currentPos, 0.0).rg;
+				lit = any(greaterThan(packedGradient, vec2(0.0))) ? 1.0 : 0.0;
+				vec2 folded = packedGradient * 2.0 - 1.0;
+				gradient = vec3(folded, 1.0 - abs(folded.x) - abs(folded.y));
+				float lower = max(-gradient.z, 0.0);
+				gradient.xy += mix(vec2(lower), vec2(-lower),
+					greaterThanEqual(folded, vec2(0.0)));
+			}
+			// Per voxel to per unit of the cube, then to the view. Lit from
+			// both sides, the gradient points into the denser side.
+			if (lit > 0.0) {
+				vec3 normal = normalize(normalToView * (gradient * uVolumeDims));
+				float facing = abs(dot(normal, viewRayDir));
+				vec3 shaded = voxelColor.rgb * (kAmbient + kDiffuse * facing) +
+					kSpecular * pow(facing, kShininess);
+				voxelColor.rgb = mix(voxelColor.rgb, shaded, lit);
+			}
+		}
 		// Don't forget to premultiply the alpha. This fixes overflow issues when
 		// compositing.
 		voxelColor.rgb *= voxelColor.a;
 
+		float weight = (1.0 - finalAlpha) * voxelColor.a;
+		depthSum += weight * t;
+		weightSum += weight;
+
 		// Now just do front-to-back compositing.
 		finalColor = (1.0 - finalAlpha) * voxelColor.rgb + finalColor;
 		finalAlpha = (1.0 - finalAlpha) * voxelColor.a + finalAlpha;
@@ -107,6 +324,100 @@ void main() {
 	// fragColor = vec4(voxel, 0.0, 0.0, voxel);
 	// fragColor = vec4(normRayDir * -1.0 , 1.0);
 	fragColor = vec4(finalColor, finalAlpha);
+	if (uWriteDepth) {
+		float depth = 0.0;
+		if (weightSum > 0.0) {
+			vec3 hitPos = entryPoint + normRayDir * (depthSum / weightSum);
+			depth = -(uViewFromModel * vec4(hitPos, 1.0)).z;
+		}
+		// What blending over the white clear color would give.
+		fragColor = vec4(finalColor * finalAlpha + (1.0 - finalAlpha), depth);
+	}
+}
+)";
+
+	const GLchar* UPSAMPLE_VERTEX_SHADER = R"(
+#version 400
+
+// A triangle that covers the whole viewport, made from the vertex ids alone.
+void main(void) {
+	vec2 corner = vec2((gl_VertexID & 1) * 4 - 1, (gl_VertexID >> 1) * 4 - 1);
+	gl_Position = vec4(corner, 0.0, 1.0);
+}
+)";
+	const GLchar* UPSAMPLE_FRAGMENT_SHADER = R"(
+#version 400
+
+out vec4 fragColor;
+
+// A frame rendered at a reduced resolution in the corner of the texture,
+// which covers uReducedScale of it. Filtered linearly over the window of
+// size uScreenSize.
+uniform sampler2D reducedSampler;
+uniform vec2 uReducedScale;
+uniform vec2 uScreenSize;
+
+void main() {
+	vec2 uv = gl_FragCoord.xy / uScreenSize * uReducedScale;
+	// Don't blend in the texels past the frame.
+	uv = min(uv, uReducedScale - 0.5 / uScreenSize);
+	fragColor = vec4(texture(reducedSampler, uv).rgb, 1.0);
+}
+)";
+	const GLchar* ACCUMULATE_FRAGMENT_SHADER = R"(
+#version 400
+
+out vec4 fragColor;
+
+// A new frame in the corner of frameSampler that uReducedScale covers, with
+// the depth written by the raycaster in alpha, and the average of the
+// frames before it, both the size of the window.
+uniform sampler2D frameSampler;
+uniform sampler2D historySampler;
+uniform vec2 uReducedScale;
+uniform vec2 uScreenSize;
+// Weight of the new frame in the average, 1 drops the history.
+uniform float uFrameWeight;
+// Follow the samples of each pixel back to where the last frame saw them,
+// from the view of this frame to the clip space of the last one, and keep
+// the history within the colors around the pixel so that what can't be
+// followed doesn't smear. Only needed while the view moves.
+uniform bool uReproject;
+uniform mat4 uPreviousClipFromView;
+// Diagonal of the projection, to bring the pixels back to the view.
+uniform vec2 uProjScale;
+
+vec4 FetchFrame(vec2 uv) {
+	// Don't blend in the texels past the frame.
+	return texture(frameSampler,
+		min(uv * uReducedScale, uReducedScale - 0.5 / uScreenSize));
+}
+
+void main() {
+	vec2 uv = gl_FragCoord.xy / uScreenSize;
+	vec4 frame = FetchFrame(uv);
+	vec2 historyUv = uv;
+	if (uReproject && frame.a > 0.0) {
+		vec3 viewPos = vec3((uv * 2.0 - 1.0) / uProjScale * frame.a, -frame.a);
+		vec4 previousClip = uPreviousClipFromView * vec4(viewPos, 1.0);
+		historyUv = previousClip.xy / previousClip.w * 0.5 + 0.5;
+	}
+	vec3 history = texture(historySampler, historyUv).rgb;
+	if (uReproject) {
+		// The four neighbours one pixel of the frame away.
+		vec2 texel = 1.0 / (uScreenSize * uReducedScale);
+		vec3 left = FetchFrame(uv - vec2(texel.x, 0.0)).rgb;
+		vec3 right = FetchFrame(uv + vec2(texel.x, 0.0)).rgb;
+		vec3 down = FetchFrame(uv - vec2(0.0, texel.y)).rgb;
+		vec3 up = FetchFrame(uv + vec2(0.0, texel.y)).rgb;
+		vec3 low = min(frame.rgb, min(min(left, right), min(down, up)));
+		vec3 high = max(frame.rgb, max(max(left, right), max(down, up)));
+		history = clamp(history, low, high);
+	}
+	// History from outside of the last frame doesn't exist.
+	bool outside = any(notEqual(historyUv, clamp(historyUv, 0.0, 1.0)));
+	fragColor = vec4(
+		mix(history, frame.rgb, outside ? 1.0 : uFrameWeight), 1.0);
 }
 )";
 }  // namespace shaders
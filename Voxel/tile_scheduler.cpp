@@ -0,0 +1,177 @@
+#include "tile_scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+#include "parallel.h"
+#include "profiler.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// The tiles left to one thread. They are always a contiguous range, so the
+// deque only needs its two ends: the owner pops from the front and thieves
+// split off the back.
+struct TileDeque {
+	std::mutex mutex;
+	size_t front = 0;
+	size_t back = 0;
+	// back - front, readable without the lock to pick a victim.
+	std::atomic<size_t> size{0};
+	// Keeps the deques of two threads off the same cache line.
+	char padding[64];
+};
+
+// Pops the next tile of |deque| into |tile|. Returns false if it is empty.
+bool PopFront(TileDeque* deque, size_t* tile) {
+	std::lock_guard<std::mutex> lock(deque->mutex);
+	if (deque->front == deque->back)
+		return false;
+	*tile = deque->front++;
+	deque->size.store(deque->back - deque->front, std::memory_order_relaxed);
+	return true;
+}
+
+// Moves the back half of the fullest deque other than |thief| to |thief|.
+// Returns the number of tiles stolen, 0 once every deque is empty.
+size_t Steal(TileDeque* deques, int deque_count, int thief) {
+	while (true) {
+		int victim = -1;
+		size_t victim_size = 0;
+		for (int i = 1; i < deque_count; ++i) {
+			const int candidate = (thief + i) % deque_count;
+			const size_t size =
+				deques[candidate].size.load(std::memory_order_relaxed);
+			if (size > victim_size) {
+				victim = candidate;
+				victim_size = size;
+			}
+		}
+		if (victim < 0)
+			return 0;
+
+		size_t front;
+		size_t back;
+		{
+			std::lock_guard<std::mutex> lock(deques[victim].mutex);
+			const size_t size = deques[victim].back - deques[victim].front;
+			// The victim may have drained its deque since we looked.
+			if (size == 0)
+				continue;
+			back = deques[victim].back;
+			front = back - (size + 1) / 2;
+			deques[victim].back = front;
+			deques[victim].size.store(front - deques[victim].front,
+				std::memory_order_relaxed);
+		}
+		std::lock_guard<std::mutex> lock(deques[thief].mutex);
+		deques[thief].front = front;
+		deques[thief].back = back;
+		deques[thief].size.store(back - front, std::memory_order_relaxed);
+		return back - front;
+	}
+}
+
+}  // namespace
+
+const char* TileScheduleName(TileSchedule schedule) {
+	switch (schedule) {
+	case TileSchedule::kStatic:
+		return "static";
+	case TileSchedule::kWorkStealing:
+		return "stealing";
+	}
+	return "unknown";
+}
+
+bool ParseTileSchedule(const char* name, TileSchedule* schedule) {
+	for (TileSchedule candidate :
+		{TileSchedule::kStatic, TileSchedule::kWorkStealing}) {
+		if (std::strcmp(name, TileScheduleName(candidate)) == 0) {
+			*schedule = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+void RunTiles(size_t tile_count, TileSchedule schedule,
+	const std::function<void(size_t tile)>& body, TileScheduleStats* stats) {
+	const int thread_count = ParallelThreadCount();
+	std::unique_ptr<TileDeque[]> deques(new TileDeque[thread_count]);
+	for (int i = 0; i < thread_count; ++i) {
+		deques[i].front = tile_count * i / thread_count;
+		deques[i].back = tile_count * (i + 1) / thread_count;
+		deques[i].size = deques[i].back - deques[i].front;
+	}
+	std::vector<TileThreadStats> thread_stats(thread_count);
+
+	const Clock::time_point start = Clock::now();
+	ParallelForEachThread([&](int thread_index) {
+		TileThreadStats& local_stats = thread_stats[thread_index];
+		Clock::duration busy = Clock::duration::zero();
+		while (true) {
+			size_t tile;
+			if (!PopFront(&deques[thread_index], &tile)) {
+				if (schedule == TileSchedule::kStatic)
+					break;
+				const size_t stolen =
+					Steal(deques.get(), thread_count, thread_index);
+				if (stolen == 0)
+					break;
+				local_stats.stolen_count += static_cast<uint32_t>(stolen);
+				continue;
+			}
+			const Clock::time_point tile_start = Clock::now();
+			{
+				const ProfileScope scope("Tile");
+				body(tile);
+			}
+			busy += Clock::now() - tile_start;
+			++local_stats.tile_count;
+		}
+		local_stats.busy_seconds =
+			std::chrono::duration<double>(busy).count();
+	});
+	const double wall_seconds =
+		std::chrono::duration<double>(Clock::now() - start).count();
+
+	if (!stats)
+		return;
+	for (TileThreadStats& local_stats : thread_stats) {
+		local_stats.idle_seconds =
+			std::max(wall_seconds - local_stats.busy_seconds, 0.0);
+	}
+	stats->wall_seconds = wall_seconds;
+	stats->threads = std::move(thread_stats);
+}
+
+void PrintTileScheduleStats(const TileScheduleStats& stats) {
+	if (stats.threads.empty())
+		return;
+	double total_busy = 0.0;
+	double max_busy = 0.0;
+	for (size_t i = 0; i < stats.threads.size(); ++i) {
+		const TileThreadStats& thread = stats.threads[i];
+		std::cout << "  thread " << i << ": busy " << thread.busy_seconds * 1000.0
+			<< " ms, idle " << thread.idle_seconds * 1000.0 << " ms, "
+			<< thread.tile_count << " tiles (" << thread.stolen_count
+			<< " stolen)\n";
+		total_busy += thread.busy_seconds;
+		max_busy = std::max(max_busy, thread.busy_seconds);
+	}
+	const double mean_busy = total_busy / stats.threads.size();
+	// The share of the thread time spent rendering, 100% when no thread
+	// ever waits.
+	const double efficiency = stats.wall_seconds > 0.0 ?
+		total_busy / (stats.wall_seconds * stats.threads.size()) : 1.0;
+	std::cout << "  busiest thread " << max_busy * 1000.0 << " ms, mean "
+		<< mean_busy * 1000.0 << " ms, efficiency " << efficiency * 100.0
+		<< "%\n";
+}
@@ -0,0 +1,55 @@
+#ifndef VOXEL_TILE_SCHEDULER
+#define VOXEL_TILE_SCHEDULER
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// How the tiles of an image are shared between the threads.
+enum class TileSchedule {
+	// Every thread renders one contiguous band of tiles, fixed up front.
+	kStatic,
+	// Every thread starts with the same band but, once done, steals half of
+	// the tiles left to the other threads.
+	kWorkStealing,
+};
+
+// Returns the name used for |schedule| on the command line ("static", ...).
+const char* TileScheduleName(TileSchedule schedule);
+
+// Parses a name returned by TileScheduleName() into |schedule|.
+bool ParseTileSchedule(const char* name, TileSchedule* schedule);
+
+// Time one thread spent on a RunTiles() call.
+struct TileThreadStats {
+	// Time spent inside the tile body.
+	double busy_seconds = 0.0;
+	// Time spent waking up, looking for tiles and waiting for the others.
+	double idle_seconds = 0.0;
+	uint32_t tile_count = 0;
+	// Tiles taken from the other threads.
+	uint32_t stolen_count = 0;
+};
+
+// Load balance of a RunTiles() call.
+struct TileScheduleStats {
+	double wall_seconds = 0.0;
+	// One entry per thread of ParallelForEachThread().
+	std::vector<TileThreadStats> threads;
+};
+
+// Calls |body| with every tile in [0, tile_count) on all the threads of
+// ParallelForEachThread() and returns once every tile is done. Tiles are
+// split in contiguous bands, one per thread, which work in order from the
+// front of their band. With kWorkStealing a thread that runs out takes the
+// back half of the busiest band it finds, so expensive regions of the image
+// end up shared. Fills |stats| if it isn't null.
+void RunTiles(size_t tile_count, TileSchedule schedule,
+	const std::function<void(size_t tile)>& body, TileScheduleStats* stats);
+
+// Prints the per-thread busy and idle time of |stats| and how evenly the
+// work was spread.
+void PrintTileScheduleStats(const TileScheduleStats& stats);
+
+#endif  // VOXEL_TILE_SCHEDULER
@@ -0,0 +1,120 @@
+#include "transfer_function.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "parallel.h"
+#include "profiler.h"
+#include "volume_source.h"
+
+bool LoadTransferFunction(const char* path, size_t entry_count,
+	std::vector<uint8_t>* table) {
+	const ProfileScope scope("LoadTransferFunction");
+	VolumeSource source;
+	if (!VolumeSource::OpenVolumeSource(&source, path))
+		return false;
+	if (source.size % 4 != 0) {
+		std::cout << "Transfer function is not made of RGBA8 entries: "
+			<< path << "\n";
+		return false;
+	}
+
+	const size_t source_count = source.size / 4;
+	table->resize(entry_count * 4);
+	if (source_count == entry_count) {
+		std::memcpy(table->data(), source.data, source.size);
+		return true;
+	}
+
+	// Sample the source at the center of each destination entry, the same
+	// place GL samples the texture.
+	const float ratio = static_cast<float>(source_count) / entry_count;
+	for (size_t i = 0; i < entry_count; ++i) {
+		const float position = std::min(std::max(
+			(i + 0.5f) * ratio - 0.5f, 0.0f), source_count - 1.0f);
+		const size_t first = static_cast<size_t>(position);
+		const size_t second = std::min(first + 1, source_count - 1);
+		const float weight = position - first;
+		for (size_t channel = 0; channel < 4; ++channel) {
+			const float value =
+				source.data[first * 4 + channel] * (1.0f - weight) +
+				source.data[second * 4 + channel] * weight;
+			(*table)[i * 4 + channel] =
+				static_cast<uint8_t>(std::lround(value));
+		}
+	}
+	return true;
+}
+
+void PreintegrateTransferFunction(const std::vector<uint8_t>& transfer_function,
+	size_t size, std::vector<float>* table) {
+	const ProfileScope scope("PreintegrateTransferFunction");
+	const size_t entry_count = transfer_function.size() / 4;
+	table->assign(size * size * 4, 0.0f);
+	if (entry_count == 0)
+		return;
+
+	// Extinction weighted colors and extinction of each entry, and their sums
+	// over the entries before each one.
+	std::vector<double> entries(entry_count * 4);
+	std::vector<double> prefix((entry_count + 1) * 4, 0.0);
+	for (size_t i = 0; i < entry_count; ++i) {
+		const double alpha = transfer_function[i * 4 + 3] / 255.0;
+		const double extinction = alpha < 1.0 ?
+			std::min(-std::log(1.0 - alpha), static_cast<double>(kMaxExtinction)) :
+			kMaxExtinction;
+		for (size_t channel = 0; channel < 3; ++channel) {
+			entries[i * 4 + channel] =
+				transfer_function[i * 4 + channel] / 255.0 * extinction;
+		}
+		entries[i * 4 + 3] = extinction;
+		for (size_t channel = 0; channel < 4; ++channel) {
+			prefix[(i + 1) * 4 + channel] =
+				prefix[i * 4 + channel] + entries[i * 4 + channel];
+		}
+	}
+
+	// Integrals of the entries up to the value at the center of each table
+	// entry, in units of entries.
+	std::vector<double> positions(size);
+	std::vector<double> integrals(size * 4);
+	for (size_t i = 0; i < size; ++i) {
+		positions[i] = (i + 0.5) / size * entry_count;
+		const size_t entry = std::min(
+			static_cast<size_t>(positions[i]), entry_count - 1);
+		const double fraction = positions[i] - entry;
+		for (size_t channel = 0; channel < 4; ++channel) {
+			integrals[i * 4 + channel] = prefix[entry * 4 + channel] +
+				fraction * entries[entry * 4 + channel];
+		}
+	}
+
+	ParallelFor(size, 16, [&](size_t begin, size_t end) {
+		for (size_t back = begin; back < end; ++back) {
+			float* row = table->data() + back * size * 4;
+			for (size_t front = 0; front < size; ++front) {
+				double average[4];
+				if (front == back) {
+					const size_t entry = std::min(
+						static_cast<size_t>(positions[front]), entry_count - 1);
+					for (size_t channel = 0; channel < 4; ++channel)
+						average[channel] = entries[entry * 4 + channel];
+				} else {
+					const double length = positions[back] - positions[front];
+					for (size_t channel = 0; channel < 4; ++channel) {
+						average[channel] = (integrals[back * 4 + channel] -
+							integrals[front * 4 + channel]) / length;
+					}
+				}
+				float* texel = row + front * 4;
+				for (size_t channel = 0; channel < 3; ++channel) {
+					texel[channel] = average[3] > 0.0 ?
+						static_cast<float>(average[channel] / average[3]) : 0.0f;
+				}
+				texel[3] = static_cast<float>(average[3]);
+			}
+		}
+	});
+}
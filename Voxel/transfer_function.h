@@ -0,0 +1,44 @@
+#ifndef VOXEL_TRANSFER_FUNCTION
+#define VOXEL_TRANSFER_FUNCTION
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Number of entries of the transfer function used with 8-bit volumes. It
+// matches the shipped tff.dat.
+const size_t kTransferFunctionSize8 = 256;
+// Number of entries of the transfer function used with 16-bit and float
+// volumes, enough to resolve 12-bit data.
+const size_t kTransferFunctionSize16 = 4096;
+
+// Loads the transfer function at |path|, a table of RGBA8 entries, and
+// resamples it to |entry_count| entries stored in |table|. Entries are
+// linearly interpolated when the file has fewer entries than requested.
+// Returns false if the file can't be read or is not a whole number of
+// entries.
+bool LoadTransferFunction(const char* path, size_t entry_count,
+	std::vector<uint8_t>* table);
+
+// Number of entries along each side of pre-integrated tables. Bigger
+// transfer functions are still integrated entry by entry.
+const size_t kPreintegratedTableSize = 1024;
+// Extinction of the opaque entries, which would be infinite.
+const float kMaxExtinction = 16.0f;
+
+// Pre-integrates |transfer_function|, a table of RGBA8 entries looked up
+// with GL_NEAREST, into |table|, |size| x |size| RGBA float entries for a 2D
+// texture looked up with GL_LINEAR. Entry (x, y) is the average of the
+// transfer function over a ray segment whose values go linearly from
+// (x + 0.5) / |size| at its front to (y + 0.5) / |size| at its back, so
+// that sharp features between two samples aren't missed. Its alpha is the
+// average extinction per reference step, -ln(1 - alpha), so that a segment
+// |e| reference steps long has an opacity of 1 - exp(-e * extinction)
+// whatever the step. Its rgb is the average of the color weighted by
+// extinction, already divided by the average extinction, so the shader uses
+// it as the color of the segment as it is (0 where nothing is opaque). Every
+// entry is computed in constant time from prefix sums, rows in parallel.
+void PreintegrateTransferFunction(const std::vector<uint8_t>& transfer_function,
+	size_t size, std::vector<float>* table);
+
+#endif  // VOXEL_TRANSFER_FUNCTION
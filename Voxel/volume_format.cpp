@@ -0,0 +1,266 @@
+#include "volume_format.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+namespace {
+
+const char kVoxMagic[4] = {'V', 'O', 'X', 'L'};
+const uint32_t kVoxVersion = 1;
+// The payload is aligned to a page so that it can be mapped on its own.
+const uint64_t kPayloadAlignment = 4096;
+
+uint32_t DivideRoundingUp(uint32_t value, uint32_t divisor) {
+	return (value + divisor - 1) / divisor;
+}
+
+template <typename T>
+T SwapBytes(T value) {
+	uint8_t bytes[sizeof(T)];
+	std::memcpy(bytes, &value, sizeof(T));
+	std::reverse(bytes, bytes + sizeof(T));
+	std::memcpy(&value, bytes, sizeof(T));
+	return value;
+}
+
+template <typename T>
+void ComputeValueRange(const void* voxels, size_t count, bool swap_bytes,
+	float* min, float* max) {
+	const T* values = static_cast<const T*>(voxels);
+	T min_value = std::numeric_limits<T>::max();
+	T max_value = std::numeric_limits<T>::lowest();
+	for (size_t i = 0; i < count; ++i) {
+		const T value = swap_bytes ? SwapBytes(values[i]) : values[i];
+		min_value = std::min(min_value, value);
+		max_value = std::max(max_value, value);
+	}
+	*min = static_cast<float>(min_value);
+	*max = static_cast<float>(max_value);
+}
+
+// Copies the linear volume |voxels| into |bricks| following the brick layout
+// of |info|. Voxels outside the volume repeat the closest edge voxel.
+void BrickVoxels(const VolumeInfo& info, const uint8_t* voxels, uint8_t* bricks) {
+	const size_t voxel_size = VoxelTypeSize(info.type);
+	const uint32_t* dims = info.dims;
+	const uint32_t* brick = info.brick_dims;
+	const uint32_t brick_count[3] = {
+		DivideRoundingUp(dims[0], brick[0]),
+		DivideRoundingUp(dims[1], brick[1]),
+		DivideRoundingUp(dims[2], brick[2]),
+	};
+
+	uint8_t* out = bricks;
+	for (uint32_t bz = 0; bz < brick_count[2]; ++bz) {
+		for (uint32_t by = 0; by < brick_count[1]; ++by) {
+			for (uint32_t bx = 0; bx < brick_count[0]; ++bx) {
+				for (uint32_t z = 0; z < brick[2]; ++z) {
+					const size_t src_z = std::min(bz * brick[2] + z, dims[2] - 1);
+					for (uint32_t y = 0; y < brick[1]; ++y) {
+						const size_t src_y = std::min(by * brick[1] + y, dims[1] - 1);
+						for (uint32_t x = 0; x < brick[0]; ++x) {
+							const size_t src_x = std::min(bx * brick[0] + x, dims[0] - 1);
+							const size_t src_index =
+								(src_z * dims[1] + src_y) * dims[0] + src_x;
+							std::memcpy(out, voxels + src_index * voxel_size, voxel_size);
+							out += voxel_size;
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+}  // namespace
+
+size_t VoxelTypeSize(VoxelType type) {
+	switch (type) {
+	case VoxelType::kUint8:
+		return 1;
+	case VoxelType::kUint16:
+		return 2;
+	case VoxelType::kFloat32:
+		return 4;
+	}
+	assert(false);
+	return 0;
+}
+
+const char* VoxelTypeName(VoxelType type) {
+	switch (type) {
+	case VoxelType::kUint8:
+		return "uint8";
+	case VoxelType::kUint16:
+		return "uint16";
+	case VoxelType::kFloat32:
+		return "float32";
+	}
+	return "unknown";
+}
+
+bool ParseVoxelType(const char* name, VoxelType* type) {
+	for (VoxelType candidate :
+		{VoxelType::kUint8, VoxelType::kUint16, VoxelType::kFloat32}) {
+		if (std::strcmp(name, VoxelTypeName(candidate)) == 0) {
+			*type = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool IsBricked(const VolumeInfo& info) {
+	return info.brick_dims[0] != 0 && info.brick_dims[1] != 0 &&
+		info.brick_dims[2] != 0;
+}
+
+size_t VoxelCount(const VolumeInfo& info) {
+	return static_cast<size_t>(info.dims[0]) * info.dims[1] * info.dims[2];
+}
+
+size_t PayloadSize(const VolumeInfo& info) {
+	if (!IsBricked(info))
+		return VoxelCount(info) * VoxelTypeSize(info.type);
+
+	size_t size = VoxelTypeSize(info.type);
+	for (int axis = 0; axis < 3; ++axis) {
+		size *= static_cast<size_t>(
+			DivideRoundingUp(info.dims[axis], info.brick_dims[axis])) *
+			info.brick_dims[axis];
+	}
+	return size;
+}
+
+bool VolumeFile::OpenVolumeFile(VolumeFile* file, const char* path) {
+	if (!VolumeSource::OpenVolumeSource(&file->source, path))
+		return false;
+
+	VoxHeader header;
+	if (file->source.size < sizeof(header)) {
+		std::cout << "Not a .vox file, too small: " << path << "\n";
+		return false;
+	}
+	std::memcpy(&header, file->source.data, sizeof(header));
+	if (std::memcmp(header.magic, kVoxMagic, sizeof(kVoxMagic)) != 0) {
+		std::cout << "Not a .vox file, bad magic: " << path << "\n";
+		return false;
+	}
+	if (header.version != kVoxVersion || header.header_size < sizeof(header)) {
+		std::cout << "Unsupported .vox version " << header.version << ": "
+			<< path << "\n";
+		return false;
+	}
+	if (header.voxel_type > static_cast<uint32_t>(VoxelType::kFloat32)) {
+		std::cout << "Unknown voxel type " << header.voxel_type << ": "
+			<< path << "\n";
+		return false;
+	}
+
+	VolumeInfo info;
+	info.type = static_cast<VoxelType>(header.voxel_type);
+	for (int axis = 0; axis < 3; ++axis) {
+		info.dims[axis] = header.dims[axis];
+		info.brick_dims[axis] = header.brick_dims[axis];
+		info.spacing[axis] = header.spacing[axis];
+	}
+	info.value_min = header.value_min;
+	info.value_max = header.value_max;
+	info.big_endian = (header.flags & kVoxFlagBigEndian) != 0;
+
+	if (VoxelCount(info) == 0) {
+		std::cout << "Empty volume in: " << path << "\n";
+		return false;
+	}
+	if (header.payload_size != PayloadSize(info) ||
+		header.payload_offset > file->source.size ||
+		file->source.size - header.payload_offset < header.payload_size) {
+		std::cout << "Truncated or inconsistent .vox payload: " << path << "\n";
+		return false;
+	}
+
+	file->info = info;
+	file->voxels = file->source.data + header.payload_offset;
+	return true;
+}
+
+bool VolumeFile::OpenRawVolumeFile(
+	VolumeFile* file, const char* path, const VolumeInfo& info) {
+	if (!VolumeSource::OpenVolumeSource(&file->source, path))
+		return false;
+
+	if (file->source.size < PayloadSize(info)) {
+		std::cout << "Raw volume file is smaller than " << info.dims[0] << "x"
+			<< info.dims[1] << "x" << info.dims[2] << " "
+			<< VoxelTypeName(info.type) << ": " << path << "\n";
+		return false;
+	}
+
+	file->info = info;
+	file->voxels = file->source.data;
+	return true;
+}
+
+bool VolumeFile::WriteVolumeFile(
+	const char* path, const VolumeInfo& info, const void* voxels) {
+	VolumeInfo out_info = info;
+	const size_t count = VoxelCount(info);
+	switch (info.type) {
+	case VoxelType::kUint8:
+		ComputeValueRange<uint8_t>(voxels, count, info.big_endian,
+			&out_info.value_min, &out_info.value_max);
+		break;
+	case VoxelType::kUint16:
+		ComputeValueRange<uint16_t>(voxels, count, info.big_endian,
+			&out_info.value_min, &out_info.value_max);
+		break;
+	case VoxelType::kFloat32:
+		ComputeValueRange<float>(voxels, count, info.big_endian,
+			&out_info.value_min, &out_info.value_max);
+		break;
+	}
+
+	VoxHeader header = {};
+	std::memcpy(header.magic, kVoxMagic, sizeof(kVoxMagic));
+	header.version = kVoxVersion;
+	header.header_size = sizeof(header);
+	header.voxel_type = static_cast<uint32_t>(out_info.type);
+	for (int axis = 0; axis < 3; ++axis) {
+		header.dims[axis] = out_info.dims[axis];
+		header.brick_dims[axis] = out_info.brick_dims[axis];
+		header.spacing[axis] = out_info.spacing[axis];
+	}
+	header.value_min = out_info.value_min;
+	header.value_max = out_info.value_max;
+	header.flags = out_info.big_endian ? kVoxFlagBigEndian : 0;
+	header.payload_offset = kPayloadAlignment;
+	header.payload_size = PayloadSize(out_info);
+
+	std::ofstream file(path, std::ofstream::out | std::ofstream::binary);
+	if (!file.is_open()) {
+		std::cout << "Failed to create .vox file: " << path << "\n";
+		return false;
+	}
+	std::vector<char> header_block(kPayloadAlignment, 0);
+	std::memcpy(header_block.data(), &header, sizeof(header));
+	file.write(header_block.data(), header_block.size());
+
+	if (IsBricked(out_info)) {
+		std::vector<uint8_t> bricks(header.payload_size);
+		BrickVoxels(out_info, static_cast<const uint8_t*>(voxels), bricks.data());
+		file.write(reinterpret_cast<const char*>(bricks.data()), bricks.size());
+	} else {
+		file.write(static_cast<const char*>(voxels), header.payload_size);
+	}
+
+	if (!file.good()) {
+		std::cout << "Failed to write .vox file: " << path << "\n";
+		return false;
+	}
+	return true;
+}
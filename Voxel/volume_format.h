@@ -0,0 +1,109 @@
+#ifndef VOXEL_VOLUME_FORMAT
+#define VOXEL_VOLUME_FORMAT
+
+#include <cstddef>
+#include <cstdint>
+
+#include "volume_source.h"
+
+// Storage type of a single voxel.
+enum class VoxelType : uint32_t {
+	kUint8 = 0,
+	kUint16 = 1,
+	kFloat32 = 2,
+};
+
+// Returns the size in bytes of one voxel of |type|.
+size_t VoxelTypeSize(VoxelType type);
+
+// Returns the name used for |type| on the command line ("uint8", ...).
+const char* VoxelTypeName(VoxelType type);
+
+// Parses a name returned by VoxelTypeName() into |type|. Returns false if
+// |name| is not a known voxel type.
+bool ParseVoxelType(const char* name, VoxelType* type);
+
+// Everything needed to interpret the voxels of a volume.
+struct VolumeInfo {
+	// Number of voxels along x, y and z. The voxels are stored x-fastest.
+	uint32_t dims[3] = {0, 0, 0};
+	VoxelType type = VoxelType::kUint8;
+	// Physical size of a voxel along each axis. Only the ratios matter.
+	float spacing[3] = {1.0f, 1.0f, 1.0f};
+	// Smallest and largest voxel value of the payload.
+	float value_min = 0.0f;
+	float value_max = 0.0f;
+	// Size of a brick in voxels, or all 0 when the payload is a single
+	// linear x-fastest block. Bricks are stored x-fastest, every brick
+	// holds a full x-fastest block and the bricks on the upper edges are
+	// padded by repeating the last voxel.
+	uint32_t brick_dims[3] = {0, 0, 0};
+	// True if multi-byte voxels are stored most significant byte first.
+	bool big_endian = false;
+};
+
+// Returns true if the payload described by |info| is split into bricks.
+bool IsBricked(const VolumeInfo& info);
+
+// Returns the number of voxels in the volume described by |info|.
+size_t VoxelCount(const VolumeInfo& info);
+
+// Returns the payload size in bytes of the volume described by |info|,
+// including the padding of the edge bricks.
+size_t PayloadSize(const VolumeInfo& info);
+
+// On-disk header of a .vox file. The payload starts at |payload_offset|
+// (aligned to 4096 bytes so it can be mapped and DMA'd efficiently). All
+// the fields are little endian.
+#pragma pack(push, 1)
+struct VoxHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t voxel_type;
+	uint32_t dims[3];
+	uint32_t brick_dims[3];
+	float spacing[3];
+	float value_min;
+	float value_max;
+	// Bit flags describing the payload, see kVoxFlag*.
+	uint32_t flags;
+	uint64_t payload_offset;
+	uint64_t payload_size;
+	uint8_t reserved[48];
+};
+#pragma pack(pop)
+static_assert(sizeof(VoxHeader) == 128, "The .vox header must be 128 bytes");
+
+// Set in VoxHeader::flags when the payload is big endian.
+const uint32_t kVoxFlagBigEndian = 1u << 0;
+
+// A volume whose payload is memory mapped. Opening a .vox file costs a
+// header parse plus the mapping, the voxels are never copied.
+class VolumeFile {
+  public:
+	// Opens the .vox file at |path| and stores it in |file|. Returns false
+	// if the file can't be mapped or its header is invalid.
+	static bool OpenVolumeFile(VolumeFile* file, const char* path);
+
+	// Opens the headerless file at |path| whose layout is given by |info|.
+	// The value range is left as given. Returns false if the file can't be
+	// mapped or is smaller than the volume described by |info|.
+	static bool OpenRawVolumeFile(
+		VolumeFile* file, const char* path, const VolumeInfo& info);
+
+	// Writes |voxels|, a linear x-fastest volume described by |info|, as a
+	// .vox file at |path|. The payload is bricked if |info| asks for it and
+	// the value range is computed from |voxels|.
+	static bool WriteVolumeFile(
+		const char* path, const VolumeInfo& info, const void* voxels);
+
+	VolumeInfo info;
+	// Start of the payload inside the mapping.
+	const uint8_t* voxels = nullptr;
+
+  private:
+	VolumeSource source;
+};
+
+#endif  // VOXEL_VOLUME_FORMAT
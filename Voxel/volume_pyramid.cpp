@@ -0,0 +1,470 @@
+#include "volume_pyramid.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include "cpu_features.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "voxel_simd.h"
+
+namespace {
+
+using namespace simd;
+
+const char kPyramidMagic[4] = {'V', 'X', 'P', 'Y'};
+const uint32_t kPyramidVersion = 1;
+// Levels are aligned to a cache line inside the sidecar.
+const size_t kLevelAlignment = 64;
+// The payload is hashed in chunks of this size, one per ParallelFor() item.
+const size_t kHashChunkSize = 4 * 1024 * 1024;
+
+size_t AlignUp(size_t value, size_t alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// XXH64, a fast non-cryptographic hash that reads 32 bytes per iteration.
+const uint64_t kPrime1 = 0x9e3779b185ebca87ull;
+const uint64_t kPrime2 = 0xc2b2ae3d27d4eb4full;
+const uint64_t kPrime3 = 0x165667b19e3779f9ull;
+const uint64_t kPrime4 = 0x85ebca77c2b2ae63ull;
+const uint64_t kPrime5 = 0x27d4eb2f165667c5ull;
+
+uint64_t RotateLeft(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t Read64(const uint8_t* bytes) {
+	uint64_t value;
+	std::memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+uint32_t Read32(const uint8_t* bytes) {
+	uint32_t value;
+	std::memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+uint64_t HashRound(uint64_t accumulator, uint64_t input) {
+	accumulator += input * kPrime2;
+	return RotateLeft(accumulator, 31) * kPrime1;
+}
+
+uint64_t HashMerge(uint64_t accumulator, uint64_t lane) {
+	accumulator ^= HashRound(0, lane);
+	return accumulator * kPrime1 + kPrime4;
+}
+
+uint64_t Hash64(const uint8_t* data, size_t size, uint64_t seed) {
+	const uint8_t* end = data + size;
+	uint64_t hash;
+	if (size >= 32) {
+		uint64_t lanes[4] = {seed + kPrime1 + kPrime2, seed + kPrime2, seed,
+			seed - kPrime1};
+		for (; data + 32 <= end; data += 32) {
+			for (int i = 0; i < 4; ++i)
+				lanes[i] = HashRound(lanes[i], Read64(data + 8 * i));
+		}
+		hash = RotateLeft(lanes[0], 1) + RotateLeft(lanes[1], 7) +
+			RotateLeft(lanes[2], 12) + RotateLeft(lanes[3], 18);
+		for (uint64_t lane : lanes)
+			hash = HashMerge(hash, lane);
+	} else {
+		hash = seed + kPrime5;
+	}
+	hash += size;
+
+	for (; data + 8 <= end; data += 8)
+		hash = RotateLeft(hash ^ HashRound(0, Read64(data)), 27) * kPrime1 + kPrime4;
+	if (data + 4 <= end) {
+		hash = RotateLeft(hash ^ (Read32(data) * kPrime1), 23) * kPrime2 + kPrime3;
+		data += 4;
+	}
+	for (; data < end; ++data)
+		hash = RotateLeft(hash ^ (*data * kPrime5), 11) * kPrime1;
+
+	hash ^= hash >> 33;
+	hash *= kPrime2;
+	hash ^= hash >> 29;
+	hash *= kPrime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+// Hashes the payload of |volume| in parallel chunks and folds in everything
+// else that changes the contents of the pyramid.
+uint64_t HashPyramidInputs(const VolumeFile& volume,
+	const VoxelConversion& conversion, MipFilter filter) {
+	const size_t payload_size = PayloadSize(volume.info);
+	const size_t chunk_count =
+		std::max<size_t>((payload_size + kHashChunkSize - 1) / kHashChunkSize, 1);
+	std::vector<uint64_t> hashes(chunk_count + 1);
+	ParallelFor(chunk_count, 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			const size_t offset = i * kHashChunkSize;
+			hashes[i] = Hash64(volume.voxels + offset,
+				std::min(kHashChunkSize, payload_size - offset), i);
+		}
+	});
+
+	const VolumeInfo& info = volume.info;
+	uint32_t window[2];
+	std::memcpy(&window[0], &conversion.window_min, sizeof(float));
+	std::memcpy(&window[1], &conversion.window_max, sizeof(float));
+	const uint32_t description[] = {
+		kPyramidVersion, info.dims[0], info.dims[1], info.dims[2],
+		static_cast<uint32_t>(info.type), info.brick_dims[0], info.brick_dims[1],
+		info.brick_dims[2], conversion.swap_bytes, conversion.windowed,
+		window[0], window[1], static_cast<uint32_t>(conversion.target),
+		static_cast<uint32_t>(filter),
+	};
+	hashes.back() = Hash64(reinterpret_cast<const uint8_t*>(description),
+		sizeof(description), 0);
+	return Hash64(reinterpret_cast<const uint8_t*>(hashes.data()),
+		hashes.size() * sizeof(uint64_t), 0);
+}
+
+// A source voxel of the filter, relative to twice the destination voxel.
+struct Tap {
+	int offset;
+	float weight;
+};
+
+const Tap kBoxTaps[] = {{0, 0.5f}, {1, 0.5f}};
+const Tap kGaussianTaps[] = {{-1, 0.25f}, {0, 0.5f}, {1, 0.25f}};
+
+// Reduces one row of a level. The taps along y and z are accumulated into a
+// float row first, which is then reduced along x. |row| has one padding
+// float on each side so that the x taps never need clamping.
+template <typename T>
+void AccumulateRowScalar(float weight, const T* source, float* row,
+	uint32_t width) {
+	for (uint32_t x = 0; x < width; ++x)
+		row[x] += weight * LoadScalar(source + x, false);
+}
+
+template <typename T>
+void ReduceRowScalar(MipFilter filter, const float* row, T* destination,
+	uint32_t width) {
+	for (uint32_t x = 0; x < width; ++x) {
+		const float* center = row + 2 * x;
+		const float value = filter == MipFilter::kBox ?
+			0.5f * (center[0] + center[1]) :
+			0.25f * (center[-1] + center[1]) + 0.5f * center[0];
+		StoreScalar(destination + x, value);
+	}
+}
+
+#ifdef VOXEL_X86
+
+template <typename T>
+VOXEL_TARGET(VOXEL_AVX2) void AccumulateRowAvx2(float weight, const T* source,
+	float* row, uint32_t width) {
+	const __m256 weights = _mm256_set1_ps(weight);
+	uint32_t x = 0;
+	for (; x + 8 <= width; x += 8) {
+		_mm256_storeu_ps(row + x, _mm256_fmadd_ps(
+			Load8(source + x, false), weights, _mm256_loadu_ps(row + x)));
+	}
+	AccumulateRowScalar(weight, source + x, row + x, width - x);
+}
+
+// Returns the even and odd floats of the 16 starting at |values|, in order.
+VOXEL_TARGET(VOXEL_AVX2) inline __m256 EvenFloats(const float* values) {
+	const __m256 shuffled = _mm256_shuffle_ps(_mm256_loadu_ps(values),
+		_mm256_loadu_ps(values + 8), _MM_SHUFFLE(2, 0, 2, 0));
+	return _mm256_castpd_ps(_mm256_permute4x64_pd(
+		_mm256_castps_pd(shuffled), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+VOXEL_TARGET(VOXEL_AVX2) inline __m256 OddFloats(const float* values) {
+	const __m256 shuffled = _mm256_shuffle_ps(_mm256_loadu_ps(values),
+		_mm256_loadu_ps(values + 8), _MM_SHUFFLE(3, 1, 3, 1));
+	return _mm256_castpd_ps(_mm256_permute4x64_pd(
+		_mm256_castps_pd(shuffled), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+template <typename T>
+VOXEL_TARGET(VOXEL_AVX2) void ReduceRowAvx2(MipFilter filter, const float* row,
+	T* destination, uint32_t width) {
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 quarter = _mm256_set1_ps(0.25f);
+	uint32_t x = 0;
+	for (; x + 8 <= width; x += 8) {
+		const float* center = row + 2 * x;
+		const __m256 even = EvenFloats(center);
+		const __m256 odd = OddFloats(center);
+		__m256 value;
+		if (filter == MipFilter::kBox) {
+			value = _mm256_mul_ps(_mm256_add_ps(even, odd), half);
+		} else {
+			// The odd floats before the even ones are the even floats of the
+			// row shifted by one.
+			const __m256 previous = EvenFloats(center - 1);
+			value = _mm256_fmadd_ps(even, half,
+				_mm256_mul_ps(_mm256_add_ps(previous, odd), quarter));
+		}
+		Store8(destination + x, value);
+	}
+	ReduceRowScalar(filter, row + 2 * x, destination + x, width - x);
+}
+
+#endif  // VOXEL_X86
+
+template <typename T>
+void Downsample(MipFilter filter, const uint8_t* source_bytes,
+	const uint32_t source_dims[3], uint8_t* destination_bytes) {
+	const T* source = reinterpret_cast<const T*>(source_bytes);
+	T* destination = reinterpret_cast<T*>(destination_bytes);
+	uint32_t dims[3];
+	NextLevelDims(source_dims, dims);
+	const Tap* taps = filter == MipFilter::kBox ? kBoxTaps : kGaussianTaps;
+	const int tap_count = filter == MipFilter::kBox ? 2 : 3;
+	const CpuFeatures& features = GetCpuFeatures();
+	const bool use_avx2 = features.avx2 && features.fma && features.f16c;
+
+	const uint32_t source_width = source_dims[0];
+	const size_t rows = static_cast<size_t>(dims[1]) * dims[2];
+	const size_t grain = std::max<size_t>(65536 / source_width, 1);
+	ParallelFor(rows, grain, [&](size_t begin, size_t end) {
+		// Room for the padding on both sides plus the 16 floats the vector
+		// reduction reads past the last pair.
+		std::vector<float> buffer(source_width + 18);
+		float* row = buffer.data() + 1;
+		for (size_t index = begin; index < end; ++index) {
+			const int y = static_cast<int>(index % dims[1]);
+			const int z = static_cast<int>(index / dims[1]);
+			std::fill(buffer.begin(), buffer.end(), 0.0f);
+			for (int tz = 0; tz < tap_count; ++tz) {
+				const int source_z = std::min(std::max(2 * z + taps[tz].offset, 0),
+					static_cast<int>(source_dims[2]) - 1);
+				for (int ty = 0; ty < tap_count; ++ty) {
+					const int source_y = std::min(std::max(2 * y + taps[ty].offset, 0),
+						static_cast<int>(source_dims[1]) - 1);
+					const T* source_row = source +
+						(static_cast<size_t>(source_z) * source_dims[1] + source_y) *
+						source_width;
+					const float weight = taps[tz].weight * taps[ty].weight;
+#ifdef VOXEL_X86
+					if (use_avx2) {
+						AccumulateRowAvx2(weight, source_row, row, source_width);
+						continue;
+					}
+#endif
+					AccumulateRowScalar(weight, source_row, row, source_width);
+				}
+			}
+			// Clamp to the edge.
+			row[-1] = row[0];
+			row[source_width] = row[source_width - 1];
+
+			T* destination_row = destination + index * dims[0];
+#ifdef VOXEL_X86
+			if (use_avx2) {
+				ReduceRowAvx2(filter, row, destination_row, dims[0]);
+				continue;
+			}
+#endif
+			ReduceRowScalar(filter, row, destination_row, dims[0]);
+		}
+	});
+	(void)use_avx2;
+}
+
+size_t LevelSize(const uint32_t dims[3], TextureFormat format) {
+	return static_cast<size_t>(dims[0]) * dims[1] * dims[2] *
+		TextureFormatSize(format);
+}
+
+// Fills |header| with the layout of the levels below |base_dims| and returns
+// the size of the sidecar holding them.
+size_t LayOutPyramid(const uint32_t base_dims[3], PyramidHeader* header,
+	TextureFormat format, std::vector<VolumePyramid::Level>* levels) {
+	levels->clear();
+	uint32_t dims[3] = {base_dims[0], base_dims[1], base_dims[2]};
+	size_t offset = AlignUp(sizeof(PyramidHeader), kLevelAlignment);
+	while (dims[0] > 1 || dims[1] > 1 || dims[2] > 1) {
+		VolumePyramid::Level level;
+		NextLevelDims(dims, level.dims);
+		level.texels = nullptr;
+		header->level_offsets[levels->size()] = offset;
+		offset = AlignUp(offset + LevelSize(level.dims, format), kLevelAlignment);
+		std::memcpy(dims, level.dims, sizeof(dims));
+		levels->push_back(level);
+	}
+	header->level_count = static_cast<uint32_t>(levels->size());
+	return offset;
+}
+
+void InitPyramidHeader(const VolumeInfo& info, TextureFormat format,
+	MipFilter filter, uint64_t content_hash, PyramidHeader* header) {
+	std::memset(header, 0, sizeof(*header));
+	std::memcpy(header->magic, kPyramidMagic, sizeof(kPyramidMagic));
+	header->version = kPyramidVersion;
+	header->content_hash = content_hash;
+	header->texture_format = static_cast<uint32_t>(format);
+	header->filter = static_cast<uint32_t>(filter);
+	std::memcpy(header->dims, info.dims, sizeof(header->dims));
+}
+
+}  // namespace
+
+const char* MipFilterName(MipFilter filter) {
+	switch (filter) {
+	case MipFilter::kBox:
+		return "box";
+	case MipFilter::kGaussian:
+		return "gaussian";
+	}
+	return "unknown";
+}
+
+bool ParseMipFilter(const char* name, MipFilter* filter) {
+	for (MipFilter candidate : {MipFilter::kBox, MipFilter::kGaussian}) {
+		if (std::strcmp(name, MipFilterName(candidate)) == 0) {
+			*filter = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+void NextLevelDims(const uint32_t dims[3], uint32_t next_dims[3]) {
+	for (int i = 0; i < 3; ++i)
+		next_dims[i] = std::max(dims[i] / 2, 1u);
+}
+
+void DownsampleLevel(TextureFormat format, MipFilter filter,
+	const uint8_t* source, const uint32_t source_dims[3], uint8_t* destination) {
+	switch (format) {
+	case TextureFormat::kR8:
+		Downsample<uint8_t>(filter, source, source_dims, destination);
+		return;
+	case TextureFormat::kR16:
+		Downsample<uint16_t>(filter, source, source_dims, destination);
+		return;
+	case TextureFormat::kR16F:
+		Downsample<Half>(filter, source, source_dims, destination);
+		return;
+	case TextureFormat::kR32F:
+		Downsample<float>(filter, source, source_dims, destination);
+		return;
+	}
+}
+
+bool VolumePyramid::CreateVolumePyramid(VolumePyramid* pyramid,
+	const VolumeFile* volume, const VoxelConversion& conversion,
+	MipFilter filter, const std::string& cache_path) {
+	pyramid->volume = volume;
+	pyramid->conversion = conversion;
+	pyramid->filter = filter;
+	pyramid->cache_path = cache_path;
+	pyramid->builder = std::thread(BuildPyramid, pyramid);
+	return true;
+}
+
+void VolumePyramid::BuildPyramid(VolumePyramid* pyramid) {
+	NameProfilerThread("pyramid builder");
+	ProfileScope hash_scope("HashPyramidInputs");
+	auto start = std::chrono::steady_clock::now();
+	pyramid->content_hash = HashPyramidInputs(
+		*pyramid->volume, pyramid->conversion, pyramid->filter);
+	std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+	pyramid->hash_seconds = elapsed.count();
+	hash_scope.End();
+
+	ProfileScope load_scope("VolumePyramid::LoadCache");
+	pyramid->from_cache = LoadCache(pyramid);
+	load_scope.End();
+	if (!pyramid->from_cache) {
+		start = std::chrono::steady_clock::now();
+		const VolumeInfo& info = pyramid->volume->info;
+		const TextureFormat format = pyramid->conversion.target;
+		PyramidHeader header;
+		InitPyramidHeader(info, format, pyramid->filter, pyramid->content_hash,
+			&header);
+		pyramid->storage.resize(
+			LayOutPyramid(info.dims, &header, format, &pyramid->levels));
+		std::memcpy(pyramid->storage.data(), &header, sizeof(header));
+
+		std::vector<uint8_t> base_storage;
+		const uint8_t* previous =
+			GetLinearTexels(*pyramid->volume, pyramid->conversion, &base_storage);
+		const uint32_t* previous_dims = info.dims;
+		for (size_t i = 0; i < pyramid->levels.size(); ++i) {
+			Level& level = pyramid->levels[i];
+			uint8_t* texels = pyramid->storage.data() + header.level_offsets[i];
+			const ProfileScope scope("DownsampleLevel");
+			DownsampleLevel(format, pyramid->filter, previous, previous_dims, texels);
+			level.texels = texels;
+			previous = texels;
+			previous_dims = level.dims;
+		}
+		elapsed = std::chrono::steady_clock::now() - start;
+		pyramid->build_seconds = elapsed.count();
+		const ProfileScope scope("VolumePyramid::WriteCache");
+		WriteCache(pyramid);
+	}
+	pyramid->ready.store(true, std::memory_order_release);
+}
+
+bool VolumePyramid::LoadCache(VolumePyramid* pyramid) {
+	// A missing sidecar is expected, don't let the mapping report it.
+	if (!std::ifstream(pyramid->cache_path))
+		return false;
+	if (!VolumeSource::OpenVolumeSource(
+		&pyramid->cache, pyramid->cache_path.c_str())) {
+		return false;
+	}
+	const uint8_t* data = pyramid->cache.data;
+	const size_t size = pyramid->cache.size;
+	if (size < sizeof(PyramidHeader))
+		return false;
+	PyramidHeader header;
+	std::memcpy(&header, data, sizeof(header));
+
+	PyramidHeader expected;
+	InitPyramidHeader(pyramid->volume->info, pyramid->conversion.target,
+		pyramid->filter, pyramid->content_hash, &expected);
+	const size_t expected_size = LayOutPyramid(pyramid->volume->info.dims,
+		&expected, pyramid->conversion.target, &pyramid->levels);
+	if (std::memcmp(&header, &expected, sizeof(header)) != 0 ||
+		size < expected_size) {
+		pyramid->levels.clear();
+		return false;
+	}
+	for (size_t i = 0; i < pyramid->levels.size(); ++i)
+		pyramid->levels[i].texels = data + header.level_offsets[i];
+	return true;
+}
+
+bool VolumePyramid::WriteCache(const VolumePyramid* pyramid) {
+	// Write next to the sidecar and rename over it so that a concurrent or
+	// interrupted launch never maps a partial file.
+	const std::string temporary_path = pyramid->cache_path + ".tmp";
+	{
+		std::ofstream file(temporary_path,
+			std::ofstream::out | std::ofstream::binary);
+		if (!file)
+			return false;
+		file.write(reinterpret_cast<const char*>(pyramid->storage.data()),
+			pyramid->storage.size());
+		if (!file) {
+			file.close();
+			std::remove(temporary_path.c_str());
+			return false;
+		}
+	}
+	std::remove(pyramid->cache_path.c_str());
+	return std::rename(temporary_path.c_str(), pyramid->cache_path.c_str()) == 0;
+}
+
+void VolumePyramid::DestroyVolumePyramid(VolumePyramid* pyramid) {
+	if (pyramid->builder.joinable())
+		pyramid->builder.join();
+}
@@ -0,0 +1,135 @@
+#ifndef VOXEL_VOLUME_PYRAMID
+#define VOXEL_VOLUME_PYRAMID
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gl_utils.h"
+#include "volume_format.h"
+#include "volume_source.h"
+#include "voxel_convert.h"
+
+// Filter used to reduce 2x2x2 voxels of a level into one of the next.
+enum class MipFilter : uint32_t {
+	// Average of the 2 voxels along each axis.
+	kBox = 0,
+	// 1-2-1 binomial weights along each axis, the 3x3x3 neighbourhood of
+	// the even voxel. Smoother than the box and free of its half voxel shift.
+	kGaussian = 1,
+};
+
+// Returns the name used for |filter| on the command line ("box", ...).
+const char* MipFilterName(MipFilter filter);
+
+// Parses a name returned by MipFilterName() into |filter|.
+bool ParseMipFilter(const char* name, MipFilter* filter);
+
+// Returns the size of the level below one of size |dims| (halved and rounded
+// down, at least 1) in |next_dims|.
+void NextLevelDims(const uint32_t dims[3], uint32_t next_dims[3]);
+
+// Reduces |source|, a linear x-fastest level of |format| texels of size
+// |source_dims|, into |destination| sized as given by NextLevelDims(). Runs
+// on all the threads of ParallelFor() with the widest SIMD kernel the CPU
+// supports.
+void DownsampleLevel(TextureFormat format, MipFilter filter,
+	const uint8_t* source, const uint32_t source_dims[3], uint8_t* destination);
+
+// On-disk header of a pyramid sidecar file. The levels below the base follow
+// it, each at its offset (aligned to 64 bytes) and sized from the base dims.
+// The base level isn't stored, it is the volume itself.
+#pragma pack(push, 1)
+struct PyramidHeader {
+	char magic[4];
+	uint32_t version;
+	// Hash of the voxels, their layout, the conversion and the filter. The
+	// sidecar is only used if it matches the volume being opened.
+	uint64_t content_hash;
+	uint32_t texture_format;
+	uint32_t filter;
+	uint32_t dims[3];
+	// Number of stored levels, the base level excluded.
+	uint32_t level_count;
+	uint64_t level_offsets[32];
+};
+#pragma pack(pop)
+static_assert(sizeof(PyramidHeader) == 296,
+	"The pyramid header layout must not change");
+
+// The mip levels of a volume below the base level, built in the background.
+//
+// A builder thread hashes the payload and looks for a sidecar file with a
+// matching hash. If there is one it is mapped and the levels point into it,
+// otherwise every level is computed from the previous one with
+// DownsampleLevel() and the result is written to the sidecar for the next
+// launch.
+class VolumePyramid {
+  public:
+	~VolumePyramid() {
+		DestroyVolumePyramid(this);
+	}
+
+	// Starts building the pyramid of |volume| converted with |conversion|,
+	// cached at |cache_path|. |volume| must outlive |pyramid|.
+	static bool CreateVolumePyramid(VolumePyramid* pyramid,
+		const VolumeFile* volume, const VoxelConversion& conversion,
+		MipFilter filter, const std::string& cache_path);
+
+	// Uploads the levels of |pyramid| as mip levels 1 and up of |texture_id|
+	// and enables trilinear mipmapping on it. Must only be called once
+	// IsReady() returns true. Defined in volume_pyramid_gl.cpp, for the
+	// tools that only build pyramids to link without GL.
+	static bool UploadVolumePyramid(const VolumePyramid* pyramid,
+		GLuint texture_id);
+
+	// Returns true once the builder thread is done, successfully or not.
+	bool IsReady() const {
+		return ready.load(std::memory_order_acquire);
+	}
+
+	// A mip level below the base, in the texture format of the conversion.
+	struct Level {
+		uint32_t dims[3];
+		const uint8_t* texels;
+	};
+
+	// Everything below is only valid once IsReady() returns true.
+	//
+	// Levels 1 and up, empty if building failed.
+	std::vector<Level> levels;
+	// True if the levels were mapped from the sidecar.
+	bool from_cache = false;
+	double hash_seconds = 0.0;
+	double build_seconds = 0.0;
+
+  private:
+	// Body of the builder thread.
+	static void BuildPyramid(VolumePyramid* pyramid);
+
+	// Maps the sidecar and points |levels| into it if its header matches.
+	static bool LoadCache(VolumePyramid* pyramid);
+
+	// Writes |levels| to the sidecar.
+	static bool WriteCache(const VolumePyramid* pyramid);
+
+	// Waits for the builder thread to finish.
+	static void DestroyVolumePyramid(VolumePyramid* pyramid);
+
+	const VolumeFile* volume = nullptr;
+	VoxelConversion conversion;
+	MipFilter filter = MipFilter::kBox;
+	std::string cache_path;
+	uint64_t content_hash = 0;
+
+	// Storage of the levels when they are computed.
+	std::vector<uint8_t> storage;
+	VolumeSource cache;
+
+	std::atomic<bool> ready{false};
+	std::thread builder;
+};
+
+#endif  // VOXEL_VOLUME_PYRAMID
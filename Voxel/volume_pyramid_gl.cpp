@@ -0,0 +1,32 @@
+#include "volume_pyramid.h"
+
+#include <cassert>
+
+#include "profiler.h"
+
+bool VolumePyramid::UploadVolumePyramid(const VolumePyramid* pyramid,
+	GLuint texture_id) {
+	const ProfileScope scope("VolumePyramid::UploadVolumePyramid");
+	assert(pyramid->IsReady());
+	if (pyramid->levels.empty())
+		return true;
+	GLint internal_format;
+	GLenum pixel_type;
+	GetGlTextureFormat(pyramid->conversion.target, &internal_format, &pixel_type);
+
+	GLint previous_texture;
+	glGetIntegerv(GL_TEXTURE_BINDING_3D, &previous_texture);
+	glBindTexture(GL_TEXTURE_3D, texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t i = 0; i < pyramid->levels.size(); ++i) {
+		const Level& level = pyramid->levels[i];
+		glTexImage3D(GL_TEXTURE_3D, static_cast<GLint>(i + 1), internal_format,
+			level.dims[0], level.dims[1], level.dims[2], 0, GL_RED, pixel_type,
+			level.texels);
+	}
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL,
+		static_cast<GLint>(pyramid->levels.size()));
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glBindTexture(GL_TEXTURE_3D, previous_texture);
+	return CheckGlError();
+}
@@ -0,0 +1,130 @@
+#include "volume_source.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool VolumeSource::OpenVolumeSource(VolumeSource* source, const char* path) {
+	CloseVolumeSource(source);
+
+	// FILE_FLAG_SEQUENTIAL_SCAN is the Windows equivalent of
+	// MADV_SEQUENTIAL: it makes the cache manager read ahead aggressively.
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+		nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		std::cout << "Failed to open volume file: " << path << "\n";
+		return false;
+	}
+	source->file_handle = file;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		std::cout << "Volume file is empty: " << path << "\n";
+		CloseVolumeSource(source);
+		return false;
+	}
+
+	HANDLE mapping =
+		CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		std::cout << "Failed to map volume file: " << path << "\n";
+		CloseVolumeSource(source);
+		return false;
+	}
+	source->mapping_handle = mapping;
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		std::cout << "Failed to map volume file: " << path << "\n";
+		CloseVolumeSource(source);
+		return false;
+	}
+	source->data = static_cast<const uint8_t*>(view);
+	source->size = static_cast<size_t>(file_size.QuadPart);
+
+	// Equivalent of MADV_WILLNEED. It is only a hint so a failure (e.g. on
+	// older versions of Windows) is not an error.
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = view;
+	range.NumberOfBytes = source->size;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+
+	return true;
+}
+
+void VolumeSource::CloseVolumeSource(VolumeSource* source) {
+	if (source->data)
+		UnmapViewOfFile(source->data);
+	if (source->mapping_handle)
+		CloseHandle(source->mapping_handle);
+	if (source->file_handle)
+		CloseHandle(source->file_handle);
+
+	source->data = nullptr;
+	source->size = 0;
+	source->mapping_handle = nullptr;
+	source->file_handle = nullptr;
+}
+
+#else
+
+bool VolumeSource::OpenVolumeSource(VolumeSource* source, const char* path) {
+	CloseVolumeSource(source);
+
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		std::cout << "Failed to open volume file: " << path << "\n";
+		return false;
+	}
+	source->file_descriptor = fd;
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+		std::cout << "Volume file is empty: " << path << "\n";
+		CloseVolumeSource(source);
+		return false;
+	}
+	const size_t size = static_cast<size_t>(file_stat.st_size);
+
+	void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED) {
+		std::cout << "Failed to map volume file: " << path << "\n";
+		CloseVolumeSource(source);
+		return false;
+	}
+	source->data = static_cast<const uint8_t*>(view);
+	source->size = size;
+
+	// The volume is read front to back exactly once by the upload, so ask
+	// for aggressive read-ahead and start faulting the pages in now. These
+	// are hints, a failure is not an error.
+	madvise(view, size, MADV_SEQUENTIAL);
+	madvise(view, size, MADV_WILLNEED);
+
+	return true;
+}
+
+void VolumeSource::CloseVolumeSource(VolumeSource* source) {
+	if (source->data)
+		munmap(const_cast<uint8_t*>(source->data), source->size);
+	if (source->file_descriptor >= 0)
+		close(source->file_descriptor);
+
+	source->data = nullptr;
+	source->size = 0;
+	source->file_descriptor = -1;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef VOXEL_VOLUME_SOURCE
+#define VOXEL_VOLUME_SOURCE
+
+#include <cstddef>
+#include <cstdint>
+
+// Read-only memory mapping of a volume file. The mapped bytes are handed
+// straight to the upload path, so the volume is never copied into the heap
+// and the OS can page it in as fast as the disk allows.
+class VolumeSource {
+  public:
+	VolumeSource() = default;
+	VolumeSource(const VolumeSource&) = delete;
+	VolumeSource& operator=(const VolumeSource&) = delete;
+	~VolumeSource() {
+		CloseVolumeSource(this);
+	}
+
+	// Maps the whole file at |path| into memory and stores the mapping in
+	// |source|. The pages are hinted as sequentially accessed and needed
+	// soon so the kernel starts reading ahead right away. Returns false if
+	// the file can't be opened, is empty or can't be mapped.
+	static bool OpenVolumeSource(VolumeSource* source, const char* path);
+
+	// Start of the mapped file and its length in bytes. |data| is nullptr
+	// when nothing is mapped.
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+  private:
+	// Unmaps the file of |source| and closes its handles.
+	static void CloseVolumeSource(VolumeSource* source);
+
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#else
+	int file_descriptor = -1;
+#endif
+};
+
+#endif  // VOXEL_VOLUME_SOURCE
@@ -0,0 +1,236 @@
+#include "volume_streamer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+
+#include "profiler.h"
+
+namespace {
+
+// Linear volumes are cut in slabs of about this many bytes: big enough to
+// amortize the per-upload overhead, small enough that committing a few of
+// them doesn't cause a visible hitch.
+const size_t kTargetSlabSize = 4 * 1024 * 1024;
+
+}  // namespace
+
+bool VolumeStreamer::CreateVolumeStreamer(VolumeStreamer* streamer,
+	const VolumeFile* volume, const VoxelConversion& conversion,
+	GLuint texture_id, int buffer_count) {
+	assert(buffer_count > 0);
+	streamer->volume = volume;
+	streamer->conversion = conversion;
+	streamer->texture_id = texture_id;
+	GetGlTextureFormat(
+		conversion.target, &streamer->internal_format, &streamer->pixel_type);
+
+	// Cut the volume in slabs. Offsets are in the payload, capacities in the
+	// converted texels.
+	const VolumeInfo& info = volume->info;
+	const size_t voxel_size = VoxelTypeSize(info.type);
+	const size_t texel_size = TextureFormatSize(conversion.target);
+	if (IsBricked(info)) {
+		// One slab per layer of bricks.
+		const uint32_t* brick = info.brick_dims;
+		const size_t bricks_per_layer =
+			static_cast<size_t>((info.dims[0] + brick[0] - 1) / brick[0]) *
+			((info.dims[1] + brick[1] - 1) / brick[1]);
+		const size_t layer_voxels =
+			bricks_per_layer * brick[0] * brick[1] * brick[2];
+		for (uint32_t z = 0; z < info.dims[2]; z += brick[2]) {
+			streamer->slabs.push_back({z, std::min(z + brick[2], info.dims[2]),
+				streamer->slabs.size() * layer_voxels * voxel_size,
+				layer_voxels});
+		}
+		streamer->slab_capacity = layer_voxels * texel_size;
+	} else {
+		const size_t slice_voxels =
+			static_cast<size_t>(info.dims[0]) * info.dims[1];
+		const uint32_t slab_depth = static_cast<uint32_t>(std::min<size_t>(
+			std::max<size_t>(kTargetSlabSize / (slice_voxels * texel_size), 1),
+			info.dims[2]));
+		for (uint32_t z = 0; z < info.dims[2]; z += slab_depth) {
+			const uint32_t z_end = std::min(z + slab_depth, info.dims[2]);
+			streamer->slabs.push_back({z, z_end, z * slice_voxels * voxel_size,
+				(z_end - z) * slice_voxels});
+		}
+		streamer->slab_capacity = slab_depth * slice_voxels * texel_size;
+	}
+
+	// Allocate the texture storage. Its contents stay undefined until the
+	// slabs arrive, readers must only look below |loaded_depth|.
+	GLint previous_texture;
+	glGetIntegerv(GL_TEXTURE_BINDING_3D, &previous_texture);
+	glBindTexture(GL_TEXTURE_3D, texture_id);
+	glTexImage3D(GL_TEXTURE_3D, 0, streamer->internal_format, info.dims[0],
+		info.dims[1], info.dims[2], 0, GL_RED, streamer->pixel_type, nullptr);
+	glBindTexture(GL_TEXTURE_3D, previous_texture);
+
+	streamer->pixel_buffers.resize(
+		std::min<size_t>(buffer_count, streamer->slabs.size()));
+	glGenBuffers(static_cast<GLsizei>(streamer->pixel_buffers.size()),
+		streamer->pixel_buffers.data());
+
+	streamer->loader = std::thread(CopySlabs, streamer);
+
+	// Fill the ring.
+	for (size_t i = 0; i < streamer->pixel_buffers.size(); ++i) {
+		if (!QueueNextSlab(streamer, i))
+			return false;
+	}
+	return CheckGlError();
+}
+
+bool VolumeStreamer::QueueNextSlab(VolumeStreamer* streamer, size_t buffer) {
+	if (streamer->next_slab_to_queue == streamer->slabs.size())
+		return true;
+
+	// Orphan the previous storage so that mapping never waits for the GPU to
+	// finish reading the last slab uploaded from this buffer.
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, streamer->pixel_buffers[buffer]);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, streamer->slab_capacity, nullptr,
+		GL_STREAM_DRAW);
+	void* destination = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+		streamer->slab_capacity,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (!destination) {
+		assert(false);
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(streamer->mutex);
+		streamer->pending_jobs.push_back({streamer->next_slab_to_queue, buffer,
+			static_cast<uint8_t*>(destination)});
+	}
+	streamer->jobs_available.notify_one();
+	++streamer->next_slab_to_queue;
+	return true;
+}
+
+void VolumeStreamer::CopySlabs(VolumeStreamer* streamer) {
+	NameProfilerThread("volume streamer");
+	while (true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(streamer->mutex);
+			streamer->jobs_available.wait(lock, [streamer] {
+				return streamer->stop || !streamer->pending_jobs.empty();
+			});
+			if (streamer->stop)
+				return;
+			job = streamer->pending_jobs.front();
+			streamer->pending_jobs.pop_front();
+		}
+
+		// This is where the mapped file is actually read from disk.
+		const ProfileScope scope("CopySlab");
+		const Slab& slab = streamer->slabs[job.slab];
+		const uint8_t* source = streamer->volume->voxels + slab.offset;
+		const size_t source_size =
+			slab.voxel_count * VoxelTypeSize(streamer->volume->info.type);
+		const auto start = std::chrono::steady_clock::now();
+		if (IsIdentityConversion(streamer->conversion)) {
+			std::memcpy(job.destination, source, source_size);
+		} else {
+			ConvertVoxels(streamer->conversion, source, job.destination,
+				slab.voxel_count);
+		}
+		const std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+
+		std::lock_guard<std::mutex> lock(streamer->mutex);
+		streamer->conversion_seconds += elapsed.count();
+		streamer->converted_bytes += source_size;
+		streamer->finished_jobs.push_back(job);
+	}
+}
+
+bool VolumeStreamer::UploadReadySlabs(VolumeStreamer* streamer, int max_slabs) {
+	const ProfileScope scope("VolumeStreamer::UploadReadySlabs");
+	const VolumeInfo& info = streamer->volume->info;
+	GLint previous_texture;
+	glGetIntegerv(GL_TEXTURE_BINDING_3D, &previous_texture);
+	glBindTexture(GL_TEXTURE_3D, streamer->texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	for (int i = 0; i < max_slabs; ++i) {
+		Job job;
+		{
+			std::lock_guard<std::mutex> lock(streamer->mutex);
+			if (streamer->finished_jobs.empty())
+				break;
+			job = streamer->finished_jobs.front();
+			streamer->finished_jobs.pop_front();
+		}
+		// There is a single loader thread so slabs finish in order.
+		assert(job.slab == streamer->next_slab_to_upload);
+		const Slab& slab = streamer->slabs[job.slab];
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, streamer->pixel_buffers[job.buffer]);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		// With a pixel buffer bound the data pointer is an offset into it.
+		if (IsBricked(info)) {
+			const uint32_t* brick = info.brick_dims;
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, brick[0]);
+			glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, brick[1]);
+			const size_t brick_size = static_cast<size_t>(brick[0]) * brick[1] *
+				brick[2] * TextureFormatSize(streamer->conversion.target);
+			size_t offset = 0;
+			for (uint32_t y = 0; y < info.dims[1]; y += brick[1]) {
+				for (uint32_t x = 0; x < info.dims[0]; x += brick[0]) {
+					glTexSubImage3D(GL_TEXTURE_3D, 0, x, y, slab.z_begin,
+						std::min(brick[0], info.dims[0] - x),
+						std::min(brick[1], info.dims[1] - y),
+						slab.z_end - slab.z_begin, GL_RED, streamer->pixel_type,
+						reinterpret_cast<const GLvoid*>(offset));
+					offset += brick_size;
+				}
+			}
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+		} else {
+			glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, slab.z_begin, info.dims[0],
+				info.dims[1], slab.z_end - slab.z_begin, GL_RED,
+				streamer->pixel_type, nullptr);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		streamer->loaded_depth = slab.z_end;
+		++streamer->next_slab_to_upload;
+		if (!QueueNextSlab(streamer, job.buffer))
+			return false;
+	}
+
+	glBindTexture(GL_TEXTURE_3D, previous_texture);
+	return CheckGlError();
+}
+
+void VolumeStreamer::DestroyVolumeStreamer(VolumeStreamer* streamer) {
+	if (streamer->loader.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(streamer->mutex);
+			streamer->stop = true;
+		}
+		streamer->jobs_available.notify_one();
+		streamer->loader.join();
+	}
+
+	// Buffers may still be mapped if loading was interrupted.
+	for (GLuint buffer : streamer->pixel_buffers) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+		GLint mapped = GL_FALSE;
+		glGetBufferParameteriv(GL_PIXEL_UNPACK_BUFFER, GL_BUFFER_MAPPED, &mapped);
+		if (mapped)
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (!streamer->pixel_buffers.empty()) {
+		glDeleteBuffers(static_cast<GLsizei>(streamer->pixel_buffers.size()),
+			streamer->pixel_buffers.data());
+	}
+	streamer->pixel_buffers.clear();
+}
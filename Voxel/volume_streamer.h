@@ -0,0 +1,98 @@
+#ifndef VOXEL_VOLUME_STREAMER
+#define VOXEL_VOLUME_STREAMER
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gl_utils.h"
+#include "volume_format.h"
+#include "voxel_convert.h"
+
+// Streams a mapped volume into a 3D texture in the background.
+//
+// The volume is split in slabs of whole z slices (one layer of bricks for
+// bricked volumes). A loader thread converts each slab from the mapping into
+// a mapped pixel buffer object, so the page faults of the read and the
+// conversion happen off the render thread, and the render thread commits a
+// few finished slabs per frame with glTexSubImage3D. Slabs are committed in z
+// order, so at any time the slices below |loaded_depth| are valid.
+class VolumeStreamer {
+  public:
+	~VolumeStreamer() {
+		DestroyVolumeStreamer(this);
+	}
+
+	// Allocates the storage of |texture_id| for |volume| converted with
+	// |conversion| and starts streaming the voxels into it through a ring of
+	// |buffer_count| pixel buffers. |volume| must outlive |streamer|.
+	static bool CreateVolumeStreamer(VolumeStreamer* streamer,
+		const VolumeFile* volume, const VoxelConversion& conversion,
+		GLuint texture_id, int buffer_count);
+
+	// Uploads up to |max_slabs| slabs that the loader thread has finished
+	// copying and hands the freed buffers back to it. Never blocks.
+	static bool UploadReadySlabs(VolumeStreamer* streamer, int max_slabs);
+
+	// Returns true once every slab has been uploaded.
+	bool IsComplete() const {
+		return next_slab_to_upload == slabs.size();
+	}
+
+	// Number of z slices that have been uploaded so far.
+	uint32_t loaded_depth = 0;
+	// Time the loader thread spent converting voxels and the size of the
+	// voxels it read. Only valid once IsComplete() returns true.
+	double conversion_seconds = 0.0;
+	size_t converted_bytes = 0;
+
+  private:
+	// A range of z slices and where its voxels live in the payload.
+	struct Slab {
+		uint32_t z_begin;
+		uint32_t z_end;
+		size_t offset;
+		size_t voxel_count;
+	};
+
+	// A slab that is being copied into a mapped pixel buffer.
+	struct Job {
+		size_t slab;
+		size_t buffer;
+		uint8_t* destination;
+	};
+
+	// Maps |buffer| and queues the next slab to be copied into it.
+	static bool QueueNextSlab(VolumeStreamer* streamer, size_t buffer);
+
+	// Body of the loader thread.
+	static void CopySlabs(VolumeStreamer* streamer);
+
+	// Stops the loader thread and releases the pixel buffers.
+	static void DestroyVolumeStreamer(VolumeStreamer* streamer);
+
+	const VolumeFile* volume = nullptr;
+	VoxelConversion conversion;
+	GLuint texture_id = 0;
+	GLint internal_format = 0;
+	GLenum pixel_type = 0;
+
+	std::vector<Slab> slabs;
+	size_t slab_capacity = 0;
+	std::vector<GLuint> pixel_buffers;
+	size_t next_slab_to_queue = 0;
+	size_t next_slab_to_upload = 0;
+
+	// Shared with the loader thread.
+	std::mutex mutex;
+	std::condition_variable jobs_available;
+	std::deque<Job> pending_jobs;
+	std::deque<Job> finished_jobs;
+	bool stop = false;
+	std::thread loader;
+};
+
+#endif  // VOXEL_VOLUME_STREAMER
@@ -0,0 +1,327 @@
+#include "voxel_convert.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "cpu_features.h"
+#include "parallel.h"
+#include "voxel_simd.h"
+
+namespace {
+
+using namespace simd;
+
+// The voxel conversion folded into a multiply-add followed by a clamp.
+struct ConversionParams {
+	bool swap_bytes;
+	float scale;
+	float bias;
+	float min;
+	float max;
+};
+
+ConversionParams GetConversionParams(const VoxelConversion& conversion) {
+	ConversionParams params;
+	params.swap_bytes = conversion.swap_bytes;
+	switch (conversion.target) {
+	case TextureFormat::kR8:
+		params.min = 0.0f;
+		params.max = 255.0f;
+		break;
+	case TextureFormat::kR16:
+		params.min = 0.0f;
+		params.max = 65535.0f;
+		break;
+	case TextureFormat::kR16F:
+	case TextureFormat::kR32F:
+		params.min = conversion.windowed ? 0.0f :
+			-std::numeric_limits<float>::max();
+		params.max = conversion.windowed ? 1.0f :
+			std::numeric_limits<float>::max();
+		break;
+	}
+
+	params.scale = 1.0f;
+	params.bias = 0.0f;
+	if (conversion.windowed) {
+		const float width = std::max(
+			conversion.window_max - conversion.window_min,
+			std::numeric_limits<float>::min());
+		params.scale = params.max / width;
+		params.bias = -conversion.window_min * params.scale;
+	}
+	return params;
+}
+
+template <typename Source, typename Target>
+void ConvertScalar(const ConversionParams& params, const Source* source,
+	Target* destination, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		const float value =
+			LoadScalar(source + i, params.swap_bytes) * params.scale + params.bias;
+		StoreScalar(destination + i,
+			std::min(std::max(value, params.min), params.max));
+	}
+}
+
+#ifdef VOXEL_X86
+
+template <typename Source, typename Target>
+VOXEL_TARGET("sse4.1") void ConvertSse41(const ConversionParams& params,
+	const Source* source, Target* destination, size_t count) {
+	const __m128 scale = _mm_set1_ps(params.scale);
+	const __m128 bias = _mm_set1_ps(params.bias);
+	const __m128 min = _mm_set1_ps(params.min);
+	const __m128 max = _mm_set1_ps(params.max);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 values = Load4(source + i, params.swap_bytes);
+		values = _mm_add_ps(_mm_mul_ps(values, scale), bias);
+		values = _mm_min_ps(_mm_max_ps(values, min), max);
+		Store4(destination + i, values);
+	}
+	ConvertScalar(params, source + i, destination + i, count - i);
+}
+
+template <typename Source, typename Target>
+VOXEL_TARGET(VOXEL_AVX2) void ConvertAvx2(const ConversionParams& params,
+	const Source* source, Target* destination, size_t count) {
+	const __m256 scale = _mm256_set1_ps(params.scale);
+	const __m256 bias = _mm256_set1_ps(params.bias);
+	const __m256 min = _mm256_set1_ps(params.min);
+	const __m256 max = _mm256_set1_ps(params.max);
+	size_t i = 0;
+	// Two independent vectors per iteration to hide the conversion latency.
+	for (; i + 16 <= count; i += 16) {
+		__m256 first = Load8(source + i, params.swap_bytes);
+		__m256 second = Load8(source + i + 8, params.swap_bytes);
+		first = _mm256_fmadd_ps(first, scale, bias);
+		second = _mm256_fmadd_ps(second, scale, bias);
+		Store8(destination + i, _mm256_min_ps(_mm256_max_ps(first, min), max));
+		Store8(destination + i + 8,
+			_mm256_min_ps(_mm256_max_ps(second, min), max));
+	}
+	for (; i + 8 <= count; i += 8) {
+		__m256 values = Load8(source + i, params.swap_bytes);
+		values = _mm256_fmadd_ps(values, scale, bias);
+		Store8(destination + i, _mm256_min_ps(_mm256_max_ps(values, min), max));
+	}
+	// The compiler may jump to the scalar tail without clearing the upper
+	// halves of the registers, which slows down every SSE instruction that
+	// runs after it, here and in the caller.
+	_mm256_zeroupper();
+	ConvertScalar(params, source + i, destination + i, count - i);
+}
+
+#endif  // VOXEL_X86
+
+enum class Kernel {
+	kScalar,
+	kSse41,
+	kAvx2,
+};
+
+Kernel GetKernel() {
+	const CpuFeatures& features = GetCpuFeatures();
+	if (features.avx2 && features.fma && features.f16c)
+		return Kernel::kAvx2;
+	if (features.sse41)
+		return Kernel::kSse41;
+	return Kernel::kScalar;
+}
+
+template <typename Source, typename Target>
+void Convert(const ConversionParams& params, const void* source,
+	void* destination, size_t count) {
+	const Source* typed_source = static_cast<const Source*>(source);
+	Target* typed_destination = static_cast<Target*>(destination);
+	switch (GetKernel()) {
+#ifdef VOXEL_X86
+	case Kernel::kAvx2:
+		ConvertAvx2(params, typed_source, typed_destination, count);
+		return;
+	case Kernel::kSse41:
+		ConvertSse41(params, typed_source, typed_destination, count);
+		return;
+#endif
+	default:
+		ConvertScalar(params, typed_source, typed_destination, count);
+		return;
+	}
+}
+
+}  // namespace
+
+size_t TextureFormatSize(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::kR8:
+		return 1;
+	case TextureFormat::kR16:
+	case TextureFormat::kR16F:
+		return 2;
+	case TextureFormat::kR32F:
+		return 4;
+	}
+	assert(false);
+	return 0;
+}
+
+float TextureFormatScale(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::kR8:
+		return 1.0f / 255.0f;
+	case TextureFormat::kR16:
+		return 1.0f / 65535.0f;
+	case TextureFormat::kR16F:
+	case TextureFormat::kR32F:
+		return 1.0f;
+	}
+	return 1.0f;
+}
+
+const char* TextureFormatName(TextureFormat format) {
+	switch (format) {
+	case TextureFormat::kR8:
+		return "r8";
+	case TextureFormat::kR16:
+		return "r16";
+	case TextureFormat::kR16F:
+		return "r16f";
+	case TextureFormat::kR32F:
+		return "r32f";
+	}
+	return "unknown";
+}
+
+bool ParseTextureFormat(const char* name, TextureFormat* format) {
+	for (TextureFormat candidate : {TextureFormat::kR8, TextureFormat::kR16,
+		TextureFormat::kR16F, TextureFormat::kR32F}) {
+		if (std::strcmp(name, TextureFormatName(candidate)) == 0) {
+			*format = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+VoxelConversion PlanVoxelConversion(const VolumeInfo& info) {
+	VoxelConversion conversion;
+	conversion.source_type = info.type;
+	conversion.swap_bytes = info.big_endian && VoxelTypeSize(info.type) > 1;
+	switch (info.type) {
+	case VoxelType::kUint8:
+		conversion.target = TextureFormat::kR8;
+		break;
+	case VoxelType::kUint16:
+		conversion.target = TextureFormat::kR16;
+		break;
+	case VoxelType::kFloat32:
+		conversion.target = TextureFormat::kR16F;
+		conversion.windowed = true;
+		conversion.window_min = info.value_min;
+		conversion.window_max = info.value_max;
+		break;
+	}
+	return conversion;
+}
+
+bool IsIdentityConversion(const VoxelConversion& conversion) {
+	if (conversion.swap_bytes || conversion.windowed)
+		return false;
+	switch (conversion.source_type) {
+	case VoxelType::kUint8:
+		return conversion.target == TextureFormat::kR8;
+	case VoxelType::kUint16:
+		return conversion.target == TextureFormat::kR16;
+	case VoxelType::kFloat32:
+		return conversion.target == TextureFormat::kR32F;
+	}
+	return false;
+}
+
+void ConvertVoxels(const VoxelConversion& conversion, const void* source,
+	void* destination, size_t count) {
+	const ConversionParams params = GetConversionParams(conversion);
+	switch (conversion.source_type) {
+	case VoxelType::kUint8:
+		assert(conversion.target == TextureFormat::kR8);
+		Convert<uint8_t, uint8_t>(params, source, destination, count);
+		return;
+	case VoxelType::kUint16:
+		assert(conversion.target == TextureFormat::kR16);
+		Convert<uint16_t, uint16_t>(params, source, destination, count);
+		return;
+	case VoxelType::kFloat32:
+		if (conversion.target == TextureFormat::kR16F) {
+			Convert<float, Half>(params, source, destination, count);
+		} else {
+			assert(conversion.target == TextureFormat::kR32F);
+			Convert<float, float>(params, source, destination, count);
+		}
+		return;
+	}
+}
+
+const uint8_t* GetLinearTexels(const VolumeFile& volume,
+	const VoxelConversion& conversion, std::vector<uint8_t>* storage) {
+	const VolumeInfo& info = volume.info;
+	const bool identity = IsIdentityConversion(conversion);
+	if (!IsBricked(info) && identity)
+		return volume.voxels;
+
+	const size_t voxel_size = VoxelTypeSize(info.type);
+	const size_t texel_size = TextureFormatSize(conversion.target);
+	const uint32_t* dims = info.dims;
+	const uint32_t* brick = info.brick_dims;
+	storage->resize(VoxelCount(info) * texel_size);
+	uint8_t* base = storage->data();
+
+	// One row of the base level at a time, made of the rows of every brick
+	// it crosses.
+	ParallelFor(static_cast<size_t>(dims[1]) * dims[2], 64,
+		[&](size_t begin, size_t end) {
+		for (size_t row = begin; row < end; ++row) {
+			const uint32_t y = static_cast<uint32_t>(row % dims[1]);
+			const uint32_t z = static_cast<uint32_t>(row / dims[1]);
+			uint8_t* destination = base + row * dims[0] * texel_size;
+			if (!IsBricked(info)) {
+				ConvertVoxels(conversion, volume.voxels + row * dims[0] * voxel_size,
+					destination, dims[0]);
+				continue;
+			}
+			const size_t bricks_x = (dims[0] + brick[0] - 1) / brick[0];
+			const size_t bricks_y = (dims[1] + brick[1] - 1) / brick[1];
+			const size_t brick_voxels =
+				static_cast<size_t>(brick[0]) * brick[1] * brick[2];
+			const size_t brick_row = (z / brick[2] * bricks_y + y / brick[1]) * bricks_x;
+			const size_t row_in_brick =
+				(static_cast<size_t>(z % brick[2]) * brick[1] + y % brick[1]) * brick[0];
+			for (uint32_t x = 0; x < dims[0]; x += brick[0]) {
+				const uint8_t* source = volume.voxels + voxel_size *
+					((brick_row + x / brick[0]) * brick_voxels + row_in_brick);
+				const uint32_t count = std::min(brick[0], dims[0] - x);
+				if (identity) {
+					std::memcpy(destination + x * texel_size, source, count * voxel_size);
+				} else {
+					ConvertVoxels(conversion, source, destination + x * texel_size, count);
+				}
+			}
+		}
+	});
+	return base;
+}
+
+const char* ConversionKernelName() {
+	switch (GetKernel()) {
+	case Kernel::kAvx2:
+		return "avx2";
+	case Kernel::kSse41:
+		return "sse4.1";
+	case Kernel::kScalar:
+		return "scalar";
+	}
+	return "unknown";
+}
@@ -0,0 +1,70 @@
+#ifndef VOXEL_VOXEL_CONVERT
+#define VOXEL_VOXEL_CONVERT
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "volume_format.h"
+
+// Single channel formats the voxels can be uploaded to the GPU as.
+enum class TextureFormat {
+	kR8,
+	kR16,
+	kR16F,
+	kR32F,
+};
+
+// Returns the size in bytes of one texel of |format|.
+size_t TextureFormatSize(TextureFormat format);
+
+// Returns the factor that maps the texels of |format| to the values the
+// shader reads, 1 for float formats which aren't normalized.
+float TextureFormatScale(TextureFormat format);
+
+// Returns the name used for |format| on the command line ("r16f", ...).
+const char* TextureFormatName(TextureFormat format);
+
+// Parses a name returned by TextureFormatName() into |format|.
+bool ParseTextureFormat(const char* name, TextureFormat* format);
+
+// How the voxels of a volume are transformed on their way to the texture.
+struct VoxelConversion {
+	VoxelType source_type = VoxelType::kUint8;
+	// Swap the bytes of each voxel, for big endian payloads.
+	bool swap_bytes = false;
+	// When set, voxel values in [window_min, window_max] are mapped to the
+	// whole range of |target| ([0, 1] for float formats) and the values
+	// outside are clamped.
+	bool windowed = false;
+	float window_min = 0.0f;
+	float window_max = 1.0f;
+	TextureFormat target = TextureFormat::kR8;
+};
+
+// Returns the default conversion of the volume described by |info|: integer
+// voxels keep their type and are only byte swapped if needed, float voxels
+// are windowed to their value range and stored as half floats so that the
+// transfer function can be indexed with them.
+VoxelConversion PlanVoxelConversion(const VolumeInfo& info);
+
+// Returns true if |conversion| leaves the voxels untouched, in which case
+// they can be uploaded straight from the mapping.
+bool IsIdentityConversion(const VoxelConversion& conversion);
+
+// Converts |count| voxels from |source| into |destination| using the widest
+// SIMD kernel the CPU supports.
+void ConvertVoxels(const VoxelConversion& conversion, const void* source,
+	void* destination, size_t count);
+
+// Returns the voxels of |volume| converted with |conversion| as a linear
+// x-fastest block of texels. It points into the mapping when there is
+// nothing to do, otherwise the voxels are converted (and unbricked) in
+// parallel into |storage|.
+const uint8_t* GetLinearTexels(const VolumeFile& volume,
+	const VoxelConversion& conversion, std::vector<uint8_t>* storage);
+
+// Returns the name of the kernel ConvertVoxels() uses on this CPU.
+const char* ConversionKernelName();
+
+#endif  // VOXEL_VOXEL_CONVERT
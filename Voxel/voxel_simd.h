@@ -0,0 +1,250 @@
+#ifndef VOXEL_VOXEL_SIMD
+#define VOXEL_VOXEL_SIMD
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include "cpu_features.h"
+
+#ifdef VOXEL_X86
+#include <immintrin.h>
+#endif
+
+// Loads and stores of every texel type as floats, one at a time and 4 (SSE4.1)
+// or 8 (AVX2) at a time. Integers are converted to floats without
+// normalization and stores round to the nearest integer, ties to even like
+// the SIMD conversions, the values must already be in range. The SIMD
+// versions must only be called after checking GetCpuFeatures().
+namespace simd {
+
+// A half float stored as its bits. It is a different type than uint16_t so
+// that the R16F and R16 kernels are different overloads.
+struct Half {
+	uint16_t bits;
+};
+
+inline uint16_t FloatToHalf(float value) {
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+	const uint32_t magnitude = bits & 0x7fffffff;
+	// Infinity and NaN.
+	if (magnitude >= 0x7f800000)
+		return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+	// Rounds to infinity, 65520 is the first value that does.
+	if (magnitude >= 0x477ff000)
+		return sign | 0x7c00;
+	// Subnormal halfs, in units of 2^-24.
+	if (magnitude < 0x38800000) {
+		float absolute;
+		std::memcpy(&absolute, &magnitude, sizeof(absolute));
+		return sign | static_cast<uint16_t>(std::nearbyint(absolute * 16777216.0f));
+	}
+	// Normal halfs: round the mantissa to nearest even and rebias the
+	// exponent from 127 to 15. A carry out of the mantissa correctly bumps
+	// the exponent.
+	const uint32_t rounded = magnitude + 0xfff + ((magnitude >> 13) & 1);
+	return sign | static_cast<uint16_t>((rounded - 0x38000000) >> 13);
+}
+
+inline float HalfToFloat(uint16_t bits) {
+	const uint32_t sign = static_cast<uint32_t>(bits & 0x8000) << 16;
+	const uint32_t exponent = (bits >> 10) & 0x1f;
+	const uint32_t mantissa = bits & 0x3ff;
+	uint32_t result;
+	if (exponent == 0x1f) {
+		// Infinity and NaN.
+		result = sign | 0x7f800000 | (mantissa << 13);
+	} else if (exponent != 0) {
+		result = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	} else {
+		// Zero and subnormals, exact in float.
+		const float value = mantissa / 16777216.0f;
+		std::memcpy(&result, &value, sizeof(result));
+		result |= sign;
+	}
+	float value;
+	std::memcpy(&value, &result, sizeof(value));
+	return value;
+}
+
+inline uint16_t SwapBytes(uint16_t value) {
+	return static_cast<uint16_t>((value << 8) | (value >> 8));
+}
+
+inline uint32_t SwapBytes(uint32_t value) {
+	return (value << 24) | ((value << 8) & 0x00ff0000) |
+		((value >> 8) & 0x0000ff00) | (value >> 24);
+}
+
+inline float LoadScalar(const uint8_t* source, bool) {
+	return *source;
+}
+
+inline float LoadScalar(const uint16_t* source, bool swap_bytes) {
+	return swap_bytes ? SwapBytes(*source) : *source;
+}
+
+inline float LoadScalar(const Half* source, bool) {
+	return HalfToFloat(source->bits);
+}
+
+inline float LoadScalar(const float* source, bool swap_bytes) {
+	if (!swap_bytes)
+		return *source;
+	uint32_t bits;
+	std::memcpy(&bits, source, sizeof(bits));
+	bits = SwapBytes(bits);
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+inline void StoreScalar(uint8_t* destination, float value) {
+	*destination = static_cast<uint8_t>(std::nearbyint(value));
+}
+
+inline void StoreScalar(uint16_t* destination, float value) {
+	*destination = static_cast<uint16_t>(std::nearbyint(value));
+}
+
+inline void StoreScalar(Half* destination, float value) {
+	destination->bits = FloatToHalf(value);
+}
+
+inline void StoreScalar(float* destination, float value) {
+	*destination = value;
+}
+
+#ifdef VOXEL_X86
+
+// SSE4.1, 4 texels at a time.
+
+VOXEL_TARGET("sse4.1") inline __m128i SwapBytes16Sse(__m128i value) {
+	return _mm_shuffle_epi8(value, _mm_setr_epi8(
+		1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+}
+
+VOXEL_TARGET("sse4.1") inline __m128i SwapBytes32Sse(__m128i value) {
+	return _mm_shuffle_epi8(value, _mm_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+}
+
+VOXEL_TARGET("sse4.1") inline __m128 Load4(const uint8_t* source, bool) {
+	int32_t packed;
+	std::memcpy(&packed, source, sizeof(packed));
+	return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+}
+
+VOXEL_TARGET("sse4.1") inline __m128 Load4(const uint16_t* source, bool swap_bytes) {
+	__m128i values = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(source));
+	if (swap_bytes)
+		values = SwapBytes16Sse(values);
+	return _mm_cvtepi32_ps(_mm_cvtepu16_epi32(values));
+}
+
+VOXEL_TARGET("sse4.1") inline __m128 Load4(const Half* source, bool) {
+	// Without F16C there is no vector conversion from half.
+	return _mm_setr_ps(HalfToFloat(source[0].bits), HalfToFloat(source[1].bits),
+		HalfToFloat(source[2].bits), HalfToFloat(source[3].bits));
+}
+
+VOXEL_TARGET("sse4.1") inline __m128 Load4(const float* source, bool swap_bytes) {
+	__m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+	if (swap_bytes)
+		values = SwapBytes32Sse(values);
+	return _mm_castsi128_ps(values);
+}
+
+VOXEL_TARGET("sse4.1") inline void Store4(uint8_t* destination, __m128 values) {
+	const __m128i integers = _mm_cvtps_epi32(values);
+	const __m128i words = _mm_packus_epi32(integers, integers);
+	const int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+	std::memcpy(destination, &packed, sizeof(packed));
+}
+
+VOXEL_TARGET("sse4.1") inline void Store4(uint16_t* destination, __m128 values) {
+	const __m128i integers = _mm_cvtps_epi32(values);
+	_mm_storel_epi64(reinterpret_cast<__m128i*>(destination),
+		_mm_packus_epi32(integers, integers));
+}
+
+VOXEL_TARGET("sse4.1") inline void Store4(Half* destination, __m128 values) {
+	// Without F16C there is no vector conversion to half.
+	alignas(16) float floats[4];
+	_mm_store_ps(floats, values);
+	for (int i = 0; i < 4; ++i)
+		destination[i].bits = FloatToHalf(floats[i]);
+}
+
+VOXEL_TARGET("sse4.1") inline void Store4(float* destination, __m128 values) {
+	_mm_storeu_ps(destination, values);
+}
+
+// AVX2, 8 texels at a time. F16C provides the half conversions.
+
+#define VOXEL_AVX2 "avx2,fma,f16c"
+
+VOXEL_TARGET(VOXEL_AVX2) inline __m256 Load8(const uint8_t* source, bool) {
+	const __m128i values =
+		_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source));
+	return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(values));
+}
+
+VOXEL_TARGET(VOXEL_AVX2) inline __m256 Load8(const uint16_t* source, bool swap_bytes) {
+	__m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+	if (swap_bytes) {
+		values = _mm_shuffle_epi8(values, _mm_setr_epi8(
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+	}
+	return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(values));
+}
+
+VOXEL_TARGET(VOXEL_AVX2) inline __m256 Load8(const Half* source, bool) {
+	return _mm256_cvtph_ps(
+		_mm_loadu_si128(reinterpret_cast<const __m128i*>(source)));
+}
+
+VOXEL_TARGET(VOXEL_AVX2) inline __m256 Load8(const float* source, bool swap_bytes) {
+	__m256i values =
+		_mm256_loadu_si256(reinterpret_cast<const __m256i*>(source));
+	if (swap_bytes) {
+		values = _mm256_shuffle_epi8(values, _mm256_setr_epi8(
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+	}
+	return _mm256_castsi256_ps(values);
+}
+
+// Packs the 8 rounded 32-bit integers of |values| into 16-bit words.
+VOXEL_TARGET(VOXEL_AVX2) inline __m128i PackWords(__m256 values) {
+	const __m256i integers = _mm256_cvtps_epi32(values);
+	return _mm_packus_epi32(_mm256_castsi256_si128(integers),
+		_mm256_extracti128_si256(integers, 1));
+}
+
+VOXEL_TARGET(VOXEL_AVX2) inline void Store8(uint8_t* destination, __m256 values) {
+	const __m128i words = PackWords(values);
+	_mm_storel_epi64(reinterpret_cast<__m128i*>(destination),
+		_mm_packus_epi16(words, words));
+}
+
+VOXEL_TARGET(VOXEL_AVX2) inline void Store8(uint16_t* destination, __m256 values) {
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(destination), PackWords(values));
+}
+
+VOXEL_TARGET(VOXEL_AVX2) inline void Store8(Half* destination, __m256 values) {
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(destination),
+		_mm256_cvtps_ph(values, _MM_FROUND_TO_NEAREST_INT));
+}
+
+VOXEL_TARGET(VOXEL_AVX2) inline void Store8(float* destination, __m256 values) {
+	_mm256_storeu_ps(destination, values);
+}
+
+#endif  // VOXEL_X86
+
+}  // namespace simd
+
+#endif  // VOXEL_VOXEL_SIMD
@@ -0,0 +1,167 @@
+#include "voxel_store.h"
+
+#include <cstring>
+#include <iostream>
+
+#ifdef VOXEL_X86
+#include <immintrin.h>
+#endif
+
+#include "cpu_features.h"
+#include "parallel.h"
+
+namespace {
+
+// Returns the number of bits needed to index |size| items.
+int IndexBits(uint32_t size) {
+	int bits = 0;
+	while ((uint64_t{1} << bits) < size)
+		++bits;
+	return bits;
+}
+
+// Returns |value| with its low bits moved to the set bits of |mask|, as
+// pdep does.
+uint32_t DepositBits(uint32_t value, uint32_t mask) {
+	uint32_t result = 0;
+	for (uint32_t bit = 1; mask != 0 && value != 0; bit <<= 1) {
+		if ((mask & bit) == 0)
+			continue;
+		if (value & 1)
+			result |= bit;
+		value >>= 1;
+		mask &= ~bit;
+	}
+	return result;
+}
+
+#ifdef VOXEL_X86
+VOXEL_TARGET("bmi2")
+void FillDepositsBmi2(uint32_t mask, uint32_t count, uint32_t* deposits) {
+	for (uint32_t i = 0; i < count; ++i)
+		deposits[i] = _pdep_u32(i, mask);
+}
+#endif
+
+// Fills |deposits| with the first |count| values deposited in |mask|.
+void FillDeposits(uint32_t mask, uint32_t count, uint32_t* deposits) {
+#ifdef VOXEL_X86
+	if (GetCpuFeatures().bmi2) {
+		FillDepositsBmi2(mask, count, deposits);
+		return;
+	}
+#endif
+	for (uint32_t i = 0; i < count; ++i)
+		deposits[i] = DepositBits(i, mask);
+}
+
+}  // namespace
+
+const char* VoxelLayoutName(VoxelLayout layout) {
+	switch (layout) {
+	case VoxelLayout::kLinear:
+		return "linear";
+	case VoxelLayout::kBrick8:
+		return "brick8";
+	case VoxelLayout::kBrick16:
+		return "brick16";
+	case VoxelLayout::kMorton:
+		return "morton";
+	}
+	return "unknown";
+}
+
+bool ParseVoxelLayout(const char* name, VoxelLayout* layout) {
+	for (VoxelLayout candidate : {VoxelLayout::kLinear, VoxelLayout::kBrick8,
+		VoxelLayout::kBrick16, VoxelLayout::kMorton}) {
+		if (std::strcmp(name, VoxelLayoutName(candidate)) == 0) {
+			*layout = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool VoxelStore::CreateVoxelStore(VoxelStore* store, const uint8_t* texels,
+	const uint32_t dims[3], TextureFormat format, VoxelLayout layout) {
+	store->layout = layout;
+	store->format = format;
+	std::copy(dims, dims + 3, store->dims);
+
+	size_t texel_count = 0;
+	switch (layout) {
+	case VoxelLayout::kLinear:
+		store->linear_address.row = dims[0];
+		store->linear_address.slice = static_cast<size_t>(dims[0]) * dims[1];
+		texel_count = store->linear_address.slice * dims[2];
+		break;
+	case VoxelLayout::kBrick8:
+	case VoxelLayout::kBrick16: {
+		const int shift = layout == VoxelLayout::kBrick8 ? 3 : 4;
+		size_t bricks[3];
+		for (int axis = 0; axis < 3; ++axis)
+			bricks[axis] = (dims[axis] + (1u << shift) - 1) >> shift;
+		const size_t brick_row = bricks[0] << (3 * shift);
+		const size_t brick_slice = brick_row * bricks[1];
+		store->brick8_address.brick_row = brick_row;
+		store->brick8_address.brick_slice = brick_slice;
+		store->brick16_address.brick_row = brick_row;
+		store->brick16_address.brick_slice = brick_slice;
+		texel_count = brick_slice * bricks[2];
+		break;
+	}
+	case VoxelLayout::kMorton: {
+		int bits[3];
+		for (int axis = 0; axis < 3; ++axis)
+			bits[axis] = IndexBits(dims[axis]);
+		if (bits[0] + bits[1] + bits[2] > 32) {
+			std::cout << "The volume is too large for a Morton layout.\n";
+			return false;
+		}
+		// Give the offset bits to the axes in turn, skipping the axes that
+		// have none left, so non cubic volumes are only padded to powers of
+		// two along each axis.
+		uint32_t masks[3] = {0, 0, 0};
+		int remaining[3] = {bits[0], bits[1], bits[2]};
+		for (int bit = 0; bit < bits[0] + bits[1] + bits[2];) {
+			for (int axis = 0; axis < 3; ++axis) {
+				if (remaining[axis] == 0)
+					continue;
+				masks[axis] |= 1u << bit++;
+				--remaining[axis];
+			}
+		}
+		store->morton_deposits.resize(
+			static_cast<size_t>(dims[0]) + dims[1] + dims[2]);
+		uint32_t* deposits[3] = {store->morton_deposits.data(),
+			store->morton_deposits.data() + dims[0],
+			store->morton_deposits.data() + dims[0] + dims[1]};
+		for (int axis = 0; axis < 3; ++axis)
+			FillDeposits(masks[axis], dims[axis], deposits[axis]);
+		store->morton_address.deposit_x = deposits[0];
+		store->morton_address.deposit_y = deposits[1];
+		store->morton_address.deposit_z = deposits[2];
+		texel_count = size_t{1} << (bits[0] + bits[1] + bits[2]);
+		break;
+	}
+	}
+
+	const size_t texel_size = TextureFormatSize(format);
+	store->texels.assign(texel_count * texel_size, 0);
+	uint8_t* destination = store->texels.data();
+	VisitAddress(*store, [&](const auto& address) {
+		ParallelFor(static_cast<size_t>(dims[1]) * dims[2], 64,
+			[&](size_t begin, size_t end) {
+			for (size_t row = begin; row < end; ++row) {
+				const uint32_t y = static_cast<uint32_t>(row % dims[1]);
+				const uint32_t z = static_cast<uint32_t>(row / dims[1]);
+				const uint8_t* source = texels + row * dims[0] * texel_size;
+				for (uint32_t x = 0; x < dims[0]; ++x) {
+					std::memcpy(destination + address.Offset(x, y, z) * texel_size,
+						source + x * texel_size, texel_size);
+				}
+			}
+		});
+	});
+	return true;
+}
@@ -0,0 +1,165 @@
+#ifndef VOXEL_VOXEL_STORE
+#define VOXEL_VOXEL_STORE
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "voxel_convert.h"
+#include "voxel_simd.h"
+
+// Orders in which a VoxelStore keeps its texels in memory.
+enum class VoxelLayout {
+	// x fastest, then y, then z, as in files and textures. Only rays along x
+	// read neighbouring texels from the same cache lines.
+	kLinear,
+	// Bricks of 8x8x8 or 16x16x16 texels, each linear inside and stored one
+	// after the other in linear order. A trilinear fetch touches at most 8
+	// bricks whatever the direction.
+	kBrick8,
+	kBrick16,
+	// The bits of x, y and z interleaved into the offset, so nearby texels
+	// are nearby in memory at every scale.
+	kMorton,
+};
+
+// Returns the name used for |layout| on the command line ("brick8", ...).
+const char* VoxelLayoutName(VoxelLayout layout);
+
+// Parses a name returned by VoxelLayoutName() into |layout|.
+bool ParseVoxelLayout(const char* name, VoxelLayout* layout);
+
+// Texel offsets of each layout. Every address has
+//   size_t Offset(uint32_t x, uint32_t y, uint32_t z) const;
+// so samplers can be templated on it and inline it.
+struct LinearAddress {
+	size_t Offset(uint32_t x, uint32_t y, uint32_t z) const {
+		return x + y * row + z * slice;
+	}
+
+	size_t row;
+	size_t slice;
+};
+
+template <int kShift>
+struct BrickAddress {
+	static const uint32_t kMask = (1u << kShift) - 1;
+
+	size_t Offset(uint32_t x, uint32_t y, uint32_t z) const {
+		const size_t brick = (static_cast<size_t>(x >> kShift) << (3 * kShift)) +
+			(y >> kShift) * brick_row + (z >> kShift) * brick_slice;
+		return brick +
+			((((z & kMask) << kShift | (y & kMask)) << kShift) | (x & kMask));
+	}
+
+	// Texels in a row and in a slice of bricks.
+	size_t brick_row;
+	size_t brick_slice;
+};
+
+// The interleaved offset is the OR of the bits of each axis deposited in
+// their own positions, looked up in one small table per axis. The tables
+// are filled with pdep where the CPU has BMI2.
+struct MortonAddress {
+	size_t Offset(uint32_t x, uint32_t y, uint32_t z) const {
+		return deposit_x[x] | deposit_y[y] | deposit_z[z];
+	}
+
+	const uint32_t* deposit_x;
+	const uint32_t* deposit_y;
+	const uint32_t* deposit_z;
+};
+
+// Returns the value of |texels|, laid out by |address| with size |dims|,
+// at |position| in model space ([0, 1] in each axis) with trilinear
+// filtering and clamping to the edge like GL. Integer texels are returned
+// unnormalized.
+template <typename T, typename Address>
+inline float SampleTrilinear(const Address& address, const T* texels,
+	const uint32_t dims[3], const float position[3]) {
+	// Texel centers are at (i + 0.5) / size.
+	uint32_t lower[3];
+	uint32_t upper[3];
+	float weights[3];
+	for (int axis = 0; axis < 3; ++axis) {
+		const float coordinate = position[axis] * dims[axis] - 0.5f;
+		const float floor = std::floor(coordinate);
+		const int last = static_cast<int>(dims[axis]) - 1;
+		const int index = static_cast<int>(floor);
+		lower[axis] = static_cast<uint32_t>(std::min(std::max(index, 0), last));
+		upper[axis] =
+			static_cast<uint32_t>(std::min(std::max(index + 1, 0), last));
+		weights[axis] = coordinate - floor;
+	}
+
+	float along_z[2];
+	for (int k = 0; k < 2; ++k) {
+		const uint32_t z = k == 0 ? lower[2] : upper[2];
+		float along_y[2];
+		for (int j = 0; j < 2; ++j) {
+			const uint32_t y = j == 0 ? lower[1] : upper[1];
+			const float left =
+				simd::LoadScalar(texels + address.Offset(lower[0], y, z), false);
+			const float right =
+				simd::LoadScalar(texels + address.Offset(upper[0], y, z), false);
+			along_y[j] = left + (right - left) * weights[0];
+		}
+		along_z[k] = along_y[0] + (along_y[1] - along_y[0]) * weights[1];
+	}
+	return along_z[0] + (along_z[1] - along_z[0]) * weights[2];
+}
+
+// A volume kept in memory in one of the VoxelLayouts, for sampling on the
+// CPU along any direction.
+//
+// Bricked and Morton layouts pad the volume, to whole bricks and to powers
+// of two along each axis respectively. The padding is never sampled as
+// SampleTrilinear() clamps to |dims|.
+class VoxelStore {
+  public:
+	// Copies |texels|, a linear x-fastest volume of size |dims| in |format|
+	// as returned by GetLinearTexels(), into |store| in |layout|.
+	static bool CreateVoxelStore(VoxelStore* store, const uint8_t* texels,
+		const uint32_t dims[3], TextureFormat format, VoxelLayout layout);
+
+	// Calls |visitor| with the address of the layout of |store|, so a
+	// generic lambda gets instantiated for each layout.
+	template <typename Visitor>
+	static void VisitAddress(const VoxelStore& store, Visitor&& visitor);
+
+	VoxelLayout layout = VoxelLayout::kLinear;
+	TextureFormat format = TextureFormat::kR8;
+	uint32_t dims[3] = {0, 0, 0};
+	// Texels in |layout|, padding included.
+	std::vector<uint8_t> texels;
+
+  private:
+	LinearAddress linear_address;
+	BrickAddress<3> brick8_address;
+	BrickAddress<4> brick16_address;
+	MortonAddress morton_address;
+	// Tables of |morton_address|, one after the other.
+	std::vector<uint32_t> morton_deposits;
+};
+
+template <typename Visitor>
+void VoxelStore::VisitAddress(const VoxelStore& store, Visitor&& visitor) {
+	switch (store.layout) {
+	case VoxelLayout::kLinear:
+		visitor(store.linear_address);
+		return;
+	case VoxelLayout::kBrick8:
+		visitor(store.brick8_address);
+		return;
+	case VoxelLayout::kBrick16:
+		visitor(store.brick16_address);
+		return;
+	case VoxelLayout::kMorton:
+		visitor(store.morton_address);
+		return;
+	}
+}
+
+#endif  // VOXEL_VOXEL_STORE
@@ -0,0 +1,571 @@
+// Microbenchmarks of the kernels the viewer runs on the CPU: loading the
+// volume and the transfer function, converting the voxels, estimating the
+// gradients, building the mip levels, pre-integrating the transfer function
+// and ray marching. No window or GL context is created.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "cpu_features.h"
+#include "cpu_raycaster.h"
+#include "gradient_volume.h"
+#include "image.h"
+#include "micro_benchmark.h"
+#include "parallel.h"
+#include "ray_packets.h"
+#include "transfer_function.h"
+#include "volume_format.h"
+#include "volume_pyramid.h"
+#include "voxel_convert.h"
+
+namespace {
+
+// Command line options of the benchmarks.
+struct BenchOptions {
+	// Raw 8-bit volume of |volume_dims| and transfer function loaded by the
+	// file benchmarks. The volume is also the first fixture. The defaults
+	// are the files shipped with the viewer, seen from this project.
+	const char* volume_path = "../Voxel/teddy.raw";
+	uint32_t volume_dims[3] = {128, 128, 62};
+	const char* tff_path = "../Voxel/tff.dat";
+	// Sides of the synthetic cubic volumes measured after it.
+	std::vector<uint32_t> synthetic_sizes = {128, 256};
+	// Every kernel runs on each of these thread counts, and each kernel with
+	// SIMD paths with each of these levels. Default to 1 and all the
+	// threads, and every level the CPU supports.
+	std::vector<uint32_t> thread_counts;
+	std::vector<RaycastKernel> simd_levels;
+	// Width and height of the images ray marched.
+	uint32_t image_size = 256;
+	// Timed repetitions of each kernel, each at least |min_ms| long.
+	uint32_t repetitions = 10;
+	float min_ms = 20.0f;
+	// When set, only the kernels whose name contains it run.
+	const char* filter = nullptr;
+	// File the JSON report is written to, printed if null.
+	const char* json_path = nullptr;
+};
+
+// A volume the kernels run on, as 8-bit texels.
+struct Fixture {
+	std::string name;
+	uint32_t dims[3] = {};
+	std::vector<uint8_t> texels;
+	// True for the volume loaded from |BenchOptions::volume_path|.
+	bool from_file = false;
+};
+
+// Thread count and SIMD level the kernels are measured with, and whether
+// they are the first ones, which the kernels that don't depend on them run
+// with alone.
+struct BenchConfig {
+	uint32_t threads = 1;
+	RaycastKernel simd = RaycastKernel::kScalar;
+	bool first_threads = true;
+	bool first_simd = true;
+};
+
+// The widest kernels of the viewer that can run at each level.
+const CpuFeatures kScalarFeatures = {};
+const CpuFeatures kSse41Features = {true};
+const CpuFeatures kAvx2Features = {true, true, true, true, true};
+const CpuFeatures kAvx512Features = {true, true, true, true, true, true};
+
+const CpuFeatures& SimdLevelFeatures(RaycastKernel level) {
+	switch (level) {
+	case RaycastKernel::kScalar:
+		return kScalarFeatures;
+	case RaycastKernel::kSse41:
+		return kSse41Features;
+	case RaycastKernel::kAvx2:
+		return kAvx2Features;
+	case RaycastKernel::kAvx512:
+		return kAvx512Features;
+	}
+	return kScalarFeatures;
+}
+
+void PrintUsage() {
+	std::cout << "Usage: VoxelBench [options]\n"
+		<< "  --volume PATH       raw 8-bit volume loaded and measured first\n"
+		<< "                      (default ../Voxel/teddy.raw)\n"
+		<< "  --dims X Y Z        size of the raw volume (default 128 128 62)\n"
+		<< "  --tff PATH          transfer function (default ../Voxel/tff.dat)\n"
+		<< "  --sizes N,...       sides of the synthetic volumes measured after\n"
+		<< "                      it (default 128,256)\n"
+		<< "  --no-synthetic      only measure the raw volume\n"
+		<< "  --threads N,...     thread counts to run the kernels on (default\n"
+		<< "                      1 and all the threads)\n"
+		<< "  --simd K,...        SIMD levels to run the kernels at: scalar,\n"
+		<< "                      sse4.1, avx2, avx512 (default all the CPU\n"
+		<< "                      supports)\n"
+		<< "  --image-size N      size of the ray marched images (default 256)\n"
+		<< "  --repetitions N     timed runs of each kernel (default 10)\n"
+		<< "  --min-ms MS         shortest timed run, short kernels are\n"
+		<< "                      repeated to last that long (default 20)\n"
+		<< "  --filter TEXT       only run the kernels whose name contains it\n"
+		<< "  --json OUT          file the JSON report is written to instead\n"
+		<< "                      of printed\n";
+}
+
+// Parses the comma separated positive integers of |text| into |values|.
+bool ParseUintList(const char* text, std::vector<uint32_t>* values) {
+	values->clear();
+	while (*text) {
+		char* end = nullptr;
+		const long value = std::strtol(text, &end, 10);
+		if (end == text || value <= 0 || (*end != ',' && *end != '\0'))
+			return false;
+		values->push_back(static_cast<uint32_t>(value));
+		text = *end == ',' ? end + 1 : end;
+	}
+	return !values->empty();
+}
+
+// Parses the comma separated kernel names of |text| into |levels|.
+bool ParseSimdLevels(const char* text, std::vector<RaycastKernel>* levels) {
+	levels->clear();
+	const std::string list = text;
+	size_t begin = 0;
+	while (begin <= list.size()) {
+		const size_t end = std::min(list.find(',', begin), list.size());
+		RaycastKernel level;
+		if (!ParseRaycastKernel(list.substr(begin, end - begin).c_str(), &level))
+			return false;
+		if (!IsRaycastKernelSupported(level)) {
+			std::cout << RaycastKernelName(level)
+				<< " isn't supported by this CPU\n";
+			return false;
+		}
+		levels->push_back(level);
+		begin = end + 1;
+	}
+	return !levels->empty();
+}
+
+bool ParseBenchOptions(int argc, char* argv[], BenchOptions* options) {
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		const bool has_value = i + 1 < argc;
+		bool valid = true;
+		if (std::strcmp(arg, "--volume") == 0) {
+			valid = has_value;
+			if (valid)
+				options->volume_path = argv[++i];
+		} else if (std::strcmp(arg, "--dims") == 0) {
+			valid = i + 3 < argc;
+			for (int axis = 0; valid && axis < 3; ++axis) {
+				const long value = std::strtol(argv[++i], nullptr, 10);
+				valid = value > 0;
+				options->volume_dims[axis] = static_cast<uint32_t>(value);
+			}
+		} else if (std::strcmp(arg, "--tff") == 0) {
+			valid = has_value;
+			if (valid)
+				options->tff_path = argv[++i];
+		} else if (std::strcmp(arg, "--sizes") == 0) {
+			valid = has_value && ParseUintList(argv[++i], &options->synthetic_sizes);
+		} else if (std::strcmp(arg, "--no-synthetic") == 0) {
+			options->synthetic_sizes.clear();
+		} else if (std::strcmp(arg, "--threads") == 0) {
+			valid = has_value && ParseUintList(argv[++i], &options->thread_counts);
+		} else if (std::strcmp(arg, "--simd") == 0) {
+			valid = has_value && ParseSimdLevels(argv[++i], &options->simd_levels);
+		} else if (std::strcmp(arg, "--image-size") == 0) {
+			std::vector<uint32_t> values;
+			valid = has_value && ParseUintList(argv[++i], &values) &&
+				values.size() == 1;
+			if (valid)
+				options->image_size = values[0];
+		} else if (std::strcmp(arg, "--repetitions") == 0) {
+			std::vector<uint32_t> values;
+			valid = has_value && ParseUintList(argv[++i], &values) &&
+				values.size() == 1;
+			if (valid)
+				options->repetitions = values[0];
+		} else if (std::strcmp(arg, "--min-ms") == 0) {
+			valid = has_value;
+			if (valid) {
+				options->min_ms = static_cast<float>(std::atof(argv[++i]));
+				valid = options->min_ms >= 0.0f;
+			}
+		} else if (std::strcmp(arg, "--filter") == 0) {
+			valid = has_value;
+			if (valid)
+				options->filter = argv[++i];
+		} else if (std::strcmp(arg, "--json") == 0) {
+			valid = has_value;
+			if (valid)
+				options->json_path = argv[++i];
+		} else {
+			valid = false;
+		}
+		if (!valid) {
+			PrintUsage();
+			return false;
+		}
+	}
+
+	// More threads than the machine has would only repeat its count.
+	std::vector<uint32_t> thread_counts;
+	for (uint32_t count : options->thread_counts) {
+		count = std::min(count, static_cast<uint32_t>(ParallelThreadCount()));
+		if (std::find(thread_counts.begin(), thread_counts.end(), count) ==
+			thread_counts.end()) {
+			thread_counts.push_back(count);
+		}
+	}
+	options->thread_counts = thread_counts;
+	if (options->thread_counts.empty()) {
+		options->thread_counts.push_back(1);
+		if (ParallelThreadCount() > 1)
+			options->thread_counts.push_back(ParallelThreadCount());
+	}
+	if (options->simd_levels.empty()) {
+		for (RaycastKernel level : {RaycastKernel::kScalar, RaycastKernel::kSse41,
+			RaycastKernel::kAvx2, RaycastKernel::kAvx512}) {
+			if (IsRaycastKernelSupported(level))
+				options->simd_levels.push_back(level);
+		}
+	}
+	return true;
+}
+
+// Returns the name of |path| without its directories and extension.
+std::string FixtureName(const char* path) {
+	std::string name = path;
+	const size_t slash = name.find_last_of("/\\");
+	if (slash != std::string::npos)
+		name = name.substr(slash + 1);
+	const size_t dot = name.find_last_of('.');
+	if (dot != std::string::npos && dot > 0)
+		name = name.substr(0, dot);
+	return name;
+}
+
+// Fills |fixture| with a |size| cube of soft overlapping blobs with some
+// noise in empty space, so that rays skip, march and stop early in
+// different parts of the images like they do through scanned volumes.
+void MakeSyntheticFixture(uint32_t size, Fixture* fixture) {
+	fixture->name = "synthetic" + std::to_string(size);
+	fixture->dims[0] = fixture->dims[1] = fixture->dims[2] = size;
+	fixture->texels.resize(static_cast<size_t>(size) * size * size);
+	const glm::vec4 blobs[] = {
+		glm::vec4(0.5f, 0.5f, 0.5f, 0.30f),
+		glm::vec4(0.3f, 0.6f, 0.4f, 0.15f),
+		glm::vec4(0.7f, 0.35f, 0.6f, 0.12f),
+		glm::vec4(0.55f, 0.75f, 0.7f, 0.10f),
+	};
+	ParallelFor(size, 1, [&](size_t begin, size_t end) {
+		for (size_t z = begin; z < end; ++z) {
+			for (uint32_t y = 0; y < size; ++y) {
+				uint8_t* row = fixture->texels.data() + (z * size + y) * size;
+				for (uint32_t x = 0; x < size; ++x) {
+					const glm::vec3 position =
+						(glm::vec3(x, y, z) + 0.5f) / static_cast<float>(size);
+					float value = 0.0f;
+					for (const glm::vec4& blob : blobs) {
+						const float distance =
+							glm::length(position - glm::vec3(blob)) / blob.w;
+						value = std::max(value, 1.0f - distance * distance);
+					}
+					uint32_t hash = (x * 73856093u) ^ (y * 19349663u) ^
+						(static_cast<uint32_t>(z) * 83492791u);
+					hash = (hash ^ (hash >> 13)) * 0x5bd1e995u;
+					const float noise = (hash >> 24) / 255.0f;
+					value = std::max(value, 0.0f) * (0.85f + 0.15f * noise);
+					row[x] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+				}
+			}
+		}
+	});
+}
+
+// Transforms of a square image of a volume of size |dims|, turned and
+// tilted so that the rays cross the volume obliquely, placed like the
+// viewer places it.
+CameraTransforms GetBenchCamera(const uint32_t dims[3]) {
+	const float PI = static_cast<float>(std::acos(-1));
+	glm::vec3 extent(dims[0], dims[1], dims[2]);
+	extent /= std::max(extent.x, std::max(extent.y, extent.z));
+	CameraTransforms camera;
+	camera.world_from_model =
+		glm::rotate(glm::mat4(1.0f), 0.3f, glm::vec3(1.0f, 0.0f, 0.0f)) *
+		glm::rotate(glm::mat4(1.0f), 0.6f, glm::vec3(0.0f, 1.0f, 0.0f)) *
+		glm::scale(glm::mat4(1.0), glm::vec3(3.0)) *
+		glm::rotate(glm::mat4(1.0f), PI / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f)) *
+		glm::translate(glm::mat4(1.0f), -0.5f * extent) *
+		glm::scale(glm::mat4(1.0f), extent);
+	camera.view_from_world = glm::lookAt(glm::vec3(0.0f, 0.0f, 10.f),
+		glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	camera.proj_from_view =
+		glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 100.0f);
+	return camera;
+}
+
+// Runs the kernels of the benchmarks.
+class BenchRunner {
+  public:
+	// Runs with |bench_options| and the transfer function |tff|, and adds
+	// the measured kernels to |results|.
+	BenchRunner(const BenchOptions& bench_options,
+		const std::vector<uint8_t>& tff, std::vector<MicroBenchmark>* results)
+		: options(bench_options), transfer_function(tff), benchmarks(results) {}
+
+	// Measures every kernel on |fixture| with |config|.
+	void RunKernels(const Fixture& fixture, const BenchConfig& config);
+
+  private:
+	// Times |run| as the kernel |name| on |fixture| and reports it, unless
+	// it is filtered out. Kernels that aren't |threaded| or |vectorized|
+	// only run with the first thread count or SIMD level. The others are
+	// skipped at the levels where |kernel_name|, called before |run|, names
+	// a kernel they were already measured with, as levels past the widest
+	// kernel of a function run the same kernel again.
+	void Measure(const char* name, const Fixture& fixture,
+		const BenchConfig& config, bool threaded, bool vectorized,
+		const std::function<const char*()>& kernel_name, double work,
+		const char* unit, const std::function<void()>& run);
+
+	const BenchOptions& options;
+	const std::vector<uint8_t>& transfer_function;
+	std::vector<MicroBenchmark>* benchmarks;
+};
+
+void BenchRunner::Measure(const char* name, const Fixture& fixture,
+	const BenchConfig& config, bool threaded, bool vectorized,
+	const std::function<const char*()>& kernel_name, double work,
+	const char* unit, const std::function<void()>& run) {
+	if (options.filter && !std::strstr(name, options.filter))
+		return;
+	if ((!threaded && !config.first_threads) ||
+		(!vectorized && !config.first_simd)) {
+		return;
+	}
+	const int threads = threaded ? ParallelThreadCount() : 1;
+	const std::string kernel = kernel_name();
+	for (const MicroBenchmark& other : *benchmarks) {
+		if (other.name == name && other.fixture == fixture.name &&
+			other.threads == threads && other.kernel == kernel) {
+			return;
+		}
+	}
+
+	MicroBenchmark benchmark;
+	benchmark.name = name;
+	benchmark.fixture = fixture.name;
+	std::copy(fixture.dims, fixture.dims + 3, benchmark.dims);
+	benchmark.threads = threads;
+	benchmark.simd = vectorized ? RaycastKernelName(config.simd) : "none";
+	benchmark.work = work;
+	benchmark.unit = unit;
+	benchmark.kernel = kernel;
+	TimeMicroBenchmark(static_cast<int>(options.repetitions), options.min_ms,
+		run, &benchmark);
+	PrintMicroBenchmark(benchmark);
+	benchmarks->push_back(benchmark);
+}
+
+void BenchRunner::RunKernels(const Fixture& fixture, const BenchConfig& config) {
+	const uint32_t* dims = fixture.dims;
+	const double voxels = static_cast<double>(fixture.texels.size());
+	const auto no_kernel = [] { return "scalar"; };
+	// CreateGradientVolume() and DownsampleLevel() pick their kernel the
+	// same way.
+	const auto avx2_kernel = [] {
+		const CpuFeatures& features = GetCpuFeatures();
+		return features.avx2 && features.fma && features.f16c ? "avx2" : "scalar";
+	};
+	// Sinks for results the compiler could otherwise drop.
+	volatile uint64_t checksum = 0;
+	volatile size_t size_sink = 0;
+
+	// The file loads of main(): mapping the volume, read through once to
+	// fault its pages in, and the transfer function.
+	if (fixture.from_file) {
+		VolumeInfo info;
+		std::copy(dims, dims + 3, info.dims);
+		Measure("load_volume", fixture, config, false, false, no_kernel,
+			voxels, "bytes", [&] {
+			VolumeFile volume;
+			if (!VolumeFile::OpenRawVolumeFile(&volume, options.volume_path, info))
+				return;
+			uint64_t sum = 0;
+			for (size_t i = 0; i < fixture.texels.size(); ++i)
+				sum += volume.voxels[i];
+			checksum = sum;
+		});
+		for (size_t entries : {kTransferFunctionSize8, kTransferFunctionSize16}) {
+			const std::string name = "load_tff_" + std::to_string(entries);
+			Measure(name.c_str(), fixture, config, false, false, no_kernel,
+				static_cast<double>(entries), "entries", [&] {
+				std::vector<uint8_t> table;
+				LoadTransferFunction(options.tff_path, entries, &table);
+				size_sink = table.size();
+			});
+		}
+		std::vector<float> preintegrated;
+		Measure("preintegrate_tff", fixture, config, true, false, no_kernel,
+			static_cast<double>(kPreintegratedTableSize) * kPreintegratedTableSize,
+			"entries", [&] {
+			PreintegrateTransferFunction(
+				transfer_function, kPreintegratedTableSize, &preintegrated);
+		});
+	}
+
+	// The conversions of 16-bit and float volumes, row by row like
+	// GetLinearTexels() does.
+	std::vector<uint16_t> source16(fixture.texels.size());
+	std::vector<float> source32(fixture.texels.size());
+	for (size_t i = 0; i < fixture.texels.size(); ++i) {
+		const uint16_t value = static_cast<uint16_t>(fixture.texels[i] * 257);
+		source16[i] = static_cast<uint16_t>((value >> 8) | (value << 8));
+		source32[i] = fixture.texels[i] / 255.0f;
+	}
+	std::vector<uint8_t> converted(fixture.texels.size() * 2);
+	const auto convert = [&](const VoxelConversion& conversion,
+		const void* source) {
+		const size_t voxel_size = VoxelTypeSize(conversion.source_type);
+		const size_t texel_size = TextureFormatSize(conversion.target);
+		ParallelFor(static_cast<size_t>(dims[1]) * dims[2], 64,
+			[&](size_t begin, size_t end) {
+			for (size_t row = begin; row < end; ++row) {
+				ConvertVoxels(conversion,
+					static_cast<const uint8_t*>(source) + row * dims[0] * voxel_size,
+					converted.data() + row * dims[0] * texel_size, dims[0]);
+			}
+		});
+	};
+	VoxelConversion swapped;
+	swapped.source_type = VoxelType::kUint16;
+	swapped.target = TextureFormat::kR16;
+	swapped.swap_bytes = true;
+	swapped.windowed = true;
+	swapped.window_min = 0.0f;
+	swapped.window_max = 40000.0f;
+	Measure("convert_u16_swapped", fixture, config, true, true,
+		ConversionKernelName, voxels, "voxels", [&] {
+		convert(swapped, source16.data());
+	});
+	VoxelConversion halved;
+	halved.source_type = VoxelType::kFloat32;
+	halved.target = TextureFormat::kR16F;
+	halved.windowed = true;
+	halved.window_min = 0.0f;
+	halved.window_max = 1.0f;
+	Measure("convert_f32_r16f", fixture, config, true, true,
+		ConversionKernelName, voxels, "voxels", [&] {
+		convert(halved, source32.data());
+	});
+
+	// The gradients precomputed for shading.
+	for (GradientFilter filter :
+		{GradientFilter::kCentralDifference, GradientFilter::kSobel}) {
+		const std::string name =
+			std::string("gradients_") + GradientFilterName(filter);
+		GradientVolume gradients;
+		Measure(name.c_str(), fixture, config, true, true, avx2_kernel,
+			voxels, "voxels", [&] {
+			GradientVolume::CreateGradientVolume(&gradients,
+				fixture.texels.data(), dims, TextureFormat::kR8, filter,
+				GradientEncoding::kRgba8);
+		});
+	}
+
+	// The first mip level, the biggest of the pyramid.
+	uint32_t level_dims[3];
+	NextLevelDims(dims, level_dims);
+	std::vector<uint8_t> level(
+		static_cast<size_t>(level_dims[0]) * level_dims[1] * level_dims[2]);
+	for (MipFilter filter : {MipFilter::kBox, MipFilter::kGaussian}) {
+		const std::string name = std::string("downsample_") + MipFilterName(filter);
+		Measure(name.c_str(), fixture, config, true, true, avx2_kernel,
+			voxels, "voxels", [&] {
+			DownsampleLevel(TextureFormat::kR8, filter, fixture.texels.data(),
+				dims, level.data());
+		});
+	}
+
+	// The ray march of QUAD_FRAGMENT_SHADER. The scalar level is the
+	// reference port, the others its SIMD packets.
+	CpuRaycaster raycaster;
+	if (!CpuRaycaster::CreateCpuRaycaster(&raycaster, fixture.texels.data(),
+		dims, TextureFormat::kR8, transfer_function)) {
+		return;
+	}
+	raycaster.kernel = config.simd;
+	const CameraTransforms camera = GetBenchCamera(dims);
+	Image image;
+	ResizeImage(&image, static_cast<int>(options.image_size),
+		static_cast<int>(options.image_size));
+	Measure("raymarch", fixture, config, true, true,
+		[&] { return RaycastKernelName(raycaster.kernel); },
+		static_cast<double>(options.image_size) * options.image_size, "rays",
+		[&] {
+		CpuRaycaster::RenderImage(&raycaster, camera, &image, nullptr);
+	});
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+	BenchOptions options;
+	if (!ParseBenchOptions(argc, argv, &options))
+		return 0;
+
+	std::vector<Fixture> fixtures(1);
+	Fixture& file_fixture = fixtures[0];
+	file_fixture.name = FixtureName(options.volume_path);
+	file_fixture.from_file = true;
+	VolumeInfo info;
+	std::copy(options.volume_dims, options.volume_dims + 3, info.dims);
+	VolumeFile volume;
+	if (!VolumeFile::OpenRawVolumeFile(&volume, options.volume_path, info))
+		return 0;
+	std::copy(info.dims, info.dims + 3, file_fixture.dims);
+	file_fixture.texels.assign(volume.voxels, volume.voxels + VoxelCount(info));
+	for (uint32_t size : options.synthetic_sizes) {
+		fixtures.emplace_back();
+		MakeSyntheticFixture(size, &fixtures.back());
+	}
+
+	std::vector<uint8_t> transfer_function;
+	if (!LoadTransferFunction(
+		options.tff_path, kTransferFunctionSize8, &transfer_function)) {
+		return 0;
+	}
+
+	std::vector<MicroBenchmark> benchmarks;
+	BenchRunner runner(options, transfer_function, &benchmarks);
+	for (const Fixture& fixture : fixtures) {
+		std::cout << fixture.name << " (" << fixture.dims[0] << "x"
+			<< fixture.dims[1] << "x" << fixture.dims[2] << ")\n";
+		for (size_t t = 0; t < options.thread_counts.size(); ++t) {
+			for (size_t s = 0; s < options.simd_levels.size(); ++s) {
+				BenchConfig config;
+				config.threads = options.thread_counts[t];
+				config.simd = options.simd_levels[s];
+				config.first_threads = t == 0;
+				config.first_simd = s == 0;
+				SetParallelThreadLimit(static_cast<int>(config.threads));
+				LimitCpuFeatures(SimdLevelFeatures(config.simd));
+				runner.RunKernels(fixture, config);
+			}
+		}
+	}
+	SetParallelThreadLimit(0);
+	LimitCpuFeatures(kAvx512Features);
+
+	WriteMicroBenchmarkJson(options.json_path, benchmarks);
+	return 0;
+}
@@ -0,0 +1,157 @@
+#include "micro_benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+#include "cpu_features.h"
+#include "json_writer.h"
+#include "parallel.h"
+
+namespace {
+
+// Returns the mean and standard deviation of |values|.
+void MeanAndStddev(const std::vector<double>& values, double* mean,
+	double* stddev) {
+	*mean = 0.0;
+	*stddev = 0.0;
+	if (values.empty())
+		return;
+	for (double value : values)
+		*mean += value;
+	*mean /= values.size();
+	for (double value : values)
+		*stddev += (value - *mean) * (value - *mean);
+	*stddev = std::sqrt(*stddev / values.size());
+}
+
+const char* JsonBool(bool value) {
+	return value ? "true" : "false";
+}
+
+}  // namespace
+
+void TimeMicroBenchmark(int repetitions, double min_ms,
+	const std::function<void()>& run, MicroBenchmark* benchmark) {
+	typedef std::chrono::steady_clock Clock;
+	const auto elapsed_ms = [](Clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(
+			Clock::now() - start).count();
+	};
+
+	const Clock::time_point warmup_start = Clock::now();
+	run();
+	const double warmup_ms = std::max(elapsed_ms(warmup_start), 1e-6);
+	benchmark->iterations =
+		std::max(1, static_cast<int>(std::ceil(min_ms / warmup_ms)));
+
+	benchmark->run_ms.clear();
+	for (int repetition = 0; repetition < repetitions; ++repetition) {
+		const Clock::time_point start = Clock::now();
+		for (int i = 0; i < benchmark->iterations; ++i)
+			run();
+		benchmark->run_ms.push_back(elapsed_ms(start) / benchmark->iterations);
+	}
+}
+
+MicroBenchmarkSummary SummarizeMicroBenchmark(const MicroBenchmark& benchmark) {
+	MicroBenchmarkSummary summary;
+	if (benchmark.run_ms.empty())
+		return summary;
+	std::vector<double> sorted_ms = benchmark.run_ms;
+	std::sort(sorted_ms.begin(), sorted_ms.end());
+	const size_t count = sorted_ms.size();
+	summary.min_ms = sorted_ms.front();
+	summary.median_ms = count % 2 == 1 ? sorted_ms[count / 2] :
+		0.5 * (sorted_ms[count / 2 - 1] + sorted_ms[count / 2]);
+	summary.max_ms = sorted_ms.back();
+	MeanAndStddev(sorted_ms, &summary.mean_ms, &summary.stddev_ms);
+	summary.variation =
+		summary.mean_ms > 0.0 ? summary.stddev_ms / summary.mean_ms : 0.0;
+
+	std::vector<double> throughputs;
+	for (double ms : benchmark.run_ms)
+		throughputs.push_back(ms > 0.0 ? benchmark.work / (ms * 1e3) : 0.0);
+	MeanAndStddev(
+		throughputs, &summary.throughput_mean, &summary.throughput_stddev);
+	return summary;
+}
+
+std::string MicroBenchmarkKey(const MicroBenchmark& benchmark) {
+	return benchmark.name + "/" + benchmark.fixture + "/t" +
+		std::to_string(benchmark.threads) + "/" + benchmark.simd;
+}
+
+void PrintMicroBenchmark(const MicroBenchmark& benchmark) {
+	const MicroBenchmarkSummary summary = SummarizeMicroBenchmark(benchmark);
+	std::cout << MicroBenchmarkKey(benchmark) << " (" << benchmark.kernel
+		<< "): median " << summary.median_ms << " ms, mean "
+		<< summary.mean_ms << " +- " << summary.stddev_ms << " ms, "
+		<< summary.throughput_mean << " +- " << summary.throughput_stddev
+		<< " M" << benchmark.unit << "/s\n";
+}
+
+bool WriteMicroBenchmarkJson(
+	const char* path, const std::vector<MicroBenchmark>& benchmarks) {
+	std::ofstream file;
+	if (path) {
+		file.open(path, std::ofstream::out | std::ofstream::trunc);
+		if (!file) {
+			std::cout << "Failed to open " << path << "\n";
+			return false;
+		}
+	}
+	std::ostream& out = path ? file : std::cout;
+
+	const CpuFeatures& features = GetCpuFeatures();
+	out << "{\n  \"hardware_threads\": " << ParallelThreadCount()
+		<< ",\n  \"cpu\": {\"sse41\": " << JsonBool(features.sse41)
+		<< ", \"avx2\": " << JsonBool(features.avx2)
+		<< ", \"fma\": " << JsonBool(features.fma)
+		<< ", \"f16c\": " << JsonBool(features.f16c)
+		<< ", \"bmi2\": " << JsonBool(features.bmi2)
+		<< ", \"avx512f\": " << JsonBool(features.avx512f)
+		<< "},\n  \"benchmarks\": {";
+	for (size_t i = 0; i < benchmarks.size(); ++i) {
+		const MicroBenchmark& benchmark = benchmarks[i];
+		const MicroBenchmarkSummary summary =
+			SummarizeMicroBenchmark(benchmark);
+		out << (i == 0 ? "\n    " : ",\n    ");
+		WriteJsonString(out, MicroBenchmarkKey(benchmark));
+		out << ": {\n      \"name\": ";
+		WriteJsonString(out, benchmark.name);
+		out << ",\n      \"fixture\": ";
+		WriteJsonString(out, benchmark.fixture);
+		out << ",\n      \"dims\": [" << benchmark.dims[0] << ", "
+			<< benchmark.dims[1] << ", " << benchmark.dims[2]
+			<< "],\n      \"threads\": " << benchmark.threads
+			<< ",\n      \"simd\": ";
+		WriteJsonString(out, benchmark.simd);
+		out << ",\n      \"kernel\": ";
+		WriteJsonString(out, benchmark.kernel);
+		out << ",\n      \"unit\": ";
+		WriteJsonString(out, benchmark.unit);
+		out << ",\n      \"work\": " << benchmark.work
+			<< ",\n      \"iterations\": " << benchmark.iterations
+			<< ",\n      \"ms\": {\"min\": " << summary.min_ms
+			<< ", \"median\": " << summary.median_ms
+			<< ", \"mean\": " << summary.mean_ms
+			<< ", \"stddev\": " << summary.stddev_ms
+			<< ", \"max\": " << summary.max_ms
+			<< "},\n      \"throughput_mean\": " << summary.throughput_mean
+			<< ",\n      \"throughput_stddev\": " << summary.throughput_stddev
+			<< ",\n      \"variation\": " << summary.variation
+			<< ",\n      \"run_ms\": [";
+		for (size_t run = 0; run < benchmark.run_ms.size(); ++run)
+			out << (run == 0 ? "" : ", ") << benchmark.run_ms[run];
+		out << "]\n    }";
+	}
+	out << "\n  }\n}\n";
+	if (path) {
+		std::cout << "Wrote " << path << "\n";
+		return static_cast<bool>(file);
+	}
+	return true;
+}
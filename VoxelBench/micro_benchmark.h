@@ -0,0 +1,67 @@
+#ifndef VOXEL_MICRO_BENCHMARK
+#define VOXEL_MICRO_BENCHMARK
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// One configuration of a kernel and how long it took.
+struct MicroBenchmark {
+	// Kernel measured ("gradients_sobel", ...), the volume it ran on and
+	// the size of that volume.
+	std::string name;
+	std::string fixture;
+	uint32_t dims[3] = {};
+	// Threads of ParallelFor() and the widest SIMD extensions the kernel
+	// could use, then the kernel that actually ran ("avx2", "scalar", ...).
+	int threads = 1;
+	std::string simd;
+	std::string kernel;
+	// Work done by one run, in |unit|s ("voxels", "rays", ...).
+	double work = 0.0;
+	std::string unit;
+	// Times each run is repeated back to back to be long enough to time.
+	int iterations = 1;
+	// Time of one run, for every repetition.
+	std::vector<double> run_ms;
+};
+
+// Statistics of the runs of a MicroBenchmark. Throughputs are in millions
+// of units per second, computed for every run so that their spread is that
+// of the runs.
+struct MicroBenchmarkSummary {
+	double min_ms = 0.0;
+	double median_ms = 0.0;
+	double mean_ms = 0.0;
+	double stddev_ms = 0.0;
+	double max_ms = 0.0;
+	double throughput_mean = 0.0;
+	double throughput_stddev = 0.0;
+	// Standard deviation over mean of the times. Above a few percent the
+	// machine was too noisy for the runs to be compared.
+	double variation = 0.0;
+};
+
+// Calls |run| once to warm the caches up and choose how many times it has
+// to be repeated to take at least |min_ms|, then times |repetitions| of
+// those repeats into |benchmark|.
+void TimeMicroBenchmark(int repetitions, double min_ms,
+	const std::function<void()>& run, MicroBenchmark* benchmark);
+
+MicroBenchmarkSummary SummarizeMicroBenchmark(const MicroBenchmark& benchmark);
+
+// Returns the key that identifies the configuration of |benchmark| from one
+// report to the next, "name/fixture/threads/simd".
+std::string MicroBenchmarkKey(const MicroBenchmark& benchmark);
+
+// Prints a line with the summary of |benchmark| to std::cout.
+void PrintMicroBenchmark(const MicroBenchmark& benchmark);
+
+// Writes |benchmarks| and their summaries as a JSON object to |path|, or to
+// std::cout if |path| is null. Every benchmark is keyed by
+// MicroBenchmarkKey() so that two reports can be diffed entry by entry.
+bool WriteMicroBenchmarkJson(
+	const char* path, const std::vector<MicroBenchmark>& benchmarks);
+
+#endif  // VOXEL_MICRO_BENCHMARK